@@ -0,0 +1,47 @@
+# checker benchmark: replay difftraces through difftest and REF without the RTL model
+CHECKER_BENCH_TARGET   = $(BUILD_DIR)/checker-bench
+CHECKER_BENCH_CSRC_DIR = $(abspath ./src/test/csrc/bench)
+CHECKER_BENCH_CXXFILES = $(SIM_CXXFILES) $(CHECKER_BENCH_CSRC_DIR)/checker_bench.cpp
+CHECKER_BENCH_CXXFLAGS = $(subst \\\",\", $(SIM_CXXFLAGS)) -DNUM_CORES=$(NUM_CORES) -O3 $(HOST_ARCH_FLAGS)
+CHECKER_BENCH_LDFLAGS  = $(SIM_LDFLAGS) -lpthread -ldl
+
+# svdpi.h from the RTL simulators, as in libso.mk
+ifneq ($(VCS_HOME),)
+CHECKER_BENCH_CXXFLAGS += -I$(VCS_HOME)/include
+else
+VERILATOR_ROOT ?= $(shell verilator --getenv VERILATOR_ROOT 2> /dev/null)
+CHECKER_BENCH_CXXFLAGS += -I$(VERILATOR_ROOT)/include/vltstd
+endif
+
+$(CHECKER_BENCH_TARGET): $(CHECKER_BENCH_CXXFILES)
+	$(CXX) $(CHECKER_BENCH_CXXFLAGS) $(CHECKER_BENCH_CXXFILES) -o $@ $(CHECKER_BENCH_LDFLAGS)
+
+checker-bench: $(CHECKER_BENCH_TARGET)
+
+# record the canonical traces listed in CHECKER_BENCH_CORPUS with emu, then replay each of them
+CHECKER_BENCH_CORPUS ?= $(abspath ./scripts/checker_bench/corpus.txt)
+CHECKER_BENCH_DIR    ?= $(BUILD_DIR)/checker-bench-corpus
+
+checker-bench-record:
+	NUM_CORES=$(NUM_CORES) bash scripts/checker_bench/run.sh record $(CHECKER_BENCH_CORPUS) $(CHECKER_BENCH_DIR) $(BUILD_DIR)/emu
+
+checker-bench-run: $(CHECKER_BENCH_TARGET)
+	NUM_CORES=$(NUM_CORES) bash scripts/checker_bench/run.sh replay $(CHECKER_BENCH_CORPUS) $(CHECKER_BENCH_DIR) $(CHECKER_BENCH_TARGET)
+
+# check the segments of one trace between its checkpoints in parallel, e.g.
+#   make checker-bench-farm FARM_TRACE=build/trace FARM_IMAGE=ready-to-run/linux.bin FARM_JOBS=64
+checker-bench-farm: $(CHECKER_BENCH_TARGET)
+	bash scripts/checker_bench/farm.sh $(FARM_TRACE) $(FARM_IMAGE) $(CHECKER_BENCH_TARGET) $(FARM_JOBS)
+
+# microbenchmarks of the golden memory, compress and RAM hot paths, e.g.
+#   make micro-bench MICRO_BENCH_ARGS="--filter=ram/ --json=ram.json"
+MICRO_BENCH_TARGET   = $(BUILD_DIR)/micro-bench
+MICRO_BENCH_CXXFILES = $(SIM_CXXFILES) $(CHECKER_BENCH_CSRC_DIR)/micro_bench.cpp
+
+$(MICRO_BENCH_TARGET): $(MICRO_BENCH_CXXFILES) $(CHECKER_BENCH_CSRC_DIR)/bench.h
+	$(CXX) $(CHECKER_BENCH_CXXFLAGS) $(MICRO_BENCH_CXXFILES) -o $@ $(CHECKER_BENCH_LDFLAGS)
+
+micro-bench: $(MICRO_BENCH_TARGET)
+	$(MICRO_BENCH_TARGET) $(MICRO_BENCH_ARGS)
+
+.PHONY: checker-bench checker-bench-record checker-bench-run checker-bench-farm micro-bench
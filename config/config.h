@@ -93,12 +93,20 @@ extern unsigned long EMU_FLASH_SIZE;
 // time to save a snapshot
 #define SNAPSHOT_INTERVAL 60 // unit: second
 
+// take a full memory base every this many snapshots. Other snapshots store the changed pages only
+#define SNAPSHOT_BASE_INTERVAL 16
+
 // if error, let simulator print debug info
 #define ENABLE_SIMULATOR_DEBUG_INFO
 
 // how many cycles child processes step forward when reaching error point
 #define STEP_FORWARD_CYCLES 100
 
+// adaptive fork interval (--fork-cycles): max percentage of the run time spent on checkpoints,
+// and the estimated cost of a copy-on-write page fault taken by the parent after a fork
+#define LIGHTSSS_MAX_OVERHEAD 5
+#define LIGHTSSS_FAULT_NS     2000
+
 // -----------------------------------------------------------------------
 // Memory difftest config
 // -----------------------------------------------------------------------
@@ -120,6 +128,47 @@ extern unsigned long EMU_FLASH_SIZE;
 #define ENABLE_STORE_LOG
 #endif // CONFIG_DIFFTEST_REPLAY
 
+// max number of 8-byte words recorded by the golden memory store log between replay snapshots
+#ifndef GOLDENMEM_STORE_LOG_SIZE
+#define GOLDENMEM_STORE_LOG_SIZE (1024 * 1024)
+#endif
+
+// number of replayable steps between replay snapshots. The store logs are kept since the last snapshot,
+// and a replay restarts the DUT trace from there.
+#ifndef REPLAY_SNAPSHOT_INTERVAL
+#define REPLAY_SNAPSHOT_INTERVAL 16
+#endif
+
+// max number of instructions executed by REF since the last replay snapshot. REF records its stores
+// in a store log of its own, which cannot tell difftest when it overflows, so a snapshot is taken before.
+#ifndef REPLAY_SNAPSHOT_INSTRS
+#define REPLAY_SNAPSHOT_INSTRS 16384
+#endif
+
+// -----------------------------------------------------------------------
+// Difftest checker config
+// -----------------------------------------------------------------------
+
+// max number of difftest_nstep() calls buffered for the async checker
+// set DIFFTEST_ASYNC=1 when make to enable the async checker
+#define DIFFTEST_ASYNC_DEPTH 64
+
+// sync and compare all registers every this many progress cycles
+// set DIFFTEST_DELTA_SYNC=1 when make to sync only the written registers in other cycles
+#define DIFFTEST_DELTA_FULL_INTERVAL 1024
+
+// number of the last commit groups and commit records displayed on mismatch
+#ifndef DIFFTEST_GROUP_TRACE_SIZE
+#define DIFFTEST_GROUP_TRACE_SIZE 16
+#endif
+#ifndef DIFFTEST_COMMIT_TRACE_SIZE
+#define DIFFTEST_COMMIT_TRACE_SIZE 32
+#endif
+
+// save REF and golden memory checkpoints every this many files when dumping difftrace
+// replay with --trace-start=CYCLE starts from the last checkpoint before CYCLE. 0 disables checkpoints
+#define DIFFTRACE_CHECKPOINT_INTERVAL 16
+
 // -----------------------------------------------------------------------
 // Simulator run ahead config
 // -----------------------------------------------------------------------
@@ -24,5 +24,14 @@ $(FPGA_TARGET): $(FPGA_CXXFILES)
 
 fpga-host: $(FPGA_TARGET)
 
+# throughput of memory pools used by the xdma threads
+MPOOL_BENCH_TARGET   = $(BUILD_DIR)/mpool-bench
+MPOOL_BENCH_CXXFILES = $(SIM_CSRC_DIR)/mpool.cpp $(SIM_CSRC_DIR)/affinity.cpp $(SIM_CSRC_DIR)/hugepage.cpp $(FPGA_CSRC_DIR)/mpool_bench.cpp
+
+$(MPOOL_BENCH_TARGET): $(MPOOL_BENCH_CXXFILES)
+	$(CXX) $(FPGA_CXXFLAGS) -I$(abspath ./src/test/csrc/bench) -DMPOOL_BENCH $(MPOOL_BENCH_CXXFILES) -o $@ -lpthread
+
+fpga-mpool-bench: $(MPOOL_BENCH_TARGET)
+
 fpga-clean:
 	rm -f $(FPGA_TARGET)
@@ -0,0 +1,71 @@
+#!/bin/bash
+#***************************************************************************************
+# Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+# Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# DiffTest is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#***************************************************************************************
+
+# Usage: farm.sh TRACE IMAGE BINARY [JOBS]
+# Check a difftrace recorded by `emu --dump-difftrace TRACE` in segments between its checkpoints.
+# Each segment is checked by checker-bench (BINARY) from its checkpoint, with at most JOBS
+# (default: nproc) segments at the same time. The log of segment N is TRACE/farm/segN.log.
+# REF_SO is the REF shared object. The first failed segment in the order of cycles is reported.
+
+set -e
+
+trace=$(realpath "$1")
+image=$(realpath "$2")
+binary=$(realpath "$3")
+jobs=${4:-$(nproc)}
+
+if [ -z "$REF_SO" ]; then
+  echo "REF_SO is not set"
+  exit 1
+fi
+if [ ! -f "$trace/index.txt" ]; then
+  echo "Trace index $trace/index.txt not found"
+  exit 1
+fi
+
+# DiffTrace takes names of at most 31 characters, so the trace is named ./NAME in its directory
+cd "$(dirname "$trace")"
+name=./$(basename "$trace")
+mkdir -p "$name/farm"
+rm -f "$name"/farm/seg*
+
+# each line of the index: cycle instrCnt file offset checkpoint, in the order of cycles
+# segment N: from the start (N = 0) or checkpoint N, to the next checkpoint or the end of the trace
+starts=(0 $(awk '{ print $1 }' "$name/index.txt"))
+segments=${#starts[@]}
+check_segment() {
+  local i=$1
+  local args=(--trace-start "${starts[i]}")
+  [ $((i + 1)) -lt $segments ] && args+=(--trace-end "${starts[i + 1]}")
+  local status=0
+  "$binary" -i "$image" --diff "$REF_SO" --trace "$name" "${args[@]}" > "$name/farm/seg$i.log" 2>&1 || status=$?
+  echo $status > "$name/farm/seg$i.status"
+  echo "[seg$i] cycle ${starts[i]}: exit $status"
+}
+export -f check_segment
+export binary image name segments
+export STARTS="${starts[*]}"
+seq 0 $((segments - 1)) | xargs -P "$jobs" -I {} bash -c 'starts=($STARTS); check_segment {}'
+
+# merge the results in the order of cycles
+for ((i = 0; i < segments; i++)); do
+  if [ "$(cat "$name/farm/seg$i.status" 2> /dev/null)" != "0" ]; then
+    echo "Segment $i from cycle ${starts[i]} failed. See $trace/farm/seg$i.log"
+    exit 1
+  fi
+done
+echo "All $segments segments passed"
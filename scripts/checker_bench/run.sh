@@ -0,0 +1,68 @@
+#!/bin/bash
+#***************************************************************************************
+# Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+# Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# DiffTest is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#***************************************************************************************
+
+# Usage: run.sh record|replay CORPUS TRACE_DIR BINARY
+# record: run emu (BINARY) on each image of CORPUS and dump its difftrace to TRACE_DIR/NAME
+# replay: run checker-bench (BINARY) on each recorded trace
+# REF_SO is the REF shared object. Entries whose NUM_CORES differ from $NUM_CORES (default 1) are skipped.
+
+set -e
+
+mode=$1
+corpus=$2
+trace_dir=$(realpath -m "$3")
+binary=$(realpath "$4")
+cores=${NUM_CORES:-1}
+
+if [ -z "$REF_SO" ]; then
+  echo "REF_SO is not set"
+  exit 1
+fi
+
+# DiffTrace takes names of at most 31 characters, so traces are named ./NAME in TRACE_DIR
+mkdir -p "$trace_dir"
+corpus=$(realpath "$corpus")
+cd "$trace_dir"
+grep -v '^#' "$corpus" | while read -r name image cycles ncores; do
+  [ -z "$name" ] && continue
+  if [ "${ncores:-1}" != "$cores" ]; then
+    echo "[$name] skipped: recorded with NUM_CORES=${ncores:-1}"
+    continue
+  fi
+  image=$NOOP_HOME/$image
+  if [ ! -f "$image" ]; then
+    echo "[$name] skipped: $image not found"
+    continue
+  fi
+  case $mode in
+    record)
+      rm -rf "./$name"
+      limit=""
+      [ "$cycles" != "0" ] && limit="-C $cycles"
+      # emu exits with non-zero on the cycle limit, which still leaves a complete trace
+      "$binary" -i "$image" --diff "$REF_SO" $limit --dump-difftrace "./$name" || true
+      ;;
+    replay)
+      echo "[$name]"
+      "$binary" -i "$image" --diff "$REF_SO" --trace "./$name"
+      ;;
+    *)
+      echo "Unknown mode $mode"
+      exit 1
+      ;;
+  esac
+done
@@ -0,0 +1,99 @@
+#/usr/bin/python3
+# -*- coding: UTF-8 -*-
+
+#***************************************************************************************
+# Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+# Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# DiffTest is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#***************************************************************************************
+
+# Decode the binary perf dump of src/test/csrc/common/perfdump.h.
+# By default the counters are printed as the [DIFFTEST_PERF] text of the printf channel.
+
+import argparse
+import struct
+import sys
+
+TAG_COUNTERS = 0x52544e43
+TAG_IPC = 0x53435049
+
+
+def read_varints(payload, count):
+    values, value, shift, pos = [], 0, 0, 0
+    while len(values) < count:
+        byte = payload[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if byte < 0x80:
+            values.append((value >> 1) ^ -(value & 1))
+            value, shift = 0, 0
+    return values
+
+
+def read_perfdump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"DTPERF01":
+        sys.exit(f"{path} is not a perf dump")
+    (num,) = struct.unpack_from("<I", data, 8)
+    pos = 12
+    names = []
+    for _ in range(num):
+        end = data.index(b"\0", pos)
+        names.append(data[pos:end].decode())
+        pos = end + 1
+    last = {TAG_COUNTERS: [0] * (num + 1), TAG_IPC: [0, 0]}
+    counters, ipc = [], []
+    while pos + 16 <= len(data):
+        tag, rows, size = struct.unpack_from("<IIQ", data, pos)
+        pos += 16
+        columns = len(last[tag])
+        deltas = read_varints(data[pos:pos + size], rows * columns)
+        pos += size
+        table = [[0] * columns for _ in range(rows)]
+        for c in range(columns):
+            value = last[tag][c]
+            for r in range(rows):
+                value = (value + deltas[c * rows + r]) & 0xffffffffffffffff
+                table[r][c] = value
+            last[tag][c] = value
+        (counters if tag == TAG_COUNTERS else ipc).extend(table)
+    return names, counters, ipc
+
+
+def main():
+    parser = argparse.ArgumentParser(description="decode a binary perf dump")
+    parser.add_argument("file", help="perf dump written by the emulator")
+    parser.add_argument("--csv", action="store_true", help="print one CSV row per dump instead of the text lines")
+    parser.add_argument("--ipc", action="store_true", help="print the IPC samples as \"instr ipc\" lines")
+    args = parser.parse_args()
+
+    names, counters, ipc = read_perfdump(args.file)
+    if args.ipc:
+        last_instr, last_cycles = 0, 0
+        for instr, cycles in ipc:
+            print(f"{instr} {(instr - last_instr) / max(cycles - last_cycles, 1):f}")
+            last_instr, last_cycles = instr, cycles
+    elif args.csv:
+        print(",".join(["time"] + names))
+        for row in counters:
+            print(",".join(map(str, row)))
+    else:
+        for row in counters:
+            for name, value in zip(names, row[1:]):
+                print(f"[DIFFTEST_PERF][time={row[0]}] {name}, {value}")
+
+
+if __name__ == "__main__":
+    main()
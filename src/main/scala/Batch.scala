@@ -36,8 +36,14 @@ case class BatchParam(config: GatewayConfig, bundles: Seq[DifftestBundle]) {
   val MaxInfoBitLen = MaxInfoByteLen * 8
   val MaxInfoSize = MaxInfoByteLen / infoByte
 
+  // Byte length of a bundle in step data, encoded by BatchCompress if enabled
+  def bundleByteLen(bundle: DifftestBundle): Int = {
+    val byteLen = bundle.getByteAlignWidth / 8
+    if (config.isBatchCompress) BatchCompress.encodedByteLen(byteLen) else byteLen
+  }
+
   val StepGroupSize = bundles.distinctBy(_.desiredCppName).length
-  val StepDataByteLen = bundles.map(_.getByteAlignWidth).map { w => w / 8 }.sum
+  val StepDataByteLen = bundles.map(bundleByteLen).sum
   val StepDataBitLen = StepDataByteLen * 8
   val StepInfoByteLen = (StepGroupSize + 1) * (infoWidth / 8) // Include BatchStep to update buffer index
   val StepInfoBitLen = StepInfoByteLen * 8
@@ -71,6 +77,29 @@ class BatchInfo extends Bundle {
   val num = UInt(8.W)
 }
 
+// Each bundle is XORed with the last bundle of the same type in the batch stream, usually leaving
+// most of its words zero. The encoded bundle is a bitmap of the nonzero 64-bit words, followed by
+// these words. It is decoded by batch_decompress() in difftest-dpic.cpp.
+object BatchCompress {
+  def numWords(byteLen: Int): Int = (byteLen + 7) / 8
+  def maskByteLen(byteLen: Int): Int = (numWords(byteLen) + 7) / 8
+  def encodedByteLen(byteLen: Int): Int = maskByteLen(byteLen) + numWords(byteLen) * 8
+
+  // Return the encoded delta and its byte length
+  def encode(delta: UInt, byteLen: Int): (UInt, UInt) = {
+    val n = numWords(byteLen)
+    val padded = delta.pad(n * 64)
+    val words = Seq.tabulate(n) { i => padded(i * 64 + 63, i * 64) }
+    val nonzero = words.map(_ =/= 0.U)
+    val nonzero_sum = Seq.tabulate(n) { i => PopCount(nonzero.take(i + 1)) }
+    val packed = VecInit.tabulate(n) { k =>
+      VecInit((k until n).map { i => Mux(nonzero(i) && nonzero_sum(i) === (k + 1).U, words(i), 0.U) }).reduce(_ | _)
+    }
+    val mask = VecInit(nonzero).asUInt.pad(maskByteLen(byteLen) * 8)
+    (Cat(packed.asUInt, mask), maskByteLen(byteLen).U +& (nonzero_sum.last << 3))
+  }
+}
+
 object Batch {
   private val template = ListBuffer.empty[DifftestBundle]
 
@@ -117,8 +146,9 @@ class BatchEndpoint(bundles: Seq[Valid[DifftestBundle]], config: GatewayConfig)
 // Cluster Data from same group in same cycle
 class BatchCluster(bundleType: DifftestBundle, groupSize: Int, param: BatchParam) extends Module {
   val alignWidth = bundleType.getByteAlignWidth
+  val dataWidth = param.bundleByteLen(bundleType) * 8
   val in = IO(Input(Vec(groupSize, Valid(bundleType))))
-  val out_data = IO(Output(UInt((groupSize * alignWidth).W)))
+  val out_data = IO(Output(UInt((groupSize * dataWidth).W)))
   val out_info = IO(Output(UInt(param.infoWidth.W)))
   val status_base = IO(Input(new BatchStats(param)))
   val status_sum = IO(Output(new BatchStats(param)))
@@ -134,15 +164,35 @@ class BatchCluster(bundleType: DifftestBundle, groupSize: Int, param: BatchParam
       Mux(valid_sum(idx) === (vid + 1).U, v_aligned(idx), 0.U)
     }).reduce(_ | _)
   }
-  out_data := collect_data.asUInt
 
   val info = Wire(new BatchInfo)
   info.id := Batch.getBundleID(bundleType).U
   info.num := v_size
   out_info := Mux(v_size =/= 0.U, info.asUInt, 0.U)
 
-  val bytes_map = Seq.tabulate(groupSize + 1) { vi => (vi.U, (alignWidth / 8 * vi).U) }
-  status_sum.data_bytes := status_base.data_bytes +& LookupTree(v_size, bytes_map)
+  if (param.config.isBatchCompress) {
+    // The first bundle is XORed with the last one collected in previous cycles
+    val last = RegInit(0.U(alignWidth.W))
+    when(v_size =/= 0.U) {
+      last := collect_data(v_size - 1.U)
+    }
+    val encoded = collect_data.zip(last +: collect_data.init).map { case (data, base) =>
+      BatchCompress.encode(data ^ base, alignWidth / 8)
+    }
+    val encoded_bytes = encoded.zipWithIndex.map { case ((_, bytes), vid) => Mux(vid.U < v_size, bytes, 0.U) }
+    // Truncate width of offset to reduce useless gates
+    val offsetWidth = log2Ceil(groupSize * dataWidth / 8 + 1)
+    val offset_bytes = encoded_bytes.scanLeft(0.U(offsetWidth.W)) { (sum, bytes) => (sum + bytes)(offsetWidth - 1, 0) }
+    out_data := VecInit(encoded.zip(offset_bytes).zipWithIndex.map { case (((data, _), offset), vid) =>
+      val shifted = (data.pad(groupSize * dataWidth) << (offset << 3)).asUInt
+      Mux(vid.U < v_size, shifted(groupSize * dataWidth - 1, 0), 0.U)
+    }.toSeq).reduce(_ | _)
+    status_sum.data_bytes := status_base.data_bytes +& offset_bytes.last
+  } else {
+    out_data := collect_data.asUInt
+    val bytes_map = Seq.tabulate(groupSize + 1) { vi => (vi.U, (alignWidth / 8 * vi).U) }
+    status_sum.data_bytes := status_base.data_bytes +& LookupTree(v_size, bytes_map)
+  }
   status_sum.info_size := status_base.info_size +& Mux(v_size =/= 0.U, 1.U, 0.U)
 }
 
@@ -156,7 +206,7 @@ class BatchCollector(bundles: Seq[Valid[DifftestBundle]], param: BatchParam) ext
   val step_enable = IO(Output(Bool()))
 
   def getGroupDataWidth: Seq[Valid[DifftestBundle]] => Int = { group =>
-    group.length * group.head.bits.getByteAlignWidth
+    group.length * param.bundleByteLen(group.head.bits) * 8
   }
   val sorted = in.groupBy(_.bits.desiredCppName).values.toSeq.map(_.toSeq).sortBy(getGroupDataWidth)
   // Stage 1: concat bundles with same desiredCppName
@@ -351,6 +351,11 @@ class TraceInfo extends DifftestBaseBundle with HasValid {
   val trace_size = UInt(16.W)
 }
 
+class ArchStateHash extends DifftestBaseBundle with HasValid {
+  val full = Bool()
+  val hash = UInt(64.W)
+}
+
 class CriticalErrorEvent extends DifftestBaseBundle with HasValid {
   val criticalError = Bool()
 }
@@ -21,7 +21,7 @@ import chisel3.reflect.DataMirror
 import chisel3.util._
 import difftest._
 import difftest.DifftestModule.createCppExtModule
-import difftest.batch.{BatchInfo, BatchIO}
+import difftest.batch.{BatchCompress, BatchInfo, BatchIO}
 import difftest.common.FileControl
 import difftest.delta.Delta
 import difftest.gateway.{GatewayConfig, GatewayResult, GatewaySinkControl}
@@ -97,6 +97,19 @@ abstract class DPICBase(config: GatewayConfig) extends ExtModule with HasExtModu
     val index = if (gen.isIndexed) s"[${prefix}index]" else if (gen.isFlatten) s"[${prefix}address]" else ""
     s"auto packet = &($packet$index);"
   }
+  def getValidMaskAssign(gen: DifftestBundle, prefix: String, config: GatewayConfig): String = {
+    if (!gen.hasValidMask) {
+      return ""
+    }
+    val dut_zone = if (config.hasDutZone) "dut_zone" else "0"
+    val dut_index = if (config.isBatch) "dut_index" else "0"
+    val macroName = s"CONFIG_DIFF_${gen.desiredCppName.toUpperCase}_VALID_MASK"
+    s"""
+       |#ifdef $macroName
+       |  DUT_BUF(${prefix}coreid, $dut_zone, $dut_index)->valid_mask.${gen.desiredCppName} |= 1ULL << ${prefix}index;
+       |#endif // $macroName
+       |""".stripMargin
+  }
   def dpicFuncAssigns: Seq[String]
   def perfCnt: String = {
     val name = "perf_" + dpicFuncName
@@ -207,13 +220,14 @@ class DPIC[T <: DifftestBundle](gen: T, config: GatewayConfig) extends DPICBase(
     val body = lhs.zip(rhs.flatten).map { case (l, r) => s"packet->$l = $r;" }
     val packetDecl = Seq(getPacketDecl(gen, "io_", config))
     val validAssign = if (!gen.bits.hasValid || gen.isFlatten) Seq() else Seq("packet->valid = true;")
+    val validMaskAssign = Seq(getValidMaskAssign(gen, "io_", config)).filter(_.nonEmpty)
     val query =
       Seq(s"""
              |#ifdef CONFIG_DIFFTEST_QUERY
              |  ${Query.writeInvoke(gen)}
              |#endif // CONFIG_DIFFTEST_QUERY
              |""".stripMargin)
-    packetDecl ++ validAssign ++ body ++ query
+    packetDecl ++ validAssign ++ validMaskAssign ++ body ++ query
   }
 
   createCppExtModule(desiredName, cppExtModule, Some("\"difftest-dpic.h\""))
@@ -227,10 +241,15 @@ class DPICBatch(template: Seq[DifftestBundle], batchIO: BatchIO, config: Gateway
     val unpack = ListBuffer.empty[String]
     // Note: locating elems will not in struct defined, but at the end of reordered Bundle
     val (elem_names, elem_bytes) = gen.getByteAlignElems.map { case (name, data) => (name, data.getWidth / 8) }.unzip
+    // Compressed bundles are decoded into the last bundle of the same type
+    val src = if (config.isBatchCompress) "last" else "data"
+    if (config.isBatchCompress) {
+      unpack += s"data = batch_decompress(last, ${BatchCompress.numWords(elem_bytes.sum)}, data);"
+    }
     elem_names.zipWithIndex.foreach { case (name, idx) =>
       if (Seq("coreid", "index", "address").contains(name)) {
         val offset = elem_bytes.take(idx).sum
-        unpack += s"$name = data[$offset];"
+        unpack += s"$name = ((uint8_t *)$src)[$offset];"
       }
     }
     unpack += getPacketDecl(gen, "", config)
@@ -239,15 +258,21 @@ class DPICBatch(template: Seq[DifftestBundle], batchIO: BatchIO, config: Gateway
     } else {
       s"sizeof(${gen.desiredModuleName})"
     }
-    unpack += s"memcpy(packet, data, $size);"
-    unpack += s"data += ${elem_bytes.sum};"
+    unpack += s"memcpy(packet, $src, $size);"
+    val validMaskAssign = getValidMaskAssign(gen, "", config)
+    if (validMaskAssign.nonEmpty) {
+      unpack += validMaskAssign
+    }
+    if (!config.isBatchCompress) {
+      unpack += s"data += ${elem_bytes.sum};"
+    }
     unpack +=
       s"""
          |#ifdef CONFIG_DIFFTEST_QUERY
          |        ${Query.writeInvoke(gen)}
          |#endif // CONFIG_DIFFTEST_QUERY
          |""".stripMargin
-    unpack.toSeq.mkString("\n        ")
+    unpack.toSeq.mkString("\n          ")
   }
 
   override def modPorts = super.modPorts ++ Seq(Seq(("io", io)))
@@ -258,16 +283,24 @@ class DPICBatch(template: Seq[DifftestBundle], batchIO: BatchIO, config: Gateway
     val bundleAssign = template.zipWithIndex.map { case (t, idx) =>
       val bundleName = bundleEnum(idx)
       val perfName = "perf_Batch_" + bundleName
+      val lastDecl = if (config.isBatchCompress) {
+        s"static uint64_t last[${BatchCompress.numWords(t.getByteAlignWidth / 8)}] = {0};"
+      } else ""
       s"""
-         |    else if (id == $bundleName) {
+         |      case $bundleName: {
+         |        $lastDecl
          |#ifdef CONFIG_DIFFTEST_PERFCNT
-         |      dpic_calls[$perfName] += num;
-         |      dpic_bytes[$perfName] += num * ${t.getByteAlignWidth / 8};
+         |        uint8_t *start = data; // compressed bundles have various lengths
+         |        dpic_calls[$perfName] += num;
          |#endif // CONFIG_DIFFTEST_PERFCNT
-         |      for (int j = 0; j < num; j++) {
-         |        ${getDPICBundleUnpack(t)}
+         |        for (int j = 0; j < num; j++) {
+         |          ${getDPICBundleUnpack(t)}
+         |        }
+         |#ifdef CONFIG_DIFFTEST_PERFCNT
+         |        dpic_bytes[$perfName] += data - start;
+         |#endif // CONFIG_DIFFTEST_PERFCNT
+         |        break;
          |      }
-         |    }
         """.stripMargin
     }.mkString("")
 
@@ -298,11 +331,26 @@ class DPICBatch(template: Seq[DifftestBundle], batchIO: BatchIO, config: Gateway
            |  };
            |  static int dut_index = 0;
            |  $batchDecl
+           |#ifdef CONFIG_DIFFTEST_PERFCNT
+           |  // the unpacking time, excluding the checker called at BatchFinish
+           |  uint64_t unpack_start = difftest_perfcnt_ns();
+           |  bool unpack_timed = false;
+           |  auto unpack_done = [&]() {
+           |    if (!unpack_timed) {
+           |      unpack_timed = true;
+           |      batch_unpack_ns += difftest_perfcnt_ns() - unpack_start;
+           |      batch_unpack_bytes += data - batch->data;
+           |    }
+           |  };
+           |#endif // CONFIG_DIFFTEST_PERFCNT
            |  for (int i = 0; i < $infoLen; i++) {
            |    uint8_t id = info[i].id;
            |    uint8_t num = info[i].num;
            |    uint32_t coreid, index, address;
            |    if (id == BatchFinish) {
+           |#ifdef CONFIG_DIFFTEST_PERFCNT
+           |      unpack_done();
+           |#endif // CONFIG_DIFFTEST_PERFCNT
            |#ifdef CONFIG_DIFFTEST_INTERNAL_STEP
            |#ifdef FPGA_HOST
            |      extern void fpga_nstep(uint8_t step);
@@ -322,8 +370,15 @@ class DPICBatch(template: Seq[DifftestBundle], batchIO: BatchIO, config: Gateway
            |#endif // CONFIG_DIFFTEST_QUERY
            |      continue;
            |    }
-           |    $bundleAssign
+           |    // bundles of one type are contiguous, and each of them is copied with a constant size
+           |    switch (id) {
+           |      $bundleAssign
+           |      default: break;
+           |    }
            |  }
+           |#ifdef CONFIG_DIFFTEST_PERFCNT
+           |  unpack_done();
+           |#endif // CONFIG_DIFFTEST_PERFCNT
            |""".stripMargin)
   }
 
@@ -400,7 +455,9 @@ object DPIC {
     interfaceCpp += "#define __DIFFTEST_DPIC_H__"
     interfaceCpp += ""
     interfaceCpp += "#include <cstdint>"
+    interfaceCpp += "#include <new>"
     interfaceCpp += "#include \"diffstate.h\""
+    interfaceCpp += "#include \"hugepage.h\""
     interfaceCpp += "#if defined(CONFIG_DIFFTEST_BATCH) && !defined(CONFIG_DIFFTEST_FPGA)"
     interfaceCpp += "#include \"svdpi.h\""
     interfaceCpp += "#endif // CONFIG_DIFFTEST_BATCH && !CONFIG_DIFFTEST_FPGA"
@@ -421,12 +478,30 @@ object DPIC {
         |  DPICBuffer() {
         |    memset(buffer, 0, sizeof(buffer));
         |  }
+        |  // the zones are read in order by the checker, so keep them in huge pages
+        |  static void* operator new(size_t size) {
+        |    void* p = huge_mmap(size);
+        |    if (p == MAP_FAILED) {
+        |      throw std::bad_alloc();
+        |    }
+        |    return p;
+        |  }
+        |  static void operator delete(void* p, size_t size) {
+        |    huge_munmap(p, size);
+        |  }
         |  inline DiffTestState* get(int zone, int index) {
         |    return buffer[zone] + index;
         |  }
         |  inline DiffTestState* next() {
         |    DiffTestState* ret = buffer[zone_ptr] + read_ptr;
         |    read_ptr = (read_ptr + 1) % CONFIG_DIFFTEST_BUFLEN;
+        |#ifdef CONFIG_DIFFTEST_HOT_LAYOUT
+        |    // the checker reads the hot states of the following step next
+        |    const char* hot = (const char*)(buffer[zone_ptr] + read_ptr);
+        |    for (size_t offset = 0; offset < DIFFSTATE_HOT_BYTES; offset += 64) {
+        |      __builtin_prefetch(hot + offset);
+        |    }
+        |#endif // CONFIG_DIFFTEST_HOT_LAYOUT
         |    return ret;
         |  }
         |  inline void switch_zone() {
@@ -464,6 +539,39 @@ object DPIC {
            |#define DELTA_BUF(core_id) (dStats->get(core_id))
            |""".stripMargin
     }
+    if (config.isBatchCompress) {
+      interfaceCpp +=
+        """
+          |#ifdef __AVX512F__
+          |#include <immintrin.h>
+          |#endif // __AVX512F__
+          |
+          |// Decode a bundle encoded by BatchCompress, and XOR its nonzero words into last.
+          |// Return the start of the next bundle.
+          |static inline uint8_t *batch_decompress(uint64_t *last, int n_words, uint8_t *data) {
+          |  const uint8_t *mask = data;
+          |  data += (n_words + 7) / 8;
+          |  for (int w = 0; w < n_words; w += 8) {
+          |    uint8_t m = mask[w / 8];
+          |#ifdef __AVX512F__
+          |    // the nonzero words are expanded into the lanes set in m
+          |    __m512i delta = _mm512_maskz_expandloadu_epi64(m, data);
+          |    __m512i base = _mm512_maskz_loadu_epi64(m, last + w);
+          |    _mm512_mask_storeu_epi64(last + w, m, _mm512_xor_si512(base, delta));
+          |    data += __builtin_popcount(m) * sizeof(uint64_t);
+          |#else
+          |    for (; m; m &= m - 1) {
+          |      uint64_t delta;
+          |      memcpy(&delta, data, sizeof(delta));
+          |      last[w + __builtin_ctz(m)] ^= delta;
+          |      data += sizeof(delta);
+          |    }
+          |#endif // __AVX512F__
+          |  }
+          |  return data;
+          |}
+          |""".stripMargin
+    }
     interfaceCpp +=
       s"""
          |DiffStateBuffer** diffstate_buffer = nullptr;
@@ -76,6 +76,9 @@ sealed trait DifftestBundle extends Bundle with DifftestWithCoreid { this: Difft
 
   protected val needFlatten: Boolean = false
   def isFlatten: Boolean = hasAddress && this.needFlatten
+  // Valid bits of the indexed instances are also collected into valid_mask of DiffTestState,
+  // so that the checker visits only the valid instances
+  def hasValidMask: Boolean = isIndexed && bits.hasValid && !supportsDelta
 
   // Convert elements into flatten UInt/Vec[UInt]
   private def seqUIntHelper(in: Seq[(String, Data)]): Seq[(String, Seq[UInt])] = {
@@ -171,6 +174,10 @@ sealed trait DifftestBundle extends Bundle with DifftestWithCoreid { this: Difft
 
   val supportsDelta: Boolean = false
   def isDeltaElem: Boolean = this.isInstanceOf[DiffDeltaElem]
+  // States compared by RefProxy::compare() can be replaced by a hash of them, see StateHash
+  def supportsStateHash: Boolean = supportsDelta
+  // States read by the checker at every step, placed first in DiffTestState with the hot layout
+  def isHotState: Boolean = false
 
   // Byte align all elements
   def getByteAlignElems(isTrace: Boolean): Seq[(String, Data)] = {
@@ -235,10 +242,12 @@ class DiffArchEvent extends ArchEvent with DifftestBundle {
   // DiffArchEvent must be instantiated once for each core.
   override def isUniqueIdentifier: Boolean = true
   override val desiredCppName: String = "event"
+  override def isHotState: Boolean = true
 }
 
 class DiffInstrCommit(nPhyRegs: Int = 32) extends InstrCommit(nPhyRegs) with DifftestBundle with DifftestWithIndex {
   override val desiredCppName: String = "commit"
+  override def isHotState: Boolean = true
 
   private val maxNumFused = 255
   override def supportsSquash(base: DifftestBundle): Bool = {
@@ -269,6 +278,7 @@ class DiffCommitData extends CommitData with DifftestBundle with DifftestWithInd
 
 class DiffTrapEvent extends TrapEvent with DifftestBundle {
   override val desiredCppName: String = "trap"
+  override def isHotState: Boolean = true
   override def supportsSquashBase: Bool = !hasTrap && !hasWFI
 }
 
@@ -292,6 +302,7 @@ class DiffDebugMode extends DebugModeCSRState with DifftestBundle {
   override val desiredCppName: String = "dmregs"
   override val updateDependency: Seq[String] = Seq("commit", "event")
   override val supportsDelta: Boolean = true
+  override def supportsStateHash: Boolean = false
 }
 
 class DiffTriggerCSRState extends TriggerCSRState with DifftestBundle {
@@ -326,6 +337,7 @@ class DiffVecV0Writeback(numRegs: Int = 32) extends DiffVecWriteback(numRegs) {
 class DiffArchIntRegState extends ArchIntRegState with DifftestBundle {
   override val desiredCppName: String = "regs_int"
   override val desiredOffset: Int = 0
+  override def isHotState: Boolean = true
   override val updateDependency: Seq[String] = Seq("commit", "event")
   override val supportsDelta: Boolean = true
 }
@@ -476,6 +488,11 @@ class DiffSyncCustomMflushpwrEvent extends SyncCustomMflushpwrEvent with Difftes
   override val desiredCppName: String = "sync_custom_mflushpwr"
 }
 
+class DiffArchStateHash extends ArchStateHash with DifftestBundle {
+  override val desiredCppName: String = "state_hash"
+  override def isHotState: Boolean = true
+}
+
 class DiffTraceInfo(config: GatewayConfig) extends TraceInfo with DifftestBundle {
   override val desiredCppName: String = "trace_info"
 
@@ -549,6 +566,7 @@ object DifftestModule {
       gateway.cppMacros,
       gateway.structPacked.getOrElse(false),
       gateway.structAligned.getOrElse(false),
+      gateway.hotLayout.getOrElse(false),
     )
     if (gateway.cppExtModule.getOrElse(false)) {
       generateCppExtModules()
@@ -651,11 +669,13 @@ object DifftestModule {
     macros: Seq[String],
     structPacked: Boolean,
     structAligned: Boolean,
+    hotLayout: Boolean,
   ): Unit = {
     val difftestCpp = ListBuffer.empty[String]
     difftestCpp += "#ifndef __DIFFSTATE_H__"
     difftestCpp += "#define __DIFFSTATE_H__"
     difftestCpp += ""
+    difftestCpp += "#include <cstddef>"
     difftestCpp += "#include <cstdint>"
     difftestCpp += ""
 
@@ -687,6 +707,9 @@ object DifftestModule {
           val configWidthName = s"CONFIG_DIFF_${macroName}_WIDTH"
           require(bundles.length % numCores == 0, s"Cores seem to have different # of $macroName")
           difftestCpp += s"#define $configWidthName ${bundles.length / numCores}"
+          if (bundleType.hasValidMask && bundles.length / numCores <= 64) {
+            difftestCpp += s"#define CONFIG_DIFF_${macroName}_VALID_MASK"
+          }
         }
         if (bundleType.isFlatten) {
           val configWidthName = s"CONFIG_DIFF_${macroName}_WIDTH"
@@ -697,8 +720,28 @@ object DifftestModule {
       })
 
     // create top-level difftest struct
-    difftestCpp += "typedef struct {"
-    for ((className, cppInstances) <- uniqBundles.toSeq.sortBy(_._2.head.order)) {
+    // With the hot layout, the hot states and valid_mask share the leading cache lines of each step,
+    // and the first cold state starts a new line
+    val sortedBundles = if (hotLayout) {
+      uniqBundles.toSeq.sortBy(b => (!b._2.head.isHotState, b._2.head.order))
+    } else {
+      uniqBundles.toSeq.sortBy(_._2.head.order)
+    }
+    val firstCold = Option.when(hotLayout)(sortedBundles.map(_._2.head).find(!_.isHotState)).flatten
+    val maskBundles = uniqBundles.values
+      .map(_.head)
+      .toSeq
+      .sortBy(_.order)
+      .filter(b => b.hasValidMask && uniqBundles(b.desiredModuleName).length / numCores <= 64)
+    def emitValidMask(): Unit = {
+      if (maskBundles.nonEmpty) {
+        difftestCpp += "  struct {"
+        maskBundles.foreach(b => difftestCpp += s"    uint64_t ${b.desiredCppName};")
+        difftestCpp += "  } valid_mask;"
+      }
+    }
+    difftestCpp += (if (hotLayout) "typedef struct __attribute__((aligned(64))) {" else "typedef struct {")
+    for ((className, cppInstances) <- sortedBundles) {
       val bundleType = cppInstances.head
       val instanceName = bundleType.desiredCppName
       val cppIsArray = bundleType.isInstanceOf[DifftestWithIndex] || bundleType.isFlatten
@@ -707,10 +750,23 @@ object DifftestModule {
       require(nInstances % numCores == 0, s"Cores seem to have different # of $instanceName")
       require(cppIsArray || nInstances == numCores, s"# of $instanceName should not be $nInstances")
       val arrayWidth = if (cppIsArray) s"[$instanceCount]" else ""
-      difftestCpp += f"  $className%-30s $instanceName$arrayWidth;"
+      val isFirstCold = firstCold.contains(bundleType)
+      if (isFirstCold) {
+        emitValidMask()
+      }
+      val lineAligned = if (isFirstCold) " __attribute__((aligned(64)))" else ""
+      difftestCpp += f"  $className%-30s $instanceName$arrayWidth$lineAligned;"
+    }
+    if (firstCold.isEmpty) {
+      emitValidMask()
     }
     difftestCpp += "} DiffTestState;"
     difftestCpp += ""
+    if (hotLayout) {
+      val hotBytes = firstCold.map(b => s"offsetof(DiffTestState, ${b.desiredCppName})").getOrElse("sizeof(DiffTestState)")
+      difftestCpp += s"#define DIFFSTATE_HOT_BYTES $hotBytes"
+      difftestCpp += ""
+    }
 
     difftestCpp +=
       s"""
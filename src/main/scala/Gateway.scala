@@ -18,6 +18,7 @@ package difftest.gateway
 import chisel3._
 import chisel3.util._
 import difftest._
+import difftest.common.DifftestPerf
 import difftest.common.DifftestWiring
 import difftest.util.Delayer
 import difftest.dpic.DPIC
@@ -26,6 +27,7 @@ import difftest.squash.Squash
 import difftest.batch.{Batch, BatchIO}
 import difftest.delta.Delta
 import difftest.replay.Replay
+import difftest.statehash.StateHash
 import difftest.trace.Trace
 import difftest.util.VerificationExtractor
 import difftest.validate.Validate
@@ -40,11 +42,16 @@ case class GatewayConfig(
   replaySize: Int = 1024,
   hasDutZone: Boolean = false,
   isDelta: Boolean = false,
+  hasStateHash: Boolean = false,
+  stateHashInterval: Int = 64,
   isBatch: Boolean = false,
   batchSize: Int = 64,
+  isBatchCompress: Boolean = false,
   hasInternalStep: Boolean = false,
   isNonBlock: Boolean = false,
   hasBuiltInPerf: Boolean = false,
+  hasPerfDump: Boolean = false,
+  hasHotLayout: Boolean = false,
   traceDump: Boolean = false,
   traceLoad: Boolean = false,
   hierarchicalWiring: Boolean = false,
@@ -64,7 +71,7 @@ case class GatewayConfig(
   def hasDeferredResult: Boolean = isNonBlock || hasInternalStep
   def needTraceInfo: Boolean = hasReplay
   def needEndpoint: Boolean =
-    hasGlobalEnable || hasDutZone || isBatch || isSquash || hierarchicalWiring || traceDump || traceLoad
+    hasGlobalEnable || hasDutZone || isBatch || isSquash || hasStateHash || hierarchicalWiring || traceDump || traceLoad
   def needPreprocess: Boolean = hasDutZone || isBatch || isSquash || needTraceInfo
   def useDPICtype: Boolean = !isFPGA && !isGSIM
   // Macros Generation for Cpp and Verilog
@@ -79,13 +86,17 @@ case class GatewayConfig(
         s"CONFIG_DIFFTEST_BATCH_SIZE ${batchSize}",
         s"CONFIG_DIFFTEST_BATCH_BYTELEN ${batchArgByteLen._1 + batchArgByteLen._2}",
       )
+    if (isBatchCompress) macros += "CONFIG_DIFFTEST_BATCH_COMPRESS"
     if (isSquash) macros ++= Seq("CONFIG_DIFFTEST_SQUASH", s"CONFIG_DIFFTEST_SQUASH_STAMPSIZE 4096") // Stamp Width 12
     if (isDelta) macros += "CONFIG_DIFFTEST_DELTA"
+    if (hasStateHash) macros += s"CONFIG_DIFFTEST_STATEHASH_INTERVAL ${stateHashInterval}"
     if (hasReplay) macros ++= Seq("CONFIG_DIFFTEST_REPLAY", s"CONFIG_DIFFTEST_REPLAY_SIZE ${replaySize}")
     if (hasDeferredResult) macros += "CONFIG_DIFFTEST_DEFERRED_RESULT"
     if (hasInternalStep) macros += "CONFIG_DIFFTEST_INTERNAL_STEP"
     if (traceDump || traceLoad) macros += "CONFIG_DIFFTEST_IOTRACE"
     if (isFPGA) macros += "CONFIG_DIFFTEST_FPGA"
+    if (hasPerfDump) macros += "CONFIG_DIFFTEST_PERFDUMP"
+    if (hasHotLayout) macros += "CONFIG_DIFFTEST_HOT_LAYOUT"
     macros.toSeq
   }
   def vMacros: Seq[String] = {
@@ -105,6 +116,9 @@ case class GatewayConfig(
     if (isBatch) require(!hasDutZone)
     // Currently Delta depends on Batch to ensure update and sync order
     if (isDelta) require(isBatch)
+    if (isBatchCompress) require(isBatch)
+    // Delta sends the changed elements of the states instead of the hash
+    if (hasStateHash) require(!isDelta && stateHashInterval > 1)
     // Batch provides unified IO interface for FPGA Diff
     if (isFPGA) require(isBatch)
     // TODO: support dump and load together
@@ -123,6 +137,7 @@ case class GatewayResult(
   instances: Seq[DifftestBundle] = Seq(),
   structPacked: Option[Boolean] = None,
   structAligned: Option[Boolean] = None, // Align struct Elem to 8 bytes for Delta Feature
+  hotLayout: Option[Boolean] = None, // Group the hot states at the head of cache-line aligned DiffTestState
   cppExtModule: Option[Boolean] = None,
   exit: Option[UInt] = None,
   step: Option[UInt] = None,
@@ -135,6 +150,7 @@ case class GatewayResult(
       instances = instances ++ that.instances,
       structPacked = if (structPacked.isDefined) structPacked else that.structPacked,
       structAligned = if (structAligned.isDefined) structAligned else that.structAligned,
+      hotLayout = if (hotLayout.isDefined) hotLayout else that.hotLayout,
       cppExtModule = if (cppExtModule.isDefined) cppExtModule else that.cppExtModule,
       exit = if (exit.isDefined) exit else that.exit,
       step = if (step.isDefined) step else that.step,
@@ -154,10 +170,14 @@ object Gateway {
       case 'R' => config = config.copy(hasReplay = true)
       case 'Z' => config = config.copy(hasDutZone = true)
       case 'D' => config = config.copy(isDelta = true)
+      case 'A' => config = config.copy(hasStateHash = true)
       case 'B' => config = config.copy(isBatch = true)
+      case 'C' => config = config.copy(isBatchCompress = true)
       case 'I' => config = config.copy(hasInternalStep = true)
       case 'N' => config = config.copy(isNonBlock = true)
       case 'P' => config = config.copy(hasBuiltInPerf = true)
+      case 'K' => config = config.copy(hasPerfDump = true)
+      case 'O' => config = config.copy(hasHotLayout = true)
       case 'T' => config = config.copy(traceDump = true)
       case 'L' => config = config.copy(traceLoad = true)
       case 'H' => config = config.copy(hierarchicalWiring = true)
@@ -169,6 +189,9 @@ object Gateway {
     config.check()
   }
 
+  // DifftestPerf counters are dumped through the binary channel instead of printf
+  def hasPerfDump: Boolean = config.hasPerfDump
+
   def apply[T <: DifftestBundle](gen: T, delay: Int): T = {
     val bundle = WireInit(0.U.asTypeOf(gen))
     if (!config.traceLoad) {
@@ -215,10 +238,15 @@ object Gateway {
     } else {
       GatewayResult(instances = instances) + GatewaySink.collect(config)
     }
+    // After the endpoint, whose Batch may add DifftestPerf counters
+    if (config.hasPerfDump) {
+      DifftestPerf.collect()
+    }
     sink + GatewayResult(
       cppMacros = config.cppMacros,
       vMacros = config.vMacros,
       cppExtModule = Some(config.isGSIM),
+      hotLayout = Some(config.hasHotLayout),
       exit = exit,
     )
   }
@@ -256,12 +284,17 @@ class GatewayEndpoint(instanceWithDelay: Seq[(DifftestBundle, Int)], config: Gat
   } else {
     WireInit(validated)
   }
-  val instances = chiselTypeOf(squashed).map(_.bits).toSeq
-  val deltas = if (config.isDelta) {
-    WireInit(Delta(squashed, config))
+  val hashed = if (config.hasStateHash) {
+    WireInit(StateHash(squashed, config))
   } else {
     WireInit(squashed)
   }
+  val instances = chiselTypeOf(hashed).map(_.bits).toSeq
+  val deltas = if (config.isDelta) {
+    WireInit(Delta(hashed, config))
+  } else {
+    WireInit(hashed)
+  }
   val toSink = deltas
 
   val zoneControl = Option.when(config.hasDutZone)(Module(new ZoneControl(config)))
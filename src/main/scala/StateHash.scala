@@ -0,0 +1,92 @@
+/***************************************************************************************
+ * Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+ * Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+ *
+ * DiffTest is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ *
+ * See the Mulan PSL v2 for more details.
+ ***************************************************************************************/
+
+package difftest.statehash
+
+import chisel3._
+import chisel3.util._
+import difftest._
+import difftest.gateway.GatewayConfig
+
+object StateHash {
+  def apply(bundles: MixedVec[Valid[DifftestBundle]], config: GatewayConfig): MixedVec[Valid[DifftestBundle]] = {
+    val module = Module(new StateHashEndpoint(chiselTypeOf(bundles).toSeq, config))
+    module.in := bundles
+    module.out
+  }
+
+  // XOR of the 64-bit words, each rotated left by its index in the state.
+  // Any single mismatched word changes the hash. Must match RefProxy::hash_words().
+  def hashWords(words: Seq[UInt]): UInt = {
+    words.zipWithIndex.map { case (w, i) => w.pad(64).rotateLeft(i % 64) }.reduce(_ ^ _)
+  }
+}
+
+class StateHashEndpoint(bundles: Seq[Valid[DifftestBundle]], config: GatewayConfig) extends Module {
+  val in = IO(Input(MixedVec(bundles)))
+  val numCores = in.count(_.bits.isUniqueIdentifier)
+
+  val in_replay =
+    in.map(_.bits)
+      .filter(_.desiredCppName == "trace_info")
+      .map(_.asInstanceOf[DiffTraceInfo].in_replay)
+      .foldLeft(false.B)(_ || _)
+  val events = in.filter(_.bits.desiredCppName == "event")
+
+  // The k-th instance of each state belongs to the k-th core
+  val states = in.filter(_.bits.supportsStateHash)
+  val stateNames = states.map(_.bits.desiredCppName).distinct
+  stateNames.foreach { n =>
+    require(states.count(_.bits.desiredCppName == n) == numCores, s"Cores seem to have different # of $n")
+  }
+  val coreStates = stateNames.map(n => states.filter(_.bits.desiredCppName == n)).transpose
+
+  val outs = coreStates.map { group =>
+    // States not updated in this cycle contribute their last hash
+    val hashes = group.map { s =>
+      val hash = StateHash.hashWords(s.bits.dataElements.flatMap(_._3))
+      Mux(s.valid, hash, RegEnable(hash, 0.U(64.W), s.valid))
+    }
+    val stateHash = WireInit(0.U.asTypeOf(Valid(new DiffArchStateHash)))
+    stateHash.valid := VecInit(group.map(_.valid).toSeq).asUInt.orR
+    stateHash.bits.valid := stateHash.valid
+    stateHash.bits.coreid := group.head.bits.coreid
+    stateHash.bits.hash := hashes.reduce(_ ^ _)
+
+    // Full states are sent at the first and every stateHashInterval-th step, in replay,
+    // and with exceptions or interrupts whose handling reads the DUT CSRs.
+    val count = RegInit(0.U(log2Ceil(config.stateHashInterval).W))
+    when(stateHash.valid) {
+      count := count + 1.U
+      when(count === (config.stateHashInterval - 1).U) {
+        count := 0.U
+      }
+    }
+    val hasEvent = events.map(e => e.valid && e.bits.coreid === stateHash.bits.coreid).foldLeft(false.B)(_ || _)
+    stateHash.bits.full := count === 0.U || hasEvent || in_replay
+
+    val gated = group.map { s =>
+      val g = WireInit(s)
+      g.valid := s.valid && stateHash.bits.full
+      g
+    }
+    gated :+ stateHash
+  }
+
+  val withHash = MixedVecInit((in.filterNot(_.bits.supportsStateHash) ++ outs.flatten).toSeq)
+  val out = IO(Output(chiselTypeOf(withHash)))
+  out := withHash
+}
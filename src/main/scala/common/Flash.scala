@@ -31,6 +31,58 @@ class DifftestFlashRead extends Bundle {
   }
 }
 
+// Flash memory and its image loading without DPI-C
+private object FlashHelper {
+  val memInit =
+    """
+      |`ifdef PALLADIUM
+      |  initial $ixc_ctrl("tb_import", "$display");
+      |`endif // PALLADIUM
+      |  // 512K entries. 4MB size.
+      |  `define FLASH_SIZE (4 * 1024 * 1024)
+      |  reg [7:0] flash_mem [0 : `FLASH_SIZE - 1];
+      |
+      |  string  bin_file;
+      |  integer flash_image = 0, n_read = 0, byte_read = 0;
+      |  byte data;
+      |  reg [7:0] flash_initval [0:11]; // Use when flash is not specified
+      |
+      |  initial begin
+      |    for (integer i = 0; i < `FLASH_SIZE; i++) begin
+      |      flash_mem[i] = 8'h0;
+      |    end
+      |    if ($test$plusargs("flash")) begin
+      |      $value$plusargs("flash=%s", bin_file);
+      |      flash_image = $fopen(bin_file, "rb");
+      |      if (flash_image == 0) begin
+      |        $display("Error: failed to open %s", bin_file);
+      |      end
+      |      for (integer i = 0; i < `FLASH_SIZE; i++) begin
+      |        byte_read = $fread(data, flash_image);
+      |        if (byte_read == 0) break;
+      |        n_read += 1;
+      |        flash_mem[i] = data;
+      |      end
+      |      $fclose(flash_image);
+      |      $display("Flash: load %d bytes from %s.", n_read, bin_file);
+      |    end
+      |    else begin
+      |      /** no specified flash_path, use defualt 3 instructions **/
+      |      // addiw   t0,zero,1
+      |      // slli    to,to,  0x1f
+      |      // jr      t0
+      |      // Used for pc = 0x8000_0000
+      |      // flash_mem[0] = 64'h01f292930010029b
+      |      // flash_mem[1] = 64'h00028067
+      |      flash_initval = '{8'h9b, 8'h02, 8'h10, 8'h00, 8'h93, 8'h92, 8'hf2, 8'h01, 8'h67, 8'h80, 8'h02, 8'h00};
+      |      for (integer i = 0; i < 12; i = i + 1) begin
+      |          flash_mem[i] = flash_initval[i];
+      |      end
+      |    end
+      |  end
+      |""".stripMargin
+}
+
 class FlashHelper extends ExtModule with HasExtModuleInline {
   val clock = IO(Input(Clock()))
   val r = IO(new DifftestFlashRead)
@@ -49,7 +101,7 @@ class FlashHelper extends ExtModule with HasExtModuleInline {
 
   setInline(
     "FlashHelper.v",
-    """
+    s"""
       |`ifdef SYNTHESIS
       |  `define DISABLE_DIFFTEST_FLASH_DPIC
       |`endif // SYNTHESIS
@@ -73,55 +125,82 @@ class FlashHelper extends ExtModule with HasExtModuleInline {
       |    if (r_en) flash_read(r_addr, r_data);
       |  end
       |`else
-      |`ifdef PALLADIUM
-      |  initial $ixc_ctrl("tb_import", "$display");
-      |`endif // PALLADIUM
-      |  // 512K entries. 4MB size.
-      |  `define FLASH_SIZE (4 * 1024 * 1024)
-      |  reg [7:0] flash_mem [0 : `FLASH_SIZE - 1];
+      |${FlashHelper.memInit}
       |
       |  for (genvar i = 0; i < 8; i++) begin
       |    always @(posedge clock) begin
       |      if (r_en) r_data[8 * i + 7 : 8 * i] <= flash_mem[r_addr + i];
       |    end
       |  end
+      |`endif // DISABLE_DIFFTEST_FLASH_DPIC
       |
-      |  string  bin_file;
-      |  integer flash_image = 0, n_read = 0, byte_read = 0;
-      |  byte data;
-      |  reg [7:0] flash_initval [0:11]; // Use when flash is not specified
+      |endmodule
+     """.stripMargin,
+  )
+}
+
+// A whole line of FLASH_LINE_BYTES in one DPI-C call, for DUTs fetching flash by cache lines
+class DifftestFlashReadLine extends Bundle {
+  val en = Input(Bool())
+  val addr = Input(UInt(32.W))
+  val data = Output(Vec(8, UInt(64.W)))
+
+  def read(enable: Bool, address: UInt): Vec[UInt] = {
+    en := enable
+    addr := address
+    data
+  }
+}
+
+class FlashLineHelper extends ExtModule with HasExtModuleInline {
+  val clock = IO(Input(Clock()))
+  val r_en = IO(Input(Bool()))
+  val r_addr = IO(Input(UInt(32.W)))
+  val r_data = IO(Output(UInt(512.W)))
+
+  val cppExtModule =
+    """
+      |void FlashLineHelper (
+      |  uint8_t   r_en,
+      |  uint32_t  r_addr,
+      |  uint8_t   r_data[64]
+      |) {
+      |  if (r_en) flash_read_line(r_addr, (uint64_t *)r_data);
+      |}
+      |""".stripMargin
+  difftest.DifftestModule.createCppExtModule("FlashLineHelper", cppExtModule, Some("\"flash.h\""))
+
+  setInline(
+    "FlashLineHelper.v",
+    s"""
+      |`ifdef SYNTHESIS
+      |  `define DISABLE_DIFFTEST_FLASH_DPIC
+      |`endif // SYNTHESIS
+      |`ifndef DISABLE_DIFFTEST_FLASH_DPIC
+      |import "DPI-C" function void flash_read_line
+      |(
+      |  input int unsigned addr,
+      |  output bit [511:0] data
+      |);
+      |`endif // DISABLE_DIFFTEST_FLASH_DPIC
       |
-      |  initial begin
-      |    for (integer i = 0; i < `FLASH_SIZE; i++) begin
-      |      flash_mem[i] = 8'h0;
-      |    end
-      |    if ($test$plusargs("flash")) begin
-      |      $value$plusargs("flash=%s", bin_file);
-      |      flash_image = $fopen(bin_file, "rb");
-      |      if (flash_image == 0) begin
-      |        $display("Error: failed to open %s", bin_file);
-      |      end
-      |      for (integer i = 0; i < `FLASH_SIZE; i++) begin
-      |        byte_read = $fread(data, flash_image);
-      |        if (byte_read == 0) break;
-      |        n_read += 1;
-      |        flash_mem[i] = data;
-      |      end
-      |      $fclose(flash_image);
-      |      $display("Flash: load %d bytes from %s.", n_read, bin_file);
-      |    end
-      |    else begin
-      |      /** no specified flash_path, use defualt 3 instructions **/
-      |      // addiw   t0,zero,1
-      |      // slli    to,to,  0x1f
-      |      // jr      t0
-      |      // Used for pc = 0x8000_0000
-      |      // flash_mem[0] = 64'h01f292930010029b
-      |      // flash_mem[1] = 64'h00028067
-      |      flash_initval = '{8'h9b, 8'h02, 8'h10, 8'h00, 8'h93, 8'h92, 8'hf2, 8'h01, 8'h67, 8'h80, 8'h02, 8'h00};
-      |      for (integer i = 0; i < 12; i = i + 1) begin
-      |          flash_mem[i] = flash_initval[i];
-      |      end
+      |module FlashLineHelper (
+      |  input clock,
+      |  input r_en,
+      |  input [31:0] r_addr,
+      |  output reg [511:0] r_data
+      |);
+      |
+      |`ifndef DISABLE_DIFFTEST_FLASH_DPIC
+      |  always @(posedge clock) begin
+      |    if (r_en) flash_read_line(r_addr, r_data);
+      |  end
+      |`else
+      |${FlashHelper.memInit}
+      |
+      |  for (genvar i = 0; i < 64; i++) begin
+      |    always @(posedge clock) begin
+      |      if (r_en) r_data[8 * i + 7 : 8 * i] <= flash_mem[{r_addr[31:6], 6'b0} + i];
       |    end
       |  end
       |`endif // DISABLE_DIFFTEST_FLASH_DPIC
@@ -131,6 +210,16 @@ class FlashHelper extends ExtModule with HasExtModuleInline {
   )
 }
 
+class DifftestFlashLine extends Module {
+  val io = IO(new DifftestFlashReadLine)
+
+  val helper = Module(new FlashLineHelper)
+  helper.clock := clock
+  helper.r_en := io.en
+  helper.r_addr := io.addr
+  io.data := helper.r_data.asTypeOf(io.data)
+}
+
 class DifftestFlash extends Module {
   val io = IO(new DifftestFlashRead)
 
@@ -144,4 +233,8 @@ object DifftestFlash {
   def apply(): DifftestFlashRead = {
     Module(new DifftestFlash).io
   }
+
+  def line(): DifftestFlashReadLine = {
+    Module(new DifftestFlashLine).io
+  }
 }
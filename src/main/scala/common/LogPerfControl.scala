@@ -16,9 +16,13 @@
 package difftest.common
 
 import chisel3._
+import chisel3.experimental.ExtModule
 import chisel3.util._
+import difftest.gateway.Gateway
 import difftest.util.DataMirror._
 
+import scala.collection.mutable.ListBuffer
+
 class LogPerfControl extends Bundle {
   val timer = UInt(64.W)
   val logEnable = Bool()
@@ -79,13 +83,111 @@ object LogPerfControl {
 }
 
 object DifftestPerf {
+  private val names = ListBuffer.empty[String]
+
   def apply(perfName: String, perfCnt: UInt) = {
     val helper = LogPerfControl.apply()
     val counter = RegInit(0.U(64.W))
     val next_counter = WireInit(counter + perfCnt)
     counter := Mux(helper.clean, 0.U, next_counter)
-    when(helper.dump) {
-      printf(p"[DIFFTEST_PERF][time=${helper.timer}] $perfName, $next_counter\n")
+    if (Gateway.hasPerfDump) {
+      DifftestWiring.addSource(next_counter, s"perf_${names.length}")
+      names += perfName
+    } else {
+      when(helper.dump) {
+        printf(p"[DIFFTEST_PERF][time=${helper.timer}] $perfName, $next_counter\n")
+      }
     }
   }
+
+  // Gather the counters at the top and dump them with one DPI-C call per PERFDUMP_CHUNK counters
+  def collect(): Unit = {
+    val chunk = PerfDumpHelper.chunk
+    if (names.nonEmpty) {
+      val counters = WireInit(VecInit(Seq.fill(names.length)(0.U(64.W))))
+      counters.zipWithIndex.foreach { case (c, i) => DifftestWiring.addSink(c, s"perf_$i") }
+      val helper = LogPerfControl.apply()
+      counters.grouped(chunk).zipWithIndex.foreach { case (group, i) =>
+        val dumper = Module(new PerfDumpHelper)
+        dumper.clock := Module.clock
+        dumper.enable := helper.dump
+        dumper.timer := helper.timer
+        dumper.base := (i * chunk).U
+        dumper.counters := VecInit(group.toSeq).asUInt
+      }
+    }
+    generateCppNames()
+  }
+
+  def generateCppNames(): Unit = {
+    val perfCpp = ListBuffer.empty[String]
+    perfCpp += "#include \"perfdump.h\""
+    perfCpp += ""
+    perfCpp += "#ifdef CONFIG_DIFFTEST_PERFDUMP"
+    perfCpp += s"const int perfdump_num_counters = ${names.length};"
+    perfCpp += s"const char *const perfdump_names[${names.length.max(1)}] = {"
+    perfCpp ++= names.map(n => s"  \"${n.replace("\\", "\\\\").replace("\"", "\\\"")}\",")
+    perfCpp += "};"
+    perfCpp += "#endif // CONFIG_DIFFTEST_PERFDUMP"
+    FileControl.write(perfCpp, "difftest-perfdump.cpp")
+  }
+}
+
+private object PerfDumpHelper {
+  // Must match PERFDUMP_CHUNK in perfdump.h
+  val chunk = 512
+}
+
+private class PerfDumpHelper extends ExtModule with HasExtModuleInline {
+  val clock = IO(Input(Clock()))
+  val enable = IO(Input(Bool()))
+  val timer = IO(Input(UInt(64.W)))
+  val base = IO(Input(UInt(32.W)))
+  val counters = IO(Input(UInt((64 * PerfDumpHelper.chunk).W)))
+
+  val cppExtModule =
+    s"""
+       |void PerfDumpHelper (
+       |  uint8_t  enable,
+       |  uint64_t timer,
+       |  uint32_t base,
+       |  uint8_t  counters[${8 * PerfDumpHelper.chunk}]
+       |) {
+       |  if (enable) v_difftest_perf_dump(timer, base, (const uint32_t *)counters);
+       |}
+       |""".stripMargin
+  difftest.DifftestModule.createCppExtModule("PerfDumpHelper", cppExtModule, Some("\"perfdump.h\""))
+
+  setInline(
+    "PerfDumpHelper.v",
+    s"""
+       |/*verilator tracing_off*/
+       |/*verilator coverage_off*/
+       |
+       |`ifndef SYNTHESIS
+       |import "DPI-C" function void v_difftest_perf_dump
+       |(
+       |  input longint unsigned timer,
+       |  input int unsigned base,
+       |  input bit [${64 * PerfDumpHelper.chunk - 1}:0] counters
+       |);
+       |`endif // SYNTHESIS
+       |
+       |module PerfDumpHelper (
+       |  input clock,
+       |  input enable,
+       |  input [63:0] timer,
+       |  input [31:0] base,
+       |  input [${64 * PerfDumpHelper.chunk - 1}:0] counters
+       |);
+       |
+       |`ifndef SYNTHESIS
+       |  always @(posedge clock) begin
+       |    if (enable) v_difftest_perf_dump(timer, base, counters);
+       |  end
+       |`endif // SYNTHESIS
+       |
+       |endmodule
+       |""".stripMargin,
+  )
 }
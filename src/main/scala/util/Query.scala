@@ -98,12 +98,7 @@ class QueryTable(val gen: DifftestBundle, locPrefix: String) {
   val initDecl =
     s"""
        |  void ${tableName}_init() {
-       |    const char* createSql = \" CREATE TABLE $tableName(\" \\
-       |      "ID INTEGER PRIMARY KEY AUTOINCREMENT," \\
-       |      ${sqlArgs.map("\"" + _._1 + " INT NOT NULL").mkString("", ",\" \\\n      ", ");\";")}
-       |    const char* insertSql = \"INSERT INTO $tableName (${sqlArgs.map(_._1).mkString(",")}) \" \\
-       |      \" VALUES (${Seq.fill(sqlArgs.length) { "?" }.mkString(",")});\";
-       |    $instName = new Query(mem_db, createSql, insertSql);
+       |    $instName = new Query(this, "$tableName", "${sqlArgs.map(_._1).mkString(",")}");
        |  }
        |""".stripMargin
   val initInvoke = s"${tableName}_init();"
@@ -111,7 +106,7 @@ class QueryTable(val gen: DifftestBundle, locPrefix: String) {
   val writeDecl =
     s"""
        |  void ${tableName}_write(${locArgs.map("uint8_t " + _._2).mkString(", ")}, ${packetType}* packet) {
-       |    query_${tableName}->write(${sqlArgs.length}, ${sqlArgs.map(_._2).mkString(", ")});
+       |    query_${tableName}->write(${sqlArgs.length}, ${sqlArgs.map("(int64_t)" + _._2).mkString(", ")});
        |  }
        |""".stripMargin
   val writeInvoke = s"qStats->${tableName}_write(${locArgs.map(locPrefix + _._2).mkString(", ")}, packet);"
@@ -0,0 +1,136 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Minimal harness of the microbenchmarks. Like Google Benchmark, the iterations of a benchmark grow
+// until it runs for min_time seconds, and the results can be written in its JSON format:
+//   --filter=SUBSTR  run the benchmarks whose names contain SUBSTR
+//   --json=FILE      write the results to FILE
+//   --min-time=SEC   minimum time of each benchmark, 0.5 by default
+class BenchSuite {
+public:
+  BenchSuite(int argc, char *argv[]) : executable(argv[0]) {
+    for (int i = 1; i < argc; i++) {
+      if (!strncmp(argv[i], "--filter=", 9)) {
+        filter = argv[i] + 9;
+      } else if (!strncmp(argv[i], "--json=", 7)) {
+        json = argv[i] + 7;
+      } else if (!strncmp(argv[i], "--min-time=", 11)) {
+        min_time = atof(argv[i] + 11);
+      } else {
+        printf("Usage: %s [--filter=SUBSTR] [--json=FILE] [--min-time=SEC]\n", argv[0]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    printf("%-60s %14s %12s %12s\n", "Benchmark", "Iterations", "Time", "Throughput");
+  }
+  ~BenchSuite() {
+    if (!json.empty()) {
+      write_json();
+    }
+  }
+
+  bool selected(const std::string &name) const {
+    return name.find(filter) != std::string::npos;
+  }
+
+  // body(n) runs n iterations, and n is a multiple of granularity. bytes are processed by each iteration.
+  void run(const std::string &name, uint64_t bytes, std::function<void(uint64_t)> body, uint64_t granularity = 1) {
+    if (!selected(name)) {
+      return;
+    }
+    uint64_t n = granularity;
+    double real, cpu;
+    while (true) {
+      auto start = std::chrono::steady_clock::now();
+      std::clock_t cpu_start = std::clock();
+      body(n);
+      cpu = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+      real = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (real >= min_time || n >= (1UL << 40)) {
+        break;
+      }
+      // aim at 1.4x of min_time for the next run, growing at most 10x
+      double scale = real > 0 ? min_time * 1.4 / real : 10;
+      uint64_t next = n * (scale < 10 ? scale : 10);
+      n = (next + granularity - 1) / granularity * granularity;
+    }
+    Result r = {name, n, real * 1e9 / n, cpu * 1e9 / n, bytes ? bytes * n / real : 0};
+    results.push_back(r);
+    if (bytes) {
+      printf("%-60s %14lu %9.1f ns %9.3f GB/s\n", name.c_str(), n, r.real_ns, r.bytes_per_second / 1e9);
+    } else {
+      printf("%-60s %14lu %9.1f ns %9.3f M/s\n", name.c_str(), n, r.real_ns, 1e3 / r.real_ns);
+    }
+    fflush(stdout);
+  }
+
+private:
+  struct Result {
+    std::string name;
+    uint64_t iterations;
+    double real_ns, cpu_ns;
+    double bytes_per_second;
+  };
+  std::string executable;
+  std::string filter;
+  std::string json;
+  double min_time = 0.5;
+  std::vector<Result> results;
+
+  void write_json() {
+    FILE *fp = fopen(json.c_str(), "w");
+    if (!fp) {
+      perror("fopen");
+      return;
+    }
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(fp, "{\n  \"context\": {\n");
+    fprintf(fp, "    \"date\": \"%s\",\n    \"executable\": \"%s\",\n", date, executable.c_str());
+    fprintf(fp, "    \"num_cpus\": %u\n  },\n  \"benchmarks\": [", std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result &r = results[i];
+      fprintf(fp, "%s\n    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n", i ? "," : "", r.name.c_str(),
+              r.name.c_str());
+      fprintf(fp, "      \"run_type\": \"iteration\",\n      \"iterations\": %lu,\n", r.iterations);
+      fprintf(fp, "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n", r.real_ns, r.cpu_ns);
+      fprintf(fp, "      \"time_unit\": \"ns\"");
+      if (r.bytes_per_second) {
+        fprintf(fp, ",\n      \"bytes_per_second\": %.1f", r.bytes_per_second);
+      }
+      fprintf(fp, "\n    }");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+  }
+};
+
+#endif // __BENCH_H
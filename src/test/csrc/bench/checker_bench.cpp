@@ -0,0 +1,138 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Replay a difftrace recorded by `emu --dump-difftrace` through the checker and REF at full speed,
+// without the RTL model, so that the checker can be measured alone. Built by `make checker-bench`.
+// With --trace-start and --trace-end, only the segment between two trace checkpoints is checked,
+// and segments are checked in parallel by scripts/checker_bench/farm.sh.
+#include "common.h"
+#include "device.h"
+#include "diffstate.h"
+#include "difftest.h"
+#include "flash.h"
+#include "goldenmem.h"
+#include "ram.h"
+#include "refproxy.h"
+#include <chrono>
+#include <getopt.h>
+
+#if defined(CONFIG_DIFFTEST_SQUASH) || defined(CONFIG_DIFFTEST_REPLAY)
+#error "checker-bench runs without the RTL model, which squash and replay call into"
+#endif
+
+static const char *image = NULL;
+static const char *flash_bin = NULL;
+static const char *trace_name = NULL;
+static uint64_t max_steps = -1;
+static uint64_t trace_start = 0;
+static uint64_t trace_end = -1;
+
+static uint64_t bench_steps = 0;
+static bool bench_reported = false;
+static std::chrono::steady_clock::time_point bench_start;
+
+static void usage(const char *prog) {
+  printf("Usage: %s -i IMAGE --diff REF_SO --trace NAME [--max-steps N] [--flash FLASH]\n", prog);
+  printf("       [--trace-start CYCLE] [--trace-end CYCLE]\n");
+  exit(EXIT_FAILURE);
+}
+
+static void args_parsing(int argc, char *argv[]) {
+  extern const char *difftest_ref_so;
+  static struct option long_options[] = {{"diff", required_argument, 0, 0},
+                                         {"trace", required_argument, 0, 0},
+                                         {"max-steps", required_argument, 0, 0},
+                                         {"flash", required_argument, 0, 0},
+                                         {"trace-start", required_argument, 0, 0},
+                                         {"trace-end", required_argument, 0, 0},
+                                         {0, 0, 0, 0}};
+  int opt, option_index = 0;
+  while ((opt = getopt_long(argc, argv, "i:", long_options, &option_index)) != -1) {
+    switch (opt) {
+      case 0:
+        switch (option_index) {
+          case 0: difftest_ref_so = optarg; break;
+          case 1: trace_name = optarg; break;
+          case 2: max_steps = strtoull(optarg, NULL, 10); break;
+          case 3: flash_bin = optarg; break;
+          case 4: trace_start = strtoull(optarg, NULL, 10); break;
+          case 5: trace_end = strtoull(optarg, NULL, 10); break;
+        }
+        break;
+      case 'i': image = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (!image || !trace_name) {
+    usage(argv[0]);
+  }
+}
+
+// Also called at exit, as DiffTrace exits when the trace runs out
+static void bench_report() {
+  if (bench_reported) {
+    return;
+  }
+  bench_reported = true;
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - bench_start).count();
+  uint64_t instrs = 0;
+  for (int i = 0; i < NUM_CORES; i++) {
+    instrs += difftest[i]->get_trap_event()->instrCnt;
+  }
+  printf("checker-bench: %lu steps, %lu instrs in %.3f s\n", bench_steps, instrs, sec);
+  printf("checker-bench: %.3f Ksteps/s, %.3f Minstrs/s\n", bench_steps / sec / 1e3, instrs / sec / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  args_parsing(argc, argv);
+
+  init_ram(image, DEFAULT_EMU_RAM_SIZE);
+  init_flash(flash_bin);
+  difftest_init();
+  for (int i = 0; i < NUM_CORES; i++) {
+    difftest[i]->set_trace(trace_name, true, trace_start);
+  }
+  init_device();
+  init_goldenmem();
+  init_nemuproxy(0);
+
+  bench_start = std::chrono::steady_clock::now();
+  atexit(bench_report);
+  int trapCode = STATE_RUNNING;
+  while (bench_steps < max_steps && trapCode == STATE_RUNNING) {
+    difftest_trace_read();
+    bench_steps++;
+    trapCode = difftest_nstep(1, true);
+    // the next segment starts from the checkpoint at trace_end
+    if (difftest[0]->get_trap_event()->cycleCnt >= trace_end) {
+      break;
+    }
+  }
+  bench_report();
+  for (int i = 0; i < NUM_CORES; i++) {
+    difftest[i]->display_stats();
+  }
+
+  common_finish();
+  // the per-phase time is dumped here with DIFFTEST_PROFILE=1
+  difftest_finish();
+  goldenmem_finish();
+  finish_device();
+  delete simMemory;
+  simMemory = nullptr;
+
+  return (trapCode == STATE_RUNNING || trapCode == STATE_GOODTRAP) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,377 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Microbenchmarks of the golden memory, compress, RAM and simulator glue hot paths. Built by `make micro-bench`.
+// The memory pools are measured by `make fpga-mpool-bench`. See bench.h for the options.
+#include "bench.h"
+#include "compress.h"
+#include "goldenmem.h"
+#include "ram.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the simulator glue is measured with a trivial model, which is the backend instead of Verilator or GSIM
+#define SIMULATOR BenchSim
+#include "../verilator/simulator.h"
+
+// the RAM and golden memory, and the part of them filled by the image and accessed by the benchmarks
+#define BENCH_RAM_SIZE     (256UL << 20)
+#define BENCH_IMAGE_SIZE   (64UL << 20)
+#define BENCH_IMAGE_WORDS  (BENCH_IMAGE_SIZE / sizeof(uint64_t))
+#define BENCH_RANDOM_COUNT (1UL << 20)
+
+static char bench_dir[] = "/tmp/difftest-bench-XXXXXX";
+static std::vector<std::string> bench_files;
+static std::vector<uint64_t> bench_random;
+static volatile uint64_t bench_sink;
+
+static uint64_t xorshift(uint64_t &s) {
+  s ^= s << 13;
+  s ^= s >> 7;
+  s ^= s << 17;
+  return s;
+}
+
+// Words of the image are non-zero with the probability of density
+static std::vector<uint64_t> bench_image(size_t words, double density) {
+  std::vector<uint64_t> data(words, 0);
+  uint64_t s = 0x9e3779b97f4a7c15UL;
+  for (size_t i = 0; i < words; i++) {
+    uint64_t r = xorshift(s);
+    if ((r >> 11) * (1.0 / (1UL << 53)) < density) {
+      data[i] = r | 1;
+    }
+  }
+  return data;
+}
+
+static std::string bench_file(const char *name) {
+  std::string path = std::string(bench_dir) + "/" + name;
+  bench_files.push_back(path);
+  return path;
+}
+
+static std::string bench_file_write(const char *name, const void *data, size_t n) {
+  std::string path = bench_file(name);
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp || fwrite(data, 1, n, fp) != n) {
+    printf("Failed to write %s\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+  return path;
+}
+
+static void *bench_mmap(size_t n) {
+  void *p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  assert(p != MAP_FAILED);
+  return p;
+}
+
+static void bench_memcpy(BenchSuite &suite) {
+  uint8_t *dest = (uint8_t *)bench_mmap(BENCH_IMAGE_SIZE);
+  for (double density: {0.0, 0.1, 0.5, 1.0}) {
+    std::string name = "compress/nonzero_large_memcpy/density:" + std::to_string(density).substr(0, 4);
+    if (!suite.selected(name)) {
+      continue;
+    }
+    std::vector<uint64_t> src = bench_image(BENCH_IMAGE_WORDS, density);
+    suite.run(name, BENCH_IMAGE_SIZE, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        nonzero_large_memcpy(dest, src.data(), BENCH_IMAGE_SIZE);
+      }
+    });
+  }
+  munmap(dest, BENCH_IMAGE_SIZE);
+}
+
+// Checkpoints of different sizes, each a quarter filled like a typical memory image
+static void bench_compress(BenchSuite &suite) {
+  uint8_t *dest = (uint8_t *)bench_mmap(BENCH_RAM_SIZE);
+  for (size_t mb: {4, 64}) {
+    size_t size = mb << 20;
+    std::string suffix = "/size:" + std::to_string(mb) + "MB";
+    std::vector<uint64_t> image = bench_image(size / sizeof(uint64_t), 0.25);
+    auto bench_read = [&](const std::string &name, const std::string &path,
+                          long (*read)(void *, const char *, long, uint8_t)) {
+      suite.run(name, size, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          bench_sink = read(dest, path.c_str(), BENCH_RAM_SIZE, LOAD_RAM);
+        }
+      });
+    };
+#ifndef NO_GZ_COMPRESSION
+    if (suite.selected("compress/readFromGz/stream" + suffix)) {
+      std::string path = bench_file(("stream" + suffix.substr(6) + ".gz").c_str());
+      gzFile gz = gzopen(path.c_str(), "wb");
+      gzwrite(gz, image.data(), size);
+      gzclose(gz);
+      bench_read("compress/readFromGz/stream" + suffix, path, readFromGz);
+    }
+    if (suite.selected("compress/readFromGz/framed" + suffix)) {
+      std::string path = bench_file(("framed" + suffix.substr(6) + ".gz").c_str());
+      bench_file(("framed" + suffix.substr(6) + ".gz.idx").c_str());
+      snapshot_compressToFile((uint8_t *)image.data(), path.c_str(), size);
+      bench_read("compress/readFromGz/framed" + suffix, path, readFromGz);
+    }
+#endif // NO_GZ_COMPRESSION
+#ifndef NO_ZSTD_COMPRESSION
+    if (suite.selected("compress/readFromZstd" + suffix)) {
+      std::vector<uint8_t> out(ZSTD_compressBound(size));
+      size_t out_size = ZSTD_compress(out.data(), out.size(), image.data(), size, 3);
+      assert(!ZSTD_isError(out_size));
+      std::string path = bench_file_write((suffix.substr(6) + ".zst").c_str(), out.data(), out_size);
+      bench_read("compress/readFromZstd" + suffix, path, readFromZstd);
+    }
+#endif // NO_ZSTD_COMPRESSION
+  }
+  munmap(dest, BENCH_RAM_SIZE);
+}
+
+// The golden memory of an image in the default RAM
+static void bench_goldenmem(BenchSuite &suite) {
+  uint64_t data[8] = {0x0123456789abcdefUL, 1, 2, 3, 4, 5, 6, 7};
+  struct {
+    int len;
+    uint64_t mask;
+  } writes[] = {{8, 0xff}, {8, 0x0f}, {8, 0x01}, {64, ~0UL}, {64, 0x00ff00ff00ff00ffUL}, {64, 0xffUL << 32}};
+  for (auto &w: writes) {
+    char name[96];
+    snprintf(name, sizeof(name), "goldenmem/update_goldenmem/len:%d/mask:0x%lx", w.len, w.mask);
+    suite.run(name, 0, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        uint64_t addr = PMEM_BASE + (bench_random[i % BENCH_RANDOM_COUNT] & ~63UL);
+        update_goldenmem(addr, data, w.mask, w.len);
+      }
+    });
+  }
+  for (int len: {1, 2, 4, 8}) {
+    std::string name = "goldenmem/read_goldenmem/len:" + std::to_string(len);
+    suite.run(name, 0, [&](uint64_t n) {
+      uint64_t sum = 0, value;
+      for (uint64_t i = 0; i < n; i++) {
+        read_goldenmem(PMEM_BASE + (bench_random[i % BENCH_RANDOM_COUNT] & ~(uint64_t)(len - 1)), &value, len);
+        sum += value;
+      }
+      bench_sink = sum;
+    });
+  }
+}
+
+static void bench_ram(BenchSuite &suite, const char *backend, SimMemory *mem) {
+  SimMemory *saved = simMemory;
+  simMemory = mem;
+  std::string prefix = std::string("ram/") + backend;
+  suite.run(prefix + "/difftest_ram_read/sequential", 8, [](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      sum += difftest_ram_read(i % BENCH_IMAGE_WORDS);
+    }
+    bench_sink = sum;
+  });
+  suite.run(prefix + "/difftest_ram_read/random", 8, [](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      sum += difftest_ram_read(bench_random[i % BENCH_RANDOM_COUNT] / sizeof(uint64_t));
+    }
+    bench_sink = sum;
+  });
+  suite.run(prefix + "/difftest_ram_write/random", 8, [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      difftest_ram_write(bench_random[i % BENCH_RANDOM_COUNT] / sizeof(uint64_t), i, 0xffffffff00000000UL);
+    }
+  });
+  simMemory = saved;
+}
+
+// A model whose evaluation is nearly free, so that the per-cycle glue dominates
+struct BenchModel {
+  unsigned clock = 0, reset = 0, perf_clean = 0, perf_dump = 0;
+  uint64_t cycles = 0, exit = 0;
+  inline void eval() {
+    cycles += clock;
+  }
+};
+
+class BenchSim final : public Simulator<BenchSim> {
+  friend class Simulator<BenchSim>;
+
+private:
+  BenchModel dut;
+
+  inline unsigned get_uart_out_valid() {
+    return 0;
+  }
+  inline uint8_t get_uart_out_ch() {
+    return 0;
+  }
+  inline unsigned get_uart_in_valid() {
+    return 0;
+  }
+  inline void set_uart_in_ch(uint8_t ch) {}
+
+public:
+  inline void set_clock(unsigned clock) {
+    dut.clock = clock;
+  }
+  inline void set_reset(unsigned reset) {
+    dut.reset = reset;
+  }
+  inline void step() {
+    dut.eval();
+  }
+  inline uint64_t get_difftest_exit() {
+    return dut.exit;
+  }
+  inline uint64_t get_difftest_step() {
+    return dut.cycles & 1;
+  }
+  inline void set_perf_clean(unsigned clean) {
+    dut.perf_clean = clean;
+  }
+  inline void set_perf_dump(unsigned dump) {
+    dut.perf_dump = dump;
+  }
+};
+
+// The same glue behind virtual calls, as in the former Simulator interface
+class BenchVirtualSim {
+public:
+  virtual ~BenchVirtualSim() {}
+  virtual void set_clock(unsigned clock) = 0;
+  virtual void step() = 0;
+  virtual uint64_t get_difftest_exit() = 0;
+  virtual uint64_t get_difftest_step() = 0;
+  virtual void set_perf_clean(unsigned clean) = 0;
+  virtual void set_perf_dump(unsigned dump) = 0;
+  virtual unsigned get_uart_out_valid() = 0;
+  virtual unsigned get_uart_in_valid() = 0;
+};
+
+class BenchVirtualModel final : public BenchVirtualSim {
+  BenchModel dut;
+
+public:
+  void set_clock(unsigned clock) override {
+    dut.clock = clock;
+  }
+  void step() override {
+    dut.eval();
+  }
+  uint64_t get_difftest_exit() override {
+    return dut.exit;
+  }
+  uint64_t get_difftest_step() override {
+    return dut.cycles & 1;
+  }
+  void set_perf_clean(unsigned clean) override {
+    dut.perf_clean = clean;
+  }
+  void set_perf_dump(unsigned dump) override {
+    dut.perf_dump = dump;
+  }
+  unsigned get_uart_out_valid() override {
+    return 0;
+  }
+  unsigned get_uart_in_valid() override {
+    return 0;
+  }
+};
+
+// not inlined, so that the calls are not devirtualized
+__attribute__((noinline)) static BenchVirtualSim *bench_virtual_sim() {
+  return new BenchVirtualModel;
+}
+
+// The glue of Emulator::single_cycle() and Emulator::tick() in one cycle
+static void bench_simulator(BenchSuite &suite) {
+  suite.run("sim/cycle/crtp", 0, [](uint64_t n) {
+    BenchSim *sim = new BenchSim;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      sim->posedge();
+      sim->step_uart();
+      sim->negedge();
+      sim->set_perf_clean(0);
+      sim->set_perf_dump(0);
+      sum += sim->get_difftest_step() + sim->get_difftest_exit();
+    }
+    bench_sink = sum;
+    delete sim;
+  });
+  suite.run("sim/cycle/virtual", 0, [](uint64_t n) {
+    BenchVirtualSim *sim = bench_virtual_sim();
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      sim->set_clock(1);
+      sim->step();
+      if (sim->get_uart_out_valid() || sim->get_uart_in_valid()) {
+        sum++;
+      }
+      sim->set_clock(0);
+      sim->step();
+      sim->set_perf_clean(0);
+      sim->set_perf_dump(0);
+      sum += sim->get_difftest_step() + sim->get_difftest_exit();
+    }
+    bench_sink = sum;
+    delete sim;
+  });
+}
+
+int main(int argc, char *argv[]) {
+  BenchSuite suite(argc, argv);
+  if (!mkdtemp(bench_dir)) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  uint64_t s = 1;
+  for (size_t i = 0; i < BENCH_RANDOM_COUNT; i++) {
+    bench_random.push_back(xorshift(s) % BENCH_IMAGE_SIZE);
+  }
+
+  bench_memcpy(suite);
+  bench_compress(suite);
+  bench_simulator(suite);
+
+  std::vector<uint64_t> image = bench_image(BENCH_IMAGE_WORDS, 0.5);
+  std::string image_path = bench_file_write("image.bin", image.data(), BENCH_IMAGE_SIZE);
+  // footprints hold the words in the order of the first access, which is all the same for the same image
+  std::string footprints_path = bench_file_write("footprints.bin", image.data(), BENCH_IMAGE_SIZE);
+  init_ram(image_path.c_str(), BENCH_RAM_SIZE);
+  if (suite.selected("goldenmem/")) {
+    init_goldenmem();
+    bench_goldenmem(suite);
+    goldenmem_finish();
+  }
+  if (suite.selected("ram/")) {
+    bench_ram(suite, "MmapMemory", simMemory);
+    SimMemory *sparse = new SparseMemory(image_path.c_str(), BENCH_RAM_SIZE);
+    bench_ram(suite, "SparseMemory", sparse);
+    delete sparse;
+    SimMemory *footprints = new FootprintsMemory(footprints_path.c_str(), BENCH_RAM_SIZE);
+    bench_ram(suite, "FootprintsMemory", footprints);
+    delete footprints;
+  }
+  delete simMemory;
+  simMemory = nullptr;
+
+  for (auto &path: bench_files) {
+    unlink(path.c_str());
+  }
+  rmdir(bench_dir);
+  return 0;
+}
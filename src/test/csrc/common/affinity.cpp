@@ -0,0 +1,226 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "affinity.h"
+#include <algorithm>
+#include <dirent.h>
+#include <sched.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#define MPOL_PREFERRED 1
+
+static std::vector<int> affinity_cpus;
+static size_t affinity_next = 0;
+static size_t affinity_checker_end = 0;
+static int affinity_node = -1;
+static cpu_set_t affinity_node_mask;
+// the plan of affinity_plan(): model cpus, checker cpus and helper cpus in the order of affinity_cpus
+static bool affinity_planned = false;
+static cpu_set_t affinity_model_mask;
+static cpu_set_t affinity_helper_mask;
+
+static int parse_cpu_list(const char *list, std::vector<int> &cpus) {
+  const char *p = list;
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0) {
+      return -1;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return -1;
+      }
+    }
+    if (last >= CPU_SETSIZE) {
+      return -1;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    if (*end == ',') {
+      p = end + 1;
+    } else if (*end == '\0' || *end == '\n') {
+      break;
+    } else {
+      return -1;
+    }
+  }
+  return cpus.size();
+}
+
+int affinity_set_cpus(const char *list) {
+  affinity_cpus.clear();
+  affinity_next = 0;
+  int n = parse_cpu_list(list, affinity_cpus);
+  affinity_checker_end = affinity_cpus.size();
+  return n;
+}
+
+// cpus [begin, end) of the list, as a mask and as a string like "0-3,8"
+static std::string cpus_of(size_t begin, size_t end, cpu_set_t *mask) {
+  std::string str;
+  CPU_ZERO(mask);
+  for (size_t i = begin; i < end; i++) {
+    size_t last = i;
+    while (last + 1 < end && affinity_cpus[last + 1] == affinity_cpus[last] + 1) {
+      last++;
+    }
+    for (size_t j = i; j <= last; j++) {
+      CPU_SET(affinity_cpus[j], mask);
+    }
+    str += (str.empty() ? "" : ",") + std::to_string(affinity_cpus[i]);
+    if (last > i) {
+      str += "-" + std::to_string(affinity_cpus[last]);
+    }
+    i = last;
+  }
+  return str.empty() ? "none" : str;
+}
+
+bool affinity_plan(int model_threads, int checker_threads) {
+  if (affinity_cpus.empty()) {
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof(mask), &mask)) {
+      perror("sched_getaffinity");
+      return false;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &mask)) {
+        affinity_cpus.push_back(cpu);
+      }
+    }
+  }
+  size_t n = affinity_cpus.size();
+  size_t model = model_threads > 1 ? model_threads : 1;
+  if (n < model + 1) {
+    printf("thread budget: %lu cpus are too few for %lu model threads, not split\n", n, model);
+    affinity_checker_end = n;
+    return false;
+  }
+  // the helpers keep at least one cpu and also take what is left by the checkers
+  size_t checker = std::min<size_t>(checker_threads > 0 ? checker_threads : 0, n - model - 1);
+  affinity_next = model;
+  affinity_checker_end = model + checker;
+  cpu_set_t checker_mask;
+  std::string model_cpus = cpus_of(0, model, &affinity_model_mask);
+  std::string checker_cpus = cpus_of(model, model + checker, &checker_mask);
+  std::string helper_cpus = cpus_of(model + checker, n, &affinity_helper_mask);
+  printf("thread budget: model on cpus %s, checkers on cpus %s, helpers on cpus %s\n", model_cpus.c_str(),
+         checker_cpus.c_str(), helper_cpus.c_str());
+  if (checker < (size_t)checker_threads) {
+    printf("thread budget: %lu of %d checker threads share the helper cpus\n", checker_threads - checker,
+           checker_threads);
+  }
+  affinity_planned = true;
+  return true;
+}
+
+void affinity_place_model() {
+  if (!affinity_planned) {
+    return;
+  }
+  DIR *dir = opendir("/proc/self/task");
+  if (!dir) {
+    perror("opendir /proc/self/task");
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    pid_t tid = atoi(entry->d_name);
+    if (tid > 0 && sched_setaffinity(tid, sizeof(affinity_model_mask), &affinity_model_mask)) {
+      perror("sched_setaffinity");
+    }
+  }
+  closedir(dir);
+}
+
+int affinity_take_cpu() {
+  return affinity_next < affinity_checker_end ? affinity_cpus[affinity_next++] : -1;
+}
+
+bool affinity_set_node(int node) {
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fgets(buf, sizeof(buf), fp) != NULL;
+  fclose(fp);
+  std::vector<int> cpus;
+  if (!ok || parse_cpu_list(buf, cpus) <= 0) {
+    return false;
+  }
+  CPU_ZERO(&affinity_node_mask);
+  for (int cpu: cpus) {
+    CPU_SET(cpu, &affinity_node_mask);
+  }
+  affinity_node = node;
+  return true;
+}
+
+int affinity_device_node(const char *sysfs_path) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/numa_node", sysfs_path);
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return -1;
+  }
+  int node = -1;
+  if (fscanf(fp, "%d", &node) != 1) {
+    node = -1;
+  }
+  fclose(fp);
+  return node;
+}
+
+void affinity_place_thread(pthread_t thread, const char *name, AffinityRole role) {
+  cpu_set_t mask;
+  int cpu = role == AFFINITY_CHECKER ? affinity_take_cpu() : -1;
+  if (cpu >= 0) {
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    printf("%s thread on cpu %d\n", name, cpu);
+  } else if (affinity_planned) {
+    mask = affinity_helper_mask;
+  } else if (affinity_node >= 0) {
+    mask = affinity_node_mask;
+  } else {
+    return;
+  }
+  if (pthread_setaffinity_np(thread, sizeof(mask), &mask)) {
+    perror("pthread_setaffinity_np");
+  }
+}
+
+void affinity_bind_memory(void *addr, size_t size) {
+  if (affinity_node < 0 || affinity_node >= 64) {
+    return;
+  }
+  // mbind through the syscall to avoid depending on libnuma
+  unsigned long nodemask = 1UL << affinity_node;
+  uintptr_t start = (uintptr_t)addr & ~4095UL;
+  size_t len = (uintptr_t)addr + size - start;
+  if (syscall(SYS_mbind, start, len, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0)) {
+    perror("mbind");
+  }
+}
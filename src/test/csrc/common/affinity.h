@@ -0,0 +1,49 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#include "common.h"
+#include <pthread.h>
+
+// Placement of the host pipeline threads and buffers.
+// Threads take cpus from the list in the order they are spawned. Without a list they are
+// restricted to the cpus of the NUMA node, and without a node they are left to the scheduler.
+
+// Parse a cpu list like "0-3,8,10-11". Return the number of cpus or -1 on a malformed list.
+int affinity_set_cpus(const char *list);
+// Use node for the buffers and for the threads without a cpu. Return false if the node has no cpus.
+bool affinity_set_node(int node);
+// NUMA node of the device at sysfs_path (e.g. /sys/class/xdma/xdma0_user/device), or -1
+int affinity_device_node(const char *sysfs_path);
+
+// Thread budget. affinity_plan() splits the cpus between the simulation thread with the threads of the RTL model,
+// the checker threads (including the DRAMSim3 worker) with a cpu each, and the helper threads (trace and
+// snapshot writers, telemetry, device I/O) sharing the rest. It uses the cpus of the process without a list, and returns false if there are too few to split.
+enum AffinityRole { AFFINITY_CHECKER, AFFINITY_HELPER };
+bool affinity_plan(int model_threads, int checker_threads);
+// Give the cpus of the model to the calling thread and the threads spawned so far, which are those of the model
+void affinity_place_model();
+// Take the next checker cpu for a thread or process placed by the caller, or -1 if there is none
+int affinity_take_cpu();
+
+// Called by the spawner, so that the placement follows the spawning order.
+// Without a plan, helpers are only restricted to the NUMA node and do not take cpus from the list.
+void affinity_place_thread(pthread_t thread, const char *name, AffinityRole role = AFFINITY_CHECKER);
+// Prefer the NUMA node for the pages of [addr, addr + size). Must be called before they are touched.
+void affinity_bind_memory(void *addr, size_t size);
+
+#endif // __AFFINITY_H__
@@ -15,9 +15,15 @@
 ***************************************************************************************/
 
 #include "common.h"
+#include "affinity.h"
+#include <algorithm>
 #include <locale.h>
+#include <mutex>
+#include <pthread.h>
 #include <signal.h>
+#include <thread>
 #include <time.h>
+#include <vector>
 
 int assert_count = 0;
 int signal_num = 0;
@@ -98,16 +104,252 @@ void common_init(const char *program_name) {
 }
 
 void common_finish() {
-  fflush(stdout);
+  asynclog_flush();
 }
 
 static eprintf_handle_t eprintf_handle = vprintf;
 
 extern "C" void common_enable_log(eprintf_handle_t h) {
   assert(h != NULL);
+  if (asynclog_active()) {
+    asynclog_stop();
+  }
   eprintf_handle = h;
 }
 
+bool log_rate_allow(LogRate *site) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  uint64_t second = now.tv_sec;
+  if (site->second.load(std::memory_order_relaxed) != second) {
+    site->second.store(second, std::memory_order_relaxed);
+    site->count.store(0, std::memory_order_relaxed);
+    uint32_t dropped = site->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+      eprintf("[%u similar messages dropped]\n", dropped);
+    }
+  }
+  if (site->count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_BURST) {
+    return true;
+  }
+  site->dropped.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+// Each thread appends to its own ring, which is drained by the log thread, by asynclog_flush(),
+// and without locks by the crash handler
+#define ASYNCLOG_RING_SIZE   (1UL << 20)
+#define ASYNCLOG_LINE_SIZE   512
+#define ASYNCLOG_MAX_THREADS 64
+#define ASYNCLOG_INTERVAL_US 1000
+
+struct LogRing {
+  char buf[ASYNCLOG_RING_SIZE];
+  std::atomic<uint64_t> head; // written by the owner thread
+  std::atomic<uint64_t> tail; // written by the drainer
+};
+
+static LogRing *asynclog_rings[ASYNCLOG_MAX_THREADS];
+static std::atomic<int> asynclog_n_rings(0);
+static thread_local LogRing *asynclog_ring = NULL;
+static std::atomic<bool> asynclog_running(false);
+static eprintf_handle_t asynclog_sink = NULL;
+static std::mutex asynclog_drain_lock;
+static std::thread *asynclog_thread = NULL;
+
+static int asynclog_sink_printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int ret = (*asynclog_sink)(fmt, args);
+  va_end(args);
+  return ret;
+}
+
+// The rings are kept after asynclog_stop(), as their threads still point to them
+static LogRing *asynclog_register() {
+  int idx = asynclog_n_rings.fetch_add(1);
+  if (idx >= ASYNCLOG_MAX_THREADS) {
+    asynclog_n_rings--;
+    return NULL;
+  }
+  LogRing *ring = new LogRing;
+  ring->head.store(0);
+  ring->tail.store(0);
+  asynclog_rings[idx] = ring;
+  asynclog_ring = ring;
+  return ring;
+}
+
+// A message is published at once, so that it is not split by the messages of other threads
+static void asynclog_push(LogRing *ring, const char *data, size_t len) {
+  while (len) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t space = ASYNCLOG_RING_SIZE - (head - ring->tail.load(std::memory_order_acquire));
+    size_t n = std::min(len, (size_t)ASYNCLOG_RING_SIZE);
+    if (space < n) {
+      // the log thread is behind
+      std::this_thread::yield();
+      continue;
+    }
+    size_t off = head % ASYNCLOG_RING_SIZE;
+    size_t first = std::min(n, ASYNCLOG_RING_SIZE - off);
+    memcpy(ring->buf + off, data, first);
+    memcpy(ring->buf, data + first, n - first);
+    ring->head.store(head + n, std::memory_order_release);
+    data += n;
+    len -= n;
+  }
+}
+
+// Called with asynclog_drain_lock held, or by the crash handler with raw writes to stdout
+static bool asynclog_drain(bool raw) {
+  bool written = false;
+  int n_rings = std::min(asynclog_n_rings.load(), ASYNCLOG_MAX_THREADS);
+  for (int i = 0; i < n_rings; i++) {
+    LogRing *ring = asynclog_rings[i];
+    if (ring == NULL) {
+      continue;
+    }
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    while (tail != head) {
+      size_t off = tail % ASYNCLOG_RING_SIZE;
+      size_t n = std::min(head - tail, ASYNCLOG_RING_SIZE - off);
+      if (raw) {
+        if (write(STDOUT_FILENO, ring->buf + off, n) < 0) {
+          return written;
+        }
+      } else {
+        asynclog_sink_printf("%.*s", (int)n, ring->buf + off);
+      }
+      tail += n;
+      written = true;
+    }
+    ring->tail.store(tail, std::memory_order_release);
+  }
+  return written;
+}
+
+static int asynclog_vprintf(const char *fmt, va_list ap) {
+  LogRing *ring = asynclog_ring ? asynclog_ring : asynclog_register();
+  if (ring == NULL) {
+    std::lock_guard<std::mutex> guard(asynclog_drain_lock);
+    return (*asynclog_sink)(fmt, ap);
+  }
+  // arguments may point to buffers reused by the caller, so the message is formatted here
+  char line[ASYNCLOG_LINE_SIZE];
+  va_list aq;
+  va_copy(aq, ap);
+  int n = vsnprintf(line, sizeof(line), fmt, ap);
+  if (n >= (int)sizeof(line)) {
+    std::vector<char> long_line(n + 1);
+    vsnprintf(long_line.data(), n + 1, fmt, aq);
+    asynclog_push(ring, long_line.data(), n);
+  } else if (n > 0) {
+    asynclog_push(ring, line, n);
+  }
+  va_end(aq);
+  return n;
+}
+
+static void asynclog_loop() {
+  while (asynclog_running.load(std::memory_order_relaxed)) {
+    bool written;
+    {
+      std::lock_guard<std::mutex> guard(asynclog_drain_lock);
+      written = asynclog_drain(false);
+    }
+    if (written) {
+      fflush(stdout);
+    }
+    usleep(ASYNCLOG_INTERVAL_US);
+  }
+}
+
+static void asynclog_crash_handler(int signo) {
+  // the log thread may be stopped halfway through a ring, so a few messages may be written twice
+  asynclog_drain(true);
+  signal(signo, SIG_DFL);
+  raise(signo);
+}
+
+// The drain lock is held across fork(), so that the child does not inherit it locked by the log thread
+static void asynclog_fork_prepare() {
+  asynclog_drain_lock.lock();
+  asynclog_drain(false);
+  fflush(stdout);
+}
+
+static void asynclog_fork_parent() {
+  asynclog_drain_lock.unlock();
+}
+
+// The child of fork() has no log thread, and logs synchronously. Messages pushed by other threads after
+// the drain in asynclog_fork_prepare() are written by the parent, and dropped here.
+static void asynclog_fork_child() {
+  asynclog_drain_lock.unlock();
+  int n_rings = std::min(asynclog_n_rings.load(), ASYNCLOG_MAX_THREADS);
+  for (int i = 0; i < n_rings; i++) {
+    if (asynclog_rings[i]) {
+      asynclog_rings[i]->tail.store(asynclog_rings[i]->head.load());
+    }
+  }
+  if (asynclog_running.load()) {
+    asynclog_running.store(false);
+    asynclog_thread = NULL;
+    eprintf_handle = asynclog_sink;
+  }
+}
+
+void asynclog_start() {
+  if (asynclog_running.load()) {
+    return;
+  }
+  static bool registered = false;
+  if (!registered) {
+    registered = true;
+    pthread_atfork(asynclog_fork_prepare, asynclog_fork_parent, asynclog_fork_child);
+    atexit(asynclog_stop);
+  }
+  asynclog_sink = eprintf_handle;
+  asynclog_running.store(true);
+  asynclog_thread = new std::thread(asynclog_loop);
+  affinity_place_thread(asynclog_thread->native_handle(), "async log", AFFINITY_HELPER);
+  eprintf_handle = asynclog_vprintf;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = asynclog_crash_handler;
+  sa.sa_flags = SA_RESETHAND;
+  for (int signo: {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+    sigaction(signo, &sa, NULL);
+  }
+}
+
+void asynclog_stop() {
+  if (!asynclog_running.load()) {
+    return;
+  }
+  eprintf_handle = asynclog_sink;
+  asynclog_running.store(false);
+  asynclog_thread->join();
+  delete asynclog_thread;
+  asynclog_thread = NULL;
+  asynclog_flush();
+}
+
+bool asynclog_active() {
+  return asynclog_running.load(std::memory_order_relaxed);
+}
+
+void asynclog_flush() {
+  {
+    std::lock_guard<std::mutex> guard(asynclog_drain_lock);
+    asynclog_drain(false);
+  }
+  fflush(stdout);
+}
+
 int eprintf(const char *fmt, ...) {
   va_list args;
   int ret;
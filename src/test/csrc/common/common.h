@@ -18,6 +18,7 @@
 #define __COMMON_H
 
 #include "config.h"
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
@@ -65,10 +66,36 @@ int eprintf(const char *fmt, ...);
     }                       \
   } while (0)
 
+// Per-site limit of LOG_RATE_BURST messages per second, for hints that may be hit at every access.
+// The number of dropped messages is reported with the next one from the site.
+#define LOG_RATE_BURST 16
+struct LogRate {
+  std::atomic<uint64_t> second;
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> dropped;
+};
+bool log_rate_allow(LogRate *site);
+
+#define Info_limited(...)                             \
+  do {                                                \
+    static LogRate __log_rate;                        \
+    if (sim_verbose && log_rate_allow(&__log_rate)) { \
+      eprintf(__VA_ARGS__);                           \
+    }                                                 \
+  } while (0)
+
+// Asynchronous backend of eprintf(). Messages are formatted into a buffer of the calling thread
+// and written by a background thread. The buffers are also written on crashing signals and at exit.
+void asynclog_start();
+void asynclog_stop();
+bool asynclog_active();
+// Write the buffered messages and stdout before the output bypassing eprintf(), such as the REF.
+void asynclog_flush();
+
 #define Assert(cond, ...)           \
   do {                              \
     if (!(cond)) {                  \
-      fflush(stdout);               \
+      asynclog_flush();             \
       fprintf(stderr, "\33[1;31m"); \
       fprintf(stderr, __VA_ARGS__); \
       fprintf(stderr, "\33[0m\n");  \
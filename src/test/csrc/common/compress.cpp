@@ -15,6 +15,61 @@
 ***************************************************************************************/
 
 #include "compress.h"
+#include <algorithm>
+#include <atomic>
+#include <emmintrin.h>
+#include <functional>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+// max # of threads for one nonzero_large_memcpy()
+#define NONZERO_MEMCPY_THREADS 8
+// min # of bytes copied by each thread
+#define NONZERO_MEMCPY_THREAD_BYTES (64 * 1024 * 1024UL)
+
+// Checkpoints are split into independent frames (gzip members or zstd frames),
+// which are compressed and decompressed in parallel.
+#define COMPRESS_FRAME_BYTES (64 * 1024 * 1024UL)
+#define COMPRESS_THREADS     8
+#define COMPRESS_ZSTD_LEVEL  3
+
+typedef struct {
+  size_t offset;     // offset in the compressed file
+  size_t size;       // compressed size
+  size_t raw_offset; // offset in the decompressed data
+  size_t raw_size;   // decompressed size
+} CompressFrame;
+
+static size_t compress_threads(size_t n_tasks) {
+  size_t n_threads = std::min<size_t>(COMPRESS_THREADS, std::thread::hardware_concurrency());
+  return std::max<size_t>(1, std::min(n_threads, n_tasks));
+}
+
+// Run task(i) for every i in [0, n) on a few threads. Returns false if any task fails.
+static bool compress_parallel_run(size_t n, std::function<bool(size_t)> task) {
+  std::atomic<size_t> next(0);
+  std::atomic<bool> ok(true);
+  auto worker = [&]() {
+    size_t i;
+    while (ok.load() && (i = next.fetch_add(1)) < n) {
+      if (!task(i)) {
+        ok.store(false);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < compress_threads(n); i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto &t: workers) {
+    t.join();
+  }
+  return ok.load();
+}
 
 double calcTime(timeval s, timeval e) {
   double sec, usec;
@@ -71,50 +126,177 @@ bool isZstdFile(const char *filename) {
   return memcmp(buf, zstd_magic, 4) == 0;
 }
 
+#ifndef NO_GZ_COMPRESSION
+// The frame index of a gz checkpoint is stored in <file>.idx: the number of frames,
+// followed by the compressed and decompressed size of each frame (all uint64_t).
+// Without the index, the concatenated gzip members are still a valid gz file.
+static std::string gz_index_name(const char *filename) {
+  return std::string(filename) + ".idx";
+}
+
+static bool gz_write_index(const char *filename, const std::vector<CompressFrame> &frames) {
+  FILE *fp = fopen(gz_index_name(filename).c_str(), "wb");
+  if (fp == NULL) {
+    return false;
+  }
+  uint64_t n_frames = frames.size();
+  bool ok = fwrite(&n_frames, sizeof(n_frames), 1, fp) == 1;
+  for (auto &f: frames) {
+    uint64_t sizes[2] = {f.size, f.raw_size};
+    ok = ok && fwrite(sizes, sizeof(sizes), 1, fp) == 1;
+  }
+  return (fclose(fp) == 0) && ok;
+}
+
+// The index is ignored if it does not match the compressed file.
+static bool gz_read_index(const char *filename, size_t file_size, std::vector<CompressFrame> &frames) {
+  FILE *fp = fopen(gz_index_name(filename).c_str(), "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  uint64_t n_frames = 0;
+  bool ok = fread(&n_frames, sizeof(n_frames), 1, fp) == 1 && n_frames <= file_size;
+  size_t offset = 0, raw_offset = 0;
+  for (uint64_t i = 0; ok && i < n_frames; i++) {
+    uint64_t sizes[2];
+    ok = fread(sizes, sizeof(sizes), 1, fp) == 1;
+    frames.push_back({offset, sizes[0], raw_offset, sizes[1]});
+    offset += sizes[0];
+    raw_offset += sizes[1];
+  }
+  fclose(fp);
+  return ok && offset == file_size && n_frames > 1;
+}
+
+static bool gz_compress_frame(const uint8_t *src, size_t n, std::vector<uint8_t> &out) {
+  z_stream s;
+  memset(&s, 0, sizeof(s));
+  if (deflateInit2(&s, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out.resize(deflateBound(&s, n));
+  s.next_in = (Bytef *)src;
+  s.avail_in = n;
+  s.next_out = out.data();
+  s.avail_out = out.size();
+  int ret = deflate(&s, Z_FINISH);
+  out.resize(s.total_out);
+  deflateEnd(&s);
+  return ret == Z_STREAM_END;
+}
+
+static bool gz_decompress_frame(const uint8_t *src, size_t n, uint8_t *dest, size_t raw_size) {
+  z_stream s;
+  memset(&s, 0, sizeof(s));
+  if (inflateInit2(&s, MAX_WBITS + 16) != Z_OK) {
+    return false;
+  }
+  s.next_in = (Bytef *)src;
+  s.avail_in = n;
+  s.next_out = dest;
+  s.avail_out = raw_size;
+  int ret = inflate(&s, Z_FINISH);
+  bool ok = ret == Z_STREAM_END && s.total_out == raw_size;
+  inflateEnd(&s);
+  return ok;
+}
+#endif // NO_GZ_COMPRESSION
+
 long snapshot_compressToFile(uint8_t *ptr, const char *filename, long buf_size) {
 #ifndef NO_GZ_COMPRESSION
-  gzFile compressed_mem = gzopen(filename, "wb");
+  // a stale index must not be used for the new file
+  unlink(gz_index_name(filename).c_str());
+  FILE *compressed_mem = fopen(filename, "wb");
 
   if (compressed_mem == NULL) {
     printf("Can't open compressed binary file '%s'", filename);
     return -1;
   }
 
+  size_t n_frames = (buf_size + COMPRESS_FRAME_BYTES - 1) / COMPRESS_FRAME_BYTES;
+  std::vector<CompressFrame> frames;
+  // compress one frame per thread at a time, then write them in order
+  size_t n_threads = compress_threads(n_frames);
+  std::vector<std::vector<uint8_t>> out(n_threads);
   long curr_size = 0;
-  const uint32_t chunk_size = 16384;
-  long *temp_page = new long[chunk_size];
-  long *pmem_current = (long *)ptr;
-
-  while (curr_size < buf_size) {
-    memset(temp_page, 0, chunk_size * sizeof(long));
-    for (uint32_t x = 0; x < chunk_size / sizeof(long); x++) {
-      pmem_current = (long *)((uint8_t *)ptr + curr_size + x * sizeof(long));
-      if (*pmem_current != 0) {
-        *(temp_page + x) = *pmem_current;
-      }
+  size_t file_size = 0;
+  bool ok = true;
+
+  for (size_t base = 0; ok && base < n_frames; base += n_threads) {
+    size_t count = std::min(n_threads, n_frames - base);
+    ok = compress_parallel_run(count, [&](size_t i) {
+      size_t raw_offset = (base + i) * COMPRESS_FRAME_BYTES;
+      size_t raw_size = std::min<size_t>(COMPRESS_FRAME_BYTES, buf_size - raw_offset);
+      return gz_compress_frame(ptr + raw_offset, raw_size, out[i]);
+    });
+    for (size_t i = 0; ok && i < count; i++) {
+      size_t raw_size = std::min<size_t>(COMPRESS_FRAME_BYTES, buf_size - curr_size);
+      ok = fwrite(out[i].data(), 1, out[i].size(), compressed_mem) == out[i].size();
+      frames.push_back({file_size, out[i].size(), (size_t)curr_size, raw_size});
+      file_size += out[i].size();
+      curr_size += raw_size;
     }
-    uint32_t bytes_write = gzwrite(compressed_mem, temp_page, chunk_size);
-    if (bytes_write <= 0) {
-      printf("Compress failed\n");
-      break;
-    }
-    curr_size += bytes_write;
-    // assert(bytes_write % sizeof(long) == 0);
+  }
+  if (!ok) {
+    printf("Compress failed\n");
   }
   // printf("Write %lu bytes from gz stream in total\n", curr_size);
 
-  delete[] temp_page;
-
-  if (gzclose(compressed_mem)) {
+  if (fclose(compressed_mem)) {
     printf("Error closing '%s'\n", filename);
     return -1;
   }
+  if (ok && !gz_write_index(filename, frames)) {
+    printf("Can't write the frame index of '%s'\n", filename);
+  }
   return curr_size;
 #else
   return 0;
 #endif
 }
 
+#ifndef NO_GZ_COMPRESSION
+// Decompress the indexed gzip members in parallel
+static long readFromGzFrames(void *ptr, const char *file_name, long buf_size, std::vector<CompressFrame> &frames) {
+  CompressFrame &last = frames.back();
+  if (last.raw_offset + last.raw_size > (size_t)buf_size) {
+    printf("File size is larger than buf_size!\n");
+    assert(0);
+  }
+
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0) {
+    printf("Can't open compressed binary file '%s'", file_name);
+    return -1;
+  }
+  size_t file_size = last.offset + last.size;
+  uint8_t *file = (uint8_t *)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == (uint8_t *)MAP_FAILED) {
+    printf("Can't mmap compressed binary file '%s'", file_name);
+    return -1;
+  }
+
+  bool ok = compress_parallel_run(frames.size(), [&](size_t i) {
+    CompressFrame &f = frames[i];
+    // zero words are not copied into the target memory
+    std::vector<uint8_t> temp(f.raw_size);
+    if (!gz_decompress_frame(file + f.offset, f.size, temp.data(), f.raw_size)) {
+      return false;
+    }
+    nonzero_large_memcpy((uint8_t *)ptr + f.raw_offset, temp.data(), f.raw_size);
+    return true;
+  });
+  munmap(file, file_size);
+
+  if (!ok) {
+    printf("Decompress failed: '%s'\n", file_name);
+    return -1;
+  }
+  return last.raw_offset + last.raw_size;
+}
+#endif // NO_GZ_COMPRESSION
+
 long readFromGz(void *ptr, const char *file_name, long buf_size, uint8_t load_type) {
 #ifndef NO_GZ_COMPRESSION
   assert(buf_size > 0);
@@ -134,6 +316,13 @@ long readFromGz(void *ptr, const char *file_name, long buf_size, uint8_t load_ty
     assert(0);
   }
 
+  struct stat file_stat;
+  std::vector<CompressFrame> frames;
+  if (stat(file_name, &file_stat) == 0 && gz_read_index(file_name, file_stat.st_size, frames)) {
+    gzclose(compressed_mem);
+    return readFromGzFrames(ptr, file_name, buf_size, frames);
+  }
+
   long *temp_page = new long[chunk_size];
 
   while (curr_size < buf_size) {
@@ -168,6 +357,101 @@ long readFromGz(void *ptr, const char *file_name, long buf_size, uint8_t load_ty
 #endif
 }
 
+#ifndef NO_ZSTD_COMPRESSION
+// Split a zstd file into its frames. Returns false if there are not several frames
+// with known decompressed sizes (e.g. a single streamed frame).
+static bool zstd_scan_frames(const uint8_t *buf, size_t size, std::vector<CompressFrame> &frames) {
+  size_t offset = 0, raw_offset = 0;
+  while (offset < size) {
+    size_t frame_size = ZSTD_findFrameCompressedSize(buf + offset, size - offset);
+    if (ZSTD_isError(frame_size)) {
+      return false;
+    }
+    // skippable frames have a content size of zero
+    unsigned long long raw_size = ZSTD_getFrameContentSize(buf + offset, frame_size);
+    if (raw_size == ZSTD_CONTENTSIZE_UNKNOWN || raw_size == ZSTD_CONTENTSIZE_ERROR) {
+      return false;
+    }
+    frames.push_back({offset, frame_size, raw_offset, (size_t)raw_size});
+    offset += frame_size;
+    raw_offset += raw_size;
+  }
+  return frames.size() > 1;
+}
+
+// Decompress independent zstd frames in parallel
+static long readFromZstdFrames(void *ptr, const uint8_t *buf, long buf_size, std::vector<CompressFrame> &frames) {
+  CompressFrame &last = frames.back();
+  if (last.raw_offset + last.raw_size > (size_t)buf_size) {
+    printf("Binary size larger than memory\n");
+    return -1;
+  }
+  bool ok = compress_parallel_run(frames.size(), [&](size_t i) {
+    CompressFrame &f = frames[i];
+    if (f.raw_size == 0) {
+      return true;
+    }
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (!dctx) {
+      return false;
+    }
+    // zero words are not copied into the target memory
+    std::vector<uint8_t> temp(f.raw_size);
+    size_t result = ZSTD_decompressDCtx(dctx, temp.data(), f.raw_size, buf + f.offset, f.size);
+    ZSTD_freeDCtx(dctx);
+    if (ZSTD_isError(result) || result != f.raw_size) {
+      printf("Decompress failed: %s\n", ZSTD_isError(result) ? ZSTD_getErrorName(result) : "size mismatch");
+      return false;
+    }
+    nonzero_large_memcpy((uint8_t *)ptr + f.raw_offset, temp.data(), f.raw_size);
+    return true;
+  });
+  return ok ? (long)(last.raw_offset + last.raw_size) : -1;
+}
+#endif // NO_ZSTD_COMPRESSION
+
+long zstd_compressToFile(const uint8_t *ptr, const char *filename, long buf_size) {
+#ifndef NO_ZSTD_COMPRESSION
+  FILE *fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    printf("Can't open compressed binary file '%s'", filename);
+    return -1;
+  }
+
+  size_t n_frames = (buf_size + COMPRESS_FRAME_BYTES - 1) / COMPRESS_FRAME_BYTES;
+  // compress one frame per thread at a time, then write them in order
+  size_t n_threads = compress_threads(n_frames);
+  std::vector<std::vector<uint8_t>> out(n_threads);
+  bool ok = true;
+  for (size_t base = 0; ok && base < n_frames; base += n_threads) {
+    size_t count = std::min(n_threads, n_frames - base);
+    ok = compress_parallel_run(count, [&](size_t i) {
+      size_t raw_offset = (base + i) * COMPRESS_FRAME_BYTES;
+      size_t raw_size = std::min<size_t>(COMPRESS_FRAME_BYTES, buf_size - raw_offset);
+      out[i].resize(ZSTD_compressBound(raw_size));
+      size_t size = ZSTD_compress(out[i].data(), out[i].size(), ptr + raw_offset, raw_size, COMPRESS_ZSTD_LEVEL);
+      if (ZSTD_isError(size)) {
+        printf("Compress failed: %s\n", ZSTD_getErrorName(size));
+        return false;
+      }
+      out[i].resize(size);
+      return true;
+    });
+    for (size_t i = 0; ok && i < count; i++) {
+      ok = fwrite(out[i].data(), 1, out[i].size(), fp) == out[i].size();
+    }
+  }
+  if (fclose(fp) || !ok) {
+    printf("Error writing '%s'\n", filename);
+    return -1;
+  }
+  return buf_size;
+#else
+  printf("Zstd compression is disabled by NO_ZSTD_COMPRESSION\n");
+  return -1;
+#endif // NO_ZSTD_COMPRESSION
+}
+
 long readFromZstd(void *ptr, const char *file_name, long buf_size, uint8_t load_type) {
 #ifndef NO_ZSTD_COMPRESSION
   assert(buf_size > 0);
@@ -213,6 +497,13 @@ long readFromZstd(void *ptr, const char *file_name, long buf_size, uint8_t load_
 
   close(fd);
 
+  std::vector<CompressFrame> frames;
+  if (zstd_scan_frames(compress_file_buffer, compress_file_buffer_size, frames)) {
+    long ret = readFromZstdFrames(ptr, compress_file_buffer, buf_size, frames);
+    delete[] compress_file_buffer;
+    return ret;
+  }
+
   ZSTD_inBuffer input_buffer = {compress_file_buffer, compress_file_buffer_size, 0};
 
   long *temp_page = new long[chunk_size];
@@ -282,9 +573,75 @@ long readFromZstd(void *ptr, const char *file_name, long buf_size, uint8_t load_
 #endif
 }
 
-void nonzero_large_memcpy(const void *__restrict dest, const void *__restrict src, size_t n) {
+// Copy the non-zero 64-byte lines. Zero words inside a non-zero line are still skipped.
+static void nonzero_memcpy_lines(uint64_t *dest, const uint64_t *src, size_t n_lines, bool stream) {
+  for (size_t i = 0; i < n_lines; i++, dest += 8, src += 8) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+    __m128i v1 = _mm_loadu_si128((const __m128i *)src + 1);
+    __m128i v2 = _mm_loadu_si128((const __m128i *)src + 2);
+    __m128i v3 = _mm_loadu_si128((const __m128i *)src + 3);
+    __m128i zero = _mm_setzero_si128();
+    // bit i is set if the i-th byte of the line is zero
+    uint64_t zero_bytes = (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, zero)) |
+                          ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, zero)) << 16) |
+                          ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v2, zero)) << 32) |
+                          ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v3, zero)) << 48);
+    if (zero_bytes == ~0UL) {
+      continue;
+    }
+    bool has_zero_word = false;
+    for (int j = 0; j < 8; j++) {
+      has_zero_word |= ((zero_bytes >> (j * 8)) & 0xff) == 0xff;
+    }
+    if (has_zero_word) {
+      for (int j = 0; j < 8; j++) {
+        if (src[j] != 0) {
+          dest[j] = src[j];
+        }
+      }
+    } else if (stream) {
+      _mm_stream_si128((__m128i *)dest, v0);
+      _mm_stream_si128((__m128i *)dest + 1, v1);
+      _mm_stream_si128((__m128i *)dest + 2, v2);
+      _mm_stream_si128((__m128i *)dest + 3, v3);
+    } else {
+      _mm_storeu_si128((__m128i *)dest, v0);
+      _mm_storeu_si128((__m128i *)dest + 1, v1);
+      _mm_storeu_si128((__m128i *)dest + 2, v2);
+      _mm_storeu_si128((__m128i *)dest + 3, v3);
+    }
+  }
+  if (stream) {
+    _mm_sfence();
+  }
+}
+
+void nonzero_large_memcpy(const void *__restrict dest, const void *__restrict src, size_t n, bool fresh_dest) {
   uint64_t *_dest = (uint64_t *)dest;
   uint64_t *_src = (uint64_t *)src;
+  size_t n_lines = n / 64;
+  if (n_lines > 0) {
+    // Non-temporal stores avoid reading the fresh destination into the cache. They require 16-byte alignment.
+    bool stream = fresh_dest && ((uintptr_t)dest % 16 == 0);
+    size_t n_threads = std::min<size_t>(NONZERO_MEMCPY_THREADS, n / NONZERO_MEMCPY_THREAD_BYTES);
+    n_threads = std::min<size_t>(n_threads, std::thread::hardware_concurrency());
+    if (n_threads > 1) {
+      std::vector<std::thread> workers;
+      size_t lines_per_thread = (n_lines + n_threads - 1) / n_threads;
+      for (size_t i = 0; i < n_lines; i += lines_per_thread) {
+        size_t count = std::min(lines_per_thread, n_lines - i);
+        workers.emplace_back(nonzero_memcpy_lines, _dest + i * 8, _src + i * 8, count, stream);
+      }
+      for (auto &t: workers) {
+        t.join();
+      }
+    } else {
+      nonzero_memcpy_lines(_dest, _src, n_lines, stream);
+    }
+    _dest += n_lines * 8;
+    _src += n_lines * 8;
+    n -= n_lines * 64;
+  }
   while (n >= sizeof(uint64_t)) {
     if (*_src != 0) {
       *_dest = *_src;
@@ -36,9 +36,13 @@ bool isGzFile(const char *filename);
 long snapshot_compressToFile(uint8_t *ptr, const char *filename, long buf_size);
 long readFromGz(void *ptr, const char *file_name, long buf_size, uint8_t load_type);
 
-void nonzero_large_memcpy(const void *__restrict dest, const void *__restrict src, size_t n);
+// Copy src to dest except for zero words. Large copies are split across threads.
+// Set fresh_dest if dest is freshly mapped, so that non-temporal stores are used.
+void nonzero_large_memcpy(const void *__restrict dest, const void *__restrict src, size_t n, bool fresh_dest = false);
 
 bool isZstdFile(const char *filename);
 long readFromZstd(void *ptr, const char *file_name, long buf_size, uint8_t load_type);
+// Compress to independent zstd frames, which readFromZstd decompresses in parallel
+long zstd_compressToFile(const uint8_t *ptr, const char *filename, long buf_size);
 
 #endif
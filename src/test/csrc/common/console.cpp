@@ -0,0 +1,177 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include "console.h"
+#include "affinity.h"
+#include "device.h"
+#include <atomic>
+#include <deque>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+const char *console_capture_path = nullptr;
+bool console_polled = false;
+
+static char console_ring[CONSOLE_RING_SIZE];
+static std::atomic<uint64_t> console_head(0), console_tail(0);
+static pthread_mutex_t console_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t console_thread;
+static std::atomic<bool> console_running(false);
+static FILE *console_capture = nullptr;
+static std::deque<char> console_input;
+
+// write the ring from tail to head, with console_lock held
+static void console_drain_locked() {
+  uint64_t tail = console_tail.load(std::memory_order_relaxed);
+  uint64_t head = console_head.load(std::memory_order_acquire);
+  while (tail != head) {
+    uint64_t start = tail % CONSOLE_RING_SIZE;
+    uint64_t n = std::min(head - tail, CONSOLE_RING_SIZE - start);
+    fwrite(console_ring + start, 1, n, stdout);
+    if (console_capture) {
+      fwrite(console_ring + start, 1, n, console_capture);
+    }
+    tail += n;
+  }
+  console_tail.store(tail, std::memory_order_release);
+  fflush(stdout);
+}
+
+// Called by the side thread and console_flush()
+static void console_drain() {
+  pthread_mutex_lock(&console_lock);
+  console_drain_locked();
+  pthread_mutex_unlock(&console_lock);
+}
+
+static void *console_writer(void *) {
+  while (console_running.load(std::memory_order_relaxed)) {
+    usleep(CONSOLE_FLUSH_MS * 1000);
+    console_drain();
+  }
+  return NULL;
+}
+
+static void console_start() {
+  console_running = true;
+  if (pthread_create(&console_thread, NULL, console_writer, NULL)) {
+    perror("console pthread_create");
+    console_running = false;
+  } else {
+    affinity_place_thread(console_thread, "console writer", AFFINITY_HELPER);
+  }
+}
+
+// fork() copies only the calling thread: the ring is written out before it, so that the child does not
+// print the output again. The child writes synchronously until console_fork_wake() restarts the writer.
+static bool console_child_pending = false;
+
+static void console_prepare_fork() {
+  pthread_mutex_lock(&console_lock);
+  console_drain_locked();
+}
+
+static void console_parent_fork() {
+  pthread_mutex_unlock(&console_lock);
+}
+
+static void console_child_fork() {
+  pthread_mutex_unlock(&console_lock);
+  console_child_pending = console_running;
+  console_running = false;
+}
+
+void console_fork_wake() {
+  if (console_child_pending) {
+    console_child_pending = false;
+    console_start();
+  }
+}
+
+void console_init() {
+  if (console_capture_path) {
+    console_capture = fopen(console_capture_path, "w");
+    if (!console_capture) {
+      printf("Cannot open %s to capture the console\n", console_capture_path);
+    }
+  }
+  static bool registered = false;
+  if (!registered) {
+    pthread_atfork(console_prepare_fork, console_parent_fork, console_child_fork);
+    device_add_timer(60 * 1000, []() {
+      if (console_polled) {
+        eprintf(ANSI_COLOR_RED "now = %ds\n" ANSI_COLOR_RESET, uptime() / 1000);
+        console_polled = false;
+      }
+    });
+    registered = true;
+  }
+  console_start();
+}
+
+void console_finish() {
+  if (console_running) {
+    console_running = false;
+    pthread_join(console_thread, NULL);
+  }
+  console_drain();
+  if (console_capture) {
+    fclose(console_capture);
+    console_capture = nullptr;
+  }
+}
+
+void console_putc(uint8_t ch) {
+  if (!console_running) {
+    putchar(ch);
+    fflush(stdout);
+    return;
+  }
+  uint64_t head = console_head.load(std::memory_order_relaxed);
+  if (head - console_tail.load(std::memory_order_acquire) >= CONSOLE_RING_SIZE / 2) {
+    console_drain();
+  }
+  console_ring[head % CONSOLE_RING_SIZE] = ch;
+  console_head.store(head + 1, std::memory_order_release);
+}
+
+void console_flush() {
+  console_drain();
+}
+
+void console_enable_input() {
+  fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+  device_watch_fd(STDIN_FILENO, []() {
+    char buf[256];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0) {
+      device_unwatch_fd(STDIN_FILENO); // EOF
+    }
+    for (ssize_t i = 0; i < n; i++) {
+      console_input.push_back(buf[i]);
+    }
+  });
+}
+
+int console_getc() {
+  if (console_input.empty()) {
+    return -1;
+  }
+  int ch = (uint8_t)console_input.front();
+  console_input.pop_front();
+  return ch;
+}
@@ -0,0 +1,44 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+
+#include "common.h"
+
+// Buffered console of the UART. console_putc() appends to a ring, which a side thread writes
+// to stdout, and to the capture file if any, every CONSOLE_FLUSH_MS or when it is half full.
+#define CONSOLE_RING_SIZE (64 * 1024)
+#define CONSOLE_FLUSH_MS  10
+
+// capture the UART output to this file, set before init_device()
+extern const char *console_capture_path;
+// set by the UART models on every input poll, for the periodic "now = ..." reminder
+extern bool console_polled;
+
+void console_init();
+void console_finish();
+void console_putc(uint8_t ch);
+// write out the buffered output, e.g. before printing other messages
+void console_flush();
+// restart the writer in a woken LightSSS checkpoint, see Emulator::fork_child_init()
+void console_fork_wake();
+
+// pre-read stdin without blocking, see console_getc()
+void console_enable_input();
+// next input character from stdin, or -1 if there is none
+int console_getc();
+
+#endif // __CONSOLE_H
@@ -24,18 +24,24 @@ void Coverage::display_uncovered_points() {
   }
 }
 
+void Coverage::to_cover_sections(std::vector<CoverSection> &sections) {
+  uint32_t total = get_total_points();
+  std::vector<uint8_t> bytes(total, 0);
+  to_covered_bytes(bytes.data());
+  CoverBitmap bitmap;
+  bitmap.resize(total);
+  bitmap.merge_bytes(bytes.data());
+  sections.push_back({get_name(), total, bitmap.get_words()});
+}
+
 #ifdef FIRRTL_COVER
 FIRRTLCoverage::FIRRTLCoverage() {
   for (int i = 0; i < n_cover; i++) {
-    acc[i] = new uint8_t[firrtl_cover[i].cover.total];
+    acc[i].resize(firrtl_cover[i].cover.total);
   }
 };
 
-FIRRTLCoverage::~FIRRTLCoverage() {
-  for (int i = 0; i < n_cover; i++) {
-    delete acc[i];
-  }
-}
+FIRRTLCoverage::~FIRRTLCoverage() {}
 
 void FIRRTLCoverage::reset() {
   for (auto c: firrtl_cover) {
@@ -53,18 +59,14 @@ uint32_t FIRRTLCoverage::get_covered_points() {
 
 void FIRRTLCoverage::accumulate() {
   for (int i = 0; i < n_cover; i++) {
-    for (auto j = 0; j < firrtl_cover[i].cover.total; j++) {
-      if (firrtl_cover[i].cover.points[j]) {
-        acc[i][j] = 1;
-      }
-    }
+    acc[i].merge_bytes(firrtl_cover[i].cover.points);
   }
 }
 
 uint32_t FIRRTLCoverage::get_acc_covered_points() {
   auto target = get();
   auto i = (FIRRTLCoverPointParam *)target - firrtl_cover;
-  return cover_sum(acc[i], firrtl_cover[i].cover.total);
+  return acc[i].count();
 }
 
 void FIRRTLCoverage::display() {
@@ -75,7 +77,7 @@ void FIRRTLCoverage::display() {
 
 void FIRRTLCoverage::display(int i) {
   uint32_t covered = cover_sum(&(firrtl_cover[i].cover));
-  uint32_t acc_value = cover_sum(acc[i], firrtl_cover[i].cover.total);
+  uint32_t acc_value = acc[i].count();
   Coverage::display(firrtl_cover[i].cover.name, firrtl_cover[i].cover.total, covered, acc_value);
 }
 
@@ -83,7 +85,7 @@ void FIRRTLCoverage::display_uncovered_points() {
   for (int i = 0; i < n_cover; i++) {
     printf("Uncovered %s coverage points:\n", firrtl_cover[i].cover.name);
     for (auto j = 0; j < firrtl_cover[i].cover.total; j++) {
-      if (!acc[i][j]) {
+      if (!acc[i].test(j)) {
         printf("  [%d] %s\n", j, firrtl_cover[i].cover.point_names[j]);
       }
     }
@@ -115,6 +117,16 @@ void FIRRTLCoverage::to_covered_bytes(uint8_t *bytes) {
   memcpy(bytes, target->points, target->total);
 }
 
+// one section for each type of FIRRTL coverage, named like FIRRTL.line
+void FIRRTLCoverage::to_cover_sections(std::vector<CoverSection> &sections) {
+  for (auto &c: firrtl_cover) {
+    CoverBitmap bitmap;
+    bitmap.resize(c.cover.total);
+    bitmap.merge_bytes(c.cover.points);
+    sections.push_back({std::string(get_name()) + "." + c.cover.name, c.cover.total, bitmap.get_words()});
+  }
+}
+
 const FIRRTLCoverPoint *FIRRTLCoverage::get() {
   for (auto &c: firrtl_cover) {
     if (c.is_feedback) {
@@ -124,16 +136,8 @@ const FIRRTLCoverPoint *FIRRTLCoverage::get() {
   return nullptr;
 }
 
-uint32_t FIRRTLCoverage::cover_sum(uint8_t *points, uint32_t total) {
-  uint32_t result = 0;
-  for (int i = 0; i < total; i++) {
-    result += points[i];
-  }
-  return result;
-}
-
 uint32_t FIRRTLCoverage::cover_sum(const FIRRTLCoverPoint *cover) {
-  return cover_sum(cover->points, cover->total);
+  return CoverBitmap::count_bytes(cover->points, cover->total);
 }
 #endif // FIRRTL_COVER
 
@@ -17,6 +17,8 @@
 #define __COVERAGE_H
 
 #include "common.h"
+#include "coverfile.h"
+#include <algorithm>
 #include <string>
 #include <vector>
 #ifdef FIRRTL_COVER
@@ -25,6 +27,102 @@
 
 #define coverage_display(s, ...) eprintf(ANSI_COLOR_GREEN s ANSI_COLOR_RESET, ##__VA_ARGS__)
 
+// Coverage points packed into 64-bit words. Bytes are packed and unpacked eight at a time.
+class CoverBitmap {
+public:
+  void resize(uint32_t n) {
+    total = n;
+    words.assign((n + 63) / 64, 0);
+  }
+  inline void clear() {
+    std::fill(words.begin(), words.end(), 0);
+  }
+  inline bool test(uint32_t i) const {
+    return (words[i / 64] >> (i % 64)) & 1;
+  }
+  inline uint64_t *data() {
+    return words.data();
+  }
+  inline const std::vector<uint64_t> &get_words() const {
+    return words;
+  }
+  inline uint32_t count() const {
+    uint32_t result = 0;
+    for (auto w: words) {
+      result += __builtin_popcountll(w);
+    }
+    return result;
+  }
+  inline void merge(const CoverBitmap &other) {
+    for (size_t i = 0; i < words.size(); i++) {
+      words[i] |= other.words[i];
+    }
+  }
+  // set the points of non-zero bytes
+  void merge_bytes(const uint8_t *bytes) {
+    uint32_t i = 0;
+    for (; i + 64 <= total; i += 64) {
+      words[i / 64] |= bytes_to_word(bytes + i);
+    }
+    for (; i < total; i++) {
+      words[i / 64] |= (uint64_t)(bytes[i] != 0) << (i % 64);
+    }
+  }
+  // set bytes of the covered points to 1, and leave others unchanged
+  void to_bytes(uint8_t *bytes) const {
+    for (uint32_t i = 0; i < total; i += 8) {
+      uint8_t m = (words[i / 64] >> (i % 64)) & 0xff;
+      if (!m) {
+        continue;
+      }
+      if (i + 8 > total) {
+        for (uint32_t j = i; j < total; j++) {
+          bytes[j] = test(j) ? 1 : bytes[j];
+        }
+        break;
+      }
+      uint64_t ones = expand_byte(m), b;
+      memcpy(&b, bytes + i, 8);
+      b = (b & ~(ones * 0xff)) | ones;
+      memcpy(bytes + i, &b, 8);
+    }
+  }
+  // number of non-zero bytes
+  static uint32_t count_bytes(const uint8_t *bytes, uint32_t n) {
+    uint32_t result = 0, i = 0;
+    for (; i + 64 <= n; i += 64) {
+      result += __builtin_popcountll(bytes_to_word(bytes + i));
+    }
+    for (; i < n; i++) {
+      result += bytes[i] != 0;
+    }
+    return result;
+  }
+
+private:
+  std::vector<uint64_t> words;
+  uint32_t total = 0;
+
+  // bit i is set if byte i of x is non-zero
+  static inline uint64_t nonzero_bytes(uint64_t x) {
+    uint64_t hi = (((x & 0x7f7f7f7f7f7f7f7fUL) + 0x7f7f7f7f7f7f7f7fUL) | x) & 0x8080808080808080UL;
+    return ((hi >> 7) * 0x0102040810204080UL) >> 56;
+  }
+  // byte i is 1 if bit i of m is set
+  static inline uint64_t expand_byte(uint8_t m) {
+    return (((m & 0xfUL) * 0x204081UL) | (((m >> 4) * 0x204081UL) << 32)) & 0x0101010101010101UL;
+  }
+  static inline uint64_t bytes_to_word(const uint8_t *bytes) {
+    uint64_t word = 0;
+    for (int j = 0; j < 8; j++) {
+      uint64_t x;
+      memcpy(&x, bytes + j * 8, 8);
+      word |= nonzero_bytes(x) << (j * 8);
+    }
+    return word;
+  }
+};
+
 class Coverage {
 public:
   Coverage() {};
@@ -65,6 +163,8 @@ public:
     is_feedback = !cover_name_cmp(cover_name, get_name());
   }
   virtual void to_covered_bytes(uint8_t *bytes) = 0;
+  // covered points of this run for the cover file
+  virtual void to_cover_sections(std::vector<CoverSection> &sections);
 
 protected:
   static int cover_name_cmp(const char *s1, const char *s2) {
@@ -90,58 +190,47 @@ protected:
       return cov_name;                                                                                    \
     }                                                                                                     \
     cov_class_name##Coverage() {                                                                          \
-      reset();                                                                                            \
-      memset(acc, 0, sizeof(acc));                                                                        \
+      info.resize(diff_width_macro);                                                                      \
+      acc.resize(diff_width_macro);                                                                       \
     }                                                                                                     \
     void reset() {                                                                                        \
-      memset(info, 0, sizeof(info));                                                                      \
+      info.clear();                                                                                       \
     }                                                                                                     \
     void update(DiffTestState *s) {                                                                       \
-      memcpy(info, s->diff_var_name, sizeof(s->diff_var_name));                                           \
+      uint64_t *words = info.data();                                                                      \
+      for (uint32_t i = 0; i < diff_width_macro; i += 64) {                                               \
+        uint64_t w = 0;                                                                                   \
+        for (uint32_t j = i; j < diff_width_macro && j < i + 64; j++) {                                   \
+          w |= (uint64_t)(s->diff_var_name[j].covered != 0) << (j - i);                                   \
+        }                                                                                                 \
+        words[i / 64] = w;                                                                                \
+      }                                                                                                   \
     }                                                                                                     \
                                                                                                           \
     uint32_t get_total_points() {                                                                         \
       return diff_width_macro;                                                                            \
     }                                                                                                     \
     uint32_t get_covered_points() {                                                                       \
-      return sum(info);                                                                                   \
+      return info.count();                                                                                \
     }                                                                                                     \
                                                                                                           \
     void accumulate() {                                                                                   \
-      for (auto i = 0; i < get_total_points(); i++) {                                                     \
-        if (info[i].covered) {                                                                            \
-          acc[i].covered = 1;                                                                             \
-        }                                                                                                 \
-      }                                                                                                   \
+      acc.merge(info);                                                                                    \
     }                                                                                                     \
     bool is_accumulated(uint32_t i) {                                                                     \
-      return acc[i].covered;                                                                              \
+      return acc.test(i);                                                                                 \
     }                                                                                                     \
     uint32_t get_acc_covered_points() {                                                                   \
-      return sum(acc);                                                                                    \
+      return acc.count();                                                                                 \
     }                                                                                                     \
                                                                                                           \
     void to_covered_bytes(uint8_t *bytes) {                                                               \
-      for (uint32_t i = 0; i < get_total_points(); i++) {                                                 \
-        if (info[i].covered) {                                                                            \
-          bytes[i] = 1;                                                                                   \
-        }                                                                                                 \
-      }                                                                                                   \
+      info.to_bytes(bytes);                                                                               \
     }                                                                                                     \
                                                                                                           \
   private:                                                                                                \
-    diff_class_name info[diff_width_macro];                                                               \
-    diff_class_name acc[diff_width_macro];                                                                \
-                                                                                                          \
-    uint32_t sum(diff_class_name *cover) {                                                                \
-      uint32_t result = 0;                                                                                \
-      for (int i = 0; i < get_total_points(); i++) {                                                      \
-        if (cover[i].covered) {                                                                           \
-          result += 1;                                                                                    \
-        }                                                                                                 \
-      }                                                                                                   \
-      return result;                                                                                      \
-    }                                                                                                     \
+    CoverBitmap info;                                                                                     \
+    CoverBitmap acc;                                                                                      \
   };
 
 #ifdef CONFIG_DIFFTEST_INSTRCOVER
@@ -174,14 +263,14 @@ public:
 
   void update_is_feedback(const char *cover_name);
   void to_covered_bytes(uint8_t *bytes);
+  void to_cover_sections(std::vector<CoverSection> &sections);
 
 private:
   const static int n_cover = sizeof(firrtl_cover) / sizeof(FIRRTLCoverPointParam);
-  uint8_t *acc[n_cover];
+  CoverBitmap acc[n_cover];
 
   const FIRRTLCoverPoint *get();
   uint32_t cover_sum(const FIRRTLCoverPoint *cover);
-  uint32_t cover_sum(uint8_t *points, uint32_t total);
   void display(int i);
 };
 #endif // FIRRTL_COVER
@@ -0,0 +1,82 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __COVERFILE_H
+#define __COVERFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Covered points of a run, shared by emu --dump-cover-bitmap and tools/cover_merge.cpp. All fields are little-endian:
+//   header:  magic "COVB", version (u32), number of sections (u32)
+//   section: name length (u32), name, number of points (u32), (points + 63) / 64 words (u64) of the bitmap
+#define COVER_FILE_MAGIC   0x42564f43
+#define COVER_FILE_VERSION 1
+
+struct CoverSection {
+  std::string name;
+  uint32_t total;
+  std::vector<uint64_t> words;
+};
+
+static inline bool cover_file_write(const char *path, const std::vector<CoverSection> &sections) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    return false;
+  }
+  uint32_t header[3] = {COVER_FILE_MAGIC, COVER_FILE_VERSION, (uint32_t)sections.size()};
+  bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+  for (auto &s: sections) {
+    uint32_t len = s.name.size();
+    ok = ok && fwrite(&len, sizeof(len), 1, fp) == 1 && fwrite(s.name.data(), 1, len, fp) == len;
+    ok = ok && fwrite(&s.total, sizeof(s.total), 1, fp) == 1;
+    ok = ok && fwrite(s.words.data(), sizeof(uint64_t), s.words.size(), fp) == s.words.size();
+  }
+  return fclose(fp) == 0 && ok;
+}
+
+// Return false on a missing or malformed file
+static inline bool cover_file_read(const char *path, std::vector<CoverSection> &sections) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  uint32_t header[3];
+  bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == COVER_FILE_MAGIC &&
+            header[1] == COVER_FILE_VERSION;
+  sections.resize(ok ? header[2] : 0);
+  for (auto &s: sections) {
+    uint32_t len = 0;
+    ok = ok && fread(&len, sizeof(len), 1, fp) == 1 && len < 4096;
+    if (!ok) {
+      break;
+    }
+    s.name.resize(len);
+    ok = fread(&s.name[0], 1, len, fp) == len && fread(&s.total, sizeof(s.total), 1, fp) == 1;
+    if (!ok) {
+      break;
+    }
+    s.words.resize((s.total + 63) / 64);
+    ok = fread(s.words.data(), sizeof(uint64_t), s.words.size(), fp) == s.words.size();
+  }
+  fclose(fp);
+  return ok;
+}
+
+#endif // __COVERFILE_H
@@ -15,52 +15,161 @@
 ***************************************************************************************/
 
 #include "device.h"
+#include "affinity.h"
+#include "console.h"
 #include "flash.h"
 #include "sdcard.h"
 #include "uart.h"
+#include "uart16550.h"
 #include "vga.h"
-#ifdef SHOW_SCREEN
-#include <SDL2/SDL.h>
-#endif
+#include <errno.h>
+#include <map>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <vector>
+
+struct DeviceSource {
+  int fd; // the watched fd, or the timerfd of a timer
+  bool is_timer;
+  std::function<void()> callback;
+  std::atomic<bool> ready;
+  bool removed;
+};
+
+static std::vector<DeviceSource *> device_sources;
+static std::multimap<uint64_t, std::function<void()>> device_events;
+static int device_epfd = -1;
+std::atomic<uint32_t> device_pending(0);
+uint64_t device_next_cycle = -1ULL;
+
+static void *device_poller(void *) {
+  struct epoll_event events[16];
+  while (true) {
+    int n = epoll_wait(device_epfd, events, 16, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("device epoll_wait");
+      return NULL;
+    }
+    for (int i = 0; i < n; i++) {
+      auto src = static_cast<DeviceSource *>(events[i].data.ptr);
+      if (!src->ready.exchange(true)) {
+        device_pending.fetch_add(1, std::memory_order_release);
+      }
+    }
+  }
+}
+
+// One-shot so that the poller does not spin on a readable fd until it is serviced
+static void device_arm(DeviceSource *src, int op) {
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = src;
+  if (epoll_ctl(device_epfd, op, src->fd, &ev)) {
+    perror("device epoll_ctl");
+  }
+}
+
+static void device_add_source(int fd, bool is_timer, std::function<void()> callback) {
+  if (device_epfd < 0) {
+    device_epfd = epoll_create1(EPOLL_CLOEXEC);
+    pthread_t thread;
+    if (device_epfd < 0 || pthread_create(&thread, NULL, device_poller, NULL)) {
+      perror("device poller");
+      exit(1);
+    }
+    affinity_place_thread(thread, "device poller", AFFINITY_HELPER);
+    pthread_detach(thread);
+  }
+  auto src = new DeviceSource;
+  src->fd = fd;
+  src->is_timer = is_timer;
+  src->callback = callback;
+  src->ready = false;
+  src->removed = false;
+  device_sources.push_back(src);
+  device_arm(src, EPOLL_CTL_ADD);
+}
+
+void device_add_timer(uint32_t interval_ms, std::function<void()> callback) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval_ms / 1000;
+  spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  spec.it_value = spec.it_interval;
+  if (fd < 0 || timerfd_settime(fd, 0, &spec, NULL)) {
+    perror("device timerfd");
+    exit(1);
+  }
+  device_add_source(fd, true, callback);
+}
+
+void device_watch_fd(int fd, std::function<void()> callback) {
+  device_add_source(fd, false, callback);
+}
 
-void send_key(uint8_t, bool);
+void device_unwatch_fd(int fd) {
+  for (auto src: device_sources) {
+    if (src->fd == fd && !src->is_timer && !src->removed) {
+      epoll_ctl(device_epfd, EPOLL_CTL_DEL, fd, NULL);
+      src->removed = true;
+    }
+  }
+}
+
+void device_schedule(uint64_t cycle, std::function<void()> callback) {
+  device_events.emplace(cycle, callback);
+  device_next_cycle = device_events.begin()->first;
+}
+
+void device_service(uint64_t cycle) {
+  while (!device_events.empty() && device_events.begin()->first <= cycle) {
+    auto callback = device_events.begin()->second;
+    device_events.erase(device_events.begin());
+    callback();
+  }
+  device_next_cycle = device_events.empty() ? -1ULL : device_events.begin()->first;
+
+  if (device_pending.load(std::memory_order_acquire)) {
+    for (auto src: device_sources) {
+      if (!src->ready.exchange(false)) {
+        continue;
+      }
+      device_pending.fetch_sub(1, std::memory_order_relaxed);
+      if (src->is_timer) {
+        // missed expirations are merged into one callback
+        uint64_t expirations;
+        if (read(src->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+          perror("device timerfd read");
+        }
+      }
+      src->callback();
+      if (!src->removed) {
+        device_arm(src, EPOLL_CTL_MOD);
+      }
+    }
+  }
+}
 
 void init_device(void) {
 #ifdef SHOW_SCREEN
   init_sdl();
 #endif
+  console_init();
   //init_uart();
-  init_uart16550;
+  init_uart16550();
   init_sd();
 }
 
 void finish_device(void) {
+  console_finish();
 #ifdef SHOW_SCREEN
   finish_sdl();
 #endif
   //finish_uart();
-  finish_uart16550;
+  finish_uart16550();
   finish_sd();
 }
-
-void poll_event() {
-#ifdef SHOW_SCREEN
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        break; //set_abort();
-
-        // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
-      default: break;
-    }
-  }
-#endif
-}
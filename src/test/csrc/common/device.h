@@ -18,9 +18,29 @@
 #define __DEVICE_H__
 
 #include "common.h"
+#include <atomic>
+#include <functional>
 
 void init_device();
 void finish_device();
-void poll_event();
+
+// Device event scheduler. Devices register wall-clock timers, readable file descriptors or
+// simulation cycles, and device_poll() in the simulation loop runs only the callbacks whose
+// events are pending. Timers and file descriptors are watched by a single epoll thread.
+// The thread is not restarted in LightSSS children, which see the cycle events only.
+void device_add_timer(uint32_t interval_ms, std::function<void()> callback);
+void device_watch_fd(int fd, std::function<void()> callback);
+void device_unwatch_fd(int fd);
+void device_schedule(uint64_t cycle, std::function<void()> callback);
+
+extern std::atomic<uint32_t> device_pending;
+extern uint64_t device_next_cycle;
+void device_service(uint64_t cycle);
+
+static inline void device_poll(uint64_t cycle) {
+  if (device_pending.load(std::memory_order_relaxed) || cycle >= device_next_cycle) {
+    device_service(cycle);
+  }
+}
 
 #endif
@@ -123,6 +123,17 @@ public:
     }
   }
 
+  // write the covered points of this run, which are merged by tools/cover_merge.cpp
+  void dump_cover_file(const char *path) {
+    std::vector<CoverSection> sections;
+    for (auto cov: cover) {
+      cov->to_cover_sections(sections);
+    }
+    if (!cover_file_write(path, sections)) {
+      printf("Failed to write the coverage bitmaps to %s\n", path);
+    }
+  }
+
   void set_feedback_cover(const char *name) {
     for (auto cov: cover) {
       cov->update_is_feedback(name);
@@ -15,6 +15,9 @@
 
 #include "elfloader.h"
 #include <algorithm>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
 
 void ElfBinary::load() {
   assert(size >= sizeof(Elf64_Ehdr));
@@ -92,8 +95,56 @@ bool isElfFile(const char *filename) {
   return true;
 }
 
-long readFromElf(void *ptr, const char *file_name, long buf_size) {
-  auto elf_file = ElfBinaryFile(file_name);
+// segments mapped from the file should be large enough to be worth a VMA
+#define ELF_MAP_MIN_BYTES (1024 * 1024)
+// copies larger than this are split among threads
+#define ELF_PARALLEL_COPY_BYTES (64 * 1024 * 1024)
+
+static void elf_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  unsigned n_threads = std::min(std::thread::hardware_concurrency(), 8U);
+  if (n < ELF_PARALLEL_COPY_BYTES || n_threads < 2) {
+    std::memcpy(dst, src, n);
+    return;
+  }
+  std::vector<std::thread> threads;
+  size_t chunk = (n / n_threads + 4095) & ~4095UL;
+  for (size_t start = 0; start < n; start += chunk) {
+    size_t len = std::min(chunk, n - start);
+    threads.emplace_back([=]() { std::memcpy(dst + start, src + start, len); });
+  }
+  for (auto &t: threads) {
+    t.join();
+  }
+}
+
+// Map the whole pages of the section from the file, if the file offset and the destination
+// have the same alignment within a page. Returns the number of leading bytes to copy, and
+// sets [map_end, data_len) as the trailing bytes to copy.
+static size_t elf_map(int fd, uint8_t *dst, uint64_t file_offset, size_t data_len, size_t &map_end) {
+  const uint64_t page = sysconf(_SC_PAGESIZE);
+  map_end = 0;
+  if (fd < 0 || ((uintptr_t)dst - file_offset) % page != 0) {
+    return data_len;
+  }
+  size_t head = (page - (uintptr_t)dst % page) % page;
+  if (head >= data_len) {
+    return data_len;
+  }
+  size_t map_len = (data_len - head) & ~(page - 1);
+  if (map_len < ELF_MAP_MIN_BYTES) {
+    return data_len;
+  }
+  void *p = mmap(dst + head, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, file_offset + head);
+  if (p == MAP_FAILED) {
+    printf("Warning: Could not map the ELF segment, errno: %s\n", strerror(errno));
+    return data_len;
+  }
+  map_end = head + map_len;
+  return head;
+}
+
+long readFromElf(void *ptr, const char *file_name, long buf_size, bool zeroed, bool mappable) {
+  ElfBinaryFile elf_file(file_name);
 
   if (elf_file.sections.size() < 1) {
     printf("The requested elf '%s' contains zero sections\n", file_name);
@@ -109,20 +160,35 @@ long readFromElf(void *ptr, const char *file_name, long buf_size) {
         "It is likely that execution leads to unexpected behaviour.\n");
   }
 
+  int fd = mappable ? open(file_name, O_RDONLY) : -1;
   for (auto section: elf_file.sections) {
     auto len = section.data_len + section.zero_len;
     auto offset = section.data_dst - base_addr;
 
     if (offset + len > buf_size) {
       printf("The size (%ld bytes) of the section at address 0x%lx is larger than buf_size!\n", len, section.data_dst);
+      if (fd >= 0) {
+        close(fd);
+      }
       return -1;
     }
 
     printf("Loading %ld bytes at address 0x%lx at offset 0x%lx\n", len, section.data_dst, offset);
-    std::memset((uint8_t *)ptr + offset, 0, len);
-    std::memcpy((uint8_t *)ptr + offset, section.data_src, section.data_len);
+    uint8_t *dst = (uint8_t *)ptr + offset;
+    if (!zeroed) {
+      std::memset(dst + section.data_len, 0, section.zero_len);
+    }
+    size_t map_end;
+    size_t head = elf_map(fd, dst, section.data_src - elf_file.raw, section.data_len, map_end);
+    elf_copy(dst, section.data_src, head);
+    if (map_end) {
+      elf_copy(dst + map_end, section.data_src + map_end, section.data_len - map_end);
+    }
     len_written += len;
   }
+  if (fd >= 0) {
+    close(fd);
+  }
   // Since we are unpacking the sections, the total amount of bytes is the last
   // section offset plus its size.
   auto last_section = elf_file.sections.back();
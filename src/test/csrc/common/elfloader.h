@@ -178,6 +178,9 @@ struct ElfBinaryFile : public ElfBinary {
 bool isElfFile(const char *filename);
 // load binary content at `file_name` into ptr. Returns the number of bytes
 // written.
-long readFromElf(void *ptr, const char *file_name, long buf_size);
+// If zeroed, ptr is known to be zero, e.g. fresh from mmap, and the bss is not cleared.
+// If mappable, ptr is a private anonymous mapping, and page-aligned parts of the segments
+// are mapped from the file with MAP_PRIVATE | MAP_FIXED instead of being copied.
+long readFromElf(void *ptr, const char *file_name, long buf_size, bool zeroed = false, bool mappable = false);
 
 #endif // __ELFLOADER_H
@@ -16,6 +16,8 @@
 
 #include "flash.h"
 #include "common.h"
+#include <fcntl.h>
+#include <sys/stat.h>
 #ifdef CONFIG_DIFFTEST_PERFCNT
 #include "perf.h"
 #endif // CONFIG_DIFFTEST_PERFCNT
@@ -46,6 +48,23 @@ void flash_read(uint32_t addr, uint64_t *data) {
   }
 }
 
+void flash_read_line(uint32_t addr, uint64_t *data) {
+#ifdef CONFIG_DIFFTEST_PERFCNT
+  difftest_calls[perf_flash_read_line]++;
+  difftest_bytes[perf_flash_read_line] += 4 + FLASH_LINE_BYTES;
+#endif // CONFIG_DIFFTEST_PERFCNT
+  if (!flash_dev.base) {
+    return;
+  }
+  uint64_t offset = addr & ~(FLASH_LINE_BYTES - 1UL);
+  if (offset + FLASH_LINE_BYTES > flash_dev.size) {
+    printf("[warning] read addr %x is out of bound\n", addr);
+    memset(data, 0, FLASH_LINE_BYTES);
+  } else {
+    memcpy(data, (uint8_t *)flash_dev.base + offset, FLASH_LINE_BYTES);
+  }
+}
+
 void init_flash(const char *flash_bin) {
   flash_dev.base = (uint64_t *)mmap(NULL, flash_dev.size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
   if (flash_dev.base == (uint64_t *)MAP_FAILED) {
@@ -73,23 +92,32 @@ void init_flash(const char *flash_bin) {
   flash_dev.img_path = (char *)flash_bin;
   Info("use %s as flash bin\n", flash_dev.img_path);
 
-  FILE *flash_fp = fopen(flash_dev.img_path, "r");
-  if (!flash_fp) {
+  int flash_fd = open(flash_dev.img_path, O_RDONLY);
+  struct stat st;
+  if (flash_fd < 0 || fstat(flash_fd, &st) < 0) {
     eprintf(ANSI_COLOR_MAGENTA "[error] flash img not found\n");
     exit(1);
   }
 
-  fseek(flash_fp, 0, SEEK_END);
-  flash_dev.img_size = ftell(flash_fp);
+  flash_dev.img_size = st.st_size;
   if (flash_dev.img_size > flash_dev.size) {
     printf("[warning] flash image size %ld bytes is out of bound, cut the image into %ld bytes\n", flash_dev.img_size,
            flash_dev.size);
     flash_dev.img_size = flash_dev.size;
   }
-  fseek(flash_fp, 0, SEEK_SET);
-  int ret = fread(flash_dev.base, flash_dev.img_size, 1, flash_fp);
-  assert(ret == 1);
-  fclose(flash_fp);
+  // The image is mapped privately over the flash, so that parallel jobs share its pages in the page cache.
+  // Pages written by FlashWrite() of xspdb become private copies. The rest of the last page reads as zeros.
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t map_size = (flash_dev.img_size + page_size - 1) & ~(page_size - 1);
+  void *image = MAP_FAILED;
+  if (map_size && map_size <= flash_dev.size) {
+    image = mmap(flash_dev.base, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, flash_fd, 0);
+  }
+  if (image == MAP_FAILED) {
+    ssize_t ret = pread(flash_fd, flash_dev.base, flash_dev.img_size, 0);
+    assert(ret == (ssize_t)flash_dev.img_size);
+  }
+  close(flash_fd);
 }
 
 void flash_finish() {
@@ -32,4 +32,8 @@ void init_flash(const char *flash_bin);
 void flash_finish();
 
 extern "C" void flash_read(uint32_t addr, uint64_t *data);
+// Read the line at addr into data[FLASH_LINE_BYTES / 8], in one call for the whole line.
+// data is the bit[511:0] output of the DPI-C function.
+#define FLASH_LINE_BYTES 64
+extern "C" void flash_read_line(uint32_t addr, uint64_t *data);
 #endif // __FLASH_H
@@ -0,0 +1,162 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __FLATSET_H__
+#define __FLATSET_H__
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Open-addressing set of aligned addresses with linear probing and backward-shift erase
+class FlatAddrSet {
+public:
+  FlatAddrSet() : slots(16, EMPTY) {}
+  inline bool contains(uint64_t addr) const {
+    return slots[find(addr)] == addr;
+  }
+  void insert(uint64_t addr) {
+    size_t i = find(addr);
+    if (slots[i] == addr) {
+      return;
+    }
+    slots[i] = addr;
+    if (++count * 2 > slots.size()) {
+      rehash(slots.size() * 2);
+    }
+  }
+  // returns whether addr was in the set
+  bool erase(uint64_t addr) {
+    size_t i = find(addr);
+    if (slots[i] != addr) {
+      return false;
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t j = (i + 1) & mask; slots[j] != EMPTY; j = (j + 1) & mask) {
+      size_t k = home(slots[j]);
+      // move slots[j] back unless its home lies cyclically in (i, j]
+      if ((j > i) ? (k <= i || k > j) : (k <= i && k > j)) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i] = EMPTY;
+    count--;
+    return true;
+  }
+  inline size_t size() const {
+    return count;
+  }
+  void clear() {
+    if (count) {
+      std::fill(slots.begin(), slots.end(), EMPTY);
+      count = 0;
+    }
+  }
+
+private:
+  enum : uint64_t { EMPTY = UINT64_MAX }; // never an aligned address
+  std::vector<uint64_t> slots;
+  size_t count = 0;
+
+  inline size_t home(uint64_t addr) const {
+    return (addr * 0x9e3779b97f4a7c15UL >> 32) & (slots.size() - 1);
+  }
+  // the slot of addr, or the empty slot where it would be inserted
+  inline size_t find(uint64_t addr) const {
+    size_t mask = slots.size() - 1;
+    size_t i = home(addr);
+    while (slots[i] != EMPTY && slots[i] != addr) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+  void rehash(size_t size) {
+    std::vector<uint64_t> old(size, EMPTY);
+    old.swap(slots);
+    for (uint64_t addr: old) {
+      if (addr != EMPTY) {
+        slots[find(addr)] = addr;
+      }
+    }
+  }
+};
+
+// Open-addressing map from addresses to values with linear probing. Entries are never erased.
+template <typename T> class FlatAddrMap {
+public:
+  FlatAddrMap() : keys(16, EMPTY), values(16) {}
+  // the value of addr, or nullptr if it is not in the map
+  inline T *get(uint64_t addr) {
+    size_t i = find(addr);
+    return keys[i] == addr ? &values[i] : nullptr;
+  }
+  T &insert(uint64_t addr, const T &value) {
+    size_t i = find(addr);
+    if (keys[i] != addr) {
+      keys[i] = addr;
+      values[i] = value;
+      if (++count * 2 > keys.size()) {
+        rehash(keys.size() * 2);
+        i = find(addr);
+      }
+    }
+    return values[i];
+  }
+  inline size_t size() const {
+    return count;
+  }
+  template <typename F> void for_each(F func) const {
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (keys[i] != EMPTY) {
+        func(keys[i], values[i]);
+      }
+    }
+  }
+
+private:
+  enum : uint64_t { EMPTY = UINT64_MAX };
+  std::vector<uint64_t> keys;
+  std::vector<T> values;
+  size_t count = 0;
+
+  inline size_t home(uint64_t addr) const {
+    return (addr * 0x9e3779b97f4a7c15UL >> 32) & (keys.size() - 1);
+  }
+  inline size_t find(uint64_t addr) const {
+    size_t mask = keys.size() - 1;
+    size_t i = home(addr);
+    while (keys[i] != EMPTY && keys[i] != addr) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+  void rehash(size_t size) {
+    std::vector<uint64_t> old_keys(size, EMPTY);
+    std::vector<T> old_values(size);
+    old_keys.swap(keys);
+    old_values.swap(values);
+    for (size_t i = 0; i < old_keys.size(); i++) {
+      if (old_keys[i] != EMPTY) {
+        size_t j = find(old_keys[i]);
+        keys[j] = old_keys[i];
+        values[j] = old_values[i];
+      }
+    }
+  }
+};
+
+#endif // __FLATSET_H__
@@ -0,0 +1,149 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "hugepage.h"
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+enum HugePageMode { HUGEPAGE_OFF, HUGEPAGE_THP, HUGEPAGE_HUGETLB, HUGEPAGE_UNKNOWN };
+enum HugePageBacking { BACKING_HUGETLB, BACKING_THP, BACKING_SMALL, BACKING_NUM };
+
+static std::atomic<int> hugepage_mode(HUGEPAGE_UNKNOWN);
+static std::atomic<size_t> backing_bytes[BACKING_NUM];
+static std::atomic<size_t> backing_regions[BACKING_NUM];
+
+static HugePageMode get_mode() {
+  int mode = hugepage_mode.load(std::memory_order_relaxed);
+  if (mode == HUGEPAGE_UNKNOWN) {
+    const char *env = getenv("DIFFTEST_HUGEPAGE");
+    mode = HUGEPAGE_THP;
+    if (env != NULL) {
+      if (!strcmp(env, "off")) {
+        mode = HUGEPAGE_OFF;
+      } else if (!strcmp(env, "hugetlb")) {
+        mode = HUGEPAGE_HUGETLB;
+      } else if (strcmp(env, "thp")) {
+        printf("Warning: unknown DIFFTEST_HUGEPAGE=%s, using thp\n", env);
+      }
+    }
+    hugepage_mode.store(mode, std::memory_order_relaxed);
+  }
+  return (HugePageMode)mode;
+}
+
+static void *account(void *addr, size_t size, HugePageBacking backing) {
+  if (addr != MAP_FAILED) {
+    backing_bytes[backing] += size;
+    backing_regions[backing]++;
+  }
+  return addr;
+}
+
+void *huge_mmap(size_t size, bool allow_hugetlb) {
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_ANON | MAP_PRIVATE | MAP_NORESERVE;
+  HugePageMode mode = get_mode();
+  // regions smaller than a huge page are not worth a whole one
+  if (mode == HUGEPAGE_OFF || size < HUGE_PAGE_SIZE) {
+    return account(mmap(NULL, size, prot, flags, -1, 0), size, BACKING_SMALL);
+  }
+
+#ifdef MAP_HUGETLB
+  // munmap() of a hugetlb region takes whole huge pages, so only sizes in whole pages are mapped this way
+  if (mode == HUGEPAGE_HUGETLB && allow_hugetlb && size % HUGE_PAGE_SIZE == 0) {
+    void *addr = mmap(NULL, size, prot, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+      return account(addr, size, BACKING_HUGETLB);
+    }
+  }
+#endif // MAP_HUGETLB
+
+  // Align the region to a huge page, so that none of it is left to the small pages at both ends
+  uint8_t *raw = (uint8_t *)mmap(NULL, size + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+  if (raw == (uint8_t *)MAP_FAILED) {
+    return account(mmap(NULL, size, prot, flags, -1, 0), size, BACKING_SMALL);
+  }
+  uint8_t *addr = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+  if (addr > raw) {
+    munmap(raw, addr - raw);
+  }
+  size_t tail = raw + size + HUGE_PAGE_SIZE - (addr + size);
+  if (tail) {
+    munmap(addr + size, tail);
+  }
+#ifdef MADV_HUGEPAGE
+  if (madvise(addr, size, MADV_HUGEPAGE) == 0) {
+    return account(addr, size, BACKING_THP);
+  }
+#endif // MADV_HUGEPAGE
+  return account(addr, size, BACKING_SMALL);
+}
+
+void huge_munmap(void *addr, size_t size) {
+  if (addr != NULL && addr != MAP_FAILED) {
+    munmap(addr, size);
+  }
+}
+
+void huge_advise(void *addr, size_t size) {
+#ifdef MADV_HUGEPAGE
+  if (get_mode() != HUGEPAGE_OFF && size >= HUGE_PAGE_SIZE) {
+    madvise(addr, size, MADV_HUGEPAGE);
+  }
+#endif // MADV_HUGEPAGE
+}
+
+static long anon_huge_pages_kb() {
+  FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  char line[128];
+  long kb = -1;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(fp);
+  return kb;
+}
+
+void hugepage_display_stats() {
+  static const char *names[BACKING_NUM] = {"hugetlb", "thp", "4KB"};
+  bool any = false;
+  for (int i = 0; i < BACKING_NUM; i++) {
+    any |= backing_regions[i] != 0;
+  }
+  if (!any) {
+    return;
+  }
+  printf("Huge pages:");
+  for (int i = 0; i < BACKING_NUM; i++) {
+    printf(" %s %luMB in %lu regions%s", names[i], backing_bytes[i].load() >> 20, backing_regions[i].load(),
+           i == BACKING_NUM - 1 ? "" : ",");
+  }
+  long kb = anon_huge_pages_kb();
+  if (kb >= 0) {
+    printf(", %ldMB AnonHugePages in use", kb >> 10);
+  }
+  printf("\n");
+}
@@ -0,0 +1,44 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __HUGEPAGE_H__
+#define __HUGEPAGE_H__
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+// Anonymous regions backed by huge pages, to reduce the TLB misses on the large buffers
+// (simulated RAM, golden memory, snapshots and the DiffState pools).
+// The mode is taken from DIFFTEST_HUGEPAGE:
+//   off     - 4 KB pages, as a plain anonymous mmap
+//   thp     - transparent huge pages through madvise(MADV_HUGEPAGE) (default)
+//   hugetlb - MAP_HUGETLB from the reserved pool (vm.nr_hugepages), falling back to thp
+// THP makes a touched page of a sparse region resident as a whole 2 MB page, so the RSS of
+// the simulated RAM grows with the spread of the accesses rather than with their number.
+
+// Map size bytes of zero-filled memory without reserving swap. Return MAP_FAILED on failure, like mmap.
+// Hugetlb pages are reserved at mmap, so that a short pool falls back here instead of failing at a later fault.
+// A hugetlb region cannot be partly replaced by MAP_FIXED mappings or dropped with MADV_DONTNEED in 4 KB pages,
+// so regions used that way must be mapped without allow_hugetlb.
+void *huge_mmap(size_t size, bool allow_hugetlb = true);
+void huge_munmap(void *addr, size_t size);
+// Advise huge pages again for [addr, addr + size) after it is replaced by a MAP_FIXED mapping
+void huge_advise(void *addr, size_t size);
+
+// Bytes and regions per backing, and the AnonHugePages actually in use
+void hugepage_display_stats();
+
+#endif // __HUGEPAGE_H__
@@ -61,25 +61,29 @@ static const uint32_t keymap[256] = {
 
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN];
-static int key_f = 0, key_r = 0;
+// keys are sent by the render thread of the screen
+static std::atomic<int> key_f(0), key_r(0);
 
 #define KEYDOWN_MASK 0x8000
 
 void send_key(uint8_t scancode, bool is_keydown) {
   if (keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
-    key_queue[key_r] = am_scancode;
-    key_r = (key_r + 1) % KEY_QUEUE_LEN;
+    int r = key_r.load(std::memory_order_relaxed);
+    key_queue[r] = am_scancode;
+    r = (r + 1) % KEY_QUEUE_LEN;
     // detect key queue overflow
-    assert(key_r != key_f);
+    assert(r != key_f.load(std::memory_order_acquire));
+    key_r.store(r, std::memory_order_release);
   }
 }
 
 uint32_t read_key(void) {
   uint32_t key = _KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+  int f = key_f.load(std::memory_order_relaxed);
+  if (f != key_r.load(std::memory_order_acquire)) {
+    key = key_queue[f];
+    key_f.store((f + 1) % KEY_QUEUE_LEN, std::memory_order_release);
   }
   return key;
 }
@@ -1,4 +1,7 @@
 #include "lightsss.h"
+#include <algorithm>
+#include <sys/resource.h>
+#include <time.h>
 
 ForkShareMemory::ForkShareMemory() {
   if ((key_n = ftok(".", 's') < 0)) {
@@ -45,16 +48,105 @@ void ForkShareMemory::shwait() {
   }
 }
 
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static uint64_t minor_faults() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+// Private (COW-diverged) memory of a process, or 0 if it is unknown
+static uint64_t private_memory(pid_t pid) {
+  char path[64], line[256];
+  snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return 0;
+  }
+  uint64_t total = 0, kb;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "Private_Clean: %lu kB", &kb) == 1 || sscanf(line, "Private_Dirty: %lu kB", &kb) == 1) {
+      total += kb * 1024;
+    }
+  }
+  fclose(fp);
+  return total;
+}
+
+void LightSSS::kill_slot(size_t index) {
+  pid_t temp = pidSlot[index].pid;
+  pidSlot.erase(pidSlot.begin() + index);
+  kill(temp, SIGKILL);
+  waitpid(temp, NULL, 0);
+  slotCnt--;
+}
+
+size_t LightSSS::select_victim() {
+  size_t n = pidSlot.size();
+  if (policy == FORK_POLICY_OLDEST || n < 3) {
+    return n - 1;
+  }
+  // Kill the one whose neighbors are the closest relative to its age. The newest and the oldest are kept.
+  uint32_t now = uptime();
+  size_t victim = n - 1;
+  double min_cost = 0;
+  for (size_t i = 1; i + 1 < n; i++) {
+    double gap = pidSlot[i - 1].time - pidSlot[i + 1].time;
+    double cost = gap / (now - pidSlot[i].time + 1);
+    if (victim == n - 1 || cost < min_cost) {
+      victim = i;
+      min_cost = cost;
+    }
+  }
+  return victim;
+}
+
+// Kill the oldest checkpoints until their private memory fits the budget. The newest is always kept.
+void LightSSS::check_mem_budget() {
+  while (memBudget && pidSlot.size() > 1) {
+    uint64_t total = 0;
+    for (auto &slot: pidSlot) {
+      total += private_memory(slot.pid);
+    }
+    if (total <= memBudget) {
+      break;
+    }
+    FORK_PRINTF("checkpoints use %lu MB private memory, more than the budget %lu MB\n", total >> 20, memBudget >> 20)
+    kill_slot(pidSlot.size() - 1);
+  }
+}
+
+bool LightSSS::fork_due(uint64_t cycles) {
+  if (cycles - lastForkCycles < targetCycles) {
+    return false;
+  }
+  uint64_t now = monotonic_ns();
+  if (nextForkNs == 0) {
+    // the faults of the last checkpoint are still growing, so those of the one before are also a lower bound
+    uint64_t faults = std::max(minor_faults() - lastForkFaults, forkFaults.load(std::memory_order_relaxed));
+    uint64_t cost = forkNs.load(std::memory_order_relaxed) + faults * LIGHTSSS_FAULT_NS;
+    nextForkNs = lastForkNs + cost * 100 / LIGHTSSS_MAX_OVERHEAD;
+  }
+  if (now < nextForkNs) {
+    return false;
+  }
+  lastForkCycles = cycles;
+  return true;
+}
+
 int LightSSS::do_fork() {
-  //kill the oldest blocked checkpoint process
-  if (slotCnt == SLOT_SIZE) {
-    pid_t temp = pidSlot.back();
-    pidSlot.pop_back();
-    kill(temp, SIGKILL);
-    int status = 0;
-    waitpid(temp, NULL, 0);
-    slotCnt--;
+  uint64_t start = monotonic_ns();
+  uint64_t faults = minor_faults();
+  //kill a blocked checkpoint process
+  if (slotCnt == maxSlot) {
+    kill_slot(select_victim());
   }
+  check_mem_budget();
   // fork a new checkpoint process and block it
   if ((pid = fork()) < 0) {
     eprintf("[%d]Error: could not fork process!\n", getpid());
@@ -63,7 +155,15 @@ int LightSSS::do_fork() {
   // the original process
   else if (pid != 0) {
     slotCnt++;
-    pidSlot.push_front(pid);
+    pidSlot.push_front({pid, uptime()});
+    uint64_t end = monotonic_ns();
+    forkNs.store(end - start, std::memory_order_relaxed);
+    // the faults before the first fork are taken by loading the workload
+    forkFaults.store(lastForkNs ? faults - lastForkFaults : 0, std::memory_order_relaxed);
+    forkIntervalMs.store(lastForkNs ? (start - lastForkNs) / 1000000 : 0, std::memory_order_relaxed);
+    lastForkNs = end;
+    lastForkFaults = minor_faults();
+    nextForkNs = 0;
     return FORK_OK;
   }
   // for the fork child
@@ -80,23 +180,23 @@ int LightSSS::do_fork() {
 
 int LightSSS::wakeup_child(uint64_t cycles) {
   forkshm.info->endCycles = cycles;
-  forkshm.info->oldest = pidSlot.back();
+  forkshm.info->oldest = pidSlot.back().pid;
 
   // only the oldest is wantted, so kill others by parent process.
-  for (auto pid: pidSlot) {
-    if (pid != forkshm.info->oldest) {
-      kill(pid, SIGKILL);
-      waitpid(pid, NULL, 0);
+  for (auto &slot: pidSlot) {
+    if (slot.pid != forkshm.info->oldest) {
+      kill(slot.pid, SIGKILL);
+      waitpid(slot.pid, NULL, 0);
     }
   }
   // flush before wake up child.
-  fflush(stdout);
+  asynclog_flush();
   fflush(stderr);
 
   forkshm.info->notgood = true;
   forkshm.info->flag = true;
   int status = -1;
-  waitpid(pidSlot.back(), &status, 0);
+  waitpid(pidSlot.back().pid, &status, 0);
   return 0;
 }
 
@@ -107,11 +207,7 @@ bool LightSSS::is_child() {
 int LightSSS::do_clear() {
   FORK_PRINTF("clear processes...\n")
   while (!pidSlot.empty()) {
-    pid_t temp = pidSlot.back();
-    pidSlot.pop_back();
-    kill(temp, SIGKILL);
-    waitpid(temp, NULL, 0);
-    slotCnt--;
+    kill_slot(pidSlot.size() - 1);
   }
   return 0;
 }
@@ -18,6 +18,7 @@
 #define __LIGHTSSS_H
 
 #include "common.h"
+#include <atomic>
 #include <deque>
 #include <list>
 #include <signal.h>
@@ -52,16 +53,53 @@ const int FORK_OK = 0;
 const int FORK_ERROR = 1;
 const int FORK_CHILD = 2;
 
+// How to choose the checkpoint process to kill when all slots are used
+enum ForkPolicy {
+  FORK_POLICY_OLDEST,    // kill the oldest, so checkpoints are evenly spaced
+  FORK_POLICY_GEOMETRIC, // keep the spacing of checkpoints growing with their ages
+};
+
 class LightSSS {
+  struct ForkSlot {
+    pid_t pid;
+    uint32_t time; // uptime() when forked
+  };
   pid_t pid = -1;
   int slotCnt = 0;
   int waitProcess = 0;
+  int maxSlot;
+  ForkPolicy policy;
+  uint64_t memBudget; // bytes of private memory of all checkpoint processes, 0 for unlimited
   // front() is the newest. back() is the oldest.
-  std::deque<pid_t> pidSlot = {};
+  std::deque<ForkSlot> pidSlot = {};
   ForkShareMemory forkshm;
 
+  void kill_slot(size_t index);
+  size_t select_victim();
+  void check_mem_budget();
+
+  // adaptive interval, see fork_due()
+  uint64_t targetCycles = 0;
+  uint64_t lastForkCycles = 0;
+  uint64_t lastForkNs = 0;
+  uint64_t lastForkFaults = 0;
+  uint64_t nextForkNs = 0; // 0 until targetCycles is reached
+
 public:
+  // cost of the checkpoints, also sampled by telemetry
+  std::atomic<uint64_t> forkNs{0};         // time of the last do_fork() in the parent
+  std::atomic<uint64_t> forkFaults{0};     // page faults of the parent between the last two forks
+  std::atomic<uint64_t> forkIntervalMs{0}; // time between the last two forks
+
+  LightSSS(int maxSlot = SLOT_SIZE, ForkPolicy policy = FORK_POLICY_OLDEST, uint64_t memBudget = 0)
+      : maxSlot(maxSlot), policy(policy), memBudget(memBudget) {}
   int do_fork();
+  // Fork every target cycles, but no more often than keeps the measured cost of a checkpoint (the time in
+  // do_fork() and the copy-on-write faults of the parent after it) under LIGHTSSS_MAX_OVERHEAD percent
+  void set_target_cycles(uint64_t cycles) {
+    targetCycles = cycles;
+  }
+  bool fork_due(uint64_t cycles);
   int wakeup_child(uint64_t cycles);
   bool is_child();
   int do_clear();
@@ -73,7 +111,9 @@ public:
 #define FORK_PRINTF(format, args...)                       \
   do {                                                     \
     Info("[FORK_INFO pid(%d)] " format, getpid(), ##args); \
-    fflush(stdout);                                        \
+    if (!asynclog_active()) {                              \
+      fflush(stdout);                                      \
+    }                                                      \
   } while (0);
 
 #endif
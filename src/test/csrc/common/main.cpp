@@ -16,6 +16,7 @@
 
 #include "common.h"
 #include "dut.h"
+#include "workload.h"
 
 #if defined(VERILATOR) || defined(GSIM)
 #include "emu.h"
@@ -32,7 +33,7 @@ int sim_main(int argc, const char *argv[]) {
   stats.reset();
 
 #else
-int main(int argc, const char *argv[]) {
+static int emu_main(int argc, const char *argv[]) {
 #endif // FUZZER_LIB
   common_init_without_assertion(argv[0]);
 
@@ -70,4 +71,15 @@ int main(int argc, const char *argv[]) {
 #endif // FUZZER_LIB
 #endif // FUZZING && !FUZZER_LIB
 }
+
+#ifndef FUZZER_LIB
+int main(int argc, const char *argv[]) {
+  int jobs = 1;
+  const char *workload_list = workload_parse_args(argc, argv, jobs);
+  if (workload_list) {
+    return workload_run(workload_list, jobs, argc, argv, emu_main) != 0;
+  }
+  return emu_main(argc, argv);
+}
+#endif // FUZZER_LIB
 #endif // DUT_MODEL
@@ -14,6 +14,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 #include "mpool.h"
+#include "spinwait.h"
 #include <thread>
 
 void MemoryPool::init_memory_pool() {
@@ -183,3 +184,64 @@ bool MemoryIdxPool::check_group() {
   bool result = (group_w_idx.load() > group_r_idx.load()) ? true : false;
   return result;
 }
+
+MemoryRing::MemoryRing(uint64_t chunk_size, size_t num_chunks) : chunk_size(mempool_page_align(chunk_size)) {
+  capacity = 1;
+  while (capacity < num_chunks) {
+    capacity <<= 1;
+  }
+  mask = capacity - 1;
+  void *base = huge_mmap(capacity * this->chunk_size);
+  if (base == MAP_FAILED) {
+    throw std::runtime_error("Failed to allocate large aligned memory block");
+  }
+  affinity_bind_memory(base, capacity * this->chunk_size);
+  memset(base, 0, capacity * this->chunk_size);
+  memory_base = static_cast<char *>(base);
+  chunk_seq = new PaddedCounter[capacity];
+}
+
+MemoryRing::~MemoryRing() {
+  delete[] chunk_seq;
+  huge_munmap(memory_base, capacity * chunk_size);
+}
+
+uint64_t MemoryRing::acquire_free(size_t n) {
+  uint64_t ticket = claim_head.value.fetch_add(n, std::memory_order_relaxed);
+  int spin = 0;
+  while (ticket + n - free_tail.value.load(std::memory_order_acquire) > capacity) {
+    if (stopped.load(std::memory_order_relaxed)) {
+      return RING_STOPPED;
+    }
+    difftest_spin_wait(spin);
+  }
+  return ticket;
+}
+
+void MemoryRing::set_busy(uint64_t ticket) {
+  chunk_seq[ticket & mask].value.store(ticket + 1, std::memory_order_release);
+}
+
+uint64_t MemoryRing::acquire_busy(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint64_t ticket = read_head + i;
+    int spin = 0;
+    while (chunk_seq[ticket & mask].value.load(std::memory_order_acquire) != ticket + 1) {
+      if (stopped.load(std::memory_order_relaxed)) {
+        return RING_STOPPED;
+      }
+      difftest_spin_wait(spin);
+    }
+  }
+  uint64_t ticket = read_head;
+  read_head += n;
+  return ticket;
+}
+
+void MemoryRing::release(size_t n) {
+  free_tail.value.store(free_tail.value.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+void MemoryRing::stop() {
+  stopped.store(true, std::memory_order_relaxed);
+}
@@ -16,8 +16,10 @@
 #ifndef __MPOOL_H__
 #define __MPOOL_H__
 
+#include "affinity.h"
 #include "common.h"
 #include "diffstate.h"
+#include "hugepage.h"
 #include <atomic>
 #include <condition_variable>
 #include <functional>
@@ -33,6 +35,12 @@
 #define REM_NUM_BLOCKS  (NUM_BLOCKS - 1)
 #define MAX_WINDOW_SIZE 256
 
+// XDMA copies C2H data into the pinned pages of the user buffer passed to read().
+// Starting every chunk at a page boundary lets one packet map to the fewest descriptors.
+static inline uint64_t mempool_page_align(uint64_t size) {
+  return (size + MEMBLOCK_SIZE - 1) / MEMBLOCK_SIZE * MEMBLOCK_SIZE;
+}
+
 class MemoryChunk {
 public:
   std::atomic<size_t> memblock_idx;
@@ -151,12 +159,13 @@ private:
   uint64_t mem_block_size = MEMBLOCK_SIZE;
 
 public:
-  MemoryIdxPool(uint64_t block_size) : mem_block_size(block_size) {
+  MemoryIdxPool(uint64_t block_size) : mem_block_size(mempool_page_align(block_size)) {
     size_t total_size = NUM_BLOCKS * mem_block_size;
-    void *base = nullptr;
-    if (posix_memalign(&base, 4096, total_size) != 0) {
+    void *base = huge_mmap(total_size);
+    if (base == MAP_FAILED) {
       throw std::runtime_error("Failed to allocate large aligned memory block");
     }
+    affinity_bind_memory(base, total_size);
     memset(base, 0, total_size);
     memory_base = static_cast<char *>(base);
     for (size_t i = 0; i < NUM_BLOCKS; ++i) {
@@ -167,7 +176,9 @@ public:
 
     printf("MemoryIdxPool using contiguous memory block\n");
   }
-  ~MemoryIdxPool() {}
+  ~MemoryIdxPool() {
+    huge_munmap(memory_base, NUM_BLOCKS * mem_block_size);
+  }
 
   // Get free block pointer increment is returned from the heap
   char *get_free_chunk(size_t *mem_idx);
@@ -190,6 +201,10 @@ public:
   bool check_group();
   // Wait mempool have data
   void wait_mempool_start();
+  // Number of groups holding data, for telemetry
+  inline size_t busy_count() {
+    return MAX_GROUP_READ - empty_blocks.load(std::memory_order_relaxed);
+  }
 
 private:
   char *memory_base = nullptr;
@@ -212,4 +227,52 @@ private:
   std::atomic<size_t> group_r_idx{1};
 };
 
+// Lock-free ring of memory chunks for multiple producers and a single consumer.
+// Producers claim chunks in batches with one atomic, then publish every chunk after it is filled.
+// The consumer reads chunks in the order they are claimed and frees them in batches.
+// Counters of producers and the consumer are padded to separate cache lines.
+class MemoryRing {
+public:
+  static const uint64_t RING_STOPPED = UINT64_MAX;
+
+  MemoryRing(uint64_t chunk_size, size_t num_chunks = NUM_BLOCKS);
+  ~MemoryRing();
+  MemoryRing(const MemoryRing &) = delete;
+  MemoryRing &operator=(const MemoryRing &) = delete;
+
+  // Claim n free chunks, and return the ticket of the first one (RING_STOPPED after stop)
+  uint64_t acquire_free(size_t n = 1);
+  // Mark the chunk of ticket filled and readable
+  void set_busy(uint64_t ticket);
+  // Wait for the next n filled chunks, and return the ticket of the first one (RING_STOPPED after stop)
+  uint64_t acquire_busy(size_t n = 1);
+  // Free the oldest n chunks returned by acquire_busy
+  void release(size_t n = 1);
+  // Wake up all waiting producers and the consumer
+  void stop();
+
+  inline char *get_chunk(uint64_t ticket) {
+    return memory_base + (ticket & mask) * chunk_size;
+  }
+  // Number of chunks claimed but not freed yet, for telemetry
+  inline size_t busy_count() {
+    return claim_head.value.load(std::memory_order_relaxed) - free_tail.value.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct alignas(64) PaddedCounter {
+    std::atomic<uint64_t> value{0};
+  };
+
+  char *memory_base = nullptr;
+  uint64_t chunk_size;
+  size_t capacity;
+  size_t mask;
+  PaddedCounter *chunk_seq; // ticket + 1 when the chunk is filled
+  PaddedCounter claim_head; // next ticket for producers
+  PaddedCounter free_tail;  // # of chunks freed by the consumer
+  uint64_t read_head = 0;   // next ticket for the consumer
+  std::atomic<bool> stopped{false};
+};
+
 #endif
@@ -19,6 +19,7 @@
 
 long long perf_run_msec = 0;
 long long difftest_calls[DIFFTEST_PERF_NUM] = {0}, difftest_bytes[DIFFTEST_PERF_NUM] = {0};
+long long batch_unpack_ns = 0, batch_unpack_bytes = 0;
 
 void difftest_perfcnt_init() {
   struct timespec ts;
@@ -28,6 +29,8 @@ void difftest_perfcnt_init() {
     difftest_calls[i] = 0;
     difftest_bytes[i] = 0;
   }
+  batch_unpack_ns = 0;
+  batch_unpack_bytes = 0;
   diffstate_perfcnt_init();
 }
 
@@ -42,10 +45,14 @@ void difftest_perfcnt_finish(uint64_t cycleCnt) {
   printf("%30s %15s %17s %16s %18s\n", "DPIC_FUNC", "DPIC_CALLS", "DPIC_CALLS/s", "DPIC_BYTES", "DPIC_BYTES/s");
   printf(">>> DiffState Func\n");
   diffstate_perfcnt_finish(perf_run_msec);
+  if (batch_unpack_ns > 0) {
+    printf("Batch unpack: %lld bytes in %lld us, %.2f MB/s\n", batch_unpack_bytes, batch_unpack_ns / 1000,
+           batch_unpack_bytes * 1000.0 / batch_unpack_ns);
+  }
   printf(">>> Other Difftest Func\n");
   const char *func_name[DIFFTEST_PERF_NUM] = {
-    "difftest_nstep", "difftest_ram_read", "difftest_ram_write", "flash_read", "sd_set_addr", "sd_read",
-    "jtag_tick",      "put_pixel",         "vmem_sync",          "pte_helper", "amo_helper",
+    "difftest_nstep", "difftest_ram_read", "difftest_ram_write", "flash_read", "flash_read_line", "sd_set_addr",
+    "sd_read",        "jtag_tick",         "put_pixel",          "vmem_sync",  "pte_helper",      "amo_helper",
   };
   for (int i = 0; i < DIFFTEST_PERF_NUM; i++) {
     difftest_perfcnt_print(func_name[i], difftest_calls[i], difftest_bytes[i], perf_run_msec);
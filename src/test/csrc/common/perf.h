@@ -17,6 +17,7 @@
 #define __PERF_H__
 
 #include "common.h"
+#include <time.h>
 
 #ifdef CONFIG_DIFFTEST_PERFCNT
 static inline void difftest_perfcnt_print(const char *name, long long calls, long long bytes, long long msec) {
@@ -26,11 +27,19 @@ static inline void difftest_perfcnt_print(const char *name, long long calls, lon
 }
 void difftest_perfcnt_init();
 void difftest_perfcnt_finish(uint64_t cycleCnt);
+static inline uint64_t difftest_perfcnt_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+// time and bytes of unpacking batches into the DiffState buffers
+extern long long batch_unpack_ns, batch_unpack_bytes;
 enum DIFFTEST_PERF {
   perf_difftest_nstep,
   perf_difftest_ram_read,
   perf_difftest_ram_write,
   perf_flash_read,
+  perf_flash_read_line,
   perf_sd_set_addr,
   perf_sd_read,
   perf_jtag_tick,
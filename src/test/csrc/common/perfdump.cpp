@@ -0,0 +1,232 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "perfdump.h"
+#include "affinity.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef CONFIG_DIFFTEST_PERFDUMP
+static const int num_counters = perfdump_num_counters;
+#else
+static const int num_counters = 0;
+#endif // CONFIG_DIFFTEST_PERFDUMP
+
+// Rows of one tag, stored column by column
+struct PerfDumpBlock {
+  uint32_t tag;
+  int columns;
+  int rows;
+  std::vector<uint64_t> values;
+  PerfDumpBlock(uint32_t tag, int columns) : tag(tag), columns(columns), rows(0), values(columns * PERFDUMP_BLOCK_ROWS) {}
+  bool full() const {
+    return rows == PERFDUMP_BLOCK_ROWS;
+  }
+  uint64_t &at(int column, int row) {
+    return values[column * PERFDUMP_BLOCK_ROWS + row];
+  }
+};
+
+static FILE *perfdump_fp = nullptr;
+static pid_t perfdump_pid = 0;
+static std::thread perfdump_thread;
+static std::mutex perfdump_mutex;
+static std::condition_variable perfdump_cv;
+static std::deque<PerfDumpBlock *> perfdump_queue;
+static bool perfdump_exit = false;
+
+// Owned by the producers under perfdump_mutex
+static PerfDumpBlock *counter_block = nullptr;
+static PerfDumpBlock *ipc_block = nullptr;
+static std::vector<uint64_t> staging;
+static uint64_t staging_timer = 0;
+static int staging_received = 0;
+
+static void push_block(PerfDumpBlock *&block) {
+  if (block->rows) {
+    perfdump_queue.push_back(block);
+    block = new PerfDumpBlock(block->tag, block->columns);
+    perfdump_cv.notify_one();
+  }
+}
+
+static void commit_row() {
+  counter_block->at(0, counter_block->rows) = staging_timer;
+  for (int i = 0; i < num_counters; i++) {
+    counter_block->at(i + 1, counter_block->rows) = staging[i];
+  }
+  counter_block->rows++;
+  staging_received = 0;
+  if (counter_block->full()) {
+    push_block(counter_block);
+  }
+}
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+// Only the helper thread encodes, so the previous rows need no locking
+static void encode_block(PerfDumpBlock *block, std::vector<uint64_t> &last, std::vector<uint8_t> &out) {
+  out.clear();
+  for (int c = 0; c < block->columns; c++) {
+    for (int r = 0; r < block->rows; r++) {
+      int64_t delta = block->at(c, r) - last[c];
+      put_varint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+      last[c] = block->at(c, r);
+    }
+  }
+  uint32_t head[2] = {block->tag, (uint32_t)block->rows};
+  uint64_t bytes = out.size();
+  fwrite(head, sizeof(head), 1, perfdump_fp);
+  fwrite(&bytes, sizeof(bytes), 1, perfdump_fp);
+  fwrite(out.data(), 1, out.size(), perfdump_fp);
+}
+
+static void perfdump_loop() {
+  std::vector<uint64_t> last_counters(num_counters + 1, 0), last_ipc(2, 0);
+  std::vector<uint8_t> out;
+  std::unique_lock<std::mutex> lock(perfdump_mutex);
+  while (true) {
+    perfdump_cv.wait(lock, [] { return perfdump_exit || !perfdump_queue.empty(); });
+    if (perfdump_queue.empty()) {
+      break;
+    }
+    PerfDumpBlock *block = perfdump_queue.front();
+    perfdump_queue.pop_front();
+    lock.unlock();
+    encode_block(block, block->tag == PERFDUMP_TAG_IPC ? last_ipc : last_counters, out);
+    fflush(perfdump_fp);
+    delete block;
+    lock.lock();
+  }
+}
+
+// A LightSSS checkpoint shares the file offset with the main process, and stdio would flush its copy of the
+// buffered data at exit. The file is pointed to /dev/null instead, since the FILE lock may be held by the helper
+// thread, which does not exist in the child.
+static void perfdump_fork_child() {
+  if (!perfdump_fp) {
+    return;
+  }
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, fileno(perfdump_fp));
+    close(null_fd);
+  }
+  new std::thread(std::move(perfdump_thread));
+  perfdump_fp = nullptr;
+}
+
+bool perfdump_start(const char *path) {
+  perfdump_fp = fopen(path, "wb");
+  if (!perfdump_fp) {
+    printf("Cannot open perf dump file %s\n", path);
+    return false;
+  }
+  uint32_t n = num_counters;
+  fwrite("DTPERF01", 8, 1, perfdump_fp);
+  fwrite(&n, sizeof(n), 1, perfdump_fp);
+#ifdef CONFIG_DIFFTEST_PERFDUMP
+  for (int i = 0; i < num_counters; i++) {
+    fwrite(perfdump_names[i], strlen(perfdump_names[i]) + 1, 1, perfdump_fp);
+  }
+#endif // CONFIG_DIFFTEST_PERFDUMP
+  Info("%d performance counters are dumped to %s\n", num_counters, path);
+  counter_block = new PerfDumpBlock(PERFDUMP_TAG_COUNTERS, num_counters + 1);
+  ipc_block = new PerfDumpBlock(PERFDUMP_TAG_IPC, 2);
+  staging.assign(num_counters, 0);
+  perfdump_exit = false;
+  perfdump_pid = getpid();
+  static bool registered = false;
+  if (!registered) {
+    registered = true;
+    pthread_atfork(nullptr, nullptr, perfdump_fork_child);
+  }
+  perfdump_thread = std::thread(perfdump_loop);
+  affinity_place_thread(perfdump_thread.native_handle(), "perf dump", AFFINITY_HELPER);
+  return true;
+}
+
+// LightSSS checkpoints replay the dumps of the main process, and they have no helper thread or file
+bool perfdump_active() {
+  return perfdump_fp && perfdump_pid == getpid();
+}
+
+void perfdump_stop() {
+  if (!perfdump_active()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(perfdump_mutex);
+    if (staging_received) {
+      commit_row();
+    }
+    push_block(counter_block);
+    push_block(ipc_block);
+    perfdump_exit = true;
+  }
+  perfdump_cv.notify_all();
+  perfdump_thread.join();
+  delete counter_block;
+  delete ipc_block;
+  fclose(perfdump_fp);
+  perfdump_fp = nullptr;
+}
+
+void perfdump_ipc(uint64_t instr, uint64_t cycles) {
+  if (!perfdump_active()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(perfdump_mutex);
+  ipc_block->at(0, ipc_block->rows) = instr;
+  ipc_block->at(1, ipc_block->rows) = cycles;
+  ipc_block->rows++;
+  if (ipc_block->full()) {
+    push_block(ipc_block);
+  }
+}
+
+#ifdef CONFIG_DIFFTEST_PERFDUMP
+// Chunks of one dump may come from different Verilator threads in any order
+extern "C" void v_difftest_perf_dump(uint64_t timer, uint32_t base, const uint32_t *counters) {
+  if (!perfdump_active()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(perfdump_mutex);
+  if (staging_received && staging_timer != timer) {
+    commit_row();
+  }
+  staging_timer = timer;
+  int count = std::min(PERFDUMP_CHUNK, num_counters - (int)base);
+  memcpy(staging.data() + base, counters, count * sizeof(uint64_t));
+  staging_received += count;
+  if (staging_received == num_counters) {
+    commit_row();
+  }
+}
+#endif // CONFIG_DIFFTEST_PERFDUMP
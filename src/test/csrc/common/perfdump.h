@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __PERFDUMP_H__
+#define __PERFDUMP_H__
+
+#include "common.h"
+
+// Binary channel of the DifftestPerf counters, enabled by the K gateway config.
+//
+// The counters of one dump arrive in chunks of PERFDUMP_CHUNK through v_difftest_perf_dump. The rows are
+// gathered into blocks and encoded by a helper thread into a columnar file (little-endian):
+//   header: "DTPERF01", uint32 number of counters, then the NUL-terminated counter names
+//   blocks: uint32 tag, uint32 rows, uint64 payload bytes, payload
+//     PERFDUMP_TAG_COUNTERS: the timer column, then one column per counter
+//     PERFDUMP_TAG_IPC:      the instruction column, then the cycle column
+// Each column holds the zigzag LEB128 deltas of its values to the previous row, continuing across blocks.
+// scripts/perfdump/perfdump.py converts the file back to the [DIFFTEST_PERF] text.
+
+#define PERFDUMP_CHUNK        512
+#define PERFDUMP_BLOCK_ROWS   16
+#define PERFDUMP_TAG_COUNTERS 0x52544e43 // "CNTR"
+#define PERFDUMP_TAG_IPC      0x53435049 // "IPCS"
+
+#ifdef CONFIG_DIFFTEST_PERFDUMP
+// Generated by DifftestPerf.collect in difftest-perfdump.cpp
+extern const int perfdump_num_counters;
+extern const char *const perfdump_names[];
+
+extern "C" void v_difftest_perf_dump(uint64_t timer, uint32_t base, const uint32_t *counters);
+#endif // CONFIG_DIFFTEST_PERFDUMP
+
+bool perfdump_start(const char *path);
+void perfdump_stop();
+bool perfdump_active();
+// IPC sample at instr committed instructions and cycles
+void perfdump_ipc(uint64_t instr, uint64_t cycles);
+
+#endif // __PERFDUMP_H__
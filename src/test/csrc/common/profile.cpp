@@ -0,0 +1,119 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifdef CONFIG_DIFFTEST_PROFILE
+#include "profile.h"
+#include <mutex>
+#include <time.h>
+#include <vector>
+
+static std::mutex profile_mutex;
+static std::vector<ProfileTable *> profile_tables;
+thread_local ProfileTable *profile_table = difftest_profile_table();
+
+static uint64_t profile_start_ticks = 0, profile_start_ns = 0;
+
+static uint64_t profile_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+ProfileTable *difftest_profile_table() {
+  ProfileTable *table = new ProfileTable();
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  profile_tables.push_back(table);
+  return table;
+}
+
+// Read the counters of a table, and snapshot them for the next dump
+static void profile_take(ProfileTable *table, int i, ProfileSnapshot &delta) {
+  ProfileCounter &c = table->counters[i];
+  ProfileSnapshot &last = table->dumped[i];
+  uint64_t calls = c.calls.load(std::memory_order_relaxed);
+  uint64_t ticks = c.ticks.load(std::memory_order_relaxed);
+  delta.calls = calls - last.calls;
+  delta.ticks = ticks - last.ticks;
+  last.calls = calls;
+  last.ticks = ticks;
+  for (int j = 0; j < PROFILE_HIST_BINS; j++) {
+    uint64_t hist = c.hist[j].load(std::memory_order_relaxed);
+    delta.hist[j] = hist - last.hist[j];
+    last.hist[j] = hist;
+  }
+}
+
+void difftest_profile_init() {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  ProfileSnapshot delta;
+  for (auto table: profile_tables) {
+    for (int i = 0; i < DIFFTEST_PROFILE_NUM; i++) {
+      profile_take(table, i, delta);
+    }
+  }
+  profile_start_ticks = profile_ticks();
+  profile_start_ns = profile_ns();
+}
+
+// the smallest duration (in ns) such that a fraction of the calls are not longer
+static double profile_percentile(const uint64_t *hist, uint64_t calls, double fraction, double ns_per_tick) {
+  if (!calls) {
+    return 0;
+  }
+  uint64_t sum = 0;
+  for (int i = 0; i < PROFILE_HIST_BINS; i++) {
+    sum += hist[i];
+    if (sum >= calls * fraction) {
+      return (double)(2UL << i) * ns_per_tick;
+    }
+  }
+  return 0;
+}
+
+void difftest_profile_dump() {
+  const char *name[DIFFTEST_PROFILE_NUM] = {
+    "rtl_eval",        "store_event", "refill_check", "l2tlb_check", "l1tlb_check", "instr_commit",
+    "load_check",      "ref_sync",    "ref_compare",  "delayed_writeback",
+  };
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  ProfileSnapshot total[DIFFTEST_PROFILE_NUM] = {};
+  for (auto table: profile_tables) {
+    for (int i = 0; i < DIFFTEST_PROFILE_NUM; i++) {
+      ProfileSnapshot c;
+      profile_take(table, i, c);
+      total[i].calls += c.calls;
+      total[i].ticks += c.ticks;
+      for (int j = 0; j < PROFILE_HIST_BINS; j++) {
+        total[i].hist[j] += c.hist[j];
+      }
+    }
+  }
+  uint64_t ticks = profile_ticks() - profile_start_ticks;
+  uint64_t ns = profile_ns() - profile_start_ns;
+  double ns_per_tick = ticks ? (double)ns / ticks : 1;
+  profile_start_ticks += ticks;
+  profile_start_ns += ns;
+
+  printf("==================== Difftest Profile ====================\n");
+  printf("Wall time: %lu ms\n", ns / 1000000);
+  printf("%20s %15s %12s %8s %12s %12s\n", "PHASE", "CALLS", "TIME(ms)", "TIME(%)", "P50(ns)", "P99(ns)");
+  for (int i = 0; i < DIFFTEST_PROFILE_NUM; i++) {
+    ProfileSnapshot &c = total[i];
+    double msec = c.ticks * ns_per_tick / 1000000;
+    printf("%20s %15lu %12.1f %8.2f %12.0f %12.0f\n", name[i], c.calls, msec, ns ? msec * 1e8 / ns : 0,
+           profile_percentile(c.hist, c.calls, 0.5, ns_per_tick), profile_percentile(c.hist, c.calls, 0.99, ns_per_tick));
+  }
+}
+#endif // CONFIG_DIFFTEST_PROFILE
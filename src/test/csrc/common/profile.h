@@ -0,0 +1,112 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "common.h"
+
+#ifdef CONFIG_DIFFTEST_PROFILE
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+enum DIFFTEST_PROFILE {
+  prof_rtl_eval,
+  prof_store_event,
+  prof_refill_check,
+  prof_l2tlb_check,
+  prof_l1tlb_check,
+  prof_instr_commit,
+  prof_load_check,
+  prof_ref_sync,
+  prof_ref_compare,
+  prof_delayed_writeback,
+  DIFFTEST_PROFILE_NUM
+};
+
+// histogram bin i counts the durations in [2^i, 2^(i+1)) ticks
+#define PROFILE_HIST_BINS 40
+
+// Written only by the owner thread, and read by difftest_profile_dump() from any thread
+struct ProfileCounter {
+  std::atomic<uint64_t> calls = {};
+  std::atomic<uint64_t> ticks = {};
+  std::atomic<uint64_t> hist[PROFILE_HIST_BINS] = {};
+};
+
+// the counter values at the last dump, owned by difftest_profile_dump()
+struct ProfileSnapshot {
+  uint64_t calls;
+  uint64_t ticks;
+  uint64_t hist[PROFILE_HIST_BINS];
+};
+
+// Counters are per thread, so that checker threads do not share cache lines. They are never reset,
+// and each dump reports the increments since the snapshot of the previous one.
+struct ProfileTable {
+  ProfileCounter counters[DIFFTEST_PROFILE_NUM];
+  ProfileSnapshot dumped[DIFFTEST_PROFILE_NUM];
+};
+ProfileTable *difftest_profile_table();
+extern thread_local ProfileTable *profile_table;
+
+static inline uint64_t profile_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+// the single writer needs no read-modify-write instruction
+static inline void profile_add(std::atomic<uint64_t> &counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+class ProfileScope {
+public:
+  ProfileScope(int id) : id(id), start(profile_ticks()) {}
+  ~ProfileScope() {
+    uint64_t ticks = profile_ticks() - start;
+    ProfileCounter &c = profile_table->counters[id];
+    profile_add(c.calls, 1);
+    profile_add(c.ticks, ticks);
+    int bin = ticks ? 63 - __builtin_clzll(ticks) : 0;
+    profile_add(c.hist[bin < PROFILE_HIST_BINS ? bin : PROFILE_HIST_BINS - 1], 1);
+  }
+
+private:
+  int id;
+  uint64_t start;
+};
+
+#define DIFFTEST_PROFILE_CONCAT_(a, b)     a##b
+#define DIFFTEST_PROFILE_CONCAT(a, b)      DIFFTEST_PROFILE_CONCAT_(a, b)
+#define DIFFTEST_PROFILE_SCOPE(id)         ProfileScope DIFFTEST_PROFILE_CONCAT(profile_scope_, __LINE__)(id)
+
+void difftest_profile_init();
+// Print the time of every phase since the last dump, summed over all threads
+void difftest_profile_dump();
+#else
+#define DIFFTEST_PROFILE_SCOPE(id)
+#endif // CONFIG_DIFFTEST_PROFILE
+
+#endif // __PROFILE_H__
@@ -17,11 +17,193 @@
 #ifdef CONFIG_DIFFTEST_QUERY
 #include "query.h"
 #include "difftest-query.h"
+#include <sys/stat.h>
 
 QueryStats *qStats;
 
+Query::Query(QueryStatsBase *stats, const char *table, const char *_columns) {
+  std::string list(_columns);
+  for (size_t pos = 0; pos <= list.size();) {
+    size_t next = list.find(',', pos);
+    if (next == std::string::npos) {
+      next = list.size();
+    }
+    columns.push_back(list.substr(pos, next - pos));
+    pos = next + 1;
+  }
+  rows.resize(QUERY_BUFFER_ROWS * columns.size());
+  stats->queries.push_back(this);
+
+#ifdef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", stats->path, table);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/%s/schema", stats->path, table);
+  FILE *schema = fopen(path, "w");
+  if (!schema) {
+    printf("Cannot create %s\n", path);
+    assert(0);
+  }
+  for (auto &c: columns) {
+    fprintf(schema, "%s\n", c.c_str());
+    snprintf(path, sizeof(path), "%s/%s/%s.i64", stats->path, table, c.c_str());
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+      printf("Cannot create %s\n", path);
+      assert(0);
+    }
+    files.push_back(fp);
+  }
+  fclose(schema);
+  column_buf.resize(QUERY_BUFFER_ROWS);
+#else
+  query_db = stats->db;
+  std::string createSql = std::string("CREATE TABLE ") + table + "(ID INTEGER PRIMARY KEY AUTOINCREMENT";
+  for (auto &c: columns) {
+    createSql += "," + c + " INT NOT NULL";
+  }
+  createSql += ");";
+  char *errMsg;
+  if (sqlite3_exec(query_db, createSql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+    printf("SQL error: %s\n", errMsg);
+    assert(0);
+  }
+  pPrepare = prepare_insert(table, 1);
+  batch_rows = std::min((size_t)QUERY_INSERT_ROWS, QUERY_MAX_VARIABLES / columns.size());
+  if (batch_rows > 1) {
+    pBatch = prepare_insert(table, batch_rows);
+  }
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+}
+
+Query::~Query() {
+  flush();
+#ifdef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  for (auto fp: files) {
+    fclose(fp);
+  }
+#else
+  sqlite3_finalize(pPrepare);
+  sqlite3_finalize(pBatch);
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+}
+
+void Query::write(int count, ...) {
+  assert(count == (int)columns.size());
+  int64_t *row = rows.data() + buffered * count;
+  va_list args;
+  va_start(args, count);
+  for (int i = 0; i < count; i++) {
+    row[i] = va_arg(args, int64_t);
+  }
+  va_end(args);
+  if (++buffered == QUERY_BUFFER_ROWS) {
+    flush();
+  }
+}
+
+#ifdef CONFIG_DIFFTEST_QUERY_COLUMNAR
+void Query::flush() {
+  size_t n = columns.size();
+  for (size_t c = 0; c < n; c++) {
+    for (size_t r = 0; r < buffered; r++) {
+      column_buf[r] = rows[r * n + c];
+    }
+    fwrite(column_buf.data(), sizeof(int64_t), buffered, files[c]);
+  }
+  buffered = 0;
+}
+#else
+sqlite3_stmt *Query::prepare_insert(const char *table, size_t n) {
+  std::string tuple = "(?";
+  for (size_t i = 1; i < columns.size(); i++) {
+    tuple += ",?";
+  }
+  tuple += ")";
+  std::string insertSql = std::string("INSERT INTO ") + table + " (";
+  for (size_t i = 0; i < columns.size(); i++) {
+    insertSql += (i ? "," : "") + columns[i];
+  }
+  insertSql += ") VALUES " + tuple;
+  for (size_t i = 1; i < n; i++) {
+    insertSql += "," + tuple;
+  }
+  insertSql += ";";
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(query_db, insertSql.c_str(), insertSql.size(), &stmt, 0) != SQLITE_OK) {
+    printf("SQL error: %s\n", sqlite3_errmsg(query_db));
+    assert(0);
+  }
+  return stmt;
+}
+
+void Query::bind_row(sqlite3_stmt *stmt, size_t first_var, const int64_t *row) {
+  for (size_t i = 0; i < columns.size(); i++) {
+    sqlite3_bind_int64(stmt, first_var + i + 1, row[i]);
+  }
+}
+
+void Query::flush() {
+  size_t n = columns.size();
+  size_t r = 0;
+  for (; pBatch && r + batch_rows <= buffered; r += batch_rows) {
+    sqlite3_reset(pBatch);
+    for (size_t i = 0; i < batch_rows; i++) {
+      bind_row(pBatch, i * n, rows.data() + (r + i) * n);
+    }
+    sqlite3_step(pBatch);
+  }
+  for (; r < buffered; r++) {
+    sqlite3_reset(pPrepare);
+    bind_row(pPrepare, 0, rows.data() + r * n);
+    sqlite3_step(pPrepare);
+  }
+  buffered = 0;
+}
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+
+QueryStatsBase::QueryStatsBase(char *_path) {
+  strncpy(path, _path, 128);
+#ifdef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  mkdir(path, 0755);
+#else
+  // rows go to the database file in every transaction, so that the memory usage is bounded by the page cache
+  if (sqlite3_open(path, &db) != SQLITE_OK) {
+    printf("Cannot open %s: %s\n", path, sqlite3_errmsg(db));
+    assert(0);
+  }
+  sqlite3_exec(db, "PRAGMA synchronous = OFF", 0, 0, 0);
+  sqlite3_exec(db, "PRAGMA journal_mode = OFF", 0, 0, 0);
+  sqlite3_exec(db, "PRAGMA cache_size = -65536", 0, 0, 0);
+  sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+}
+
+QueryStatsBase::~QueryStatsBase() {
+  for (auto q: queries) {
+    delete q;
+  }
+#ifndef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+  sqlite3_close(db);
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+}
+
+void QueryStatsBase::step() {
+  query_step++;
+#ifndef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  if (query_step % 10000 == 0) {
+    sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+    sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+  }
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+}
+
 void difftest_query_init() {
   char query_path[128];
+#ifdef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  snprintf(query_path, 128, "%s/build/%s", getenv("NOOP_HOME"), "difftest_query");
+#else
   snprintf(query_path, 128, "%s/build/%s", getenv("NOOP_HOME"), "difftest_query.db");
   // remove exist file
   FILE *fp = fopen(query_path, "r");
@@ -29,6 +211,7 @@ void difftest_query_init() {
     fclose(fp);
     remove(query_path);
   }
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
   qStats = new QueryStats(query_path);
 }
 
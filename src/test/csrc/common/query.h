@@ -20,78 +20,63 @@
 #include "common.h"
 
 #ifdef CONFIG_DIFFTEST_QUERY
+#include <string>
+#include <vector>
+#ifndef CONFIG_DIFFTEST_QUERY_COLUMNAR
 #include <sqlite3.h>
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
 
+// rows buffered by every table before they are inserted or appended
+#define QUERY_BUFFER_ROWS 4096
+// rows inserted by one multi-row statement, limited by the number of SQLite variables
+#define QUERY_INSERT_ROWS   64
+#define QUERY_MAX_VARIABLES 999
+
+class QueryStatsBase;
+
+// A table of integer columns. Rows are buffered and then either inserted into the SQLite
+// database with multi-row statements, or appended to one binary file per column with
+// CONFIG_DIFFTEST_QUERY_COLUMNAR. A columnar table is a directory of COLUMN.i64 files of
+// little-endian int64 values, and a schema file listing the columns in order.
 class Query {
-protected:
-  sqlite3_stmt *pPrepare = nullptr;
+private:
+  std::vector<std::string> columns;
+  std::vector<int64_t> rows; // row-major
+  size_t buffered = 0;
+#ifdef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  std::vector<FILE *> files;
+  std::vector<int64_t> column_buf;
+#else
   sqlite3 *query_db = nullptr;
+  sqlite3_stmt *pPrepare = nullptr; // single row
+  sqlite3_stmt *pBatch = nullptr;   // batch_rows rows
+  size_t batch_rows = 1;
+  sqlite3_stmt *prepare_insert(const char *table, size_t n);
+  void bind_row(sqlite3_stmt *stmt, size_t first_var, const int64_t *row);
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
 
 public:
-  Query(sqlite3 *db, const char *createSql, const char *insertSql) {
-    query_db = db;
-    char *errMsg;
-    int rc;
-    rc = sqlite3_exec(query_db, createSql, 0, 0, &errMsg);
-    if (rc != SQLITE_OK) {
-      printf("SQL error: %s\n", errMsg);
-      assert(0);
-    }
-    rc = sqlite3_prepare_v2(query_db, insertSql, strlen(insertSql), &pPrepare, 0);
-    if (rc != SQLITE_OK) {
-      printf("SQL error: %s\n", sqlite3_errmsg(query_db));
-      assert(0);
-    }
-  }
-  ~Query() {
-    sqlite3_finalize(pPrepare);
-  }
-  void write(int count, ...) {
-    va_list args;
-    va_start(args, count);
-    sqlite3_reset(pPrepare);
-    for (int i = 0; i < count; i++) {
-      sqlite3_bind_int(pPrepare, i + 1, va_arg(args, int));
-    }
-    va_end(args);
-    sqlite3_step(pPrepare);
-  }
+  // columns: comma-separated column names
+  Query(QueryStatsBase *stats, const char *table, const char *columns);
+  ~Query();
+  // count values of int64_t, one for each column
+  void write(int count, ...);
+  void flush();
 };
 
 class QueryStatsBase {
 public:
   char path[128];
   long long query_step = 0;
-  sqlite3 *mem_db = nullptr;
-  QueryStatsBase(char *_path) {
-    strncpy(path, _path, 128);
-    sqlite3_open(":memory:", &mem_db);
-    sqlite3_exec(mem_db, "PRAGMA synchronous = OFF", 0, 0, 0);
-    sqlite3_exec(mem_db, "BEGIN;", 0, 0, 0);
-  }
-  ~QueryStatsBase() {
-    sqlite3_exec(mem_db, "COMMIT;", 0, 0, 0);
-    sqlite3 *disk_db = nullptr;
-    sqlite3_backup *pBackup;
-    int rc = sqlite3_open(path, &disk_db);
-    if (rc == SQLITE_OK) {
-      pBackup = sqlite3_backup_init(disk_db, "main", mem_db, "main");
-      if (pBackup) {
-        (void)sqlite3_backup_step(pBackup, -1);
-        (void)sqlite3_backup_finish(pBackup);
-      }
-      rc = sqlite3_errcode(disk_db);
-    }
-    sqlite3_close(disk_db);
-    sqlite3_close(mem_db);
-  }
-  virtual void step() {
-    query_step++;
-    if (query_step % 10000 == 0) {
-      sqlite3_exec(mem_db, "COMMIT;", 0, 0, 0);
-      sqlite3_exec(mem_db, "BEGIN;", 0, 0, 0);
-    }
-  }
+#ifndef CONFIG_DIFFTEST_QUERY_COLUMNAR
+  sqlite3 *db = nullptr;
+#endif // CONFIG_DIFFTEST_QUERY_COLUMNAR
+  std::vector<Query *> queries;
+
+  // path is the database with SQLite, or the table directory with CONFIG_DIFFTEST_QUERY_COLUMNAR
+  QueryStatsBase(char *_path);
+  virtual ~QueryStatsBase();
+  virtual void step();
 };
 
 class QueryStats;
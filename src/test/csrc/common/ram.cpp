@@ -18,6 +18,8 @@
 #include "common.h"
 #include "compress.h"
 #include "elfloader.h"
+#include "hugepage.h"
+#include <algorithm>
 #include <iostream>
 #ifdef CONFIG_DIFFTEST_PERFCNT
 #include "perf.h"
@@ -27,14 +29,58 @@
 
 #ifdef WITH_DRAMSIM3
 #include "cosimulation.h"
+#include <deque>
+#ifdef DRAMSIM3_THREAD
+#include "affinity.h"
+#include "spinwait.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#endif // DRAMSIM3_THREAD
 CoDRAMsim3 *dram = NULL;
 #endif
 
 SimMemory *simMemory = nullptr;
 
-void init_ram(const char *image, uint64_t ram_size) {
-  simMemory = new MmapMemory(image, ram_size);
+#ifdef FUZZER_LIB
+// the last RAM from init_ram(), and whether it is kept for the next input
+static MmapMemory *ram_last = nullptr;
+static bool ram_pooled = false;
+#endif // FUZZER_LIB
+
+void init_ram(const char *image, uint64_t ram_size, bool share_image) {
+#ifdef FUZZER_LIB
+  if (ram_pooled && ram_last->get_size() == ram_size && !share_image) {
+    ram_pooled = false;
+    ram_last->reload(image);
+    simMemory = ram_last;
+    return;
+  }
+  if (ram_pooled) {
+    ram_pooled = false;
+    delete ram_last;
+  }
+  simMemory = ram_last = new MmapMemory(image, ram_size, share_image);
+#else
+  simMemory = new MmapMemory(image, ram_size, share_image);
+#endif // FUZZER_LIB
+}
+
+#ifdef FUZZER_LIB
+void ram_recycle(SimMemory *mem) {
+  // a shared image cannot be reset by dropping the private pages
+  if (mem != ram_last || ram_last->get_image_fd() >= 0) {
+    delete mem;
+    return;
+  }
+  ram_pooled = true;
+#ifdef WITH_DRAMSIM3
+  dramsim3_finish();
+#endif
 }
+#endif // FUZZER_LIB
 
 #ifdef TLB_UNITTEST
 // Note: addpageSv39 only supports pmem base 0x80000000
@@ -128,7 +174,44 @@ void addpageSv39() {
 }
 #endif
 
-SimMemory::~SimMemory() {}
+// Cached view of simMemory for difftest_ram_read/write, refreshed when simMemory changes.
+// base is null if the memory needs the virtual at(). mask is words - 1 if words is a power of 2.
+static struct {
+  SimMemory *owner;
+  uint64_t *base;
+  uint64_t words;
+  uint64_t mask;
+} ram_fast = {nullptr, nullptr, 0, 0};
+
+static inline uint64_t *ram_fast_base() {
+  if (simMemory != ram_fast.owner) {
+    ram_fast.owner = simMemory;
+    ram_fast.base = simMemory->direct_ptr();
+    ram_fast.words = simMemory->get_size() / sizeof(uint64_t);
+    ram_fast.mask = (ram_fast.words & (ram_fast.words - 1)) ? 0 : ram_fast.words - 1;
+  }
+  return ram_fast.base;
+}
+
+static inline uint64_t ram_fast_wrap(uint64_t idx) {
+  return ram_fast.mask ? (idx & ram_fast.mask) : (idx % ram_fast.words);
+}
+
+SimMemory::~SimMemory() {
+  if (ram_fast.owner == this) {
+    ram_fast.owner = nullptr;
+  }
+}
+
+static inline bool is_zero_page(const void *data, uint64_t n) {
+  const uint64_t *p = (const uint64_t *)data;
+  for (uint64_t i = 0; i < n / sizeof(uint64_t); i++) {
+    if (p[i]) {
+      return false;
+    }
+  }
+  return true;
+}
 
 bool SimMemory::is_stdin(const char *image) {
   return !strcmp(image, "-");
@@ -196,6 +279,15 @@ uint64_t WimReader::read_all(void *dest, uint64_t max_bytes) {
   return n_read;
 }
 
+uint64_t WimReader::read_at(void *dest, uint64_t offset, uint64_t n) {
+  if (offset >= size) {
+    return 0;
+  }
+  uint64_t n_read = (size - offset > n) ? n : size - offset;
+  memcpy(dest, (uint8_t *)base_addr + offset, n_read);
+  return n_read;
+}
+
 FileReader::FileReader(const char *filename) : file(filename, std::ios::binary) {
   if (!file.is_open()) {
     std::cerr << "Cannot open '" << filename << "'\n";
@@ -225,6 +317,17 @@ uint64_t FileReader::read_all(void *dest, uint64_t max_bytes) {
   return read_size;
 }
 
+uint64_t FileReader::read_at(void *dest, uint64_t offset, uint64_t n) {
+  if (offset >= file_size) {
+    return 0;
+  }
+  uint64_t read_size = (file_size - offset > n) ? n : file_size - offset;
+  file.clear();
+  file.seekg(offset, std::ios::beg);
+  file.read(static_cast<char *>(dest), read_size);
+  return read_size;
+}
+
 InputReader *SimMemory::createInputReader(const char *image) {
   if (is_stdin(image)) {
     return new StdinReader();
@@ -236,23 +339,88 @@ InputReader *SimMemory::createInputReader(const char *image) {
   return new FileReader(image);
 }
 
-void SimMemory::display_stats() {
 #ifdef FUZZING
-  uint64_t req_in_range = 0;
-  auto const img_indices = get_img_size() / sizeof(uint64_t);
-  for (auto index: accessed_indices) {
-    if (index < img_indices) {
-      req_in_range++;
+AccessBitmap::AccessBitmap(uint64_t n_bytes) : n_words(n_bytes / sizeof(uint64_t)) {
+  // bits of untouched pages are never populated
+  uint64_t n_pages = (n_words + PAGE_WORDS - 1) / PAGE_WORDS;
+  word_bits = (uint64_t *)mmap(NULL, n_pages * PAGE_WORDS / 8, PROT_READ | PROT_WRITE,
+                               MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  page_bits = (uint64_t *)mmap(NULL, (n_pages + 63) / 64 * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                               MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (word_bits == (uint64_t *)MAP_FAILED || page_bits == (uint64_t *)MAP_FAILED) {
+    printf("Error: Could not mmap the access bitmap of 0x%lx bytes\n", n_bytes);
+    assert(0);
+  }
+}
+
+AccessBitmap::~AccessBitmap() {
+  uint64_t n_pages = (n_words + PAGE_WORDS - 1) / PAGE_WORDS;
+  munmap(word_bits, n_pages * PAGE_WORDS / 8);
+  munmap(page_bits, (n_pages + 63) / 64 * sizeof(uint64_t));
+}
+
+uint64_t AccessBitmap::count(uint64_t limit) const {
+  const uint64_t page_bit_words = PAGE_WORDS / 64;
+  uint64_t n = 0;
+  for (auto page: pages) {
+    uint64_t first = page * PAGE_WORDS;
+    if (first >= limit) {
+      continue;
+    }
+    const uint64_t *bits = word_bits + page * page_bit_words;
+    for (uint64_t i = 0; i < page_bit_words; i++) {
+      uint64_t word = bits[i];
+      uint64_t begin = first + i * 64;
+      if (begin + 64 > limit) {
+        word &= begin < limit ? ((1UL << (limit - begin)) - 1) : 0;
+      }
+      n += __builtin_popcountll(word);
     }
   }
-  auto req_all = accessed_indices.size();
+  return n;
+}
+
+void AccessBitmap::clear() {
+  const uint64_t page_bit_words = PAGE_WORDS / 64;
+  for (auto page: pages) {
+    memset(word_bits + page * page_bit_words, 0, page_bit_words * sizeof(uint64_t));
+    page_bits[page / 64] &= ~(1UL << (page % 64));
+  }
+  pages.clear();
+}
+#endif // FUZZING
+
+void SimMemory::display_stats() {
+#ifdef FUZZING
+  auto const img_indices = get_img_size() / sizeof(uint64_t);
+  auto req_in_range = accessed_indices.count(img_indices);
+  auto req_all = accessed_indices.count();
   printf("SimMemory: img_size %lu, req_all %lu, req_in_range %lu\n", img_indices, req_all, req_in_range);
 #endif // FUZZING
 }
 
-MmapMemory::MmapMemory(const char *image, uint64_t n_bytes) : SimMemory(n_bytes) {
+MmapMemory::MmapMemory(const char *image, uint64_t n_bytes, bool share_image) : SimMemory(n_bytes) {
+  if (share_image) {
+    image_fd = memfd_create("difftest-image", MFD_CLOEXEC);
+    if (image_fd >= 0 && ftruncate(image_fd, memory_size) == 0) {
+      // load the image through a shared mapping, which is replaced by a private one later
+      ram = (uint64_t *)mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, image_fd, 0);
+    } else {
+      ram = (uint64_t *)MAP_FAILED;
+    }
+    if (ram == (uint64_t *)MAP_FAILED) {
+      printf("Warning: Could not share the image, errno: %s\n", strerror(errno));
+      if (image_fd >= 0) {
+        close(image_fd);
+        image_fd = -1;
+      }
+    }
+  }
   // initialize memory using Linux mmap
-  ram = (uint64_t *)mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (image_fd < 0) {
+    // ELF segments are mapped over it and reload() drops it in small pages, which hugetlb does not allow
+    ram = (uint64_t *)huge_mmap(memory_size, false);
+  }
   if (ram == (uint64_t *)MAP_FAILED) {
     printf("Warning: Insufficient phisical memory\n");
     memory_size = 128 * 1024 * 1024UL;
@@ -270,6 +438,17 @@ MmapMemory::MmapMemory(const char *image, uint64_t n_bytes) : SimMemory(n_bytes)
   //new end
 #endif
 
+  load_image(image);
+
+  if (image_fd >= 0) {
+    // DUT writes go to private copies of pages. Untouched pages are shared with other mappings of image_fd.
+    void *view = mmap(ram, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, image_fd, 0);
+    assert(view == ram);
+    Info("Sharing the image between simulated RAM, golden memory and REF\n");
+  }
+}
+
+void MmapMemory::load_image(const char *image) {
   if (image == NULL) {
     img_size = 0;
     return;
@@ -286,7 +465,8 @@ MmapMemory::MmapMemory(const char *image, uint64_t n_bytes) : SimMemory(n_bytes)
     assert(img_size >= 0);
   } else if (isElfFile(image)) {
     Info("ELF file detected and loading image from extracted elf file\n");
-    img_size = readFromElf(ram, image, memory_size);
+    // the shared image is written through the memfd mapping, which must not be replaced
+    img_size = readFromElf(ram, image, memory_size, true, image_fd < 0);
     assert(img_size >= 0);
   } else {
     InputReader *reader = createInputReader(image);
@@ -295,8 +475,47 @@ MmapMemory::MmapMemory(const char *image, uint64_t n_bytes) : SimMemory(n_bytes)
   }
 }
 
+#ifdef FUZZER_LIB
+void MmapMemory::reload(const char *image) {
+  const uint64_t page_size = 1UL << AccessBitmap::PAGE_SHIFT;
+  uint8_t *base = (uint8_t *)ram;
+  // ELF segments may be private mappings of the file, so the image is replaced by zero pages
+  uint64_t image_end = (img_size + page_size - 1) & ~(page_size - 1);
+  if (image_end) {
+    void *p = mmap(base, image_end, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    assert(p == base);
+    huge_advise(base, image_end);
+  }
+  // other pages are anonymous and read as zeros after being dropped. Adjacent pages are dropped together.
+  std::vector<uint64_t> pages = accessed_indices.accessed_pages();
+  std::sort(pages.begin(), pages.end());
+  uint64_t run_begin = 0, run_end = 0;
+  for (auto page: pages) {
+    uint64_t offset = page << AccessBitmap::PAGE_SHIFT;
+    if (offset < image_end) {
+      continue;
+    }
+    if (offset != run_end) {
+      if (run_end) {
+        madvise(base + run_begin, run_end - run_begin, MADV_DONTNEED);
+      }
+      run_begin = offset;
+    }
+    run_end = offset + page_size;
+  }
+  if (run_end) {
+    madvise(base + run_begin, run_end - run_begin, MADV_DONTNEED);
+  }
+  accessed_indices.clear();
+  load_image(image);
+}
+#endif // FUZZER_LIB
+
 MmapMemory::~MmapMemory() {
-  munmap(ram, memory_size);
+  huge_munmap(ram, memory_size);
+  if (image_fd >= 0) {
+    close(image_fd);
+  }
 #ifdef WITH_DRAMSIM3
   dramsim3_finish();
 #endif
@@ -315,8 +534,11 @@ uint64_t difftest_ram_read(uint64_t rIdx) {
     return 0;
   }
 #endif // PMEM_CHECK
+  if (uint64_t *base = ram_fast_base()) {
+    return base[ram_fast_wrap(rIdx)];
+  }
   rIdx %= simMemory->get_size() / sizeof(uint64_t);
-  uint64_t rdata = simMemory->at(rIdx);
+  uint64_t rdata = simMemory->read(rIdx);
   return rdata;
 }
 
@@ -330,10 +552,52 @@ void difftest_ram_write(uint64_t wIdx, uint64_t wdata, uint64_t wmask) {
       printf("ERROR: ram wIdx = 0x%lx out of bound!\n", wIdx);
       return;
     }
+    if (uint64_t *base = ram_fast_base()) {
+      base[wIdx] = (base[wIdx] & ~wmask) | (wdata & wmask);
+      return;
+    }
     simMemory->at(wIdx) = (simMemory->at(wIdx) & ~wmask) | (wdata & wmask);
   }
 }
 
+void difftest_ram_read_burst(uint64_t rIdx, uint64_t *rdata, uint64_t n) {
+#ifdef CONFIG_DIFFTEST_PERFCNT
+  difftest_calls[perf_difftest_ram_read]++;
+  difftest_bytes[perf_difftest_ram_read] += 8 * n;
+#endif // CONFIG_DIFFTEST_PERFCNT
+  if (!simMemory) {
+    memset(rdata, 0, n * sizeof(uint64_t));
+    return;
+  }
+  uint64_t *base = ram_fast_base();
+  uint64_t start = ram_fast_wrap(rIdx);
+  if (base && start + n <= ram_fast.words) {
+    memcpy(rdata, base + start, n * sizeof(uint64_t));
+    return;
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    rdata[i] = simMemory->read(ram_fast_wrap(rIdx + i));
+  }
+}
+
+void difftest_ram_write_burst(uint64_t wIdx, const uint64_t *wdata, const uint64_t *wmask, uint64_t n) {
+#ifdef CONFIG_DIFFTEST_PERFCNT
+  difftest_calls[perf_difftest_ram_write]++;
+  difftest_bytes[perf_difftest_ram_write] += 16 * n;
+#endif // CONFIG_DIFFTEST_PERFCNT
+  if (!simMemory || n == 0)
+    return;
+  if (!simMemory->in_range_u64(wIdx) || !simMemory->in_range_u64(wIdx + n - 1)) {
+    printf("ERROR: ram wIdx = 0x%lx (%lu words) out of bound!\n", wIdx, n);
+    return;
+  }
+  uint64_t *base = ram_fast_base();
+  for (uint64_t i = 0; i < n; i++) {
+    uint64_t &word = base ? base[wIdx + i] : simMemory->at(wIdx + i);
+    word = (word & ~wmask[i]) | (wdata[i] & wmask[i]);
+  }
+}
+
 uint64_t pmem_read(uint64_t raddr) {
   if (raddr % sizeof(uint64_t)) {
     printf("Warning: pmem_read only supports 64-bit aligned memory access\n");
@@ -376,25 +640,179 @@ uint64_t &MmapMemoryWithFootprints::at(uint64_t index) {
 }
 
 FootprintsMemory::FootprintsMemory(const char *footprints_name, uint64_t n_bytes)
-    : SimMemory(n_bytes), reader(createInputReader(footprints_name)), n_accessed(0) {
+    : SimMemory(n_bytes), reader(createInputReader(footprints_name)), n_accessed(0), block(BLOCK_WORDS) {
   printf("The image is %s\n", footprints_name);
-  add_callback([this](uint64_t, uint64_t) { this->on_access(this->n_accessed / sizeof(uint64_t)); });
 }
 
 FootprintsMemory::~FootprintsMemory() {
+  pages.for_each([](uint64_t, Page *p) { delete p; });
   delete reader;
 }
 
-uint64_t &FootprintsMemory::at(uint64_t index) {
-  if (ram.find(index) == ram.end()) {
-    uint64_t value = reader->next();
-    ram[index] = value;
+uint64_t FootprintsMemory::next_value() {
+  if (block_pos == block_len) {
+    if (reader->len() == 0) {
+      // stdin is read in order only
+      return reader->next();
+    }
+    block_offset += block_len * sizeof(uint64_t);
+    uint64_t n_read = reader->read_at(block.data(), block_offset, BLOCK_WORDS * sizeof(uint64_t));
+    // zero the missing bytes of a partial last word
+    if (n_read % sizeof(uint64_t)) {
+      memset((char *)block.data() + n_read, 0, sizeof(uint64_t) - n_read % sizeof(uint64_t));
+    }
+    block_len = (n_read + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    block_pos = 0;
+    if (block_len == 0) {
+      // the end of the footprints
+      return 0;
+    }
+  }
+  return block[block_pos++];
+}
+
+uint64_t &FootprintsMemory::populate(uint64_t index) {
+  uint64_t page = index / PAGE_WORDS, slot = index % PAGE_WORDS;
+  if (page != last_page_number) {
+    Page **p = pages.get(page);
+    last_page = p ? *p : pages.insert(page, new Page());
+    last_page_number = page;
+  }
+  uint64_t &data = last_page->data[slot];
+  if (!((last_page->present[slot / 64] >> (slot % 64)) & 1)) {
+    last_page->present[slot / 64] |= 1UL << (slot % 64);
+    data = next_value();
+    on_access(n_accessed / sizeof(uint64_t));
     for (auto &cb: callbacks) {
-      cb(index, value);
+      cb(index, data);
     }
     n_accessed += sizeof(uint64_t);
   }
-  return ram[index];
+  return data;
+}
+
+void FootprintsMemory::clone_on_demand(std::function<void(uint64_t, void *, size_t)> func, bool skip_zero) {
+  // the accessed words are copied in runs
+  pages.for_each([&func](uint64_t page, Page *p) {
+    uint64_t start = 0;
+    for (uint64_t slot = 0; slot <= PAGE_WORDS; slot++) {
+      bool present = slot < PAGE_WORDS && ((p->present[slot / 64] >> (slot % 64)) & 1);
+      if (present) {
+        continue;
+      }
+      if (slot > start) {
+        func((page * PAGE_WORDS + start) * sizeof(uint64_t), p->data + start, (slot - start) * sizeof(uint64_t));
+      }
+      start = slot + 1;
+    }
+  });
+  // words accessed later are cloned when they are read from the footprints
+  add_callback([func](uint64_t index, uint64_t value) { func(index * sizeof(uint64_t), &value, sizeof(uint64_t)); });
+}
+
+const uint64_t SparseMemory::zero_page[SparseMemory::PAGE_WORDS] = {};
+
+SparseMemory::SparseMemory(const char *image, uint64_t n_bytes)
+    : SimMemory(n_bytes), n_populated(0), reader(nullptr), img_size(0) {
+  n_regions = (memory_size + (1UL << REGION_SHIFT) - 1) >> REGION_SHIFT;
+  regions = (Region **)mmap(NULL, n_regions * sizeof(Region *), PROT_READ | PROT_WRITE,
+                            MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (regions == (Region **)MAP_FAILED) {
+    printf("Error: Cound not mmap the page table for 0x%lx bytes\n", memory_size);
+    assert(0);
+  }
+  Info("Using simulated %luMB sparse RAM\n", memory_size / (1024 * 1024));
+  if (image != NULL) {
+    load_image(image);
+  }
+}
+
+SparseMemory::~SparseMemory() {
+  for (uint64_t i = 0; i < n_regions; i++) {
+    if (regions[i]) {
+      munmap(regions[i]->data, 1UL << REGION_SHIFT);
+      delete regions[i];
+    }
+  }
+  munmap(regions, n_regions * sizeof(Region *));
+  delete reader;
+}
+
+void SparseMemory::load_image(const char *image) {
+  printf("The image is %s\n", image);
+  bool is_compressed = isGzFile(image) || isZstdFile(image) || isElfFile(image);
+  if (!is_compressed && !is_stdin(image)) {
+    // raw images support random access and are loaded on demand
+    reader = createInputReader(image);
+    img_size = reader->len();
+    return;
+  }
+  // Other images are extracted to a temporary buffer, whose non-zero pages are copied.
+  uint8_t *buf = (uint8_t *)mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  assert(buf != (uint8_t *)MAP_FAILED);
+  if (isGzFile(image)) {
+    img_size = readFromGz(buf, image, memory_size, LOAD_RAM);
+  } else if (isZstdFile(image)) {
+    img_size = readFromZstd(buf, image, memory_size, LOAD_RAM);
+  } else if (isElfFile(image)) {
+    img_size = readFromElf(buf, image, memory_size, true, true);
+  } else {
+    InputReader *stdin_reader = createInputReader(image);
+    img_size = stdin_reader->read_all(buf, memory_size);
+    delete stdin_reader;
+  }
+  const uint64_t page_bytes = 1UL << PAGE_SHIFT;
+  for (uint64_t offset = 0; offset < img_size; offset += page_bytes) {
+    if (!is_zero_page(buf + offset, page_bytes)) {
+      memcpy(populate(offset >> PAGE_SHIFT), buf + offset, page_bytes);
+    }
+  }
+  munmap(buf, memory_size);
+}
+
+uint64_t *SparseMemory::populate(uint64_t page) {
+  Region *&r = regions[page / REGION_PAGES];
+  if (!r) {
+    r = new Region();
+    // only the touched 4 KB pages of the region are backed by physical memory
+    r->data = (uint64_t *)mmap(NULL, 1UL << REGION_SHIFT, PROT_READ | PROT_WRITE,
+                               MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    assert(r->data != (uint64_t *)MAP_FAILED);
+  }
+  uint64_t slot = page % REGION_PAGES;
+  uint64_t *data = r->data + slot * PAGE_WORDS;
+  r->populated[slot / 64] |= 1UL << (slot % 64);
+  n_populated++;
+  uint64_t offset = page << PAGE_SHIFT;
+  if (reader && offset < img_size) {
+    uint64_t n = reader->read_at(data, offset, 1UL << PAGE_SHIFT);
+    if (n && !is_zero_page(data, n)) {
+      for (auto &cb: callbacks) {
+        cb(offset, data, n);
+      }
+    }
+  }
+  return data;
+}
+
+void SparseMemory::clone_on_demand(std::function<void(uint64_t, void *, size_t)> func, bool skip_zero) {
+  const uint64_t page_bytes = 1UL << PAGE_SHIFT;
+  for (uint64_t i = 0; i < n_regions; i++) {
+    if (!regions[i]) {
+      continue;
+    }
+    for (uint64_t slot = 0; slot < REGION_PAGES; slot++) {
+      if ((regions[i]->populated[slot / 64] >> (slot % 64)) & 1) {
+        uint64_t offset = ((i * REGION_PAGES) + slot) << PAGE_SHIFT;
+        void *data = regions[i]->data + slot * PAGE_WORDS;
+        if (!skip_zero || !is_zero_page(data, page_bytes)) {
+          func(offset, data, page_bytes);
+        }
+      }
+    }
+  }
+  // pages loaded from the image later are cloned when they are populated
+  callbacks.push_back(func);
 }
 
 LinearizedFootprintsMemory::LinearizedFootprintsMemory(const char *footprints_name, uint64_t n_bytes,
@@ -440,12 +858,129 @@ void LinearizedFootprintsMemory::save_linear_memory(const char *filename) {
 
 void overwrite_ram(const char *gcpt_restore, uint64_t overwrite_nbytes) {
   InputReader *reader = new FileReader(gcpt_restore);
-  int overwrite_size = reader->read_all(simMemory->as_ptr(), overwrite_nbytes);
+  int overwrite_size;
+  int image_fd = simMemory->get_image_fd();
+  if (image_fd >= 0) {
+    // write to the shared image, which is visible to all private mappings until they write the pages
+    void *image = mmap(NULL, overwrite_nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    assert(image != MAP_FAILED);
+    overwrite_size = reader->read_all(image, overwrite_nbytes);
+    munmap(image, overwrite_nbytes);
+  } else if (simMemory->as_ptr()) {
+    overwrite_size = reader->read_all(simMemory->as_ptr(), overwrite_nbytes);
+  } else {
+    std::vector<uint64_t> buf((overwrite_nbytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    overwrite_size = reader->read_all(buf.data(), overwrite_nbytes);
+    for (uint64_t i = 0; i < (overwrite_size + sizeof(uint64_t) - 1) / sizeof(uint64_t); i++) {
+      simMemory->at(i) = buf[i];
+    }
+  }
   Info("Overwrite %d bytes from file %s.\n", overwrite_size, gcpt_restore);
   delete reader;
 }
 
 #ifdef WITH_DRAMSIM3
+// Requests added to DRAMSim3 whose responses are not returned yet.
+// When it is zero, memory_response() returns without touching DRAMSim3.
+static uint64_t dram_outstanding = 0;
+// Completed responses drained from DRAMSim3 in bulk, [0] for reads and [1] for writes
+static std::deque<uint32_t> dram_responses[2];
+
+#ifdef DRAMSIM3_THREAD
+// DRAMSim3 is ticked by dram_thread up to dram_target, overlapping with the RTL evaluation.
+// Other threads touch dram only after dramsim3_sync(), when dram_thread has caught up.
+static pthread_t dram_thread;
+static bool dram_thread_running = false;
+// the worker was lost by fork(), and is restarted when the child ticks DRAMSim3 again
+static bool dram_thread_lost = false;
+static uint64_t dram_cycles = 0;
+static std::atomic<uint64_t> dram_target(0), dram_done(0);
+static std::atomic<bool> dram_exit(false);
+// An idle worker spins for a while, and then sleeps on dram_cv until the next tick or exit
+static std::mutex dram_mutex;
+static std::condition_variable dram_cv;
+static std::atomic<bool> dram_sleeping(false);
+// the cpus of the first worker, which a restarted worker runs on as well
+static cpu_set_t dram_thread_mask;
+static bool dram_thread_placed = false;
+
+static void *dramsim3_worker(void *) {
+  uint64_t done = dram_done.load(std::memory_order_relaxed);
+  int spin = 0;
+  while (!dram_exit.load(std::memory_order_relaxed)) {
+    uint64_t target = dram_target.load(std::memory_order_acquire);
+    if (done == target) {
+      if (spin < DIFFTEST_SPIN_LIMIT) {
+        difftest_spin_wait(spin);
+        continue;
+      }
+      // dram_sleeping is set before the last check, and read by dramsim3_wake() after the target is set
+      std::unique_lock<std::mutex> lock(dram_mutex);
+      dram_sleeping.store(true);
+      dram_cv.wait(lock, [done] { return dram_target.load() != done || dram_exit.load(); });
+      dram_sleeping.store(false);
+      continue;
+    }
+    spin = 0;
+    while (done < target) {
+      dram->tick();
+      done++;
+    }
+    dram_done.store(done, std::memory_order_release);
+  }
+  return NULL;
+}
+
+static void dramsim3_wake() {
+  if (dram_sleeping.load()) {
+    std::lock_guard<std::mutex> lock(dram_mutex);
+    dram_cv.notify_one();
+  }
+}
+
+static void dramsim3_thread_start() {
+  if (pthread_create(&dram_thread, NULL, dramsim3_worker, NULL)) {
+    perror("dramsim3 pthread_create");
+    exit(1);
+  }
+  if (!dram_thread_placed) {
+    affinity_place_thread(dram_thread, "dramsim3", AFFINITY_CHECKER);
+    dram_thread_placed = !pthread_getaffinity_np(dram_thread, sizeof(dram_thread_mask), &dram_thread_mask);
+  } else {
+    pthread_setaffinity_np(dram_thread, sizeof(dram_thread_mask), &dram_thread_mask);
+  }
+  dram_thread_running = true;
+}
+
+static inline void dramsim3_sync() {
+  int spin = 0;
+  while (dram_done.load(std::memory_order_acquire) != dram_cycles) {
+    difftest_spin_wait(spin);
+  }
+}
+
+// LightSSS forks only the calling thread. Let the worker catch up before fork so that
+// the child inherits a consistent DRAMSim3. The child restarts the worker lazily in dramsim3_step(),
+// so that sleeping checkpoints and other forked processes do not run one.
+static void dramsim3_prepare_fork() {
+  if (dram_thread_running)
+    dramsim3_sync();
+}
+
+static void dramsim3_child_fork() {
+  if (dram_thread_running) {
+    dram_thread_running = false;
+    dram_thread_lost = true;
+    // the lost worker may have held the mutex or waited on the condition variable
+    new (&dram_mutex) std::mutex;
+    new (&dram_cv) std::condition_variable;
+    dram_sleeping.store(false);
+  }
+}
+#else
+static inline void dramsim3_sync() {}
+#endif // DRAMSIM3_THREAD
+
 void dramsim3_init(const char *config_file, const char *out_dir) {
 #if !defined(DRAMSIM3_CONFIG) || !defined(DRAMSIM3_OUTDIR)
 #error DRAMSIM3_CONFIG or DRAMSIM3_OUTDIR is not defined
@@ -468,29 +1003,74 @@ void dramsim3_init(const char *config_file, const char *out_dir) {
   std::cout << "DRAMSIM3 outdir: " << out_dir << std::endl;
   dram = new ComplexCoDRAMsim3(config_file, out_dir);
   // dram = new SimpleCoDRAMsim3(90);
+#ifdef DRAMSIM3_THREAD
+  pthread_atfork(dramsim3_prepare_fork, NULL, dramsim3_child_fork);
+  dramsim3_thread_start();
+#endif // DRAMSIM3_THREAD
 }
 
 void dramsim3_step() {
   if (dram == NULL)
     return;
+#ifdef DRAMSIM3_THREAD
+  if (dram_thread_lost) {
+    dram_thread_lost = false;
+    dramsim3_thread_start();
+  }
+  dram_target.store(++dram_cycles);
+  dramsim3_wake();
+#else
   dram->tick();
+#endif // DRAMSIM3_THREAD
 }
 
 void dramsim3_finish() {
+  if (dram == NULL)
+    return;
+#ifdef DRAMSIM3_THREAD
+  if (dram_thread_running) {
+    dramsim3_sync();
+    dram_exit.store(true);
+    dramsim3_wake();
+    pthread_join(dram_thread, NULL);
+    dram_thread_running = false;
+  }
+#endif // DRAMSIM3_THREAD
   delete dram;
   dram = NULL;
 }
 
-uint64_t memory_response(bool isWrite) {
-  if (dram == NULL)
-    return 0;
-  auto response = (isWrite) ? dram->check_write_response() : dram->check_read_response();
-  if (response) {
+static void dramsim3_drain(bool isWrite) {
+  CoDRAMResponse *response;
+  while ((response = isWrite ? dram->check_write_response() : dram->check_read_response())) {
     auto meta = static_cast<dramsim3_meta *>(response->req->meta);
-    uint64_t response_value = meta->id | (1UL << 32);
+    dram_responses[isWrite].push_back(meta->id);
     delete meta;
     delete response;
-    return response_value;
+  }
+}
+
+uint32_t memory_response_batch(bool isWrite, uint32_t *id, uint32_t max_n) {
+  if (dram == NULL || dram_outstanding == 0)
+    return 0;
+  auto &queue = dram_responses[isWrite];
+  if (queue.size() < max_n) {
+    dramsim3_sync();
+    dramsim3_drain(isWrite);
+  }
+  uint32_t n = 0;
+  while (n < max_n && !queue.empty()) {
+    id[n++] = queue.front();
+    queue.pop_front();
+  }
+  dram_outstanding -= n;
+  return n;
+}
+
+uint64_t memory_response(bool isWrite) {
+  uint32_t id;
+  if (memory_response_batch(isWrite, &id, 1)) {
+    return id | (1UL << 32);
   }
   return 0;
 }
@@ -498,6 +1078,7 @@ uint64_t memory_response(bool isWrite) {
 bool memory_request(uint64_t address, uint32_t id, bool isWrite) {
   if (dram == NULL)
     return false;
+  dramsim3_sync();
   if (dram->will_accept(address, isWrite)) {
     auto req = new CoDRAMRequest();
     auto meta = new dramsim3_meta;
@@ -506,6 +1087,7 @@ bool memory_request(uint64_t address, uint32_t id, bool isWrite) {
     meta->id = id;
     req->meta = meta;
     dram->add_request(req);
+    dram_outstanding++;
     return true;
   }
   return false;
@@ -18,11 +18,11 @@
 #define __RAM_H
 
 #include "common.h"
+#include "flatset.h"
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
-#include <set>
 #include <unordered_map>
 #include <vector>
 
@@ -34,6 +34,9 @@ uint64_t pmem_read(uint64_t raddr);
 void pmem_write(uint64_t waddr, uint64_t wdata);
 extern "C" uint64_t difftest_ram_read(uint64_t rIdx);
 extern "C" void difftest_ram_write(uint64_t wIdx, uint64_t wdata, uint64_t wmask);
+// n consecutive 64-bit words starting from rIdx / wIdx, e.g. a cache line of an AXI burst
+extern "C" void difftest_ram_read_burst(uint64_t rIdx, uint64_t *rdata, uint64_t n);
+extern "C" void difftest_ram_write_burst(uint64_t wIdx, const uint64_t *wdata, const uint64_t *wmask, uint64_t n);
 
 class InputReader {
 public:
@@ -43,6 +46,10 @@ public:
   };
   virtual uint64_t next() = 0;
   virtual uint64_t read_all(void *, uint64_t) = 0;
+  // random access of n bytes at offset, returns 0 if not supported
+  virtual uint64_t read_at(void *dest, uint64_t offset, uint64_t n) {
+    return 0;
+  }
 };
 
 class StdinReader : public InputReader {
@@ -65,6 +72,7 @@ public:
   };
   uint64_t next();
   uint64_t read_all(void *dest, uint64_t max_bytes = -1ULL);
+  uint64_t read_at(void *dest, uint64_t offset, uint64_t n);
 
 private:
   uint64_t *base_addr;
@@ -82,21 +90,59 @@ public:
   };
   uint64_t next();
   uint64_t read_all(void *dest, uint64_t max_bytes = -1ULL);
+  uint64_t read_at(void *dest, uint64_t offset, uint64_t n);
 
 private:
   std::ifstream file;
   uint64_t file_size;
 };
 
+#ifdef FUZZING
+// Bitmap of the accessed 8-byte words, which are grouped by 4 KB pages. The first access to
+// a page adds it to a list, so that summaries and clearing take O(accessed pages).
+class AccessBitmap {
+public:
+  static const uint64_t PAGE_SHIFT = 12;
+  static const uint64_t PAGE_WORDS = (1UL << PAGE_SHIFT) / sizeof(uint64_t);
+
+  AccessBitmap(uint64_t n_bytes);
+  ~AccessBitmap();
+  inline void insert(uint64_t index) {
+    if (index >= n_words) {
+      return;
+    }
+    uint64_t page = index / PAGE_WORDS;
+    if (!(page_bits[page / 64] & (1UL << (page % 64)))) {
+      page_bits[page / 64] |= 1UL << (page % 64);
+      pages.push_back(page);
+    }
+    word_bits[index / 64] |= 1UL << (index % 64);
+  }
+  // number of accessed words with index < limit
+  uint64_t count(uint64_t limit = -1ULL) const;
+  // accessed pages, in the order of the first access
+  const std::vector<uint64_t> &accessed_pages() const {
+    return pages;
+  }
+  void clear();
+
+private:
+  uint64_t n_words;
+  uint64_t *word_bits;
+  uint64_t *page_bits;
+  std::vector<uint64_t> pages;
+};
+#endif // FUZZING
+
 class SimMemory {
 private:
-  bool is_stdin(const char *image);
   uint64_t *is_wim(const char *image, uint64_t &wim_size);
 
 protected:
+  bool is_stdin(const char *image);
   uint64_t memory_size; // in bytes
 #ifdef FUZZING
-  std::set<uint64_t> accessed_indices;
+  AccessBitmap accessed_indices;
 #endif
   InputReader *createInputReader(const char *image);
   void inline on_access(uint64_t index) {
@@ -106,7 +152,11 @@ protected:
   }
 
 public:
+#ifdef FUZZING
+  SimMemory(uint64_t n_bytes) : memory_size(n_bytes), accessed_indices(n_bytes) {}
+#else
   SimMemory(uint64_t n_bytes) : memory_size(n_bytes) {}
+#endif // FUZZING
   virtual ~SimMemory();
   virtual uint64_t get_img_size() = 0;
   uint64_t get_size() {
@@ -126,7 +176,19 @@ public:
   virtual uint64_t *as_ptr() {
     return nullptr;
   }
+  // flat storage if at(index) is nothing more than ptr[index], used by the difftest_ram fast path
+  virtual uint64_t *direct_ptr() {
+    return nullptr;
+  }
+  // memfd of the loaded image, whose private mappings share the untouched pages, or -1
+  virtual int get_image_fd() {
+    return -1;
+  }
   virtual uint64_t &at(uint64_t index) = 0;
+  // read-only access, which may avoid allocating the storage of untouched words
+  virtual uint64_t read(uint64_t index) {
+    return at(index);
+  }
   void display_stats();
 };
 
@@ -134,10 +196,17 @@ class MmapMemory : public SimMemory {
 private:
   uint64_t *ram;
   uint64_t img_size;
+  int image_fd = -1;
+  void load_image(const char *image);
 
 public:
-  MmapMemory(const char *image, uint64_t n_bytes);
+  // If share_image is set, the image is loaded to a memfd and ram is a private mapping of it
+  MmapMemory(const char *image, uint64_t n_bytes, bool share_image = false);
   virtual ~MmapMemory();
+#ifdef FUZZER_LIB
+  // Zero the image and the accessed pages, and load another image
+  void reload(const char *image);
+#endif // FUZZER_LIB
   void clone(std::function<void(void *, uint64_t)> func, bool skip_zero = false) {
     uint64_t n_bytes = skip_zero ? img_size : get_size();
     func(ram, n_bytes);
@@ -150,6 +219,16 @@ public:
   uint64_t *as_ptr() {
     return ram;
   }
+  uint64_t *direct_ptr() {
+#ifdef FUZZING
+    return nullptr; // at() records the accessed indices
+#else
+    return ram;
+#endif
+  }
+  int get_image_fd() {
+    return image_fd;
+  }
   virtual inline uint64_t get_img_size() {
     return img_size;
   }
@@ -164,15 +243,35 @@ public:
   MmapMemoryWithFootprints(const char *image, uint64_t n_bytes, const char *footprints_name);
   ~MmapMemoryWithFootprints();
   uint64_t &at(uint64_t index);
+  uint64_t *direct_ptr() {
+    return nullptr;
+  }
 };
 
+// Memory of a footprints file, which holds the value of each word in the order of the first access.
+// Words are kept in 4 KB pages found by an open-addressing table, and the file is read in blocks.
 class FootprintsMemory : public SimMemory {
 private:
-  std::unordered_map<uint64_t, uint64_t> ram;
-  std::ifstream footprints_file;
+  static const uint64_t PAGE_SHIFT = 12;
+  static const uint64_t PAGE_WORDS = (1UL << PAGE_SHIFT) / sizeof(uint64_t);
+  static const uint64_t BLOCK_WORDS = 64 * 1024;
+  struct Page {
+    uint64_t data[PAGE_WORDS];
+    uint64_t present[PAGE_WORDS / 64];
+  };
+  FlatAddrMap<Page *> pages;
+  uint64_t last_page_number = -1ULL;
+  Page *last_page = nullptr;
   std::vector<std::function<void(uint64_t, uint64_t)>> callbacks;
   InputReader *reader;
   uint64_t n_accessed;
+  // the block of the footprints starting at block_offset, and the next word to use
+  std::vector<uint64_t> block;
+  uint64_t block_offset = 0;
+  size_t block_len = 0, block_pos = 0;
+
+  uint64_t next_value();
+  uint64_t &populate(uint64_t index);
 
 protected:
   void add_callback(std::function<void(uint64_t, uint64_t)> func) {
@@ -182,20 +281,81 @@ protected:
 public:
   FootprintsMemory(const char *footprints_name, uint64_t n_bytes);
   ~FootprintsMemory();
-  uint64_t &at(uint64_t index);
+  uint64_t &at(uint64_t index) {
+    uint64_t page = index / PAGE_WORDS, slot = index % PAGE_WORDS;
+    if (page == last_page_number && ((last_page->present[slot / 64] >> (slot % 64)) & 1)) {
+      return last_page->data[slot];
+    }
+    return populate(index);
+  }
   void clone(std::function<void(void *, uint64_t)> func, bool skip_zero = false) {
     printf("clone_instant not support by FootprintsMemory\n");
     assert(0);
   }
-  void clone_on_demand(std::function<void(uint64_t, void *, size_t)> func, bool skip_zero = false) {
-    auto cb = [func](uint64_t index, uint64_t value) { func(index * sizeof(uint64_t), &value, sizeof(uint64_t)); };
-    for (auto i = ram.begin(); i != ram.end(); i++) {
-      cb(i->first, i->second);
+  void clone_on_demand(std::function<void(uint64_t, void *, size_t)> func, bool skip_zero = false);
+  virtual inline uint64_t get_img_size() {
+    return reader->len();
+  }
+};
+
+// Memory in 4 KB pages allocated on first access, which are indexed by a table of 2 MB regions.
+// Pages of a raw image are read from the image on their first access.
+class SparseMemory : public SimMemory {
+private:
+  static const uint64_t PAGE_SHIFT = 12;
+  static const uint64_t REGION_SHIFT = 21;
+  static const uint64_t PAGE_WORDS = (1UL << PAGE_SHIFT) / sizeof(uint64_t);
+  static const uint64_t REGION_PAGES = 1UL << (REGION_SHIFT - PAGE_SHIFT);
+  struct Region {
+    uint64_t *data;
+    uint64_t populated[REGION_PAGES / 64];
+  };
+  Region **regions;
+  uint64_t n_regions;
+  uint64_t n_populated;
+  // reader for lazy loading of the image, or nullptr if the image is loaded at start
+  InputReader *reader;
+  uint64_t img_size;
+  std::vector<std::function<void(uint64_t, void *, size_t)>> callbacks;
+
+  // shared by the reads of all unpopulated pages out of the image
+  static const uint64_t zero_page[PAGE_WORDS];
+
+  uint64_t *populate(uint64_t page);
+  void load_image(const char *image);
+
+public:
+  SparseMemory(const char *image, uint64_t n_bytes);
+  ~SparseMemory();
+  uint64_t &at(uint64_t index) {
+    on_access(index);
+    uint64_t page = index / PAGE_WORDS;
+    Region *r = regions[page / REGION_PAGES];
+    uint64_t slot = page % REGION_PAGES;
+    if (!r || !((r->populated[slot / 64] >> (slot % 64)) & 1)) {
+      return populate(page)[index % PAGE_WORDS];
     }
-    add_callback(cb);
+    return r->data[slot * PAGE_WORDS + index % PAGE_WORDS];
   }
+  // Pages are populated by writes. Reads populate only the pages loaded lazily from the image.
+  uint64_t read(uint64_t index) {
+    on_access(index);
+    uint64_t page = index / PAGE_WORDS;
+    Region *r = regions[page / REGION_PAGES];
+    uint64_t slot = page % REGION_PAGES;
+    if (!r || !((r->populated[slot / 64] >> (slot % 64)) & 1)) {
+      const uint64_t *data = (reader && (page << PAGE_SHIFT) < img_size) ? populate(page) : zero_page;
+      return data[index % PAGE_WORDS];
+    }
+    return r->data[slot * PAGE_WORDS + index % PAGE_WORDS];
+  }
+  void clone(std::function<void(void *, uint64_t)> func, bool skip_zero = false) {
+    printf("clone_instant not support by SparseMemory\n");
+    assert(0);
+  }
+  void clone_on_demand(std::function<void(uint64_t, void *, size_t)> func, bool skip_zero = false);
   virtual inline uint64_t get_img_size() {
-    return reader->len();
+    return img_size;
   }
 };
 
@@ -213,7 +373,12 @@ public:
 
 extern SimMemory *simMemory;
 // This is to initialize the common mmap RAM
-void init_ram(const char *image, uint64_t n_bytes);
+void init_ram(const char *image, uint64_t n_bytes, bool share_image = false);
+#ifdef FUZZER_LIB
+// Keep the RAM from init_ram() for the next input, which resets only its accessed pages.
+// Other memories are deleted.
+void ram_recycle(SimMemory *mem);
+#endif // FUZZER_LIB
 void overwrite_ram(const char *gcpt_restore, uint64_t overwrite_nbytes);
 
 #ifdef WITH_DRAMSIM3
@@ -224,6 +389,8 @@ void dramsim3_finish();
 
 extern "C" uint64_t memory_response(bool isWrite);
 extern "C" bool memory_request(uint64_t address, uint32_t id, bool isWrite);
+// Bulk version for a whole cycle. Return the number of responses written to id.
+extern "C" uint32_t memory_response_batch(bool isWrite, uint32_t *id, uint32_t max_n);
 
 struct dramsim3_meta {
   uint32_t id;
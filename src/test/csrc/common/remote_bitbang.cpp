@@ -8,13 +8,15 @@
 #include <cstdlib>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 /////////// remote_bitbang_t
 
-remote_bitbang_t::remote_bitbang_t(uint16_t port) : err(0), socket_fd(0), client_fd(0), recv_start(0), recv_end(0) {
+remote_bitbang_t::remote_bitbang_t(uint16_t port)
+    : err(0), socket_fd(0), client_fd(0), recv_start(0), recv_end(0), send_end(0), idle_ticks(0), idle_backoff(0) {
   socket_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (socket_fd == -1) {
     fprintf(stderr, "remote_bitbang failed to make socket: %s (%d)\n", strerror(errno), errno);
@@ -68,7 +70,8 @@ void remote_bitbang_t::accept() {
     client_fd = ::accept(socket_fd, NULL, NULL);
     if (client_fd == -1) {
       if (errno == EAGAIN) {
-        // No client waiting to connect right now.
+        // No client waiting to connect right now. Sleep until one does.
+        wait_readable(socket_fd);
       } else {
         fprintf(stderr, "failed to accept on socket: %s (%d)\n", strerror(errno), errno);
         again = 0;
@@ -77,16 +80,35 @@ void remote_bitbang_t::accept() {
     } else {
       fcntl(client_fd, F_SETFL, O_NONBLOCK);
       fprintf(stderr, "Accepted successfully.");
+      recv_start = recv_end = 0;
+      send_end = 0;
+      idle_ticks = idle_backoff = 0;
       again = 0;
     }
   }
 }
 
+void remote_bitbang_t::wait_readable(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+    ;
+}
+
+void remote_bitbang_t::wait_writable(int fd) {
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+    ;
+}
+
 void remote_bitbang_t::tick(unsigned char *jtag_tck, unsigned char *jtag_tms, unsigned char *jtag_tdi,
                             unsigned char *jtag_trstn, unsigned char jtag_tdo) {
   if (client_fd > 0) {
     tdo = jtag_tdo;
-    execute_command();
+    if (idle_ticks > 0) {
+      idle_ticks--;
+    } else {
+      execute_commands();
+    }
   } else {
     this->accept();
   }
@@ -107,69 +129,98 @@ void remote_bitbang_t::set_pins(char _tck, char _tms, char _tdi) {
   tdi = _tdi;
 }
 
-void remote_bitbang_t::execute_command() {
-  char command;
-  int again = 1;
-  while (again) {
-    ssize_t num_read = read(client_fd, &command, sizeof(command));
-    if (num_read == -1) {
+bool remote_bitbang_t::read_commands() {
+  while (1) {
+    ssize_t num_read = read(client_fd, recv_buf, buf_size);
+    if (num_read > 0) {
+      recv_start = 0;
+      recv_end = num_read;
+      idle_backoff = 0;
+      return true;
+    }
+    if (num_read == 0) {
+      // The client closed the connection without sending 'Q'
+      recv_buf[0] = 'Q';
+      recv_start = 0;
+      recv_end = 1;
+      return true;
+    }
+    if (errno == EAGAIN) {
+      idle_backoff = idle_backoff ? std::min(idle_backoff * 2, (int)max_idle_backoff) : 1;
+      idle_ticks = idle_backoff;
+      return false;
+    }
+    if (errno != EINTR) {
+      fprintf(stderr, "remote_bitbang failed to read on socket: %s (%d)\n", strerror(errno), errno);
+      abort();
+    }
+  }
+}
+
+void remote_bitbang_t::flush_responses() {
+  ssize_t sent = 0;
+  while (sent < send_end) {
+    ssize_t bytes = write(client_fd, send_buf + sent, send_end - sent);
+    if (bytes == -1) {
       if (errno == EAGAIN) {
-        // We'll try again the next call.
-        //fprintf(stderr, "Received no command. Will try again on the next call\n");
-      } else {
-        fprintf(stderr, "remote_bitbang failed to read on socket: %s (%d)\n", strerror(errno), errno);
-        again = 0;
+        wait_writable(client_fd);
+      } else if (errno != EINTR) {
+        fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
         abort();
       }
-    } else if (num_read == 0) {
-      fprintf(stderr, "No Command Received.\n");
-      again = 1;
     } else {
-      again = 0;
+      sent += bytes;
     }
   }
+  send_end = 0;
+}
 
-  //fprintf(stderr, "Received a command %c\n", command);
-
-  int dosend = 0;
-
-  char tosend = '?';
-
-  switch (command) {
-    case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
-    case 'b': /* fprintf(stderr, "_______\n"); */ break;
-    case 'r': reset(); break; // This is wrong. 'r' has other bits that indicated TRST and SRST.
-    case '0': set_pins(0, 0, 0); break;
-    case '1': set_pins(0, 0, 1); break;
-    case '2': set_pins(0, 1, 0); break;
-    case '3': set_pins(0, 1, 1); break;
-    case '4': set_pins(1, 0, 0); break;
-    case '5': set_pins(1, 0, 1); break;
-    case '6': set_pins(1, 1, 0); break;
-    case '7': set_pins(1, 1, 1); break;
-    case 'R':
-      dosend = 1;
-      tosend = tdo ? '1' : '0';
-      break;
-    case 'Q': quit = 1; break;
-    default: fprintf(stderr, "remote_bitbang got unsupported command '%c'\n", command);
-  }
-
-  if (dosend) {
-    while (1) {
-      ssize_t bytes = write(client_fd, &tosend, sizeof(tosend));
-      if (bytes == -1) {
-        fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
-        abort();
+void remote_bitbang_t::execute_commands() {
+  bool pins_changed = false;
+  while (!pins_changed && !quit) {
+    if (recv_start == recv_end) {
+      // The client waits for the responses before sending more commands
+      flush_responses();
+      if (!read_commands()) {
+        return;
       }
-      if (bytes > 0) {
+    }
+    char command = recv_buf[recv_start++];
+
+    //fprintf(stderr, "Received a command %c\n", command);
+
+    switch (command) {
+      case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
+      case 'b': /* fprintf(stderr, "_______\n"); */ break;
+      case 'r': reset(); break; // This is wrong. 'r' has other bits that indicated TRST and SRST.
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7': {
+        int pins = command - '0';
+        // Pins set to their current values make no edge and take no tick
+        pins_changed = (tck << 2 | tms << 1 | tdi) != pins;
+        set_pins((pins >> 2) & 1, (pins >> 1) & 1, pins & 1);
         break;
       }
+      case 'R':
+        if (send_end == buf_size) {
+          flush_responses();
+        }
+        send_buf[send_end++] = tdo ? '1' : '0';
+        break;
+      case 'Q': quit = 1; break;
+      default: fprintf(stderr, "remote_bitbang got unsupported command '%c'\n", command);
     }
   }
 
   if (quit) {
-    // The remote disconnected.
+    // The remote disconnected, and waits for no responses.
+    send_end = 0;
     fprintf(stderr, "Remote end disconnected\n");
     close(client_fd);
     client_fd = 0;
@@ -45,13 +45,27 @@ private:
   static const ssize_t buf_size = 64 * 1024;
   char recv_buf[buf_size];
   ssize_t recv_start, recv_end;
+  // Responses are sent when the client has to wait for them, i.e. when its commands run out
+  char send_buf[buf_size];
+  ssize_t send_end;
+
+  // While the client sends nothing, the socket is read every idle_backoff ticks,
+  // doubled up to max_idle_backoff, and the simulation runs on.
+  static const int max_idle_backoff = 16;
+  int idle_ticks, idle_backoff;
 
   // Check for a client connecting, and accept if there is one.
   void accept();
-  // Execute any commands the client has for us.
-  // But we only execute 1 because we need time for the
-  // simulation to run.
-  void execute_command();
+  // Block until fd is readable
+  void wait_readable(int fd);
+  // Block until fd is writable
+  void wait_writable(int fd);
+  // Read the commands available without blocking. Return false if there are none.
+  bool read_commands();
+  void flush_responses();
+  // Execute the commands the client has for us, up to the first one changing the pins,
+  // because the simulation needs time to see them. Reads and no-ops before it take no ticks.
+  void execute_commands();
 
   // Reset. Currently does nothing.
   void reset();
@@ -20,10 +20,18 @@
 #include "perf.h"
 #endif // CONFIG_DIFFTEST_PERFCNT
 
-FILE *fp = NULL;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The image is mapped privately and read-only. Pages are shared with other simulations of the same image.
+static uint8_t *sd_image = NULL;
+static uint64_t sd_size = 0;
+static uint64_t sd_offset = 0;
 
 void check_sdcard() {
-  if (!fp) {
+  if (!sd_image) {
     eprintf(ANSI_COLOR_MAGENTA "[warning] sdcard img not found\n");
   }
 }
@@ -34,9 +42,7 @@ void sd_setaddr(uint32_t addr) {
   difftest_bytes[perf_sd_set_addr] += 4;
 #endif // CONFIG_DIFFTEST_PERFCNT
   check_sdcard();
-#ifdef SDCARD_IMAGE
-  fseek(fp, addr, SEEK_SET);
-#endif
+  sd_offset = addr;
   //printf("set addr to 0x%08x\n", addr);
   //assert(0);
 }
@@ -47,22 +53,46 @@ void sd_read(uint32_t *data) {
   difftest_bytes[perf_sd_read] += 4;
 #endif // CONFIG_DIFFTEST_PERFCNT
   check_sdcard();
-#ifdef SDCARD_IMAGE
-  fread(data, 4, 1, fp);
-#endif
+  if (sd_offset < sd_size) {
+    memcpy(data, sd_image + sd_offset, std::min((uint64_t)4, sd_size - sd_offset));
+    sd_offset += 4;
+  }
   //printf("read data = 0x%08x\n", *data);
   //assert(0);
 }
 
+uint64_t sd_get_offset() {
+  return sd_offset;
+}
+
+void sd_set_offset(uint64_t offset) {
+  sd_offset = offset;
+}
+
 void init_sd(void) {
 #ifdef SDCARD_IMAGE
-  fp = fopen(SDCARD_IMAGE, "r");
+  int fd = open(SDCARD_IMAGE, O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      sd_image = (uint8_t *)ptr;
+      sd_size = st.st_size;
+      // the DUT reads blocks sequentially
+      madvise(sd_image, sd_size, MADV_SEQUENTIAL);
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
   check_sdcard();
 #endif
 }
 
 void finish_sd(void) {
-#ifdef SDCARD_IMAGE
-  fclose(fp);
-#endif
+  if (sd_image) {
+    munmap(sd_image, sd_size);
+    sd_image = NULL;
+    sd_size = 0;
+  }
 }
@@ -19,9 +19,11 @@
 
 #include "common.h"
 
-extern FILE *fp;
 extern "C" void sd_setaddr(uint32_t addr);
 extern "C" void sd_read(uint32_t *data);
+// read position in the image, saved in snapshots
+uint64_t sd_get_offset();
+void sd_set_offset(uint64_t offset);
 void init_sd(void);
 void finish_sd(void);
 #endif // __SDCARD_H
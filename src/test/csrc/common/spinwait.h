@@ -0,0 +1,34 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __SPINWAIT_H__
+#define __SPINWAIT_H__
+
+#include <thread>
+#include <xmmintrin.h>
+
+// spin this many rounds before yielding the cpu while waiting
+#define DIFFTEST_SPIN_LIMIT 4096
+
+static inline void difftest_spin_wait(int &spin) {
+  if (spin < DIFFTEST_SPIN_LIMIT) {
+    spin++;
+    _mm_pause();
+  } else {
+    std::this_thread::yield();
+  }
+}
+
+#endif // __SPINWAIT_H__
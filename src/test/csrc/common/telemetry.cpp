@@ -0,0 +1,135 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "telemetry.h"
+#include "affinity.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+TelemetryCounters telemetry;
+
+struct TelemetryGauge {
+  std::string name;
+  std::function<uint64_t()> gauge;
+};
+
+static std::mutex telemetry_mutex;
+static std::condition_variable telemetry_cv;
+static std::vector<TelemetryGauge> telemetry_gauges;
+static std::thread telemetry_thread;
+static bool telemetry_exit = false;
+// The telemetry thread is not inherited by a LightSSS child
+static pid_t telemetry_pid = 0;
+
+void telemetry_add_gauge(const char *name, std::function<uint64_t()> gauge) {
+  std::lock_guard<std::mutex> lock(telemetry_mutex);
+  telemetry_gauges.push_back({name, gauge});
+}
+
+static void telemetry_loop(FILE *fp, int sock, uint64_t interval_ms) {
+  uint64_t start_ns = telemetry_ns();
+  uint64_t last_ns = start_ns, last_cycles = 0, last_instrs = 0, last_check_ns = 0;
+  std::unique_lock<std::mutex> lock(telemetry_mutex);
+  while (!telemetry_cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [] { return telemetry_exit; })) {
+    uint64_t now = telemetry_ns();
+    uint64_t cycles = telemetry.cycles.load(std::memory_order_relaxed);
+    uint64_t instrs = telemetry.instrs.load(std::memory_order_relaxed);
+    uint64_t check_ns = telemetry.check_ns.load(std::memory_order_relaxed);
+    double elapsed = now - last_ns;
+    char line[1024];
+    int n = snprintf(line, sizeof(line),
+                     "{\"time_ms\":%lu,\"cycles\":%lu,\"instrs\":%lu,\"khz\":%.3f,\"ipc\":%.4f,\"ref_stall\":%.4f",
+                     (now - start_ns) / 1000000, cycles, instrs, (cycles - last_cycles) * 1e6 / elapsed,
+                     cycles > last_cycles ? (double)(instrs - last_instrs) / (cycles - last_cycles) : 0,
+                     (check_ns - last_check_ns) / elapsed);
+    for (auto &g: telemetry_gauges) {
+      if (n < (int)sizeof(line)) {
+        n += snprintf(line + n, sizeof(line) - n, ",\"%s\":%lu", g.name.c_str(), g.gauge());
+      }
+    }
+    if (n < (int)sizeof(line)) {
+      n += snprintf(line + n, sizeof(line) - n, "}\n");
+    }
+    if (n < (int)sizeof(line)) {
+      if (fp) {
+        fputs(line, fp);
+        fflush(fp);
+      } else {
+        send(sock, line, n, MSG_DONTWAIT);
+      }
+    }
+    last_ns = now;
+    last_cycles = cycles;
+    last_instrs = instrs;
+    last_check_ns = check_ns;
+  }
+  if (fp) {
+    fclose(fp);
+  } else {
+    close(sock);
+  }
+}
+
+void telemetry_start(const char *path, uint64_t interval_ms) {
+  FILE *fp = NULL;
+  int sock = -1;
+  if (!strncmp(path, "unix:", 5)) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path + 5, sizeof(addr.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+      printf("Cannot connect to telemetry socket %s\n", path + 5);
+      if (sock >= 0) {
+        close(sock);
+      }
+      return;
+    }
+  } else {
+    fp = fopen(path, "w");
+    if (!fp) {
+      printf("Cannot open telemetry file %s\n", path);
+      return;
+    }
+  }
+  Info("Telemetry is written to %s every %lu ms\n", path, interval_ms);
+  telemetry_exit = false;
+  telemetry_pid = getpid();
+  telemetry_thread = std::thread(telemetry_loop, fp, sock, interval_ms);
+  affinity_place_thread(telemetry_thread.native_handle(), "telemetry", AFFINITY_HELPER);
+}
+
+void telemetry_stop() {
+  if (!telemetry_thread.joinable()) {
+    return;
+  }
+  if (telemetry_pid != getpid()) {
+    // the mutex may be held by the thread of the parent, and the handle is leaked rather than joined
+    new std::thread(std::move(telemetry_thread));
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(telemetry_mutex);
+    telemetry_exit = true;
+  }
+  telemetry_cv.notify_all();
+  telemetry_thread.join();
+}
@@ -0,0 +1,45 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include "common.h"
+#include <atomic>
+#include <functional>
+#include <time.h>
+
+// Progress of the simulation thread, sampled by the telemetry thread
+struct TelemetryCounters {
+  std::atomic<uint64_t> cycles{0};
+  std::atomic<uint64_t> instrs{0};
+  std::atomic<uint64_t> check_ns{0}; // time spent in the difftest checker
+};
+extern TelemetryCounters telemetry;
+
+static inline uint64_t telemetry_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// Write a JSON line every interval_ms to path, or to the UNIX datagram socket at path if it starts with "unix:".
+// Records are dropped rather than blocking if the socket is not ready.
+void telemetry_start(const char *path, uint64_t interval_ms);
+void telemetry_stop();
+// Add a field to every record. The gauge is called on the telemetry thread.
+void telemetry_add_gauge(const char *name, std::function<uint64_t()> gauge);
+
+#endif // __TELEMETRY_H__
@@ -16,6 +16,7 @@
 
 #include "uart.h"
 #include "common.h"
+#include "console.h"
 #include "stdlib.h"
 
 #define QUEUE_SIZE 1024
@@ -49,18 +50,16 @@ static int uart_dequeue(void) {
 
 uint32_t uptime(void);
 uint8_t uart_getc() {
-  static uint32_t lasttime = 0;
-  uint32_t now = uptime();
-
+  console_polled = true;
   uint8_t ch = -1;
-  if (now - lasttime > 60 * 1000) {
-    // 1 minute
-    eprintf(ANSI_COLOR_RED "now = %ds\n" ANSI_COLOR_RESET, now / 1000);
-    lasttime = now;
+  if (f != r) {
+    ch = uart_dequeue();
+  } else {
+    int k = console_getc();
+    if (k >= 0) {
+      ch = k;
+    }
   }
-  // if (now > 4 * 3600 * 1000) { // 4 hours
-  //   ch = uart_dequeue();
-  // }
   return ch;
 }
 
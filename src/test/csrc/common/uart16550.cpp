@@ -16,6 +16,7 @@
 
 #include "uart16550.h"
 #include "common.h"
+#include "console.h"
 #include "stdlib.h"
 
 // 16550 UART Constants
@@ -113,48 +114,32 @@ static uint8_t uart16550_get_lsr(void) {
 
 // Main UART getc function for 16550
 uint8_t uart16550_getc() {
-  static uint32_t lasttime = 0;
-  uint32_t now = uptime();
-
-  uint8_t ch = 0xff; // Default value like NEMU
-  if (now - lasttime > 60 * 1000) {
-    // 1 minute
-    eprintf(ANSI_COLOR_RED "uart16550: now = %ds\n" ANSI_COLOR_RESET, now / 1000);
-    lasttime = now;
-  }
-  
-  // Return data from RX FIFO if available
-  if (rx_f != rx_r) {
-    ch = uart16550_rx_dequeue();
-  }
-  
+  uint8_t ch;
+  uart16550_getc_legacy(&ch);
   return ch;
 }
 
 // Legacy getc function for compatibility
 void uart16550_getc_legacy(uint8_t *ch) {
-  static uint32_t lasttime = 0;
-  uint32_t now = uptime();
+  console_polled = true;
 
-  *ch = 0xff; // Default value
-  if (now - lasttime > 60 * 1000) {
-    // 1 minute
-    eprintf(ANSI_COLOR_RED "uart16550: now = %ds\n" ANSI_COLOR_RESET, now / 1000);
-    lasttime = now;
-  }
-  
-  // Return data from RX FIFO if available
+  *ch = 0xff; // Default value like NEMU
+
+  // Return data from RX FIFO if available, and then from stdin
   if (rx_f != rx_r) {
     *ch = uart16550_rx_dequeue();
+  } else {
+    int k = console_getc();
+    if (k >= 0) {
+      *ch = k;
+    }
   }
 }
 
 // Put character to TX FIFO (simulated output)
 void uart16550_putc(uint8_t ch) {
   uart16550_tx_enqueue(ch);
-  // In real implementation, this would be sent to stdout
-  printf("%c", ch);
-  fflush(stdout);
+  console_putc(ch);
 }
 
 // Read 16550 register
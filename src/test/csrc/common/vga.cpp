@@ -20,18 +20,28 @@
 #include "perf.h"
 #endif // CONFIG_DIFFTEST_PERFCNT
 #ifdef SHOW_SCREEN
+#include "affinity.h"
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #define SCREEN_PORT 0x100 // Note that this is not the standard
 #define SCREEN_MMIO 0x4100
 #define SCREEN_H    600
 #define SCREEN_W    800
+#define SCREEN_FPS  60
 
-static uint32_t vmem[800 * 600];
+// The DPI calls only write vmem and mark the rows. SDL is owned by the render thread, which presents
+// the dirty rows after vmem_sync() at most SCREEN_FPS times a second and polls the window events.
+static uint32_t vmem[SCREEN_W * SCREEN_H];
+static std::atomic<uint8_t> vmem_dirty[SCREEN_H];
+static std::atomic<bool> vmem_synced(false);
+static std::atomic<bool> render_running(false);
+static std::thread *render_thread = nullptr;
+static pid_t render_pid = 0;
 
-static SDL_Window *window;
-static SDL_Renderer *renderer;
-static SDL_Texture *texture;
+void send_key(uint8_t, bool);
 
 void put_pixel(uint32_t pixel) {
 #ifdef CONFIG_DIFFTEST_PERFCNT
@@ -39,8 +49,10 @@ void put_pixel(uint32_t pixel) {
   difftest_bytes[perf_put_pixel] += 4;
 #endif // CONFIG_DIFFTEST_PERFCNT
   static int i = 0;
-  vmem[i++] = pixel;
-  if (i >= 800 * 600)
+  vmem[i] = pixel;
+  vmem_dirty[i / SCREEN_W].store(1, std::memory_order_release);
+  i++;
+  if (i >= SCREEN_W * SCREEN_H)
     i = 0;
 }
 
@@ -48,20 +60,91 @@ void vmem_sync(void) {
 #ifdef CONFIG_DIFFTEST_PERFCNT
   difftest_calls[perf_vmem_sync]++;
 #endif // CONFIG_DIFFTEST_PERFCNT
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+  vmem_synced.store(true, std::memory_order_release);
+}
+
+static void poll_event() {
+  SDL_Event event;
+  while (SDL_PollEvent(&event)) {
+    switch (event.type) {
+      case SDL_QUIT:
+        break; //set_abort();
+
+        // If a key was pressed
+      case SDL_KEYDOWN:
+      case SDL_KEYUP: {
+        uint8_t k = event.key.keysym.scancode;
+        bool is_keydown = (event.key.type == SDL_KEYDOWN);
+        send_key(k, is_keydown);
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+// Upload the span of the dirty rows. Rows written during the upload stay dirty for the next frame.
+static void present(SDL_Renderer *renderer, SDL_Texture *texture) {
+  int lo = SCREEN_H, hi = -1;
+  for (int row = 0; row < SCREEN_H; row++) {
+    if (vmem_dirty[row].exchange(0, std::memory_order_acquire)) {
+      lo = std::min(lo, row);
+      hi = row;
+    }
+  }
+  if (hi < 0) {
+    return;
+  }
+  SDL_Rect rect = {0, lo, SCREEN_W, hi - lo + 1};
+  SDL_UpdateTexture(texture, &rect, vmem + lo * SCREEN_W, SCREEN_W * sizeof(uint32_t));
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
 
-void init_sdl() {
+static void render_loop() {
+  SDL_Window *window;
+  SDL_Renderer *renderer;
   SDL_Init(SDL_INIT_VIDEO);
   SDL_CreateWindowAndRenderer(SCREEN_W, SCREEN_H, 0, &window, &renderer);
   SDL_SetWindowTitle(window, "NOOP");
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+  SDL_Texture *texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+
+  const uint32_t frame_ms = 1000 / SCREEN_FPS;
+  while (render_running.load(std::memory_order_relaxed)) {
+    uint32_t start = SDL_GetTicks();
+    poll_event();
+    if (vmem_synced.exchange(false, std::memory_order_acquire)) {
+      present(renderer, texture);
+    }
+    uint32_t spent = SDL_GetTicks() - start;
+    if (spent < frame_ms) {
+      SDL_Delay(frame_ms - spent);
+    }
+  }
+
+  SDL_DestroyTexture(texture);
+  SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+}
+
+void init_sdl() {
+  render_running.store(true);
+  render_pid = getpid();
+  render_thread = new std::thread(render_loop);
+  affinity_place_thread(render_thread->native_handle(), "vga render", AFFINITY_HELPER);
 }
 
 void finish_sdl() {
+  // LightSSS children have no render thread
+  if (render_thread && getpid() == render_pid) {
+    render_running.store(false);
+    render_thread->join();
+    delete render_thread;
+    render_thread = nullptr;
+  }
   memset(vmem, 0, sizeof(vmem));
 }
 #else
@@ -0,0 +1,151 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "workload.h"
+#include <fcntl.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+struct Workload {
+  std::string image;
+  uint64_t max_instr;
+  pid_t pid;
+  int status;
+  uint64_t start_ms, time_ms;
+};
+
+const char *workload_parse_args(int &argc, const char *argv[], int &jobs) {
+  const char *list = nullptr;
+  int n = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--workload-list=", 16)) {
+      list = argv[i] + 16;
+    } else if (!strncmp(argv[i], "--workload-jobs=", 16)) {
+      jobs = atoi(argv[i] + 16);
+    } else {
+      argv[n++] = argv[i];
+    }
+  }
+  argc = n;
+  argv[n] = nullptr;
+  return list;
+}
+
+static bool workload_load(const char *list, std::vector<Workload> &workloads) {
+  FILE *fp = fopen(list, "r");
+  if (!fp) {
+    printf("Fail to open workload list %s\n", list);
+    return false;
+  }
+  char name[1024];
+  unsigned long long num;
+  while (fscanf(fp, "%1023s %llu", name, &num) == 2) {
+    workloads.push_back({name, num, -1, 0, 0, 0});
+  }
+  bool ok = feof(fp);
+  if (!ok) {
+    printf("Unknown workload list format\n");
+  }
+  fclose(fp);
+  return ok;
+}
+
+static pid_t workload_start(const char *list, int index, Workload &w, bool redirect, int argc, const char *argv[],
+                            workload_main_t main) {
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("workload fork");
+    return pid;
+  }
+  if (pid > 0) {
+    return pid;
+  }
+
+  if (redirect) {
+    std::string log = std::string(list) + "." + std::to_string(index) + ".log";
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      dup2(fd, STDOUT_FILENO);
+      dup2(fd, STDERR_FILENO);
+      close(fd);
+    }
+  }
+  std::string image = "--image=" + w.image;
+  std::string max_instr = "--max-instr=" + std::to_string(w.max_instr);
+  std::vector<const char *> args(argv, argv + argc);
+  args.push_back(image.c_str());
+  if (w.max_instr) {
+    args.push_back(max_instr.c_str());
+  }
+  args.push_back(nullptr);
+  int ret = main(args.size() - 1, args.data());
+  fflush(stdout);
+  fflush(stderr);
+  _exit(ret);
+}
+
+int workload_run(const char *list, int jobs, int argc, const char *argv[], workload_main_t main) {
+  std::vector<Workload> workloads;
+  if (!workload_load(list, workloads)) {
+    return 1;
+  }
+  jobs = std::max(jobs, 1);
+  bool redirect = jobs > 1;
+  Info("Running %lu workloads from %s with %d jobs\n", workloads.size(), list, jobs);
+
+  size_t next = 0, running = 0;
+  while (next < workloads.size() || running) {
+    if (next < workloads.size() && running < (size_t)jobs) {
+      Workload &w = workloads[next];
+      w.start_ms = uptime();
+      w.pid = workload_start(list, next, w, redirect, argc, argv, main);
+      if (w.pid < 0) {
+        w.status = -1;
+      } else {
+        running++;
+      }
+      next++;
+      continue;
+    }
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      perror("workload wait");
+      break;
+    }
+    for (auto &w: workloads) {
+      if (w.pid == pid) {
+        w.status = status;
+        w.time_ms = uptime() - w.start_ms;
+        running--;
+      }
+    }
+  }
+
+  int failed = 0;
+  Info("Workload results:\n");
+  for (size_t i = 0; i < workloads.size(); i++) {
+    Workload &w = workloads[i];
+    bool good = w.pid > 0 && WIFEXITED(w.status) && WEXITSTATUS(w.status) == 0;
+    failed += !good;
+    Info("  [%lu] %-8s %8lums  %s\n", i, good ? "PASS" : "FAIL", w.time_ms, w.image.c_str());
+  }
+  Info("%lu workloads, %d failed\n", workloads.size(), failed);
+  return failed;
+}
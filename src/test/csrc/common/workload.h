@@ -0,0 +1,35 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __WORKLOAD_H
+#define __WORKLOAD_H
+
+#include "common.h"
+#include <functional>
+
+// Multi-workload runner. Each line of the list is "IMAGE MAX_INSTR" as for simv +workload_list,
+// where MAX_INSTR 0 means no limit. Every workload runs in its own forked process, so the
+// simulator, RAM, golden memory and REF singletons are private to it, while the program,
+// the REF library and the images are shared through the page cache.
+typedef std::function<int(int, const char **)> workload_main_t;
+
+// Remove --workload-list=FILE and --workload-jobs=N from argv. Return FILE, or nullptr if not given.
+const char *workload_parse_args(int &argc, const char *argv[], int &jobs);
+
+// Run main with the arguments plus --image and --max-instr for each workload, at most jobs at a time.
+// With more than one job, the output of workload i goes to LIST.i.log. Return the number of failures.
+int workload_run(const char *list, int jobs, int argc, const char *argv[], workload_main_t main);
+
+#endif // __WORKLOAD_H
@@ -15,23 +15,36 @@
 ***************************************************************************************/
 
 #include "difftest.h"
+#include "affinity.h"
+#include "compress.h"
 #include "difftrace.h"
 #include "dut.h"
 #include "flash.h"
 #include "goldenmem.h"
+#include "parallel.h"
 #include "ram.h"
 #include "spikedasm.h"
+#include "telemetry.h"
 #if defined(CONFIG_DIFFTEST_SQUASH) && !defined(CONFIG_DIFFTEST_FPGA)
 #include "svdpi.h"
 #endif // CONFIG_DIFFTEST_SQUASH && !CONFIG_DIFFTEST_FPGA
 #ifdef CONFIG_DIFFTEST_PERFCNT
 #include "perf.h"
 #endif // CONFIG_DIFFTEST_PERFCNT
+#include "profile.h"
 #ifdef CONFIG_DIFFTEST_QUERY
 #include "query.h"
 #endif // CONFIG_DIFFTEST_QUERY
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif // __AVX512F__ || __AVX2__
 
 Difftest **difftest = NULL;
+#ifdef CONFIG_DIFFTEST_PARALLEL
+static ParallelChecker *parallel_checker = NULL;
+#endif // CONFIG_DIFFTEST_PARALLEL
+
+static int difftest_check();
 
 int difftest_init() {
 #ifdef CONFIG_DIFFTEST_PERFCNT
@@ -43,15 +56,67 @@ int difftest_init() {
 #ifdef CONFIG_DIFFTEST_QUERY
   difftest_query_init();
 #endif // CONFIG_DIFFTEST_QUERY
+#ifdef CONFIG_DIFFTEST_PROFILE
+  difftest_profile_init();
+#endif // CONFIG_DIFFTEST_PROFILE
   diffstate_buffer_init();
   difftest = new Difftest *[NUM_CORES];
   for (int i = 0; i < NUM_CORES; i++) {
     difftest[i] = new Difftest(i);
     difftest[i]->dut = diffstate_buffer[i]->get(0, 0);
   }
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  parallel_checker = new ParallelChecker(NUM_CORES, [](int i) {
+#ifdef DEBUG_GOLDENMEM
+    goldenmem_set_view(i);
+#endif // DEBUG_GOLDENMEM
+    int ret = difftest[i]->step();
+#ifdef DEBUG_GOLDENMEM
+    goldenmem_set_view(-1);
+#endif // DEBUG_GOLDENMEM
+    return ret;
+  });
+#endif // CONFIG_DIFFTEST_PARALLEL
   return 0;
 }
 
+// Idle REF instances of finished workloads. They are reset and reused by the next workload,
+// which saves loading and initializing REF again.
+static bool ref_pool_enabled = false;
+static REF_PROXY *ref_pool[NUM_CORES] = {};
+static size_t ref_pool_ramsize[NUM_CORES] = {};
+
+void difftest_ref_pool_enable() {
+  ref_pool_enabled = true;
+}
+
+void difftest_ref_pool_free() {
+  for (int i = 0; i < NUM_CORES; i++) {
+    delete ref_pool[i];
+    ref_pool[i] = NULL;
+  }
+  ref_pool_enabled = false;
+}
+
+// Sampled difftest, disabled if sample_interval is 0
+static uint64_t sample_window = 0;
+static uint64_t sample_interval = 0;
+
+void difftest_sample_enable(uint64_t window, uint64_t interval) {
+  Info("Checking %lu of every %lu instructions\n", window, interval);
+  sample_window = window;
+  sample_interval = interval;
+}
+
+int difftest_sample_disable() {
+  int ret = 0;
+  for (int i = 0; i < NUM_CORES; i++) {
+    ret = ret ? ret : difftest[i]->sample_flush();
+  }
+  sample_interval = 0;
+  return ret;
+}
+
 int init_nemuproxy(size_t ramsize = 0) {
   for (int i = 0; i < NUM_CORES; i++) {
     difftest[i]->update_nemuproxy(i, ramsize);
@@ -71,6 +136,188 @@ int difftest_state() {
   return STATE_RUNNING;
 }
 
+#ifdef CONFIG_DIFFTEST_ASYNC
+// The simulation thread copies DUT states of every step into a bounded ring,
+// and the checker thread consumes them in order. Only the first non-running
+// status is reported back, together with the cycle at which it was found.
+struct AsyncSlot {
+  int step;
+  bool enable_diff;
+  // requests of the simulation thread for core i, -1 for no change
+  int8_t ref_debug[NUM_CORES];
+  int8_t commit_trace[NUM_CORES];
+  DiffTestState state[CONFIG_DIFFTEST_BUFLEN][NUM_CORES];
+};
+
+static AsyncSlot *async_ring = NULL;
+static std::thread *async_thread = NULL;
+static std::atomic<uint64_t> async_head(0); // # of slots produced
+static std::atomic<uint64_t> async_tail(0); // # of slots checked
+static std::atomic<int> async_status(STATE_RUNNING);
+static std::atomic<bool> async_exit(false);
+static uint64_t async_fail_cycle = 0;
+static uint64_t async_fail_lag = 0; // # of slots pushed but not checked at the failure
+// Owned by the simulation thread: trap events of the last pushed states, and requests for the next slot
+static DifftestTrapEvent async_trap[NUM_CORES];
+static int8_t async_ref_debug[NUM_CORES];
+static int8_t async_commit_trace[NUM_CORES];
+
+static int difftest_async_check(AsyncSlot *slot) {
+  for (int i = 0; i < NUM_CORES; i++) {
+    if (slot->ref_debug[i] >= 0) {
+      difftest[i]->proxy->set_debug(slot->ref_debug[i]);
+    }
+    if (slot->commit_trace[i] >= 0) {
+      difftest[i]->set_commit_trace(slot->commit_trace[i]);
+    }
+  }
+  for (int k = 0; k < slot->step; k++) {
+    for (int i = 0; i < NUM_CORES; i++) {
+      difftest[i]->dut = &slot->state[k][i];
+    }
+    if (slot->enable_diff && difftest_check()) {
+      return STATE_ABORT;
+    }
+    int status = difftest_state();
+    if (status != STATE_RUNNING) {
+      return status;
+    }
+  }
+  return STATE_RUNNING;
+}
+
+static void difftest_async_loop() {
+  uint64_t tail = async_tail.load(std::memory_order_relaxed);
+  while (true) {
+    int spin = 0;
+    while (async_head.load(std::memory_order_acquire) == tail) {
+      if (async_exit.load(std::memory_order_acquire)) {
+        return;
+      }
+      difftest_spin_wait(spin);
+    }
+    int status = difftest_async_check(&async_ring[tail % DIFFTEST_ASYNC_DEPTH]);
+    async_tail.store(++tail, std::memory_order_release);
+    if (status != STATE_RUNNING) {
+      async_fail_cycle = difftest[0]->get_trap_event()->cycleCnt;
+      async_fail_lag = async_head.load(std::memory_order_acquire) - tail;
+      async_status.store(status, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+static int difftest_async_push(int step, bool enable_diff) {
+  int status = async_status.load(std::memory_order_acquire);
+  if (status != STATE_RUNNING || step == 0) {
+    return status;
+  }
+  uint64_t head = async_head.load(std::memory_order_relaxed);
+  int spin = 0;
+  while (head - async_tail.load(std::memory_order_acquire) >= DIFFTEST_ASYNC_DEPTH) {
+    status = async_status.load(std::memory_order_acquire);
+    if (status != STATE_RUNNING) {
+      return status;
+    }
+    difftest_spin_wait(spin);
+  }
+  AsyncSlot *slot = &async_ring[head % DIFFTEST_ASYNC_DEPTH];
+  slot->step = step;
+  slot->enable_diff = enable_diff;
+  memcpy(slot->ref_debug, async_ref_debug, sizeof(async_ref_debug));
+  memcpy(slot->commit_trace, async_commit_trace, sizeof(async_commit_trace));
+  memset(async_ref_debug, -1, sizeof(async_ref_debug));
+  memset(async_commit_trace, -1, sizeof(async_commit_trace));
+  for (int k = 0; k < step; k++) {
+    for (int i = 0; i < NUM_CORES; i++) {
+      memcpy(&slot->state[k][i], diffstate_buffer[i]->next(), sizeof(DiffTestState));
+    }
+#if defined(CONFIG_DIFFTEST_QUERY) && !defined(CONFIG_DIFFTEST_BATCH)
+    difftest_query_step();
+#endif // CONFIG_DIFFTEST_QUERY
+  }
+  for (int i = 0; i < NUM_CORES; i++) {
+    async_trap[i] = slot->state[step - 1][i].trap;
+  }
+  async_head.store(head + 1, std::memory_order_release);
+  return STATE_RUNNING;
+}
+
+void difftest_async_start() {
+  async_ring = new AsyncSlot[DIFFTEST_ASYNC_DEPTH];
+  async_head.store(0);
+  async_tail.store(0);
+  async_status.store(STATE_RUNNING);
+  async_exit.store(false);
+  for (int i = 0; i < NUM_CORES; i++) {
+    async_trap[i] = *difftest[i]->get_trap_event();
+  }
+  memset(async_ref_debug, -1, sizeof(async_ref_debug));
+  memset(async_commit_trace, -1, sizeof(async_commit_trace));
+  async_thread = new std::thread(difftest_async_loop);
+  affinity_place_thread(async_thread->native_handle(), "difftest async");
+}
+
+int difftest_async_stop() {
+  if (!async_thread) {
+    return STATE_RUNNING;
+  }
+  // check all states pushed before the simulation stops
+  int spin = 0;
+  while (async_status.load(std::memory_order_acquire) == STATE_RUNNING &&
+         async_tail.load(std::memory_order_acquire) != async_head.load(std::memory_order_relaxed)) {
+    difftest_spin_wait(spin);
+  }
+  async_exit.store(true, std::memory_order_release);
+  async_thread->join();
+  delete async_thread;
+  async_thread = NULL;
+  // the last checked states are still used to display trap info
+  for (int i = 0; i < NUM_CORES; i++) {
+    DiffTestState *dut = diffstate_buffer[i]->get(0, 0);
+    memcpy(dut, difftest[i]->dut, sizeof(DiffTestState));
+    difftest[i]->dut = dut;
+  }
+  delete[] async_ring;
+  async_ring = NULL;
+  int status = async_status.load();
+  if (status != STATE_RUNNING) {
+    Info("The async checker stopped at cycle %lu with state %d, %lu steps behind the simulation.\n",
+         async_fail_cycle, status, async_fail_lag);
+  }
+  return status;
+}
+#endif // CONFIG_DIFFTEST_ASYNC
+
+DifftestTrapEvent *difftest_trap_event(int i) {
+#ifdef CONFIG_DIFFTEST_ASYNC
+  if (async_thread) {
+    return &async_trap[i];
+  }
+#endif // CONFIG_DIFFTEST_ASYNC
+  return difftest[i]->get_trap_event();
+}
+
+void difftest_set_ref_debug(int i, bool enable) {
+#ifdef CONFIG_DIFFTEST_ASYNC
+  if (async_thread) {
+    async_ref_debug[i] = enable;
+    return;
+  }
+#endif // CONFIG_DIFFTEST_ASYNC
+  difftest[i]->proxy->set_debug(enable);
+}
+
+void difftest_set_commit_trace(int i, bool enable) {
+#ifdef CONFIG_DIFFTEST_ASYNC
+  if (async_thread) {
+    async_commit_trace[i] = enable;
+    return;
+  }
+#endif // CONFIG_DIFFTEST_ASYNC
+  difftest[i]->set_commit_trace(enable);
+}
+
 int difftest_nstep(int step, bool enable_diff) {
 #ifdef CONFIG_DIFFTEST_PERFCNT
   difftest_calls[perf_difftest_nstep]++;
@@ -80,6 +327,11 @@ int difftest_nstep(int step, bool enable_diff) {
 #if CONFIG_DIFFTEST_ZONESIZE > 1
   difftest_switch_zone();
 #endif // CONFIG_DIFFTEST_ZONESIZE
+#ifdef CONFIG_DIFFTEST_ASYNC
+  if (async_thread) {
+    return difftest_async_push(step, enable_diff);
+  }
+#endif // CONFIG_DIFFTEST_ASYNC
   for (int i = 0; i < step; i++) {
     if (enable_diff) {
       if (difftest_step())
@@ -104,11 +356,40 @@ void difftest_set_dut() {
     difftest[i]->dut = diffstate_buffer[i]->next();
   }
 }
+static void (*difftest_step_hook)() = nullptr;
+void difftest_set_step_hook(void (*hook)()) {
+  difftest_step_hook = hook;
+}
 int difftest_step() {
   difftest_set_dut();
+  if (difftest_step_hook) {
+    difftest_step_hook();
+  }
 #if defined(CONFIG_DIFFTEST_QUERY) && !defined(CONFIG_DIFFTEST_BATCH)
   difftest_query_step();
 #endif // CONFIG_DIFFTEST_QUERY
+  return difftest_check();
+}
+
+// Check the DUT states currently pointed by difftest[i]->dut
+static int difftest_check() {
+#ifdef CONFIG_DIFFTEST_PARALLEL
+#ifdef DEBUG_GOLDENMEM
+  // Golden memory is shared by all cores. Apply its updates here in the order of cores, and journal the
+  // overwritten words, so that the checker of each core reads the memory before the stores of later cores.
+  goldenmem_cycle_begin();
+  for (int i = 0; i < NUM_CORES; i++) {
+    goldenmem_set_writer(i);
+    int ret = difftest[i]->do_golden_memory_update();
+    if (ret) {
+      goldenmem_set_writer(-1);
+      return ret;
+    }
+  }
+  goldenmem_set_writer(-1);
+#endif // DEBUG_GOLDENMEM
+  return parallel_checker->run();
+#else
   for (int i = 0; i < NUM_CORES; i++) {
     int ret = difftest[i]->step();
     if (ret) {
@@ -116,6 +397,7 @@ int difftest_step() {
     }
   }
   return 0;
+#endif // CONFIG_DIFFTEST_PARALLEL
 }
 
 void difftest_trace_read() {
@@ -130,23 +412,36 @@ void difftest_trace_write(int step) {
   }
 }
 
-void difftest_finish() {
+int difftest_finish() {
+  int status = STATE_RUNNING;
+#ifdef CONFIG_DIFFTEST_ASYNC
+  status = difftest_async_stop();
+#endif // CONFIG_DIFFTEST_ASYNC
 #ifdef CONFIG_DIFFTEST_PERFCNT
   uint64_t cycleCnt = difftest[0]->get_trap_event()->cycleCnt;
   difftest_perfcnt_finish(cycleCnt);
 #endif // CONFIG_DIFFTEST_PERFCNT
+#ifdef CONFIG_DIFFTEST_PROFILE
+  difftest_profile_dump();
+#endif // CONFIG_DIFFTEST_PROFILE
 #ifdef CONFIG_DIFFTEST_IOTRACE
   difftest_iotrace_free();
 #endif // CONFIG_DIFFTEST_IOTRACE
 #ifdef CONFIG_DIFFTEST_QUERY
   difftest_query_finish();
 #endif // CONFIG_DIFFTEST_QUERY
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  delete parallel_checker;
+  parallel_checker = NULL;
+#endif // CONFIG_DIFFTEST_PARALLEL
   diffstate_buffer_free();
   for (int i = 0; i < NUM_CORES; i++) {
     delete difftest[i];
   }
   delete[] difftest;
   difftest = NULL;
+  asynclog_flush();
+  return status;
 }
 
 #if defined(CONFIG_DIFFTEST_SQUASH) && !defined(CONFIG_DIFFTEST_FPGA)
@@ -193,7 +488,9 @@ Difftest::Difftest(int coreid) : id(coreid) {
 Difftest::~Difftest() {
   delete state;
   delete difftrace;
-  if (proxy) {
+  if (proxy && ref_pool_enabled && !ref_pool[id]) {
+    ref_pool[id] = proxy;
+  } else if (proxy) {
     delete proxy;
   }
 #ifdef CONFIG_DIFFTEST_REPLAY
@@ -209,7 +506,20 @@ bool enable_vec_load_goldenmem_check = true;
 #endif // CONFIG_DIFFTEST_LOADEVENT && CONFIG_DIFFTEST_ARCHVECREGSTATE
 
 void Difftest::update_nemuproxy(int coreid, size_t ram_size = 0) {
-  proxy = new REF_PROXY(coreid, ram_size);
+  REF_PROXY *pooled = ref_pool[coreid];
+  ref_pool[coreid] = NULL;
+  if (pooled && ref_pool_ramsize[coreid] == ram_size && pooled->reset()) {
+    Info("Reusing the REF instance of core %d\n", coreid);
+    proxy = pooled;
+    if (NUM_CORES > 1) {
+      proxy->ref_set_mhartid(coreid);
+      proxy->ref_put_gmaddr(ref_golden_mem);
+    }
+  } else {
+    delete pooled;
+    proxy = new REF_PROXY(coreid, ram_size);
+    ref_pool_ramsize[coreid] = ram_size;
+  }
 #if defined(CONFIG_DIFFTEST_LOADEVENT) && defined(CONFIG_DIFFTEST_ARCHVECREGSTATE)
   enable_vec_load_goldenmem_check = proxy->check_ref_vec_load_goldenmem();
 #endif // CONFIG_DIFFTEST_LOADEVENT && CONFIG_DIFFTEST_ARCHVECREGSTATE
@@ -219,6 +529,147 @@ void Difftest::update_nemuproxy(int coreid, size_t ram_size = 0) {
 #endif // CONFIG_DIFFTEST_REPLAY
 }
 
+void Difftest::switch_ref(const char *ref_so, size_t ram_size) {
+  REF_PROXY *old = proxy;
+  const char *ref_so_saved = difftest_ref_so;
+  difftest_ref_so = ref_so;
+  proxy = new REF_PROXY(id, ram_size);
+  difftest_ref_so = ref_so_saved;
+#if defined(CONFIG_DIFFTEST_LOADEVENT) && defined(CONFIG_DIFFTEST_ARCHVECREGSTATE)
+  enable_vec_load_goldenmem_check = proxy->check_ref_vec_load_goldenmem();
+#endif // CONFIG_DIFFTEST_LOADEVENT && CONFIG_DIFFTEST_ARCHVECREGSTATE
+#ifdef CONFIG_DIFFTEST_REPLAY
+  proxy_reg_size = proxy->get_reg_size();
+  proxy_reg_ss = (uint8_t *)realloc(proxy_reg_ss, proxy_reg_size);
+#endif // CONFIG_DIFFTEST_REPLAY
+
+  // Before the first commit, the states are copied from DUT as usual
+  if (has_commit) {
+    proxy->flash_init((const uint8_t *)flash_dev.base, flash_dev.img_size, flash_dev.img_path);
+    const size_t buf_size = 2 * 1024 * 1024;
+    uint8_t *buf = (uint8_t *)malloc(buf_size);
+    size_t mem_size = simMemory->get_size();
+    for (size_t offset = 0; offset < mem_size; offset += buf_size) {
+      size_t n = std::min(buf_size, mem_size - offset);
+      old->mem_init(PMEM_BASE + offset, buf, n, REF_TO_DUT);
+      proxy->mem_init(PMEM_BASE + offset, buf, n, DUT_TO_REF);
+    }
+    free(buf);
+    uint64_t csr_buf[4096];
+    old->ref_csrcpy(csr_buf, REF_TO_DUT);
+    proxy->ref_csrcpy(csr_buf, DUT_TO_REF);
+    old->sync();
+    memcpy(&proxy->regs_int, &old->regs_int, REF_STATE_SIZE);
+    proxy->sync(DUT_TO_REF);
+  }
+  delete old;
+  Info("Core %d switched to the reference model %s\n", id, ref_so);
+}
+
+// Outside the sampled windows, the committed instructions are only counted. Cycles with events, MMIO and
+// special instructions, delayed writebacks, REF synchronizations or a trap are still checked, as REF cannot
+// execute them alone and check_all would otherwise return before them.
+// The golden memory is updated from store events before this. The store events are kept, and checked after
+// REF executes the skipped instructions, so a cycle is also checked before they could overflow the queue.
+bool Difftest::sample_skip() {
+  if (dut->trap.instrCnt % sample_interval < sample_window || dut->event.valid || dut->trap.hasTrap) {
+    return false;
+  }
+#ifdef CONFIG_DIFFTEST_STOREEVENT
+  if (store_event_queue.size() >= DIFFTEST_STORE_RING_SIZE / 2) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_STOREEVENT
+#ifdef CONFIG_DIFFTEST_LRSCEVENT
+  if (dut->lrsc.valid) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_LRSCEVENT
+#ifdef CONFIG_DIFFTEST_NONREGINTERRUPTPENDINGEVENT
+  if (dut->non_reg_interrupt_pending.valid) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_NONREGINTERRUPTPENDINGEVENT
+#ifdef CONFIG_DIFFTEST_MHPMEVENTOVERFLOWEVENT
+  if (dut->mhpmevent_overflow.valid) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_MHPMEVENTOVERFLOWEVENT
+#ifdef CONFIG_DIFFTEST_CRITICALERROREVENT
+  if (dut->critical_error.valid) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_CRITICALERROREVENT
+#ifdef CONFIG_DIFFTEST_SYNCAIAEVENT
+  if (dut->sync_aia.valid) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_SYNCAIAEVENT
+#ifdef CONFIG_DIFFTEST_SYNCCUSTOMMFLUSHPWREVENT
+  if (dut->sync_custom_mflushpwr.valid) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_SYNCCUSTOMMFLUSHPWREVENT
+#ifdef CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
+  for (int i = 0; i < CONFIG_DIFF_REGS_INT_DELAYED_WIDTH; i++) {
+    if (dut->regs_int_delayed[i].valid) {
+      return false;
+    }
+  }
+#endif // CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
+#ifdef CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
+  for (int i = 0; i < CONFIG_DIFF_REGS_FP_DELAYED_WIDTH; i++) {
+    if (dut->regs_fp_delayed[i].valid) {
+      return false;
+    }
+  }
+#endif // CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
+  uint64_t n = 0;
+  for (int i = 0; i < CONFIG_DIFF_COMMIT_WIDTH; i++) {
+    if (dut->commit[i].valid) {
+      if (dut->commit[i].skip || dut->commit[i].special) {
+        return false;
+      }
+      n += dut->commit[i].nFused + 1;
+    }
+  }
+#if defined(CONFIG_DIFFTEST_SQUASH) && defined(CONFIG_DIFFTEST_STOREEVENT)
+  // the stamps of the store events must tell the skipped instructions from those of the checked cycle
+  if (sample_pending + n >= CONFIG_DIFFTEST_SQUASH_STAMPSIZE) {
+    return false;
+  }
+#endif // CONFIG_DIFFTEST_SQUASH && CONFIG_DIFFTEST_STOREEVENT
+  if (n > 0) {
+    sample_pending += n;
+    update_last_commit();
+  }
+#if defined(CONFIG_DIFFTEST_SQUASH) && defined(CONFIG_DIFFTEST_LOADEVENT)
+  while (!load_event_queue.empty()) {
+    load_event_queue.pop();
+  }
+#endif // CONFIG_DIFFTEST_SQUASH && CONFIG_DIFFTEST_LOADEVENT
+  return true;
+}
+
+int Difftest::sample_flush() {
+  if (sample_pending == 0) {
+    return 0;
+  }
+  proxy->ref_exec(sample_pending);
+  int span = sample_pending;
+#ifdef CONFIG_DIFFTEST_SQUASH
+  commit_stamp = (commit_stamp + sample_pending) % CONFIG_DIFFTEST_SQUASH_STAMPSIZE;
+#endif // CONFIG_DIFFTEST_SQUASH
+  sample_pending = 0;
+  proxy->sync();
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+  // registers written by the skipped instructions are not marked dirty
+  delta_sync_count = -1;
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+  // REF has recorded the stores of the skipped instructions as well
+  return do_store_check(span);
+}
+
 #ifdef CONFIG_DIFFTEST_REPLAY
 bool Difftest::can_replay() {
   auto info = dut->trace_info;
@@ -240,6 +691,10 @@ bool Difftest::in_replay_range() {
 }
 
 void Difftest::replay_snapshot() {
+  replay_ss.age = 0;
+  replay_ss.trace_head = dut->trace_info.trace_head;
+  replay_ss.trace_size = 0;
+  replay_ss.instrs = 0;
   memcpy(state_ss, state, sizeof(DiffState));
   memcpy(proxy_reg_ss, &proxy->regs_int, proxy_reg_size);
   proxy->ref_csrcpy(squash_csr_buf, REF_TO_DUT);
@@ -249,22 +704,22 @@ void Difftest::replay_snapshot() {
   goldenmem_set_store_log(true);
 }
 
+// The DUT replays its trace from the snapshot, which may be several steps before the error
 void Difftest::do_replay() {
-  auto info = dut->trace_info;
   replay_status.in_replay = true;
-  replay_status.trace_head = info.trace_head;
-  replay_status.trace_size = info.trace_size;
+  replay_status.trace_head = replay_ss.trace_head;
+  replay_status.trace_size = replay_ss.trace_size;
+  replay_ss.age = -1;
   memcpy(state, state_ss, sizeof(DiffState));
   memcpy(&proxy->regs_int, proxy_reg_ss, proxy_reg_size);
   proxy->ref_regcpy(&proxy->regs_int, DUT_TO_REF, false);
   proxy->ref_csrcpy(squash_csr_buf, DUT_TO_REF);
   proxy->ref_store_log_restore();
   goldenmem_store_log_restore();
-  difftest_replay_head(info.trace_head);
+  difftest_replay_head(replay_ss.trace_head);
   // clear buffered queue
 #ifdef CONFIG_DIFFTEST_STOREEVENT
-  while (!store_event_queue.empty())
-    store_event_queue.pop();
+  store_event_queue.clear();
 #endif // CONFIG_DIFFTEST_STOREEVENT
 #if defined(CONFIG_DIFFTEST_LOADEVENT) && defined(CONFIG_DIFFTEST_SQUASH)
   while (!load_event_queue.empty())
@@ -275,7 +730,6 @@ void Difftest::do_replay() {
 
 int Difftest::step() {
 #ifdef CONFIG_DIFFTEST_REPLAY
-  static int replay_step = 0;
   if (replay_status.in_replay) {
     if (!in_replay_range()) {
       return 0;
@@ -289,13 +743,24 @@ int Difftest::step() {
   }
   bool canReplay = can_replay();
   if (canReplay) {
-    replay_snapshot();
+    // a new snapshot is needed if the trace since the last one would be overwritten in the DUT,
+    // or the REF store log since then could overflow
+    int trace_size = dut->trace_info.trace_size;
+    if (replay_ss.age < 0 || replay_ss.age >= REPLAY_SNAPSHOT_INTERVAL ||
+        replay_ss.trace_size + trace_size > CONFIG_DIFFTEST_REPLAY_SIZE || replay_ss.instrs >= REPLAY_SNAPSHOT_INSTRS) {
+      replay_snapshot();
+    }
+    replay_ss.age++;
+    replay_ss.trace_size += trace_size;
   } else {
+    replay_ss.age = -1;
     proxy->set_store_log(false);
     goldenmem_set_store_log(false);
   }
   int ret = check_all();
-  if (ret && canReplay) {
+  replay_ss.instrs += num_commit;
+  // golden memory cannot be restored if its store log has overflowed
+  if (ret && canReplay && !goldenmem_store_log_overflow()) {
     Info("\n**** Start replay for more accurate error location ****\n");
     do_replay();
     return 0;
@@ -307,9 +772,84 @@ int Difftest::step() {
 #endif // CONFIG_DIFFTEST_REPLAY
 }
 
+// Calls f(0), ..., f(N - 1) with constant arguments until one of them returns true
+template <int N> struct CommitUnroll {
+  template <typename F> static inline bool run(const F &f) {
+    return CommitUnroll<N - 1>::run(f) || f(N - 1);
+  }
+};
+template <> struct CommitUnroll<0> {
+  template <typename F> static inline bool run(const F &f) {
+    return false;
+  }
+};
+
+template <bool batch> inline int Difftest::check_commit(int i) {
+  if (!dut->commit[i].valid) {
+    return 0;
+  }
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_instr_commit);
+    if (do_instr_commit(i, batch)) {
+      return 1;
+    }
+  }
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+  proxy->mark_dirty(dut->commit[i].rfwen, dut->commit[i].fpwen, dut->commit[i].vecwen, dut->commit[i].wdest);
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+#ifndef CONFIG_DIFFTEST_SQUASH
+  // stores are checked after the batch is executed
+  if (!batch) {
+    {
+      DIFFTEST_PROFILE_SCOPE(prof_load_check);
+      do_load_check(i);
+    }
+    if (do_store_check()) {
+      return 1;
+    }
+  }
+#endif // CONFIG_DIFFTEST_SQUASH
+  dut->commit[i].valid = 0;
+  num_commit += 1 + dut->commit[i].nFused;
+  return 0;
+}
+
+template <bool batch> inline int Difftest::check_commits() {
+#ifdef CONFIG_DIFF_COMMIT_VALID_MASK
+  // only the slots marked valid by the DPI-C functions are visited
+  for (uint64_t mask = dut->valid_mask.commit; mask; mask &= mask - 1) {
+    if (check_commit<batch>(__builtin_ctzll(mask))) {
+      return 1;
+    }
+  }
+  dut->valid_mask.commit = 0;
+  return 0;
+#elif defined(CONFIG_DIFFTEST_GENERIC_CHECKER)
+  for (int i = 0; i < CONFIG_DIFF_COMMIT_WIDTH; i++) {
+    if (check_commit<batch>(i)) {
+      return 1;
+    }
+  }
+  return 0;
+#else
+  return CommitUnroll<CONFIG_DIFF_COMMIT_WIDTH>::run([this](int i) { return check_commit<batch>(i) != 0; });
+#endif // CONFIG_DIFFTEST_GENERIC_CHECKER
+}
+
 inline int Difftest::check_all() {
   progress = false;
 
+#if DIFFTRACE_CHECKPOINT_INTERVAL > 0
+  if (difftrace) {
+    if (trace_checkpoint[0]) {
+      trace_checkpoint_restore();
+    } else if (!difftrace->is_read && NUM_CORES == 1 &&
+               trace_steps++ % (DIFFTRACE_CHECKPOINT_INTERVAL * difftrace->get_file_traces()) == 0 && has_commit) {
+      trace_checkpoint_save();
+    }
+  }
+#endif // DIFFTRACE_CHECKPOINT_INTERVAL
+
   if (check_timeout()) {
     return 1;
   }
@@ -318,7 +858,10 @@ inline int Difftest::check_all() {
   // Each cycle is checked for an store event, and recorded in queue.
   // It is checked every time an instruction is committed and queue has content.
 #ifdef CONFIG_DIFFTEST_STOREEVENT
-  store_event_record();
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_store_event);
+    store_event_record();
+  }
 #endif
 
 #ifdef CONFIG_DIFFTEST_SQUASH
@@ -327,7 +870,7 @@ inline int Difftest::check_all() {
 #endif // CONFIG_DIFFTEST_LOADEVENT
 #endif // CONFIG_DIFFTEST_SQUASH
 
-#ifdef DEBUG_GOLDENMEM
+#if defined(DEBUG_GOLDENMEM) && !defined(CONFIG_DIFFTEST_PARALLEL)
   if (do_golden_memory_update()) {
     return 1;
   }
@@ -341,21 +884,39 @@ inline int Difftest::check_all() {
     return 0;
   }
 
+  if (sample_interval) {
+    if (sample_skip()) {
+      return 0;
+    }
+    if (sample_flush()) {
+      return 1;
+    }
+  }
+
 #ifdef DEBUG_REFILL
-  if (do_irefill_check() || do_drefill_check() || do_ptwrefill_check()) {
-    return 1;
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_refill_check);
+    if (do_irefill_check() || do_drefill_check() || do_ptwrefill_check()) {
+      return 1;
+    }
   }
 #endif
 
 #ifdef DEBUG_L2TLB
-  if (do_l2tlb_check()) {
-    return 1;
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_l2tlb_check);
+    if (do_l2tlb_check()) {
+      return 1;
+    }
   }
 #endif
 
 #ifdef DEBUG_L1TLB
-  if (do_l1tlb_check()) {
-    return 1;
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_l1tlb_check);
+    if (do_l1tlb_check()) {
+      return 1;
+    }
   }
 #endif
 
@@ -412,42 +973,74 @@ inline int Difftest::check_all() {
       }
     }
 #endif
-    for (int i = 0; i < CONFIG_DIFF_COMMIT_WIDTH; i++) {
-      if (dut->commit[i].valid) {
-        if (do_instr_commit(i)) {
-          return 1;
-        }
-#ifndef CONFIG_DIFFTEST_SQUASH
-        do_load_check(i);
-        if (do_store_check()) {
-          return 1;
-        }
-#endif // CONFIG_DIFFTEST_SQUASH
-        dut->commit[i].valid = 0;
-        num_commit += 1 + dut->commit[i].nFused;
-      }
+#ifdef DIFFTEST_EXEC_BATCH
+    const bool batch = use_exec_batch();
+#else
+    const bool batch = false;
+#endif // DIFFTEST_EXEC_BATCH
+    if (batch ? check_commits<true>() : check_commits<false>()) {
+      return 1;
+    }
+#ifdef DIFFTEST_EXEC_BATCH
+    if (batch && do_exec_batch()) {
+      return 1;
     }
+#endif // DIFFTEST_EXEC_BATCH
   }
 
-  if (update_delayed_writeback()) {
-    return 1;
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_delayed_writeback);
+    if (update_delayed_writeback()) {
+      return 1;
+    }
   }
 
   if (!progress) {
     return 0;
   }
 
-  proxy->sync();
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+  // Only the registers written in this cycle are synced and compared, except for a periodic full check.
+  bool full_sync = ++delta_sync_count % DIFFTEST_DELTA_FULL_INTERVAL == 0;
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_ref_sync);
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+    proxy->sync_dirty(full_sync);
+#else
+    proxy->sync();
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+  }
 
   if (num_commit > 0) {
     state->record_group(dut->commit[0].pc, num_commit);
   }
 
-  if (apply_delayed_writeback()) {
-    return 1;
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_delayed_writeback);
+    if (apply_delayed_writeback()) {
+      return 1;
+    }
   }
 
-  if (proxy->compare(dut) || pc_mismatch) {
+  bool mismatch;
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+  bool hash_only = !dut->state_hash.full;
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_ref_compare);
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+    if (hash_only) {
+      mismatch = compare_state_hash() || pc_mismatch;
+    } else
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+      mismatch = proxy->compare_dirty(dut, full_sync) || pc_mismatch;
+#else
+      mismatch = proxy->compare(dut) || pc_mismatch;
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+  }
+  if (mismatch) {
 #ifdef FUZZING
     if (in_disambiguation_state()) {
       Info("Mismatch detected with a disambiguation state at pc = 0x%lx.\n", dut->trap.pc);
@@ -455,7 +1048,12 @@ inline int Difftest::check_all() {
     }
 #endif
     display();
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+    // DUT states in this step are unknown, so only REF states are displayed
+    proxy->display(hash_only ? nullptr : dut);
+#else
     proxy->display(dut);
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
 #ifdef FUZZER_LIB
     stats.exit_code = SimExitCode::difftest;
 #endif // FUZZER_LIB
@@ -507,8 +1105,6 @@ void Difftest::do_exception() {
   }
 
 #ifdef FUZZING
-  static uint64_t lastExceptionPC = 0xdeadbeafUL;
-  static int sameExceptionPCCount = 0;
   if (dut->event.exceptionPC == lastExceptionPC) {
     if (sameExceptionPCCount >= 5) {
       Info("Found infinite loop at exception_pc %lx. Exiting.\n", dut->event.exceptionPC);
@@ -530,7 +1126,7 @@ void Difftest::do_exception() {
   progress = true;
 }
 
-int Difftest::do_instr_commit(int i) {
+int Difftest::do_instr_commit(int i, bool batch) {
 
   // store the writeback info to debug array
 #ifdef BASIC_DIFFTEST_ONLY
@@ -591,29 +1187,91 @@ int Difftest::do_instr_commit(int i) {
 
   // MMIO accessing should not be a branch or jump, just +2/+4 to get the next pc
   // to skip the checking of an instruction, just copy the reg state to reference design
-  if (dut->commit[i].skip || (DEBUG_MODE_SKIP(dut->commit[i].valid, dut->commit[i].pc, dut->commit[i].inst))) {
+  bool skip = dut->commit[i].skip || (DEBUG_MODE_SKIP(dut->commit[i].valid, dut->commit[i].pc, dut->commit[i].inst));
+#ifdef DIFFTEST_EXEC_BATCH
+  if (batch) {
+    ExecBatchCommit *c = exec_batch + exec_batch_size++;
+    c->pc = dut->commit[i].pc;
+    c->wdata = skip ? get_commit_data(i) : 0;
+    c->wdest = dut->commit[i].wdest;
+    c->nFused = dut->commit[i].nFused;
+    c->skip = skip;
+    c->isRVC = dut->commit[i].isRVC;
+    c->rfwen = dut->commit[i].rfwen && dut->commit[i].wdest != 0;
+    c->fpwen = dut->commit[i].fpwen;
+    c->vecwen = dut->commit[i].vecwen;
+    return 0;
+  }
+#endif // DIFFTEST_EXEC_BATCH
+  if (skip) {
     // We use the physical register file to get wdata
     proxy->skip_one(dut->commit[i].isRVC, (dut->commit[i].rfwen && dut->commit[i].wdest != 0), dut->commit[i].fpwen,
                     dut->commit[i].vecwen, dut->commit[i].wdest, get_commit_data(i));
     return 0;
   }
 
-  // Default: single step exec
-  // when there's a fused instruction, let proxy execute more instructions.
-  for (int j = 0; j < dut->commit[i].nFused + 1; j++) {
-    proxy->ref_exec(1);
 #ifdef CONFIG_DIFFTEST_SQUASH
-    commit_stamp = (commit_stamp + 1) % CONFIG_DIFFTEST_SQUASH_STAMPSIZE;
+  // A squashed commit stands for nFused + 1 instructions. Run REF to the next load/store event in one
+  // call and check the event there, which is the same as checking after every instruction.
+  int remain = dut->commit[i].nFused + 1;
+  while (remain > 0) {
+    int n = std::min(remain, next_event_distance());
+    proxy->ref_exec(n);
+    remain -= n;
+    commit_stamp = (commit_stamp + n) % CONFIG_DIFFTEST_SQUASH_STAMPSIZE;
     do_load_check(i);
     if (do_store_check()) {
       return 1;
     }
-#endif // CONFIG_DIFFTEST_SQUASH
   }
+#else
+  // Default: single step exec
+  // when there's a fused instruction, let proxy execute more instructions.
+  for (int j = 0; j < dut->commit[i].nFused + 1; j++) {
+    proxy->ref_exec(1);
+  }
+#endif // CONFIG_DIFFTEST_SQUASH
 
   return 0;
 }
 
+#ifdef CONFIG_DIFFTEST_SQUASH
+int Difftest::next_event_distance() {
+  int distance = CONFIG_DIFFTEST_SQUASH_STAMPSIZE;
+#ifdef CONFIG_DIFFTEST_LOADEVENT
+  // do_load_check uses the load events only for SMP
+  if (NUM_CORES > 1 && !load_event_queue.empty()) {
+    distance = std::min(distance, stamp_distance(load_event_queue.front().stamp));
+  }
+#endif // CONFIG_DIFFTEST_LOADEVENT
+#ifdef CONFIG_DIFFTEST_STOREEVENT
+  if (!store_event_queue.empty()) {
+    distance = std::min(distance, stamp_distance(store_event_queue.front().stamp));
+  }
+#endif // CONFIG_DIFFTEST_STOREEVENT
+  return distance;
+}
+#endif // CONFIG_DIFFTEST_SQUASH
+
+#ifdef DIFFTEST_EXEC_BATCH
+int Difftest::do_exec_batch() {
+  int n = exec_batch_size;
+  exec_batch_size = 0;
+  if (n == 0) {
+    return 0;
+  }
+  int done = proxy->exec_batch(exec_batch, n);
+  if (done < n) {
+    // REF stops at the first commit with a mismatched pc, which fails the later compare
+    proxy->sync();
+    dut_commit_first_pc = exec_batch[done].pc;
+    ref_commit_first_pc = proxy->pc;
+    pc_mismatch = true;
+  }
+  return do_store_check();
+}
+#endif // DIFFTEST_EXEC_BATCH
+
 void Difftest::do_first_instr_commit() {
   if (!has_commit && dut->commit[0].valid) {
 #ifndef BASIC_DIFFTEST_ONLY
@@ -626,12 +1284,15 @@ void Difftest::do_first_instr_commit() {
     nemu_this_pc = FIRST_INST_ADDRESS;
 
     proxy->flash_init((const uint8_t *)flash_dev.base, flash_dev.img_size, flash_dev.img_path);
-    simMemory->clone_on_demand(
-        [this](uint64_t offset, void *src, size_t n) {
-          uint64_t dest_addr = PMEM_BASE + offset;
-          proxy->mem_init(dest_addr, src, n, DUT_TO_REF);
-        },
-        true);
+    int image_fd = simMemory->get_image_fd();
+    if (image_fd < 0 || !proxy->mem_map_fd(image_fd, PMEM_BASE, simMemory->get_size())) {
+      simMemory->clone_on_demand(
+          [this](uint64_t offset, void *src, size_t n) {
+            uint64_t dest_addr = PMEM_BASE + offset;
+            proxy->mem_init(dest_addr, src, n, DUT_TO_REF);
+          },
+          true);
+    }
     // Use a temp variable to store the current pc of dut
     uint64_t dut_this_pc = dut->commit[0].pc;
     // NEMU should always start at FIRST_INST_ADDRESS
@@ -645,6 +1306,135 @@ void Difftest::do_first_instr_commit() {
   }
 }
 
+static bool trace_backlog_gauge = false;
+
+void Difftest::set_trace(const char *name, bool is_read, uint64_t start_cycle) {
+  trace_name = name;
+  uint64_t start_file = 0;
+  char path[128];
+  DiffTrace<DiffTestState>::trace_file_path(name, "index.txt", path);
+  if (!is_read) {
+    // checkpoints of an older trace are no longer valid
+    unlink(path);
+  } else if (start_cycle > 0) {
+    char checkpoint[64];
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+      printf("Trace index %s not found.\n", path);
+      exit(0);
+    }
+    // each line: cycle instrCnt file offset checkpoint, in the order of cycles
+    uint64_t cycle, instr, file, offset, ckpt_cycle = 0;
+    while (fscanf(fp, "%lu %lu %lu %lu %63s", &cycle, &instr, &file, &offset, checkpoint) == 5 &&
+           cycle <= start_cycle) {
+      start_file = file;
+      ckpt_cycle = cycle;
+      strcpy(trace_checkpoint, checkpoint);
+    }
+    fclose(fp);
+    if (trace_checkpoint[0]) {
+      Info("Replaying traces from checkpoint %s at cycle %lu\n", trace_checkpoint, ckpt_cycle);
+    } else {
+      Info("No trace checkpoint before cycle %lu. Replaying traces from the start\n", start_cycle);
+    }
+  }
+  difftrace = new DiffTrace<DiffTestState>(name, is_read, 1024 * 1024, start_file);
+  // the backlog is shared by the traces of all cores
+  if (!is_read && !trace_backlog_gauge) {
+    telemetry_add_gauge("trace_backlog", [] { return DiffTrace<DiffTestState>::io_backlog.load(); });
+    trace_backlog_gauge = true;
+  }
+}
+
+// A trace checkpoint is taken right before the first trace of a file is checked. It has the REF registers
+// in ckptN.regs, the REF memory in ckptN.ref.gz and the golden memory in ckptN.gm.gz, where N is the file.
+void Difftest::trace_checkpoint_save() {
+  // the index has one offset for all cores, which only holds for a single core
+  assert(NUM_CORES == 1);
+  uint64_t file = (trace_steps - 1) / difftrace->get_file_traces();
+  uint64_t offset = (trace_steps - 1) % difftrace->get_file_traces();
+  char name[64], file_name[96], path[128];
+  snprintf(name, 64, "ckpt%lu", file);
+  uint64_t cycleCnt = get_trap_event()->cycleCnt;
+  Info("Saving trace checkpoint %s at cycle %lu ...\n", name, cycleCnt);
+
+  proxy->sync();
+  snprintf(file_name, 96, "%s.regs", name);
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, file_name, path);
+  FILE *fp = fopen(path, "wb");
+  if (!fp || fwrite(&proxy->regs_int, REF_STATE_SIZE, 1, fp) != 1) {
+    printf("Failed to write trace checkpoint %s\n", path);
+    assert(0);
+  }
+  fclose(fp);
+
+  size_t size = simMemory->get_size();
+  uint8_t *buf = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  assert(buf != (uint8_t *)MAP_FAILED);
+  proxy->ref_memcpy(PMEM_BASE, buf, size, REF_TO_DUT);
+  snprintf(file_name, 96, "%s.ref.gz", name);
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, file_name, path);
+  bool ok = snapshot_compressToFile(buf, path, size) == (long)size;
+  munmap(buf, size);
+#ifdef DEBUG_GOLDENMEM
+  snprintf(file_name, 96, "%s.gm.gz", name);
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, file_name, path);
+  ok = ok && goldenmem_save(path);
+#endif // DEBUG_GOLDENMEM
+  if (!ok) {
+    printf("Failed to write trace checkpoint %s\n", name);
+    assert(0);
+  }
+
+  // the checkpoint is usable only after it is added to the index
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, "index.txt", path);
+  fp = fopen(path, "a");
+  assert(fp);
+  fprintf(fp, "%lu %lu %lu %lu %s\n", cycleCnt, get_trap_event()->instrCnt, file, offset, name);
+  fclose(fp);
+}
+
+void Difftest::trace_checkpoint_restore() {
+  char file_name[96], path[128];
+  Info("Restoring trace checkpoint %s ...\n", trace_checkpoint);
+
+  snprintf(file_name, 96, "%s.regs", trace_checkpoint);
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, file_name, path);
+  FILE *fp = fopen(path, "rb");
+  if (!fp || fread(&proxy->regs_int, REF_STATE_SIZE, 1, fp) != 1) {
+    printf("Failed to read trace checkpoint %s\n", path);
+    assert(0);
+  }
+  fclose(fp);
+
+  proxy->flash_init((const uint8_t *)flash_dev.base, flash_dev.img_size, flash_dev.img_path);
+  size_t size = simMemory->get_size();
+  uint8_t *buf = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  assert(buf != (uint8_t *)MAP_FAILED);
+  snprintf(file_name, 96, "%s.ref.gz", trace_checkpoint);
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, file_name, path);
+  bool ok = readFromGz(buf, path, size, LOAD_SNAPSHOT) >= 0;
+  if (ok) {
+    proxy->mem_init(PMEM_BASE, buf, size, DUT_TO_REF);
+  }
+  munmap(buf, size);
+#ifdef DEBUG_GOLDENMEM
+  snprintf(file_name, 96, "%s.gm.gz", trace_checkpoint);
+  DiffTrace<DiffTestState>::trace_file_path(trace_name, file_name, path);
+  ok = ok && goldenmem_load(path);
+#endif // DEBUG_GOLDENMEM
+  if (!ok) {
+    printf("Failed to read trace checkpoint %s\n", trace_checkpoint);
+    assert(0);
+  }
+  proxy->sync(true);
+
+  has_commit = 1;
+  nemu_this_pc = proxy->pc;
+  update_last_commit();
+  trace_checkpoint[0] = '\0';
+}
+
 #if defined(CONFIG_DIFFTEST_LOADEVENT) && defined(CONFIG_DIFFTEST_ARCHVECREGSTATE)
 void Difftest::do_vec_load_check(int index, DifftestLoadEvent load_event) {
   if (!enable_vec_load_goldenmem_check) {
@@ -664,42 +1454,36 @@ void Difftest::do_vec_load_check(int index, DifftestLoadEvent load_event) {
   auto vecFirstLdest = dut->commit[index].wdest;
 #endif // CONFIG_DIFFTEST_SQUASH
 
-  bool reg_mismatch = false;
-
-  for (int vdidx = 0; vdidx < vdNum; vdidx++) {
-#ifndef CONFIG_DIFFTEST_COMMITDATA
-    bool v0Wen = dut->commit[index].v0wen && vdidx == 0;
-    auto vecNextPdest = dut->commit[index].otherwpdest[vdidx];
-    uint64_t *dutRegPtr = v0Wen ? dut->wb_v0[vecNextPdest].data : dut->wb_vec[vecNextPdest].data;
-#endif // !CONFIG_DIFFTEST_COMMITDATA
-
-    auto vecNextLdest = vecFirstLdest + vdidx;
-
-    for (int i = 0; i < VLENE_64; i++) {
+  // The VLENE_64 words of a register are contiguous in both DUT and REF, so whole registers are compared at once
+  auto dut_vec_reg = [&](int vdidx) -> uint64_t * {
 #ifdef CONFIG_DIFFTEST_COMMITDATA
 #ifdef CONFIG_DIFFTEST_SQUASH
-      uint64_t dutRegData = load_event.vecCommitData[VLENE_64 * vdidx + i];
+    return load_event.vecCommitData + VLENE_64 * vdidx;
 #else
-      uint64_t dutRegData = dut->commit_data[index].vecData[VLENE_64 * vdidx + i];
+    return dut->commit_data[index].vecData + VLENE_64 * vdidx;
 #endif // CONFIG_DIFFTEST_SQUASH
 #else
-      uint64_t dutRegData = dutRegPtr[i];
+    bool v0Wen = dut->commit[index].v0wen && vdidx == 0;
+    auto vecNextPdest = dut->commit[index].otherwpdest[vdidx];
+    return v0Wen ? dut->wb_v0[vecNextPdest].data : dut->wb_vec[vecNextPdest].data;
 #endif // CONFIG_DIFFTEST_COMMITDATA
+  };
+  const size_t vec_reg_size = VLENE_64 * sizeof(uint64_t);
 
-      uint64_t *refRegPtr = proxy->arch_vecreg(VLENE_64 * vecNextLdest + i);
-      reg_mismatch |= dutRegData != *refRegPtr;
-    }
+  bool reg_mismatch = false;
+  for (int vdidx = 0; vdidx < vdNum && !reg_mismatch; vdidx++) {
+    reg_mismatch = memcmp(dut_vec_reg(vdidx), proxy->arch_vecreg(VLENE_64 * (vecFirstLdest + vdidx)),
+                          vec_reg_size) != 0;
   }
 
   // ===============================================================
   //                      Regs Mismatch handle
   // ===============================================================
-  bool goldenmem_mismatch = false;
-
   if (reg_mismatch) {
     // ===============================================================
     //                      Check golden memory
     // ===============================================================
+    // the REF gathers the elements from golden memory only for the mismatched loads
     uint64_t *vec_goldenmem_regPtr = (uint64_t *)proxy->get_vec_goldenmem_reg();
 
     if (vec_goldenmem_regPtr == nullptr) {
@@ -707,26 +1491,9 @@ void Difftest::do_vec_load_check(int index, DifftestLoadEvent load_event) {
       return;
     }
 
-    for (int vdidx = 0; vdidx < vdNum; vdidx++) {
-#ifndef CONFIG_DIFFTEST_COMMITDATA
-      bool v0Wen = dut->commit[index].v0wen && vdidx == 0;
-      auto vecNextPdest = dut->commit[index].otherwpdest[vdidx];
-      uint64_t *dutRegPtr = v0Wen ? dut->wb_v0[vecNextPdest].data : dut->wb_vec[vecNextPdest].data;
-#endif // !CONFIG_DIFFTEST_COMMITDATA
-
-      for (int i = 0; i < VLENE_64; i++) {
-#ifdef CONFIG_DIFFTEST_COMMITDATA
-#ifdef CONFIG_DIFFTEST_SQUASH
-        uint64_t dutRegData = load_event.vecCommitData[VLENE_64 * vdidx + i];
-#else
-        uint64_t dutRegData = dut->commit_data[index].vecData[VLENE_64 * vdidx + i];
-#endif // CONFIG_DIFFTEST_SQUASH
-#else
-        uint64_t dutRegData = dutRegPtr[i];
-#endif // CONFIG_DIFFTEST_COMMITDATA
-
-        goldenmem_mismatch |= dutRegData != vec_goldenmem_regPtr[VLENE_64 * vdidx + i];
-      }
+    bool goldenmem_mismatch = false;
+    for (int vdidx = 0; vdidx < vdNum && !goldenmem_mismatch; vdidx++) {
+      goldenmem_mismatch = memcmp(dut_vec_reg(vdidx), vec_goldenmem_regPtr + VLENE_64 * vdidx, vec_reg_size) != 0;
     }
 
     if (!goldenmem_mismatch) {
@@ -736,28 +1503,7 @@ void Difftest::do_vec_load_check(int index, DifftestLoadEvent load_event) {
       proxy->vec_update_goldenmem();
 
       for (int vdidx = 0; vdidx < vdNum; vdidx++) {
-#ifndef CONFIG_DIFFTEST_COMMITDATA
-        bool v0Wen = dut->commit[index].v0wen && vdidx == 0;
-        auto vecNextPdest = dut->commit[index].otherwpdest[vdidx];
-        uint64_t *dutRegPtr = v0Wen ? dut->wb_v0[vecNextPdest].data : dut->wb_vec[vecNextPdest].data;
-#endif // !CONFIG_DIFFTEST_COMMITDATA
-
-        auto vecNextLdest = vecFirstLdest + vdidx;
-
-        for (int i = 0; i < VLENE_64; i++) {
-#ifdef CONFIG_DIFFTEST_COMMITDATA
-#ifdef CONFIG_DIFFTEST_SQUASH
-          uint64_t dutRegData = load_event.vecCommitData[VLENE_64 * vdidx + i];
-#else
-          uint64_t dutRegData = dut->commit_data[index].vecData[VLENE_64 * vdidx + i];
-#endif // CONFIG_DIFFTEST_SQUASH
-#else
-          uint64_t dutRegData = dutRegPtr[i];
-#endif // CONFIG_DIFFTEST_COMMITDATA
-
-          uint64_t *refRegPtr = proxy->arch_vecreg(VLENE_64 * vecNextLdest + i);
-          *refRegPtr = dutRegData;
-        }
+        memcpy(proxy->arch_vecreg(VLENE_64 * (vecFirstLdest + vdidx)), dut_vec_reg(vdidx), vec_reg_size);
       }
 
       proxy->sync(true);
@@ -912,40 +1658,52 @@ void Difftest::do_load_check(int i) {
 #endif // CONFIG_DIFFTEST_LOADEVENT
 }
 
-int Difftest::do_store_check() {
+int Difftest::do_store_check(int span) {
 #ifdef CONFIG_DIFFTEST_STOREEVENT
+  // All recorded stores (those of this commit with squash) are checked by REF in one call
+  StoreCommit stores[DIFFTEST_STORE_CHECK_BATCH];
   while (!store_event_queue.empty()) {
-    auto store_event = store_event_queue.front();
+    int n = 0;
+    for (; n < DIFFTEST_STORE_CHECK_BATCH && (size_t)n < store_event_queue.size(); n++) {
+      auto &store_event = store_event_queue[n];
 #ifdef CONFIG_DIFFTEST_SQUASH
-    if (store_event.stamp != commit_stamp)
-      return 0;
+      int age =
+          (commit_stamp - store_event.stamp + CONFIG_DIFFTEST_SQUASH_STAMPSIZE) % CONFIG_DIFFTEST_SQUASH_STAMPSIZE;
+      if (age >= std::max(span, 1))
+        break;
 #endif // CONFIG_DIFFTEST_SQUASH
-    auto addr = store_event.addr;
-    auto data = store_event.data;
-    auto mask = store_event.mask;
+      stores[n] = {store_event.addr, store_event.data, store_event.mask};
+    }
+    if (n == 0) {
+      return 0;
+    }
 
-    if (proxy->store_commit(&addr, &data, &mask)) {
+    int done = proxy->store_commit_batch(stores, n);
+    if (done < n) {
 #ifdef FUZZING
       if (in_disambiguation_state()) {
         Info("Store mismatch detected with a disambiguation state at pc = 0x%lx.\n", dut->trap.pc);
+        store_event_queue.pop(done);
         return 0;
       }
 #endif
+      auto &store_event = store_event_queue[done];
       uint64_t pc = store_event.pc;
       display();
 
       Info("\n==============  Store Commit Event (Core %d)  ==============\n", this->id);
       proxy->get_store_event_other_info(&pc);
       Info("Mismatch for store commits \n");
-      Info("  REF commits addr 0x%016lx, data 0x%016lx, mask 0x%04x, pc 0x%016lx\n", addr, data, mask, pc);
+      Info("  REF commits addr 0x%016lx, data 0x%016lx, mask 0x%04x, pc 0x%016lx\n", stores[done].addr,
+           stores[done].data, stores[done].mask, pc);
       Info("  DUT commits addr 0x%016lx, data 0x%016lx, mask 0x%04x, pc 0x%016lx, robidx 0x%x\n", store_event.addr,
            store_event.data, store_event.mask, store_event.pc, store_event.robidx);
 
-      store_event_queue.pop();
+      store_event_queue.pop(done + 1);
       return 1;
     }
 
-    store_event_queue.pop();
+    store_event_queue.pop(n);
   }
 #endif // CONFIG_DIFFTEST_STOREEVENT
   return 0;
@@ -960,6 +1718,36 @@ int Difftest::do_store_check() {
 //          6 -> icache ipf refill cache
 //          7 -> icache mainPipe port0 read PIQ
 //          8 -> icache mainPipe port1 read PIQ
+// bit i is set if the i-th word of the refilled line differs from the golden memory
+static inline uint8_t refill_diff_mask(const uint64_t *dut, const uint64_t *gold) {
+#if defined(__AVX512F__)
+  return _mm512_cmpneq_epu64_mask(_mm512_loadu_si512(dut), _mm512_loadu_si512(gold));
+#elif defined(__AVX2__)
+  __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)dut), _mm256_loadu_si256((const __m256i *)gold));
+  __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(dut + 4)),
+                                  _mm256_loadu_si256((const __m256i *)(gold + 4)));
+  int eq = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) | (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+  return ~eq & 0xff;
+#else
+  uint8_t mask = 0;
+  for (int i = 0; i < 8; i++) {
+    mask |= (dut[i] != gold[i]) << i;
+  }
+  return mask;
+#endif
+}
+
+static inline void refill_display_line(const uint64_t *gold, const uint64_t *dut, const char *indent) {
+  for (int j = 0; j < 8; j++) {
+    Info("%016lx", gold[j]);
+  }
+  Info("\n%sCore: ", indent);
+  for (int j = 0; j < 8; j++) {
+    Info("%016lx", dut[j]);
+  }
+  Info("\n");
+}
+
 int Difftest::do_refill_check(int cacheid) {
 #ifdef CONFIG_DIFFTEST_REFILLEVENT
   auto dut_refill = &(dut->refill[cacheid]);
@@ -967,87 +1755,60 @@ int Difftest::do_refill_check(int cacheid) {
     return 0;
   }
   dut_refill->valid = 0;
-  static int delay = 0;
+  int &delay = refill_delay;
   delay = delay * 2;
   if (delay > 16) {
     return 1;
   }
-  static uint64_t last_valid_addr = 0;
-  char buf[512];
-  char flag_buf[512];
+  uint64_t &last_valid_addr = refill_last_valid_addr;
   uint64_t realpaddr = dut_refill->addr;
   dut_refill->addr = dut_refill->addr - dut_refill->addr % 64;
-  if (dut_refill->addr != last_valid_addr) {
-    last_valid_addr = dut_refill->addr;
-    if (!in_pmem(dut_refill->addr)) {
-      // speculated illegal mem access should be ignored
-      return 0;
-    }
-    for (int i = 0; i < 8; i++) {
-      read_goldenmem(dut_refill->addr + i * 8, &buf, 8, &flag_buf);
-      if (dut_refill->data[i] != *((uint64_t *)buf)) {
+  if (dut_refill->addr == last_valid_addr) {
+    return 0;
+  }
+  last_valid_addr = dut_refill->addr;
+  if (!in_pmem(dut_refill->addr) || !in_pmem(dut_refill->addr + 63)) {
+    // speculated illegal mem access should be ignored
+    return 0;
+  }
+  uint64_t gold[8];
+  read_goldenmem_line(dut_refill->addr, gold);
+  uint8_t diff = refill_diff_mask(dut_refill->data, gold);
+  if (diff == 0) {
+    return 0;
+  }
 #ifdef CONFIG_DIFFTEST_CMOINVALEVENT
-        if (cmo_inval_event_set.find(dut_refill->addr) != cmo_inval_event_set.end()) {
-          // If the data inconsistency occurs in the cache block operated by CBO.INVAL,
-          // it is considered reasonable and the DUT data is used to update goldenMem.
-          Info("INFO: Sync GoldenMem using refill Data from DUT (Because of CBO.INVAL):\n");
-          Info("      cacheid=%d, addr: %lx\n      Gold: ", cacheid, dut_refill->addr);
-          for (int j = 0; j < 8; j++) {
-            read_goldenmem(dut_refill->addr + j * 8, &buf, 8);
-            Info("%016lx", *((uint64_t *)buf));
-          }
-          Info("\n      Core: ");
-          for (int j = 0; j < 8; j++) {
-            Info("%016lx", dut_refill->data[j]);
-          }
-          Info("\n");
-          update_goldenmem(dut_refill->addr, dut_refill->data, 0xffffffffffffffffUL, 64);
-          proxy->ref_memcpy(dut_refill->addr, dut_refill->data, 64, DUT_TO_REF);
-          cmo_inval_event_set.erase(dut_refill->addr);
-          return 0;
-        } else {
+  if (cmo_inval_event_set.erase(dut_refill->addr)) {
+    // If the data inconsistency occurs in the cache block operated by CBO.INVAL,
+    // it is considered reasonable and the DUT data is used to update goldenMem.
+    Info("INFO: Sync GoldenMem using refill Data from DUT (Because of CBO.INVAL):\n");
+    Info("      cacheid=%d, addr: %lx\n      Gold: ", cacheid, dut_refill->addr);
+    refill_display_line(gold, dut_refill->data, "      ");
+    update_goldenmem(dut_refill->addr, dut_refill->data, 0xffffffffffffffffUL, 64);
+    proxy->ref_memcpy(dut_refill->addr, dut_refill->data, 64, DUT_TO_REF);
+    return 0;
+  }
 #endif // CONFIG_DIFFTEST_CMOINVALEVENT
 #ifdef CONFIG_DIFFTEST_UNCACHEMMSTOREEVENT
-          // in multi-core, uncache mm store may cause data inconsistencies.
-          // so here needs to override the nemu value with the dut value by cacheline granularity.
-          if (*((uint64_t *)flag_buf) != 0) {
-            Info("INFO: Sync GoldenMem using refill Data from DUT (Because of uncache main-mem store):\n");
-            Info("      cacheid=%d, addr: %lx\n      Gold: ", cacheid, dut_refill->addr);
-            for (int j = 0; j < 8; j++) {
-              read_goldenmem(dut_refill->addr + j * 8, &buf, 8);
-              Info("%016lx", *((uint64_t *)buf));
-            }
-            Info("\n      Core: ");
-            for (int j = 0; j < 8; j++) {
-              Info("%016lx", dut_refill->data[j]);
-            }
-            Info("\n");
-            update_goldenmem(dut_refill->addr, dut_refill->data, 0xffffffffffffffffUL, 64);
-            proxy->ref_memcpy(dut_refill->addr, dut_refill->data, 64, DUT_TO_REF);
-            return 0;
-          }
+  // in multi-core, uncache mm store may cause data inconsistencies.
+  // so here needs to override the nemu value with the dut value by cacheline granularity.
+  uint64_t word, flag;
+  read_goldenmem(dut_refill->addr + __builtin_ctz(diff) * 8, &word, 8, &flag);
+  if (flag != 0) {
+    Info("INFO: Sync GoldenMem using refill Data from DUT (Because of uncache main-mem store):\n");
+    Info("      cacheid=%d, addr: %lx\n      Gold: ", cacheid, dut_refill->addr);
+    refill_display_line(gold, dut_refill->data, "      ");
+    update_goldenmem(dut_refill->addr, dut_refill->data, 0xffffffffffffffffUL, 64);
+    proxy->ref_memcpy(dut_refill->addr, dut_refill->data, 64, DUT_TO_REF);
+    return 0;
+  }
 #endif // CONFIG_DIFFTEST_UNCACHEMMSTOREEVENT
-          Info("cacheid=%d,idtfr=%d,realpaddr=0x%lx: Refill test failed!\n", cacheid, dut_refill->idtfr, realpaddr);
-          Info("addr: %lx\nGold: ", dut_refill->addr);
-          for (int j = 0; j < 8; j++) {
-            read_goldenmem(dut_refill->addr + j * 8, &buf, 8);
-            Info("%016lx", *((uint64_t *)buf));
-          }
-          Info("\nCore: ");
-          for (int j = 0; j < 8; j++) {
-            Info("%016lx", dut_refill->data[j]);
-          }
-          Info("\n");
-          // continue run some cycle before aborted to dump wave
-          if (delay == 0) {
-            delay = 1;
-          }
-          return 0;
-#ifdef CONFIG_DIFFTEST_CMOINVALEVENT
-        }
-#endif // CONFIG_DIFFTEST_CMOINVALEVENT
-      }
-    }
+  Info("cacheid=%d,idtfr=%d,realpaddr=0x%lx: Refill test failed!\n", cacheid, dut_refill->idtfr, realpaddr);
+  Info("addr: %lx\nGold: ", dut_refill->addr);
+  refill_display_line(gold, dut_refill->data, "");
+  // continue run some cycle before aborted to dump wave
+  if (delay == 0) {
+    delay = 1;
   }
 #endif // CONFIG_DIFFTEST_REFILLEVENT
   return 0;
@@ -1078,6 +1839,12 @@ typedef struct {
   uint8_t level;
 } r_s2xlate;
 
+// watch the page before reading, so that a write after the read drops the cached walks
+static inline void read_pte(uint64_t paddr, PTE *pte) {
+  goldenmem_watch_pt(paddr);
+  read_goldenmem(paddr, &pte->val, 8);
+}
+
 r_s2xlate do_s2xlate(Hgatp *hgatp, uint64_t gpaddr) {
   PTE pte;
   uint64_t hpaddr;
@@ -1092,7 +1859,7 @@ r_s2xlate do_s2xlate(Hgatp *hgatp, uint64_t gpaddr) {
   int max_level = hgatp->mode == 8 ? 2 : 3;
   for (level = max_level; level >= 0; level--) {
     hpaddr = pg_base + GVPNi(gpaddr, level, max_level) * sizeof(uint64_t);
-    read_goldenmem(hpaddr, &pte.val, 8);
+    read_pte(hpaddr, &pte);
     pg_base = pte.ppn << 12;
     if (!pte.v || pte.r || pte.x || pte.w || level == 0) {
       break;
@@ -1103,6 +1870,115 @@ r_s2xlate do_s2xlate(Hgatp *hgatp, uint64_t gpaddr) {
   return r_s2;
 }
 
+#if defined(CONFIG_DIFFTEST_L1TLBEVENT) || defined(CONFIG_DIFFTEST_L2TLBEVENT)
+#define L1TLB_WALK 0
+#define L2TLB_WALK 4 // plus s2xlate
+
+static PageWalk l1tlb_walk(Satp *satp, Satp *vsatp, Hgatp *hgatp, uint8_t s2xlate, uint64_t vpn) {
+  PTE pte;
+  uint64_t paddr;
+  uint8_t difftest_level;
+  r_s2xlate r_s2;
+  bool isNapot = false;
+
+  uint8_t hasS2xlate = s2xlate != noS2xlate;
+  uint8_t onlyS2 = s2xlate == onlyStage2;
+  uint8_t hasAllStage = s2xlate == allStage;
+  uint64_t pg_base = (hasS2xlate ? vsatp->ppn : satp->ppn) << 12;
+  int mode = hasS2xlate ? vsatp->mode : satp->mode;
+  int max_level = mode == 8 ? 2 : 3;
+  if (onlyS2) {
+    r_s2 = do_s2xlate(hgatp, vpn << 12);
+    pte = r_s2.pte;
+    difftest_level = r_s2.level;
+  } else {
+    for (difftest_level = max_level; difftest_level >= 0; difftest_level--) {
+      paddr = pg_base + VPNi(vpn, difftest_level) * sizeof(uint64_t);
+      if (hasAllStage) {
+        r_s2 = do_s2xlate(hgatp, paddr);
+        uint64_t pg_mask = ((1ull << VPNiSHFT(r_s2.level)) - 1);
+        if (r_s2.level == 0 && r_s2.pte.n) {
+          pg_mask = ((1ull << NAPOTSHFT) - 1);
+        }
+        pg_base = (r_s2.pte.ppn << 12 & ~pg_mask) | (paddr & pg_mask & ~PAGE_MASK);
+        paddr = pg_base | (paddr & PAGE_MASK);
+      }
+      read_pte(paddr, &pte);
+      pg_base = pte.ppn << 12;
+      if (!pte.v || pte.r || pte.x || pte.w || difftest_level == 0) {
+        break;
+      }
+    }
+    if (difftest_level > 0 && pte.v) {
+      uint64_t pg_mask = ((1ull << VPNiSHFT(difftest_level)) - 1);
+      pg_base = (pte.ppn << 12 & ~pg_mask) | (vpn << 12 & pg_mask & ~PAGE_MASK);
+    } else if (difftest_level == 0 && pte.n) {
+      isNapot = true;
+      uint64_t pg_mask = ((1ull << NAPOTSHFT) - 1);
+      pg_base = (pte.ppn << 12 & ~pg_mask) | (vpn << 12 & pg_mask & ~PAGE_MASK);
+    }
+    if (hasAllStage && pte.v) {
+      r_s2 = do_s2xlate(hgatp, pg_base);
+      pte = r_s2.pte;
+      difftest_level = r_s2.level;
+      if (difftest_level == 0 && pte.n) {
+        isNapot = true;
+      }
+    }
+  }
+
+  PageWalk walk = {};
+  walk.pte = pte;
+  walk.level = difftest_level;
+  walk.napot = isNapot;
+  return walk;
+}
+
+static PageWalk l2tlb_walk(Satp *satp, Satp *vsatp, Hgatp *hgatp, uint8_t s2xlate, uint64_t vpn) {
+  PTE pte;
+  r_s2xlate r_s2 = {};
+  uint64_t paddr = vpn << 12;
+  uint8_t difftest_level;
+
+  uint8_t hasS2xlate = s2xlate != noS2xlate;
+  uint8_t onlyS2 = s2xlate == onlyStage2;
+  uint64_t pg_base = (hasS2xlate ? vsatp->ppn : satp->ppn) << 12;
+  int mode = hasS2xlate ? vsatp->mode : satp->mode;
+  int max_level = mode == 8 ? 2 : 3;
+  if (onlyS2) {
+    r_s2 = do_s2xlate(hgatp, vpn << 12);
+    uint64_t pg_mask = ((1ull << VPNiSHFT(r_s2.level)) - 1);
+    uint64_t s2_pg_base = r_s2.pte.ppn << 12;
+    pg_base = (s2_pg_base & ~pg_mask) | (paddr & pg_mask & ~PAGE_MASK);
+    paddr = pg_base | (paddr & PAGE_MASK);
+  }
+  for (difftest_level = max_level; difftest_level >= 0; difftest_level--) {
+    paddr = pg_base + VPNi(vpn, difftest_level) * sizeof(uint64_t);
+    if (hasS2xlate) {
+      r_s2 = do_s2xlate(hgatp, paddr);
+      uint64_t pg_mask = ((1ull << VPNiSHFT(r_s2.level)) - 1);
+      pg_base = (r_s2.pte.ppn << 12 & ~pg_mask) | (paddr & pg_mask & ~PAGE_MASK);
+      paddr = pg_base | (paddr & PAGE_MASK);
+    }
+    read_pte(paddr, &pte);
+    if (!pte.v || pte.r || pte.x || pte.w || difftest_level == 0) {
+      break;
+    }
+    pg_base = pte.ppn << 12;
+  }
+  if (hasS2xlate) {
+    r_s2 = do_s2xlate(hgatp, pg_base);
+  }
+
+  PageWalk walk = {};
+  walk.pte = pte;
+  walk.level = difftest_level;
+  walk.s2_pte = r_s2.pte;
+  walk.s2_level = r_s2.level;
+  return walk;
+}
+#endif // CONFIG_DIFFTEST_L1TLBEVENT || CONFIG_DIFFTEST_L2TLBEVENT
+
 int Difftest::do_l1tlb_check() {
 #ifdef CONFIG_DIFFTEST_L1TLBEVENT
   for (int i = 0; i < CONFIG_DIFF_L1TLB_WIDTH; i++) {
@@ -1110,61 +1986,24 @@ int Difftest::do_l1tlb_check() {
       continue;
     }
     dut->l1tlb[i].valid = 0;
-    PTE pte;
-    uint64_t paddr;
-    uint8_t difftest_level;
-    r_s2xlate r_s2;
-    bool isNapot = false;
-
     Satp *satp = (Satp *)&dut->l1tlb[i].satp;
     Satp *vsatp = (Satp *)&dut->l1tlb[i].vsatp;
     Hgatp *hgatp = (Hgatp *)&dut->l1tlb[i].hgatp;
-    uint8_t hasS2xlate = dut->l1tlb[i].s2xlate != noS2xlate;
-    uint8_t onlyS2 = dut->l1tlb[i].s2xlate == onlyStage2;
-    uint8_t hasAllStage = dut->l1tlb[i].s2xlate == allStage;
-    uint64_t pg_base = (hasS2xlate ? vsatp->ppn : satp->ppn) << 12;
-    int mode = hasS2xlate ? vsatp->mode : satp->mode;
-    int max_level = mode == 8 ? 2 : 3;
-    if (onlyS2) {
-      r_s2 = do_s2xlate(hgatp, dut->l1tlb[i].vpn << 12);
-      pte = r_s2.pte;
-      difftest_level = r_s2.level;
+    uint8_t kind = L1TLB_WALK + dut->l1tlb[i].s2xlate;
+    uint64_t vpn = dut->l1tlb[i].vpn;
+    uint64_t generation = goldenmem_pt_walk_generation();
+    PageWalk walk;
+    const PageWalk *cached = page_walk_cache.find(kind, satp->val, vsatp->val, hgatp->val, vpn, generation);
+    if (cached) {
+      walk = *cached;
     } else {
-      for (difftest_level = max_level; difftest_level >= 0; difftest_level--) {
-        paddr = pg_base + VPNi(dut->l1tlb[i].vpn, difftest_level) * sizeof(uint64_t);
-        if (hasAllStage) {
-          r_s2 = do_s2xlate(hgatp, paddr);
-          uint64_t pg_mask = ((1ull << VPNiSHFT(r_s2.level)) - 1);
-          if (r_s2.level == 0 && r_s2.pte.n) {
-            pg_mask = ((1ull << NAPOTSHFT) - 1);
-          }
-          pg_base = (r_s2.pte.ppn << 12 & ~pg_mask) | (paddr & pg_mask & ~PAGE_MASK);
-          paddr = pg_base | (paddr & PAGE_MASK);
-        }
-        read_goldenmem(paddr, &pte.val, 8);
-        pg_base = pte.ppn << 12;
-        if (!pte.v || pte.r || pte.x || pte.w || difftest_level == 0) {
-          break;
-        }
-      }
-      if (difftest_level > 0 && pte.v) {
-        uint64_t pg_mask = ((1ull << VPNiSHFT(difftest_level)) - 1);
-        pg_base = (pte.ppn << 12 & ~pg_mask) | (dut->l1tlb[i].vpn << 12 & pg_mask & ~PAGE_MASK);
-      } else if (difftest_level == 0 && pte.n) {
-        isNapot = true;
-        uint64_t pg_mask = ((1ull << NAPOTSHFT) - 1);
-        pg_base = (pte.ppn << 12 & ~pg_mask) | (dut->l1tlb[i].vpn << 12 & pg_mask & ~PAGE_MASK);
-      }
-      if (hasAllStage && pte.v) {
-        r_s2 = do_s2xlate(hgatp, pg_base);
-        pte = r_s2.pte;
-        difftest_level = r_s2.level;
-        if (difftest_level == 0 && pte.n) {
-          isNapot = true;
-        }
-      }
+      walk = l1tlb_walk(satp, vsatp, hgatp, dut->l1tlb[i].s2xlate, vpn);
+      page_walk_cache.insert(kind, satp->val, vsatp->val, hgatp->val, vpn, generation, walk);
     }
-    if (isNapot) {
+    PTE pte = walk.pte;
+    uint8_t difftest_level = walk.level;
+
+    if (walk.napot) {
       dut->l1tlb[i].ppn = dut->l1tlb[i].ppn >> 4 << 4;
       pte.difftest_ppn = pte.difftest_ppn >> 4 << 4;
     } else {
@@ -1192,45 +2031,24 @@ int Difftest::do_l2tlb_check() {
     Satp *satp = (Satp *)&dut->l2tlb[i].satp;
     Satp *vsatp = (Satp *)&dut->l2tlb[i].vsatp;
     Hgatp *hgatp = (Hgatp *)&dut->l2tlb[i].hgatp;
-    PTE pte;
-    r_s2xlate r_s2;
-    r_s2xlate check_s2;
-    uint64_t paddr;
-    uint8_t difftest_level;
+    uint8_t hasS2xlate = dut->l2tlb[i].s2xlate != noS2xlate;
+    uint8_t kind = L2TLB_WALK + dut->l2tlb[i].s2xlate;
+    uint64_t generation = goldenmem_pt_walk_generation();
     for (int j = 0; j < 8; j++) {
       if (dut->l2tlb[i].valididx[j]) {
-        uint8_t hasS2xlate = dut->l2tlb[i].s2xlate != noS2xlate;
-        uint8_t onlyS2 = dut->l2tlb[i].s2xlate == onlyStage2;
-        uint64_t pg_base = (hasS2xlate ? vsatp->ppn : satp->ppn) << 12;
-        int mode = hasS2xlate ? vsatp->mode : satp->mode;
-        int max_level = mode == 8 ? 2 : 3;
-        if (onlyS2) {
-          r_s2 = do_s2xlate(hgatp, dut->l2tlb[i].vpn << 12);
-          uint64_t pg_mask = ((1ull << VPNiSHFT(r_s2.level)) - 1);
-          uint64_t s2_pg_base = r_s2.pte.ppn << 12;
-          pg_base = (s2_pg_base & ~pg_mask) | (paddr & pg_mask & ~PAGE_MASK);
-          paddr = pg_base | (paddr & PAGE_MASK);
-        }
-        for (difftest_level = max_level; difftest_level >= 0; difftest_level--) {
-          paddr = pg_base + VPNi(dut->l2tlb[i].vpn + j, difftest_level) * sizeof(uint64_t);
-          if (hasS2xlate) {
-            r_s2 = do_s2xlate(hgatp, paddr);
-            uint64_t pg_mask = ((1ull << VPNiSHFT(r_s2.level)) - 1);
-            pg_base = (r_s2.pte.ppn << 12 & ~pg_mask) | (paddr & pg_mask & ~PAGE_MASK);
-            paddr = pg_base | (paddr & PAGE_MASK);
-          }
-          read_goldenmem(paddr, &pte.val, 8);
-          if (!pte.v || pte.r || pte.x || pte.w || difftest_level == 0) {
-            break;
-          }
-          pg_base = pte.ppn << 12;
+        uint64_t vpn = dut->l2tlb[i].vpn + j;
+        PageWalk walk;
+        const PageWalk *cached = page_walk_cache.find(kind, satp->val, vsatp->val, hgatp->val, vpn, generation);
+        if (cached) {
+          walk = *cached;
+        } else {
+          walk = l2tlb_walk(satp, vsatp, hgatp, dut->l2tlb[i].s2xlate, vpn);
+          page_walk_cache.insert(kind, satp->val, vsatp->val, hgatp->val, vpn, generation, walk);
         }
+        PTE pte = walk.pte;
+        uint8_t difftest_level = walk.level;
+        r_s2xlate r_s2 = {walk.s2_pte, walk.s2_level};
 
-        if (hasS2xlate) {
-          r_s2 = do_s2xlate(hgatp, pg_base);
-          if (dut->l2tlb[i].pteidx[j])
-            check_s2 = r_s2;
-        }
         bool difftest_gpf = !r_s2.pte.v || (!r_s2.pte.r && r_s2.pte.w);
         bool difftest_pf = !pte.v || (!pte.r && pte.w);
         bool s1_check_fail = pte.difftest_ppn != dut->l2tlb[i].ppn[j] || pte.difftest_perm != dut->l2tlb[i].perm ||
@@ -1474,8 +2292,18 @@ int Difftest::do_golden_memory_update() {
 
 #ifdef CONFIG_DIFFTEST_STOREEVENT
 void Difftest::store_event_record() {
+#ifdef CONFIG_DIFF_STORE_VALID_MASK
+  uint64_t mask = dut->valid_mask.store;
+  dut->valid_mask.store = 0;
+  for (; mask; mask &= mask - 1) {
+    int i = __builtin_ctzll(mask);
+#else
   for (int i = 0; i < CONFIG_DIFF_STORE_WIDTH; i++) {
+#endif // CONFIG_DIFF_STORE_VALID_MASK
     if (dut->store[i].valid) {
+      if (store_event_queue.full()) {
+        panic("Core %d: more than %d stores are not checked", id, DIFFTEST_STORE_RING_SIZE);
+      }
       store_event_queue.push(dut->store[i]);
       dut->store[i].valid = 0;
     }
@@ -1537,8 +2365,14 @@ int Difftest::check_timeout() {
   return 0;
 }
 
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+#define DELTA_MARK_DELAYED(is_fp, addr) proxy->mark_dirty(!(is_fp), is_fp, false, addr)
+#else
+#define DELTA_MARK_DELAYED(is_fp, addr)
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+
 int Difftest::update_delayed_writeback() {
-#define CHECK_DELAYED_WB(wb, delayed, n, regs_name)                                                \
+#define CHECK_DELAYED_WB(wb, delayed, n, regs_name, is_fp)                                         \
   do {                                                                                             \
     for (int i = 0; i < n; i++) {                                                                  \
       auto delay = dut->wb + i;                                                                    \
@@ -1556,6 +2390,7 @@ int Difftest::update_delayed_writeback() {
           }                                                                                        \
         } else {                                                                                   \
           delayed[delay->address] = 0;                                                             \
+          DELTA_MARK_DELAYED(is_fp, delay->address);                                               \
         }                                                                                          \
         progress = true;                                                                           \
       }                                                                                            \
@@ -1563,10 +2398,10 @@ int Difftest::update_delayed_writeback() {
   } while (0);
 
 #ifdef CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
-  CHECK_DELAYED_WB(regs_int_delayed, delayed_int, CONFIG_DIFF_REGS_INT_DELAYED_WIDTH, regs_name_int)
+  CHECK_DELAYED_WB(regs_int_delayed, delayed_int, CONFIG_DIFF_REGS_INT_DELAYED_WIDTH, regs_name_int, false)
 #endif // CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
 #ifdef CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
-  CHECK_DELAYED_WB(regs_fp_delayed, delayed_fp, CONFIG_DIFF_REGS_FP_DELAYED_WIDTH, regs_name_fp)
+  CHECK_DELAYED_WB(regs_fp_delayed, delayed_fp, CONFIG_DIFF_REGS_FP_DELAYED_WIDTH, regs_name_fp, true)
 #endif // CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
   return 0;
 }
@@ -1598,6 +2433,33 @@ int Difftest::apply_delayed_writeback() {
   return 0;
 }
 
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+bool Difftest::compare_state_hash() {
+  // Registers with pending delayed writebacks are not final in DUT. They are checked with the next full states.
+#ifdef CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
+  for (int i = 0; i < 32; i++) {
+    if (delayed_int[i]) {
+      return false;
+    }
+  }
+#endif // CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
+#ifdef CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
+  for (int i = 0; i < 32; i++) {
+    if (delayed_fp[i]) {
+      return false;
+    }
+  }
+#endif // CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
+  uint64_t ref_hash = proxy->update_hash();
+  if (ref_hash == dut->state_hash.hash) {
+    return false;
+  }
+  Info("State hash different at pc = 0x%010lx, right = 0x%016lx, wrong = 0x%016lx\n", dut->commit[0].pc, ref_hash,
+       dut->state_hash.hash);
+  return true;
+}
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
+
 void Difftest::raise_trap(int trapCode) {
   dut->trap.hasTrap = 1;
   dut->trap.code = trapCode;
@@ -1682,20 +2544,41 @@ void Difftest::display() {
   state->display(this->id);
 
   Info("\n==============  REF Regs  ==============\n");
-  fflush(stdout);
+  asynclog_flush();
   proxy->ref_reg_display();
   Info("privilegeMode: %lu\n", dut->csr.privilegeMode);
 }
 
-void CommitTrace::display(bool use_spike) {
+const char *CommitTrace::get_type() const {
+  switch (type) {
+    case TRACE_EXCEPTION: return "exception";
+    case TRACE_INTERRUPT: return "interrupt";
+    default: return "commit";
+  }
+}
+
+void CommitTrace::display(bool use_spike) const {
   Info("%s pc %016lx inst %08x", get_type(), pc, inst);
-  display_custom();
+  if (type == TRACE_COMMIT) {
+    Info(" wen %d dst %02d data %016lx idx %03x", wen, dest, data, robidx);
+    if (isLoad) {
+      Info(" (%02x)", lqidx);
+    }
+    if (isStore) {
+      Info(" (%02x)", sqidx);
+    }
+    if (tag) {
+      Info(" (%c)", tag);
+    }
+  } else {
+    Info(" cause %016lx", data);
+  }
   if (use_spike) {
     Info(" %s", spike_dasm(inst));
   }
 }
 
-void CommitTrace::display_line(int index, bool use_spike, bool is_retire) {
+void CommitTrace::display_line(int index, bool use_spike, bool is_retire) const {
   Info("[%02d] ", index);
   display(use_spike);
   Info("%s\n", is_retire ? " <--" : "");
@@ -1723,27 +2606,22 @@ void Difftest::warmup_display_stats() {
 
 void DiffState::display(int coreid) {
   Info("\n============== Commit Group Trace (Core %d) ==============\n", coreid);
-  int group_index = 0;
-  while (!retire_group_queue.empty()) {
-    auto retire_group = retire_group_queue.front();
-    auto pc = retire_group.first;
-    auto cnt = retire_group.second;
-    retire_group_queue.pop();
-    Info("commit group [%02d]: pc %010lx cmtcnt %d%s\n", group_index, pc, cnt,
-         retire_group_queue.empty() ? " <--" : "");
-    group_index++;
+  size_t n_group = retire_group_trace.size();
+  for (size_t i = 0; i < n_group; i++) {
+    auto pc = retire_group_trace[i].first;
+    auto cnt = retire_group_trace[i].second;
+    Info("commit group [%02zu]: pc %010lx cmtcnt %d%s\n", i, pc, cnt, i + 1 == n_group ? " <--" : "");
   }
 
   Info("\n============== Commit Instr Trace ==============\n");
-  int commit_index = 0;
-  while (!commit_trace.empty()) {
-    CommitTrace *trace = commit_trace.front();
-    commit_trace.pop();
-    trace->display_line(commit_index, use_spike, commit_trace.empty());
-    commit_index++;
+  size_t n_commit = commit_trace.size();
+  for (size_t i = 0; i < n_commit; i++) {
+    commit_trace[i].display_line(i, use_spike, i + 1 == n_commit);
   }
+  retire_group_trace.clear();
+  commit_trace.clear();
 
-  fflush(stdout);
+  asynclog_flush();
 }
 
 DiffState::DiffState() : use_spike(spike_valid()) {}
@@ -20,14 +20,34 @@
 #include "common.h"
 #include "difftrace.h"
 #include "dut.h"
+#include "flatset.h"
 #include "golden.h"
 #include "refproxy.h"
+#include <algorithm>
 #include <queue>
-#include <unordered_set>
 #ifdef FUZZING
 #include "emu.h"
 #endif // FUZZING
 
+#if defined(CONFIG_DIFFTEST_PARALLEL) && defined(CONFIG_DIFFTEST_REPLAY)
+#error "CONFIG_DIFFTEST_PARALLEL does not support CONFIG_DIFFTEST_REPLAY"
+#endif // CONFIG_DIFFTEST_PARALLEL && CONFIG_DIFFTEST_REPLAY
+#if defined(CONFIG_DIFFTEST_ASYNC) && defined(CONFIG_DIFFTEST_REPLAY)
+#error "CONFIG_DIFFTEST_ASYNC requires the DUT not to wait for checking results"
+#endif // CONFIG_DIFFTEST_ASYNC
+#ifdef CONFIG_DIFFTEST_STOREEVENT
+#define DIFFTEST_STORE_RING_SIZE 4096
+// stores checked by REF in one call
+#define DIFFTEST_STORE_CHECK_BATCH 64
+#endif // CONFIG_DIFFTEST_STOREEVENT
+// execute all commits of a cycle with one call of difftest_exec_batch if REF provides it
+#if !defined(BASIC_DIFFTEST_ONLY) && !defined(CONFIG_DIFFTEST_SQUASH)
+#define DIFFTEST_EXEC_BATCH
+#endif // !BASIC_DIFFTEST_ONLY && !CONFIG_DIFFTEST_SQUASH
+#if defined(CONFIG_DIFFTEST_DELTA_SYNC) && defined(CONFIG_DIFFTEST_SQUASH)
+#error "CONFIG_DIFFTEST_DELTA_SYNC requires the written register of every instruction"
+#endif // CONFIG_DIFFTEST_DELTA_SYNC && CONFIG_DIFFTEST_SQUASH
+
 enum {
   EX_IAM,       // instruction address misaligned
   EX_IAF,       // instruction address fault
@@ -98,87 +118,90 @@ public:
   uint8_t mask;
 };
 
-class CommitTrace {
-public:
-  uint64_t pc;
-  uint32_t inst;
-
-  CommitTrace(uint64_t pc, uint32_t inst) : pc(pc), inst(inst) {}
-  virtual ~CommitTrace() {}
-  virtual const char *get_type() = 0;
-  virtual void display(bool use_spike = false);
-  void display_line(int index, bool use_spike, bool is_retire);
-
-protected:
-  virtual void display_custom() = 0;
+enum CommitTraceType : uint8_t {
+  TRACE_COMMIT,
+  TRACE_EXCEPTION,
+  TRACE_INTERRUPT
 };
 
-class InstrTrace : public CommitTrace {
-public:
+// A record of the commit trace. It is plain data of 32 bytes, so that the DiffState can be copied by memcpy.
+struct CommitTrace {
+  uint64_t pc;
+  uint64_t data; // the written data of a commit, or the cause of an exception or interrupt
+  uint32_t inst;
+  uint16_t robidx;
+  uint8_t type;
   uint8_t wen;
   uint8_t dest;
-  uint64_t data;
-  char tag;
-
-  uint16_t robidx;
   uint8_t isLoad;
   uint8_t lqidx;
   uint8_t isStore;
   uint8_t sqidx;
+  char tag;
 
-  InstrTrace(uint64_t pc, uint32_t inst, uint8_t wen, uint8_t dest, uint64_t data, uint8_t lqidx, uint8_t sqidx,
-             uint16_t robidx, uint8_t isLoad, uint8_t isStore, bool skip = false, bool delayed = false)
-      : CommitTrace(pc, inst), robidx(robidx), isLoad(isLoad), lqidx(lqidx), isStore(isStore), sqidx(sqidx), wen(wen),
-        dest(dest), data(data), tag(get_tag(skip, delayed)) {}
-  virtual inline const char *get_type() {
-    return "commit";
-  };
+  const char *get_type() const;
+  void display(bool use_spike = false) const;
+  void display_line(int index, bool use_spike, bool is_retire) const;
+};
+static_assert(sizeof(CommitTrace) == 32, "CommitTrace should be 32 bytes");
 
-protected:
-  void display_custom() {
-    Info(" wen %d dst %02d data %016lx idx %03x", wen, dest, data, robidx);
-    if (isLoad) {
-      Info(" (%02x)", lqidx);
-    }
-    if (isStore) {
-      Info(" (%02x)", sqidx);
-    }
-    if (tag) {
-      Info(" (%c)", tag);
-    }
+// The last N records, kept without any allocation
+template <typename T, size_t N> class TraceRing {
+public:
+  // the record to be overwritten by the newest one
+  inline T &push() {
+    return buf[head++ % N];
+  }
+  inline size_t size() const {
+    return head < N ? head : N;
+  }
+  // i-th record from the oldest one
+  inline const T &operator[](size_t i) const {
+    return buf[(head - size() + i) % N];
+  }
+  inline void clear() {
+    head = 0;
   }
 
 private:
-  char get_tag(bool skip, bool delayed) {
-    char t = '\0';
-    if (skip)
-      t |= 'S';
-    if (delayed)
-      t |= 'D';
-    return t;
-  }
+  T buf[N];
+  uint64_t head = 0;
 };
 
-class ExceptionTrace : public CommitTrace {
-public:
-  uint64_t cause;
-  ExceptionTrace(uint64_t pc, uint32_t inst, uint64_t cause) : CommitTrace(pc, inst), cause(cause) {}
-  virtual inline const char *get_type() {
-    return "exception";
-  };
-
-protected:
-  void display_custom() {
-    Info(" cause %016lx", cause);
-  }
-};
+// A FIFO of at most N events, kept without any allocation. N must be a power of 2.
+template <typename T, size_t N> class EventRing {
+  static_assert((N & (N - 1)) == 0, "EventRing size should be a power of 2");
 
-class InterruptTrace : public ExceptionTrace {
 public:
-  InterruptTrace(uint64_t pc, uint32_t inst, uint64_t cause) : ExceptionTrace(pc, inst, cause) {}
-  virtual inline const char *get_type() {
-    return "interrupt";
+  inline bool empty() const {
+    return head == tail;
+  }
+  inline size_t size() const {
+    return head - tail;
   }
+  inline bool full() const {
+    return size() == N;
+  }
+  inline void push(const T &e) {
+    buf[head++ % N] = e;
+  }
+  // i-th event from the oldest one
+  inline T &operator[](size_t i) {
+    return buf[(tail + i) % N];
+  }
+  inline T &front() {
+    return buf[tail % N];
+  }
+  inline void pop(size_t n = 1) {
+    tail += n;
+  }
+  inline void clear() {
+    tail = head;
+  }
+
+private:
+  T buf[N];
+  uint64_t head = 0, tail = 0;
 };
 
 typedef struct {
@@ -186,49 +209,112 @@ typedef struct {
   uint64_t cycleCnt;
 } WarmupInfo;
 
+#if defined(CONFIG_DIFFTEST_L1TLBEVENT) || defined(CONFIG_DIFFTEST_L2TLBEVENT)
+typedef struct {
+  PTE pte;
+  PTE s2_pte;
+  uint8_t level;
+  uint8_t s2_level;
+  bool napot;
+} PageWalk;
+
+// Direct-mapped cache of the TLB page-table walks. Entries of an older generation of the
+// golden page tables (see goldenmem_pt_generation) are misses.
+class PageWalkCache {
+public:
+  // kind tells the walkers apart, since they differ in the s2xlate handling
+  inline const PageWalk *find(uint8_t kind, uint64_t satp, uint64_t vsatp, uint64_t hgatp, uint64_t vpn,
+                              uint64_t generation) const {
+    const Entry &e = entries[index(vpn, satp)];
+    if (e.generation == generation && e.vpn == vpn && e.satp == satp && e.vsatp == vsatp && e.hgatp == hgatp &&
+        e.kind == kind) {
+      return &e.walk;
+    }
+    return nullptr;
+  }
+  inline void insert(uint8_t kind, uint64_t satp, uint64_t vsatp, uint64_t hgatp, uint64_t vpn, uint64_t generation,
+                     const PageWalk &walk) {
+    Entry &e = entries[index(vpn, satp)];
+    e.kind = kind;
+    e.satp = satp;
+    e.vsatp = vsatp;
+    e.hgatp = hgatp;
+    e.vpn = vpn;
+    e.generation = generation;
+    e.walk = walk;
+  }
+
+private:
+  static const size_t SIZE = 4096;
+  struct Entry {
+    uint64_t generation = UINT64_MAX;
+    uint64_t satp, vsatp, hgatp, vpn;
+    uint8_t kind;
+    PageWalk walk;
+  } entries[SIZE];
+
+  static inline size_t index(uint64_t vpn, uint64_t satp) {
+    return (vpn ^ (satp * 0x9e3779b97f4a7c15UL >> 52)) % SIZE;
+  }
+};
+#endif // CONFIG_DIFFTEST_L1TLBEVENT || CONFIG_DIFFTEST_L2TLBEVENT
+
 class DiffState {
 public:
   bool dump_commit_trace = false;
 
   DiffState();
   void record_group(uint64_t pc, uint32_t count) {
-    if (retire_group_queue.size() >= DEBUG_GROUP_TRACE_SIZE) {
-      retire_group_queue.pop();
-    }
-    retire_group_queue.push(std::make_pair(pc, count));
+    retire_group_trace.push() = std::make_pair(pc, count);
   }
   void record_inst(uint64_t pc, uint32_t inst, uint8_t en, uint8_t dest, uint64_t data, bool skip, bool delayed,
                    uint8_t lqidx, uint8_t sqidx, uint16_t robidx, uint8_t isLoad, uint8_t isStore) {
-    push_back_trace(new InstrTrace(pc, inst, en, dest, data, lqidx, sqidx, robidx, isLoad, isStore, skip, delayed));
+    CommitTrace &trace = commit_trace.push();
+    trace.pc = pc;
+    trace.data = data;
+    trace.inst = inst;
+    trace.robidx = robidx;
+    trace.type = TRACE_COMMIT;
+    trace.wen = en;
+    trace.dest = dest;
+    trace.isLoad = isLoad;
+    trace.lqidx = lqidx;
+    trace.isStore = isStore;
+    trace.sqidx = sqidx;
+    trace.tag = (skip ? 'S' : '\0') | (delayed ? 'D' : '\0');
+    dump_trace(trace);
   };
   void record_exception(uint64_t pc, uint32_t inst, uint64_t cause) {
-    push_back_trace(new ExceptionTrace(pc, inst, cause));
+    record_event(TRACE_EXCEPTION, pc, inst, cause);
   };
   void record_interrupt(uint64_t pc, uint32_t inst, uint64_t cause) {
-    push_back_trace(new InterruptTrace(pc, inst, cause));
+    record_event(TRACE_INTERRUPT, pc, inst, cause);
   };
   void display(int coreid);
 
 private:
   const bool use_spike;
 
-  static const int DEBUG_GROUP_TRACE_SIZE = 16;
-  std::queue<std::pair<uint64_t, uint32_t>> retire_group_queue;
-
-  static const int DEBUG_INST_TRACE_SIZE = 32;
-  std::queue<CommitTrace *> commit_trace;
-
-  void push_back_trace(CommitTrace *trace) {
-    if (commit_trace.size() >= DEBUG_INST_TRACE_SIZE) {
-      delete commit_trace.front();
-      commit_trace.pop();
-    }
-    commit_trace.push(trace);
+  TraceRing<std::pair<uint64_t, uint32_t>, DIFFTEST_GROUP_TRACE_SIZE> retire_group_trace;
+  TraceRing<CommitTrace, DIFFTEST_COMMIT_TRACE_SIZE> commit_trace;
+
+  void record_event(uint8_t type, uint64_t pc, uint32_t inst, uint64_t cause) {
+    CommitTrace &trace = commit_trace.push();
+    memset(&trace, 0, sizeof(trace));
+    trace.pc = pc;
+    trace.data = cause;
+    trace.inst = inst;
+    trace.type = type;
+    dump_trace(trace);
+  }
+  inline void dump_trace(const CommitTrace &trace) {
     if (dump_commit_trace) {
       static uint64_t commit_counter = 0;
-      trace->display_line(commit_counter, use_spike, false);
+      trace.display_line(commit_counter, use_spike, false);
       commit_counter++;
-      fflush(stdout);
+      if (!asynclog_active()) {
+        fflush(stdout);
+      }
     }
   }
   void display_commit_count(int i);
@@ -250,7 +336,15 @@ public:
   WarmupInfo warmup_info;
   // Trigger a difftest checking procdure
   int step();
+  // Apply stores to the golden memory. It is called by step() unless CONFIG_DIFFTEST_PARALLEL,
+  // where updates from all cores are applied in order before the parallel checking, and each checker
+  // reads the golden memory without the stores of later cores.
+  int do_golden_memory_update();
   void update_nemuproxy(int, size_t);
+  // Let REF execute the instructions skipped by sampling, and check their stores
+  int sample_flush();
+  // Replace REF with the one in ref_so, which continues from the states of the current REF
+  void switch_ref(const char *ref_so, size_t ram_size);
   inline bool get_trap_valid() {
     return dut->trap.hasTrap;
   }
@@ -265,9 +359,8 @@ public:
   void display();
   void display_stats();
 
-  void set_trace(const char *name, bool is_read) {
-    difftrace = new DiffTrace<DiffTestState>(name, is_read);
-  }
+  // Trace replay starts from the last trace checkpoint before start_cycle
+  void set_trace(const char *name, bool is_read, uint64_t start_cycle = 0);
   void trace_read() {
     if (difftrace) {
       difftrace->read_next(dut);
@@ -331,6 +424,13 @@ public:
 
 protected:
   DiffTrace<DiffTestState> *difftrace = nullptr;
+  const char *trace_name = nullptr;
+  // # of steps checked while dumping traces
+  uint64_t trace_steps = 0;
+  // the checkpoint to be restored before replaying traces
+  char trace_checkpoint[64] = {};
+  void trace_checkpoint_save();
+  void trace_checkpoint_restore();
 
 #ifdef CONFIG_DIFFTEST_BATCH
   static const uint64_t commit_storage = CONFIG_DIFFTEST_BATCH_SIZE;
@@ -370,6 +470,14 @@ protected:
 #ifdef DEBUG_REFILL
   uint64_t track_instr = 0;
 #endif
+  int refill_delay = 0;
+  uint64_t refill_last_valid_addr = 0;
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+  uint64_t delta_sync_count = 0;
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+  // # of committed instructions not executed by REF yet, when sampling
+  uint64_t sample_pending = 0;
+  bool sample_skip();
 
 #ifdef CONFIG_DIFFTEST_SQUASH
   int commit_stamp = 0;
@@ -377,15 +485,22 @@ protected:
   std::queue<DifftestLoadEvent> load_event_queue;
   void load_event_record();
 #endif // CONFIG_DIFFTEST_LOADEVENT
+  // Number of instructions until commit_stamp reaches the stamp of a pending load or store event
+  inline int stamp_distance(int stamp) {
+    int d = (stamp - commit_stamp + CONFIG_DIFFTEST_SQUASH_STAMPSIZE) % CONFIG_DIFFTEST_SQUASH_STAMPSIZE;
+    return d == 0 ? CONFIG_DIFFTEST_SQUASH_STAMPSIZE : d;
+  }
+  int next_event_distance();
 #endif // CONFIG_DIFFTEST_SQUASH
 
 #ifdef CONFIG_DIFFTEST_STOREEVENT
-  std::queue<DifftestStoreEvent> store_event_queue;
+  // the recorded stores not checked yet, which are many commits ahead of REF only with squash
+  EventRing<DifftestStoreEvent, DIFFTEST_STORE_RING_SIZE> store_event_queue;
   void store_event_record();
 #endif
 
 #ifdef CONFIG_DIFFTEST_CMOINVALEVENT
-  std::unordered_set<uint64_t> cmo_inval_event_set;
+  FlatAddrSet cmo_inval_event_set;
   void cmo_inval_event_record();
 #endif
 
@@ -394,22 +509,38 @@ protected:
   }
   int check_timeout();
   int check_all();
+  // commits of this cycle, unrolled for CONFIG_DIFF_COMMIT_WIDTH unless CONFIG_DIFFTEST_GENERIC_CHECKER
+  template <bool batch> int check_commits();
+  template <bool batch> int check_commit(int i);
   void do_first_instr_commit();
   void do_interrupt();
   void do_exception();
-  int do_instr_commit(int index);
+  int do_instr_commit(int index, bool batch = false);
+#ifdef DIFFTEST_EXEC_BATCH
+  // commits of this cycle to be executed by REF in one call
+  ExecBatchCommit exec_batch[CONFIG_DIFF_COMMIT_WIDTH];
+  int exec_batch_size = 0;
+  // Single-core only, since the SMP load check requires the REF states after every load.
+  inline bool use_exec_batch() {
+    return NUM_CORES == 1 && proxy->has_exec_batch();
+  }
+  int do_exec_batch();
+#endif // DIFFTEST_EXEC_BATCH
 #if defined(CONFIG_DIFFTEST_LOADEVENT) && defined(CONFIG_DIFFTEST_ARCHVECREGSTATE)
   void do_vec_load_check(int index, DifftestLoadEvent load_event);
 #endif // CONFIG_DIFFTEST_LOADEVENT && CONFIG_DIFFTEST_ARCHVECREGSTATE
   void do_load_check(int index);
-  int do_store_check();
+  // With CONFIG_DIFFTEST_SQUASH, the stores of the last span instructions are checked, or of this commit if 0
+  int do_store_check(int span = 0);
   int do_refill_check(int cacheid);
   int do_irefill_check();
   int do_drefill_check();
   int do_ptwrefill_check();
   int do_l1tlb_check();
   int do_l2tlb_check();
-  int do_golden_memory_update();
+#if defined(CONFIG_DIFFTEST_L1TLBEVENT) || defined(CONFIG_DIFFTEST_L2TLBEVENT)
+  PageWalkCache page_walk_cache;
+#endif // CONFIG_DIFFTEST_L1TLBEVENT || CONFIG_DIFFTEST_L2TLBEVENT
 
   inline uint64_t get_commit_data(int i) {
 #ifdef CONFIG_DIFFTEST_COMMITDATA
@@ -457,7 +588,6 @@ protected:
     return dut->trap.hasWFI;
   }
   inline bool in_disambiguation_state() {
-    static bool was_found = false;
 #ifdef FUZZING
     // Only in fuzzing mode
     if (proxy->in_disambiguation_state()) {
@@ -471,6 +601,12 @@ protected:
 #endif // FUZZING
     return was_found;
   }
+  // Checker states are kept per core, as the cores may be checked concurrently
+  bool was_found = false;
+#ifdef FUZZING
+  uint64_t lastExceptionPC = 0xdeadbeafUL;
+  int sameExceptionPCCount = 0;
+#endif // FUZZING
 
 #ifdef CONFIG_DIFFTEST_ARCHINTDELAYEDUPDATE
   int delayed_int[32] = {0};
@@ -480,6 +616,10 @@ protected:
 #endif // CONFIG_DIFFTEST_ARCHFPDELAYEDUPDATE
   int update_delayed_writeback();
   int apply_delayed_writeback();
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+  // compare the state hash when DUT does not send the full states in this step
+  bool compare_state_hash();
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
 
   void raise_trap(int trapCode);
 #ifdef CONFIG_DIFFTEST_NONREGINTERRUPTPENDINGEVENT
@@ -503,7 +643,16 @@ protected:
     int trace_head;
     int trace_size;
   } replay_status;
+  int replay_step = 0;
 
+  // steps checked since the last snapshot (-1 if there is no valid one), the DUT trace they cover,
+  // and the instructions REF has executed in them
+  struct {
+    int age = -1;
+    int trace_head;
+    int trace_size;
+    uint64_t instrs;
+  } replay_ss;
   DiffState *state_ss = NULL;
   int proxy_reg_size = 0;
   uint8_t *proxy_reg_ss = NULL;
@@ -522,13 +671,40 @@ int difftest_nstep(int step, bool enable_diff);
 void difftest_switch_zone();
 void difftest_set_dut();
 int difftest_step();
+// Call hook in difftest_step() after the DUT states are set and before they are checked
+void difftest_set_step_hook(void (*hook)());
 int difftest_state();
-void difftest_finish();
+// Return STATE_RUNNING, or the state of the async checker if it has failed
+int difftest_finish();
 
 void difftest_trace_read();
 void difftest_trace_write(int step);
 
 int init_nemuproxy(size_t);
+// Keep REF instances after difftest_finish() and reset them for the next difftest_init(), if REF supports reset
+void difftest_ref_pool_enable();
+void difftest_ref_pool_free();
+// Check only the first window instructions of every interval instructions. REF executes the others in bulk.
+// The architectural states are compared when the next window starts.
+void difftest_sample_enable(uint64_t window, uint64_t interval);
+// Check all instructions again, e.g. in the LightSSS checkpoint re-running an interval after an error.
+// Return nonzero if the stores of the skipped instructions mismatch.
+int difftest_sample_disable();
+
+// Trap event of core i as seen by the simulation thread, which is ahead of the checker with CONFIG_DIFFTEST_ASYNC
+DifftestTrapEvent *difftest_trap_event(int i);
+// Turn on or off the REF debug log and the commit trace of core i. With CONFIG_DIFFTEST_ASYNC the requests
+// are passed with the next pushed states, and applied by the checker thread before checking them.
+void difftest_set_ref_debug(int i, bool enable);
+void difftest_set_commit_trace(int i, bool enable);
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+// Check DUT states on a separate thread. difftest_nstep() then only copies the states
+// and returns the first non-running state reported by the checker thread.
+void difftest_async_start();
+// Wait until all pushed states are checked, and return the state of the checker thread
+int difftest_async_stop();
+#endif // CONFIG_DIFFTEST_ASYNC
 
 #ifdef CONFIG_DIFFTEST_SQUASH
 extern "C" void set_squash_scope();
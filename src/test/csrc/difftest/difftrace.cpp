@@ -1,15 +1,132 @@
 #include "difftrace.h"
+#include "affinity.h"
+#include <algorithm>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef CONFIG_DIFFTRACE_DELTA
+// A delta trace file starts with the number of traces, followed by one record per trace.
+// Each trace is XORed with the previous one (the first one with zeros) in 8-byte words.
+// A record is a summary bitmap of the changed 64-word groups, and for each changed group,
+// its word bitmap followed by the changed XOR words.
+static void delta_encode(const uint8_t *data, size_t size, uint64_t count, std::vector<uint64_t> &out) {
+  size_t n_words = (size + 7) / 8;
+  size_t n_groups = (n_words + 63) / 64;
+  size_t n_summary = (n_groups + 63) / 64;
+  std::vector<uint64_t> prev(n_words, 0), cur(n_words, 0);
+  out.push_back(count);
+  for (uint64_t i = 0; i < count; i++) {
+    memcpy(cur.data(), data + i * size, size);
+    size_t summary = out.size();
+    out.resize(summary + n_summary, 0);
+    for (size_t g = 0; g < n_groups; g++) {
+      size_t start = g * 64, end = std::min(start + 64, n_words);
+      uint64_t bitmap = 0;
+      for (size_t w = start; w < end; w++) {
+        bitmap |= (uint64_t)(cur[w] != prev[w]) << (w - start);
+      }
+      if (bitmap) {
+        out[summary + g / 64] |= 1UL << (g % 64);
+        out.push_back(bitmap);
+        for (size_t w = start; w < end; w++) {
+          if (cur[w] != prev[w]) {
+            out.push_back(cur[w] ^ prev[w]);
+          }
+        }
+      }
+    }
+    prev.swap(cur);
+  }
+}
+
+// Returns false if the file is truncated
+static bool delta_decode(const uint64_t *in, size_t n_in, uint8_t *data, size_t size, uint64_t count) {
+  size_t n_words = (size + 7) / 8;
+  size_t n_groups = (n_words + 63) / 64;
+  size_t n_summary = (n_groups + 63) / 64;
+  std::vector<uint64_t> state(n_words, 0);
+  const uint64_t *end = in + n_in;
+  for (uint64_t i = 0; i < count; i++) {
+    if (end - in < (ptrdiff_t)n_summary) {
+      return false;
+    }
+    const uint64_t *summary = in;
+    in += n_summary;
+    for (size_t g = 0; g < n_groups; g++) {
+      if (!((summary[g / 64] >> (g % 64)) & 1)) {
+        continue;
+      }
+      if (in == end) {
+        return false;
+      }
+      uint64_t bitmap = *in++;
+      if (end - in < __builtin_popcountl(bitmap)) {
+        return false;
+      }
+      for (; bitmap; bitmap &= bitmap - 1) {
+        state[g * 64 + __builtin_ctzl(bitmap)] ^= *in++;
+      }
+    }
+    memcpy(data + i * size, state.data(), size);
+  }
+  return true;
+}
+#endif // CONFIG_DIFFTRACE_DELTA
+
+template <typename T> std::atomic<uint64_t> DiffTrace<T>::trace_index(0);
+template <typename T> std::atomic<uint64_t> DiffTrace<T>::io_backlog(0);
+template <typename T> std::vector<DiffTrace<T> *> DiffTrace<T>::instances;
+
+template <typename T> void DiffTrace<T>::fork_prepare() {
+  for (auto t: instances) {
+    std::unique_lock<std::mutex> lock(t->io_mutex);
+    t->io_cv.wait(lock, [t] { return !t->io_busy; });
+    lock.release();
+  }
+}
+
+template <typename T> void DiffTrace<T>::fork_parent() {
+  for (auto t: instances) {
+    t->io_mutex.unlock();
+  }
+}
+
+// The chunks queued for writing are written by the parent, and their buffers are reused here.
+// The condition variable may have waiters of the parent, which do not exist in the child.
+template <typename T> void DiffTrace<T>::fork_child() {
+  for (auto t: instances) {
+    if (!t->is_read) {
+      for (auto &chunk: t->io_queue) {
+        t->free_buffers.push_back(chunk.data);
+        io_backlog--;
+      }
+      t->io_queue.clear();
+    }
+    new (&t->io_cv) std::condition_variable;
+    t->io_lost = true;
+    t->io_mutex.unlock();
+  }
+}
+
+template <typename T> void DiffTrace<T>::io_start() {
+  if (is_read) {
+    io_thread = std::thread(&DiffTrace<T>::read_loop, this);
+  } else {
+    io_thread = std::thread(&DiffTrace<T>::write_loop, this);
+  }
+  affinity_place_thread(io_thread.native_handle(), "difftrace io", AFFINITY_HELPER);
+}
+
 template <typename T>
-DiffTrace<T>::DiffTrace(const char *_trace_name, bool is_read, uint64_t _buffer_size) : is_read(is_read) {
+DiffTrace<T>::DiffTrace(const char *_trace_name, bool is_read, uint64_t _buffer_size, uint64_t start_file)
+    : is_read(is_read) {
+  file_traces = _buffer_size;
   buffer_size = _buffer_size;
-  if (!is_read) {
-    buffer = (T *)calloc(buffer_size, sizeof(T));
-  }
-  if (strlen(trace_name) > 31) {
-    printf("Length of trace_name %s is more than 31 characters.\n", trace_name);
+  if (strlen(_trace_name) > 31) {
+    printf("Length of trace_name %s is more than 31 characters.\n", _trace_name);
     printf("Please use a shorter name.\n");
     exit(0);
   }
@@ -17,6 +134,53 @@ DiffTrace<T>::DiffTrace(const char *_trace_name, bool is_read, uint64_t _buffer_
 #ifdef CONFIG_IOTRACE_ZSTD
   trace_zstd = new DiffTraceZstd(buffer_size);
 #endif
+  if (!is_read) {
+    buffer = (T *)calloc(buffer_size, sizeof(T));
+    for (int i = 1; i < DIFFTRACE_BUFFERS; i++) {
+      free_buffers.push_back((T *)calloc(buffer_size, sizeof(T)));
+    }
+  } else {
+    trace_index = start_file;
+  }
+  static bool registered = false;
+  if (!registered) {
+    registered = true;
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+  }
+  instances.push_back(this);
+  io_start();
+}
+
+template <typename T> DiffTrace<T>::~DiffTrace() {
+  if (!is_read) {
+    trace_file_next();
+  }
+  {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    io_exit = true;
+  }
+  io_cv.notify_all();
+  if (io_lost) {
+    // the handle of the thread of the parent is leaked rather than joined
+    new std::thread(std::move(io_thread));
+  } else {
+    io_thread.join();
+  }
+  instances.erase(std::find(instances.begin(), instances.end(), this));
+  if (is_read) {
+    release_chunk(current);
+    for (auto &chunk: io_queue) {
+      release_chunk(chunk);
+    }
+  } else {
+    free(buffer);
+    for (auto buf: free_buffers) {
+      free(buf);
+    }
+  }
+#ifdef CONFIG_IOTRACE_ZSTD
+  delete trace_zstd;
+#endif // CONFIG_IOTRACE_ZSTD
 }
 
 template <typename T> bool DiffTrace<T>::append(const T *trace) {
@@ -29,11 +193,8 @@ template <typename T> bool DiffTrace<T>::append(const T *trace) {
 }
 
 template <typename T> bool DiffTrace<T>::read_next(T *trace) {
-#ifndef CONFIG_IOTRACE_ZSTD
-  if (!buffer || buffer_count == buffer_size) {
-#else
-  if (!buffer || trace_zstd->trace_load_len == buffer_count) {
-#endif // CONFIG_IOTRACE_ZSTD
+  // buffer_size is the number of traces in the current chunk
+  while (!buffer || buffer_count == buffer_size) {
     trace_file_next();
   }
   memcpy(trace, buffer + buffer_count, sizeof(T));
@@ -42,9 +203,7 @@ template <typename T> bool DiffTrace<T>::read_next(T *trace) {
   return 0;
 }
 
-template <typename T> void DiffTrace<T>::next_file_name(char *file_name) {
-  memset(file_name, 0, 128);
-  static uint64_t trace_index = 0;
+template <typename T> void DiffTrace<T>::trace_file_path(const char *trace_name, const char *file, char *path) {
   char dirname[128];
   if (strchr(trace_name, '/')) {
     snprintf(dirname, 128, "%s", trace_name);
@@ -53,89 +212,204 @@ template <typename T> void DiffTrace<T>::next_file_name(char *file_name) {
     snprintf(dirname, 128, "%s/%s", noop_home, trace_name);
   }
   mkdir(dirname, 0755);
-#ifndef CONFIG_IOTRACE_ZSTD
+  snprintf(path, 128, "%s/%s", dirname, file);
+}
+
+template <typename T> void DiffTrace<T>::next_file_name(char *file_name) {
+  memset(file_name, 0, 128);
+#if defined(CONFIG_DIFFTRACE_DELTA)
+  const char *prefix = "dbin";
+#elif !defined(CONFIG_IOTRACE_ZSTD)
   const char *prefix = "bin";
 #else
   const char *prefix = "zstd";
 #endif // CONFIG_IOTRACE_ZSTD
-  snprintf(file_name, 128, "%s/%lu.%s", dirname, trace_index, prefix);
-  trace_index++;
+  char file[64];
+  snprintf(file, 64, "%lu.%s", trace_index.fetch_add(1), prefix);
+  trace_file_path(trace_name, file, file_name);
 }
 
+// Hand the current chunk over to the I/O thread and take the next one.
 template <typename T> bool DiffTrace<T>::trace_file_next() {
-  static char *filename = (char *)malloc(128);
-#ifdef CONFIG_IOTRACE_ZSTD
-  if (trace_zstd->need_load_new_file == true && is_read) {
-    next_file_name(filename);
-    trace_zstd->diff_zstd_next(filename, is_read);
-    trace_zstd->need_load_new_file = false;
-    Info("Loading traces from %s ...\n", filename);
-  } else if (!is_read) {
-    next_file_name(filename);
-    trace_zstd->diff_zstd_next(filename, is_read);
-  }
-#else
-  next_file_name(filename);
-  static FILE *file = nullptr;
-  if (file) {
-    fclose(file);
+  if (io_lost) {
+    io_lost = false;
+    new std::thread(std::move(io_thread));
+    io_start();
   }
-#endif
-
+  std::unique_lock<std::mutex> lock(io_mutex);
   if (is_read) {
-    if (buffer) {
-      free(buffer);
-    }
+    release_chunk(current);
+    io_cv.wait(lock, [this] { return !io_queue.empty(); });
+    current = io_queue.front();
+    io_queue.pop_front();
+    io_cv.notify_all();
+    if (current.end) {
 #ifndef CONFIG_IOTRACE_ZSTD
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-      printf("File %s not found.\n", filename);
+      printf("File %s not found.\n", current.file_name);
+#else
+      printf("Run %s not find,No more trace files.End simulation\n", current.file_name);
+#endif // CONFIG_IOTRACE_ZSTD
       exit(0);
     }
-    // check the number of traces
-    fseek(file, 0, SEEK_END);
-    buffer_size = ftell(file) / sizeof(T);
-    buffer = (T *)calloc(buffer_size, sizeof(T));
-    // read the binary file
-    fseek(file, 0, SEEK_SET);
-    uint64_t read_bytes = fread(buffer, sizeof(T), buffer_size, file);
-    assert(read_bytes == buffer_size);
+    buffer = current.data;
+    buffer_size = current.count;
+  } else if (buffer_count > 0) {
+    Chunk chunk = {buffer, buffer_count, 0, false, {}};
+    next_file_name(chunk.file_name);
+    io_queue.push_back(chunk);
+    io_backlog++;
+    io_cv.notify_all();
+    io_cv.wait(lock, [this] { return !free_buffers.empty(); });
+    buffer = free_buffers.back();
+    free_buffers.pop_back();
+  }
+  buffer_count = 0;
+  return 0;
+}
+
+template <typename T> void DiffTrace<T>::write_loop() {
+  std::unique_lock<std::mutex> lock(io_mutex);
+  while (true) {
+    io_cv.wait(lock, [this] { return io_exit || !io_queue.empty(); });
+    if (io_queue.empty()) {
+      return;
+    }
+    Chunk chunk = io_queue.front();
+    io_queue.pop_front();
+    io_busy = true;
+    lock.unlock();
+
+    Info("Writing %lu traces to %s ...\n", chunk.count, chunk.file_name);
+#if defined(CONFIG_DIFFTRACE_DELTA)
+    std::vector<uint64_t> encoded;
+    delta_encode((const uint8_t *)chunk.data, sizeof(T), chunk.count, encoded);
+    FILE *file = fopen(chunk.file_name, "wb");
+    fwrite(encoded.data(), sizeof(uint64_t), encoded.size(), file);
+    fclose(file);
+#elif !defined(CONFIG_IOTRACE_ZSTD)
+    FILE *file = fopen(chunk.file_name, "wb");
+    fwrite(chunk.data, sizeof(T), chunk.count, file);
     fclose(file);
-    Info("Loading %lu traces from %s ...\n", buffer_size, filename);
 #else
-    buffer = (T *)calloc(buffer_size, sizeof(T));
-    trace_zstd->diff_IOtrace_load((char *)buffer, sizeof(T));
+    trace_zstd->diff_zstd_next(chunk.file_name, false);
+    trace_zstd->diff_IOtrace_dump((char *)chunk.data, sizeof(T) * chunk.count);
 #endif // CONFIG_IOTRACE_ZSTD
-  } else if (buffer_count > 0) {
-    Info("Writing %lu traces to %s ...\n", buffer_count, filename);
+
+    lock.lock();
+    io_busy = false;
+    io_backlog--;
+    free_buffers.push_back(chunk.data);
+    io_cv.notify_all();
+  }
+}
+
+// Load chunks ahead of the simulation thread. An empty chunk marks the end of the trace.
+template <typename T> void DiffTrace<T>::read_loop() {
+  bool has_next = true;
+  while (has_next) {
+    {
+      std::unique_lock<std::mutex> lock(io_mutex);
+      io_cv.wait(lock, [this] { return io_exit || io_queue.size() < DIFFTRACE_BUFFERS - 1; });
+      if (io_exit) {
+        return;
+      }
+      io_busy = true;
+    }
+    Chunk chunk = {};
+    has_next = load_chunk(chunk);
+    chunk.end = !has_next;
+    std::lock_guard<std::mutex> lock(io_mutex);
+    io_busy = false;
+    io_queue.push_back(chunk);
+    io_cv.notify_all();
+  }
+}
+
+template <typename T> bool DiffTrace<T>::load_chunk(Chunk &chunk) {
 #ifndef CONFIG_IOTRACE_ZSTD
-    FILE *file = fopen(filename, "wb");
-    fwrite(buffer, sizeof(T), buffer_count, file);
-    fclose(file);
+  next_file_name(chunk.file_name);
+  int fd = open(chunk.file_name, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  // map the whole file instead of copying it. MAP_POPULATE reads it on this thread.
+  struct stat file_stat;
+  fstat(fd, &file_stat);
+#ifdef CONFIG_DIFFTRACE_DELTA
+  chunk.map_size = file_stat.st_size / sizeof(uint64_t) * sizeof(uint64_t);
 #else
-    trace_zstd->diff_IOtrace_dump((char *)buffer, sizeof(T) * buffer_count);
-#endif
+  chunk.count = file_stat.st_size / sizeof(T);
+  chunk.map_size = chunk.count * sizeof(T);
+#endif // CONFIG_DIFFTRACE_DELTA
+  if (chunk.map_size > 0) {
+    void *data = mmap(NULL, chunk.map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    assert(data != MAP_FAILED);
+    chunk.data = (T *)data;
   }
-  buffer_count = 0;
-  return 0;
+  close(fd);
+#ifdef CONFIG_DIFFTRACE_DELTA
+  // decode into a buffer of full states
+  const uint64_t *encoded = (const uint64_t *)chunk.data;
+  size_t n_encoded = chunk.map_size / sizeof(uint64_t);
+  chunk.count = (n_encoded > 0) ? encoded[0] : 0;
+  chunk.data = (T *)calloc(chunk.count, sizeof(T));
+  if (n_encoded > 0 && !delta_decode(encoded + 1, n_encoded - 1, (uint8_t *)chunk.data, sizeof(T), chunk.count)) {
+    printf("Delta trace file %s is truncated.\n", chunk.file_name);
+    assert(0);
+  }
+  if (n_encoded > 0) {
+    munmap((void *)encoded, chunk.map_size);
+  }
+  chunk.map_size = 0;
+#endif // CONFIG_DIFFTRACE_DELTA
+  Info("Loading %lu traces from %s ...\n", chunk.count, chunk.file_name);
+#else
+  chunk.data = (T *)calloc(buffer_size, sizeof(T));
+  // fill the buffer, possibly from several files
+  while (chunk.count < buffer_size) {
+    if (trace_zstd->need_load_new_file) {
+      if (chunk.count > 0) {
+        break;
+      }
+      next_file_name(chunk.file_name);
+      if (!trace_zstd->diff_zstd_next(chunk.file_name, true)) {
+        free(chunk.data);
+        chunk.data = NULL;
+        return false;
+      }
+      trace_zstd->need_load_new_file = false;
+      Info("Loading traces from %s ...\n", chunk.file_name);
+    }
+    if (trace_zstd->diff_IOtrace_load((char *)(chunk.data + chunk.count), sizeof(T), buffer_size - chunk.count)) {
+      chunk.count += trace_zstd->trace_load_len;
+    }
+  }
+#endif // CONFIG_IOTRACE_ZSTD
+  return true;
+}
+
+template <typename T> void DiffTrace<T>::release_chunk(Chunk &chunk) {
+  if (chunk.map_size > 0) {
+    munmap(chunk.data, chunk.map_size);
+  } else if (chunk.data) {
+    free(chunk.data);
+  }
+  chunk = {};
 }
 
 template class DiffTrace<DiffTestState>;
 
 #ifdef CONFIG_IOTRACE_ZSTD
-void DiffTraceZstd::diff_zstd_next(const char *file_name, bool is_read) {
+bool DiffTraceZstd::diff_zstd_next(const char *file_name, bool is_read) {
   if (io_trace_file.is_open()) {
     io_trace_file.close();
   }
   if (is_read) {
     io_trace_file.open(file_name, std::ios::binary | std::ios::in);
-    if (io_trace_file.is_open() == false) {
-      printf("Run %s not find,No more trace files.End simulation\n", file_name);
-      exit(0);
-    }
   } else {
     io_trace_file.open(file_name, std::ios::binary | std::ios::out);
   }
+  return io_trace_file.is_open();
 }
 
 void DiffTraceZstd::diff_IOtrace_dump(const char *str, uint64_t len) {
@@ -157,13 +431,13 @@ void DiffTraceZstd::diff_IOtrace_dump(const char *str, uint64_t len) {
   trace_cctx = NULL;
 }
 
-bool DiffTraceZstd::diff_IOtrace_load(char *buffer, uint64_t len) {
+bool DiffTraceZstd::diff_IOtrace_load(char *buffer, uint64_t len, uint64_t max_count) {
   int result = diff_IOtrace_ZstdDcompress();
   if (result != 0) {
     need_load_new_file = true;
     return false;
   } else {
-    uint64_t have_size = io_trace_buffer.size() / len;
+    uint64_t have_size = std::min(io_trace_buffer.size() / len, max_count);
     uint64_t byte_size = have_size * len;
     memcpy(buffer, io_trace_buffer.data(), byte_size);
     trace_load_len = have_size;
@@ -211,7 +485,7 @@ int DiffTraceZstd::diff_IOtrace_ZstdDcompress() {
   // Decompress the data
   size_t ret = ZSTD_decompressStream(trace_dctx, &output, &input);
 
-  io_trace_buffer.insert(io_trace_buffer.end(), outputBuffer.begin(), outputBuffer.end());
+  io_trace_buffer.insert(io_trace_buffer.end(), outputBuffer.begin(), outputBuffer.begin() + output.pos);
 
   return 0;
 }
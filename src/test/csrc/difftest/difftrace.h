@@ -2,16 +2,25 @@
 #define __DIFFTRACE_H__
 
 #include "common.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 #ifdef CONFIG_DIFFTEST_IOTRACE
 #include "difftest-iotrace.h"
 #endif // CONFIG_DIFFTEST_IOTRACE
 #ifdef CONFIG_IOTRACE_ZSTD
 #include <fstream>
 #include <iostream>
-#include <vector>
 #include <zstd.h>
 #endif // CONFIG_IOTRACE_ZSTD
 
+#if defined(CONFIG_DIFFTRACE_DELTA) && defined(CONFIG_IOTRACE_ZSTD)
+#error "DIFFTRACE_DELTA is not supported with IOTRACE_ZSTD"
+#endif
+
 #ifdef CONFIG_IOTRACE_ZSTD
 class DiffTraceZstd {
 public:
@@ -29,11 +38,11 @@ public:
     ZSTD_freeCCtx(trace_cctx);
   }
 
-  void diff_zstd_next(const char *file_name, bool is_read);
+  bool diff_zstd_next(const char *file_name, bool is_read);
 
   void diff_IOtrace_dump(const char *str, uint64_t len);
 
-  bool diff_IOtrace_load(char *buffer, uint64_t len);
+  bool diff_IOtrace_load(char *buffer, uint64_t len, uint64_t max_count);
   int diff_IOtrace_ZstdDcompress();
 
 private:
@@ -48,6 +57,10 @@ private:
 };
 #endif // CONFIG_IOTRACE_ZSTD
 
+// Number of trace buffers. While the simulation thread fills (or consumes) one buffer,
+// the trace I/O thread writes (or loads) the others.
+#define DIFFTRACE_BUFFERS 2
+
 template <typename T> class DiffTrace {
 public:
   char trace_name[32];
@@ -56,28 +69,60 @@ public:
   DiffTraceZstd *trace_zstd = NULL;
 #endif // CONFIG_IOTRACE_ZSTD
 
-  DiffTrace(const char *trace_name, bool is_read, uint64_t buffer_size = 1024 * 1024);
-  ~DiffTrace() {
-    if (!is_read) {
-      trace_file_next();
-    }
-    if (buffer) {
-      free(buffer);
-    }
-#ifdef CONFIG_IOTRACE_ZSTD
-    delete trace_zstd;
-#endif // CONFIG_IOTRACE_ZSTD
-  }
+  // Reading starts from trace file start_file
+  DiffTrace(const char *trace_name, bool is_read, uint64_t buffer_size = 1024 * 1024, uint64_t start_file = 0);
+  ~DiffTrace();
   bool append(const T *trace);
   bool read_next(T *trace);
   void next_file_name(char *file_name);
+  // number of traces in every trace file except the last one
+  uint64_t get_file_traces() const {
+    return file_traces;
+  }
+  // path of a file in the trace directory
+  static void trace_file_path(const char *trace_name, const char *file, char *path);
+  // number of filled chunks not written to files yet
+  static std::atomic<uint64_t> io_backlog;
 
 private:
+  // traces of one file, owned by either the simulation thread or the I/O thread
+  struct Chunk {
+    T *data;
+    uint64_t count;
+    size_t map_size; // non-zero if data is mmapped from the file
+    bool end;        // no more trace files
+    char file_name[128];
+  };
+
+  static std::atomic<uint64_t> trace_index;
+  uint64_t file_traces;
   uint64_t buffer_size;
   uint64_t buffer_count = 0;
   T *buffer = nullptr;
+  Chunk current = {};
+
+  // write: filled chunks to be written; read: loaded chunks to be consumed
+  std::deque<Chunk> io_queue;
+  std::vector<T *> free_buffers;
+  std::mutex io_mutex;
+  std::condition_variable io_cv;
+  std::thread io_thread;
+  bool io_exit = false;
+  bool io_busy = false; // the I/O thread is writing or loading a chunk
+  // the I/O thread was lost by fork(), and is restarted when the child uses the trace again
+  bool io_lost = false;
 
+  // LightSSS forks only the calling thread. The I/O threads finish their chunks before fork.
+  static std::vector<DiffTrace<T> *> instances;
+  static void fork_prepare();
+  static void fork_parent();
+  static void fork_child();
+  void io_start();
   bool trace_file_next();
+  void write_loop();
+  void read_loop();
+  bool load_chunk(Chunk &chunk);
+  void release_chunk(Chunk &chunk);
 };
 
 #endif
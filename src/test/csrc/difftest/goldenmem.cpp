@@ -16,14 +16,196 @@
 
 #include "common.h"
 #include "compress.h"
+#include "flatset.h"
+#include "hugepage.h"
 #include "ram.h"
 #include "refproxy.h"
 #include <goldenmem.h>
 #include <stdlib.h>
+#ifdef __AVX512BW__
+#include <immintrin.h>
+#endif // __AVX512BW__
+#ifdef CONFIG_DIFFTEST_PARALLEL
+#include "parallel.h"
+#endif // CONFIG_DIFFTEST_PARALLEL
 
 uint8_t *pmem;
-uint8_t *pmem_flag; // 1: store update but load check skip; 0: update and check. others: assert
+uint64_t *pmem_flag; // 1 bit per byte. 1: store update but load check skip; 0: update and check
+// 1 bit per page of pmem, set if any flag in the page may be 1
+static uint64_t *pmem_flag_page;
 static uint64_t pmem_size;
+#define PMEM_FLAG_PAGE_SHIFT 12
+#ifdef CONFIG_DIFFTEST_PARALLEL
+// Per-core checkers read the golden memory and sync it with DUT data concurrently. Pages are hashed to sequence
+// locks: a writer makes the sequence odd while writing, and a reader retries if the sequence was odd or has changed.
+#define GOLDENMEM_LOCK_SHARDS 1024
+struct alignas(64) GoldenmemLock {
+  std::atomic<uint32_t> seq;
+};
+static GoldenmemLock goldenmem_locks[GOLDENMEM_LOCK_SHARDS];
+
+static inline int goldenmem_shard(uint64_t addr) {
+  return (addr >> PMEM_FLAG_PAGE_SHIFT) % GOLDENMEM_LOCK_SHARDS;
+}
+
+static inline void goldenmem_lock(int shard) {
+  std::atomic<uint32_t> &seq = goldenmem_locks[shard].seq;
+  int spin = 0;
+  while (true) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    if (!(s & 1) && seq.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+      return;
+    }
+    difftest_spin_wait(spin);
+  }
+}
+
+static inline void goldenmem_unlock(int shard) {
+  goldenmem_locks[shard].seq.fetch_add(1, std::memory_order_release);
+}
+
+// Lock the (at most two) shards of [addr, addr + len) in order
+class GoldenmemWriteGuard {
+public:
+  GoldenmemWriteGuard(uint64_t addr, uint64_t len) {
+    int a = goldenmem_shard(addr), b = goldenmem_shard(addr + len - 1);
+    if (a > b) {
+      std::swap(a, b);
+    }
+    goldenmem_lock(a);
+    first = a;
+    if (b != a) {
+      goldenmem_lock(b);
+      second = b;
+    }
+  }
+  ~GoldenmemWriteGuard() {
+    if (second >= 0) {
+      goldenmem_unlock(second);
+    }
+    if (first >= 0) {
+      goldenmem_unlock(first);
+    }
+  }
+
+private:
+  int first = -1, second = -1;
+};
+
+// Run read() until no write to [addr, addr + len) overlaps it
+template <typename F> static inline void goldenmem_read_consistent(uint64_t addr, uint64_t len, F read) {
+  int a = goldenmem_shard(addr), b = goldenmem_shard(addr + len - 1);
+  std::atomic<uint32_t> &seq_a = goldenmem_locks[a].seq, &seq_b = goldenmem_locks[b].seq;
+  int spin = 0;
+  while (true) {
+    uint32_t sa = seq_a.load(std::memory_order_acquire), sb = seq_b.load(std::memory_order_acquire);
+    if (!((sa | sb) & 1)) {
+      read();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_a.load(std::memory_order_relaxed) == sa && seq_b.load(std::memory_order_relaxed) == sb) {
+        return;
+      }
+    }
+    difftest_spin_wait(spin);
+  }
+}
+#endif // CONFIG_DIFFTEST_PARALLEL
+
+// A hashed filter of the watched pages. False positives only cost an extra flush.
+std::atomic<uint64_t> goldenmem_pt_generation(0);
+#define PT_FILTER_BITS 16
+static uint64_t pt_filter[(1 << PT_FILTER_BITS) / 64];
+static std::atomic<bool> pt_filter_empty(true);
+
+static inline uint64_t pt_filter_index(uint64_t addr) {
+  return ((addr >> 12) * 0x9e3779b97f4a7c15UL) >> (64 - PT_FILTER_BITS);
+}
+
+void goldenmem_watch_pt(uint64_t addr) {
+  uint64_t idx = pt_filter_index(addr);
+  __atomic_fetch_or(&pt_filter[idx / 64], 1UL << (idx % 64), __ATOMIC_RELAXED);
+  pt_filter_empty.store(false, std::memory_order_relaxed);
+}
+
+void goldenmem_flush_pt() {
+  memset(pt_filter, 0, sizeof(pt_filter));
+  pt_filter_empty.store(true, std::memory_order_relaxed);
+  goldenmem_pt_generation.fetch_add(1, std::memory_order_release);
+}
+
+static inline bool pt_watched(uint64_t addr) {
+  uint64_t idx = pt_filter_index(addr);
+  return (__atomic_load_n(&pt_filter[idx / 64], __ATOMIC_RELAXED) >> (idx % 64)) & 1;
+}
+
+static inline void pt_write_check(uint64_t addr, uint64_t len) {
+  if (!pt_filter_empty.load(std::memory_order_relaxed) && (pt_watched(addr) || pt_watched(addr + len - 1))) {
+    goldenmem_flush_pt();
+  }
+}
+
+static inline size_t pmem_flag_size() {
+  // one more word for reading across the last word
+  return ((pmem_size + 63) / 64 + 1) * sizeof(uint64_t);
+}
+
+static inline size_t pmem_flag_page_size() {
+  return ((pmem_size >> PMEM_FLAG_PAGE_SHIFT) + 64) / 64 * sizeof(uint64_t);
+}
+
+// spread the 8-bit mask to one 0/1 byte per bit
+static inline uint64_t spread_bits(uint8_t m) {
+  uint64_t low = ((m & 0x7f) * 0x0002040810204081UL) & 0x0101010101010101UL;
+  return low | ((uint64_t)(m >> 7) << 56);
+}
+
+// gather the lowest bit of each byte to an 8-bit mask
+static inline uint8_t gather_bits(uint64_t bytes) {
+  return ((bytes & 0x0101010101010101UL) * 0x0102040810204080UL) >> 56;
+}
+
+// get len (<= 64) flag bits starting at the pmem offset
+static inline uint64_t pmem_flag_get(uint64_t offset, int len) {
+  uint64_t first = offset >> PMEM_FLAG_PAGE_SHIFT, last = (offset + len - 1) >> PMEM_FLAG_PAGE_SHIFT;
+  // most pages never have an update with the skip flag, and their bitmap is not touched
+  if (!((pmem_flag_page[first / 64] >> (first % 64)) & 1) && !((pmem_flag_page[last / 64] >> (last % 64)) & 1)) {
+    return 0;
+  }
+  uint64_t idx = offset / 64, shift = offset % 64;
+  uint64_t bits = pmem_flag[idx] >> shift;
+  if (shift + len > 64) {
+    bits |= pmem_flag[idx + 1] << (64 - shift);
+  }
+  return len < 64 ? bits & ((1UL << len) - 1) : bits;
+}
+
+// set (flag = true) or clear the flag bits in mask, where bit i of mask is for the pmem offset + i
+static inline void pmem_flag_set(uint64_t offset, uint64_t mask, bool flag) {
+  uint64_t idx = offset / 64, shift = offset % 64;
+  uint64_t lo = mask << shift, hi = shift ? mask >> (64 - shift) : 0;
+  if (flag) {
+    for (uint64_t page = offset >> PMEM_FLAG_PAGE_SHIFT; page <= (offset + 63) >> PMEM_FLAG_PAGE_SHIFT; page++) {
+#ifdef CONFIG_DIFFTEST_PARALLEL
+      // a word of the bitmap covers pages of different shards
+      __atomic_fetch_or(&pmem_flag_page[page / 64], 1UL << (page % 64), __ATOMIC_RELAXED);
+#else
+      pmem_flag_page[page / 64] |= 1UL << (page % 64);
+#endif // CONFIG_DIFFTEST_PARALLEL
+    }
+    pmem_flag[idx] |= lo;
+    if (hi) {
+      pmem_flag[idx + 1] |= hi;
+    }
+  } else {
+    // clean pages are kept clean without touching the bitmap
+    if (pmem_flag_get(offset, 64) & mask) {
+      pmem_flag[idx] &= ~lo;
+      if (hi) {
+        pmem_flag[idx + 1] &= ~hi;
+      }
+    }
+  }
+}
 
 void *guest_to_host(uint64_t addr) {
   return &pmem[addr];
@@ -31,37 +213,202 @@ void *guest_to_host(uint64_t addr) {
 
 void init_goldenmem() {
   pmem_size = simMemory->get_size();
-  pmem = (uint8_t *)mmap(NULL, pmem_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
-  pmem_flag = (uint8_t *)mmap(NULL, pmem_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  int image_fd = simMemory->get_image_fd();
+  if (image_fd >= 0) {
+    // a private view of the shared image, without copying it
+    pmem = (uint8_t *)mmap(NULL, pmem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, image_fd, 0);
+  } else {
+    pmem = (uint8_t *)huge_mmap(pmem_size);
+  }
+  pmem_flag = (uint64_t *)huge_mmap(pmem_flag_size());
+  pmem_flag_page = (uint64_t *)huge_mmap(pmem_flag_page_size());
   if (pmem == (uint8_t *)MAP_FAILED) {
     Info("ERROR allocating physical memory. \n");
   }
-  simMemory->clone_on_demand([](uint64_t offset, void *src, size_t n) { nonzero_large_memcpy(pmem + offset, src, n); },
-                             true);
+  if (image_fd < 0) {
+    simMemory->clone_on_demand(
+        [](uint64_t offset, void *src, size_t n) { nonzero_large_memcpy(pmem + offset, src, n, true); }, true);
+  }
   ref_golden_mem = pmem;
 }
 
 void goldenmem_finish() {
-  munmap(pmem, pmem_size);
-  munmap(pmem_flag, pmem_size);
+  huge_munmap(pmem, pmem_size);
+  huge_munmap(pmem_flag, pmem_flag_size());
+  huge_munmap(pmem_flag_page, pmem_flag_page_size());
   pmem = NULL;
   pmem_flag = NULL;
+  pmem_flag_page = NULL;
 }
 
-void update_goldenmem(uint64_t addr, void *data, uint64_t mask, int len, uint8_t flag) {
-  uint8_t *dataArray = (uint8_t *)data;
-  for (int i = 0; i < len; i++) {
-    if (((mask >> i) & 1) != 0) {
-      paddr_write(addr + i, dataArray[i], flag, 1);
+bool goldenmem_save(const char *filename) {
+  return snapshot_compressToFile(pmem, filename, pmem_size) == (long)pmem_size;
+}
+
+bool goldenmem_load(const char *filename) {
+  // zero words are not copied by readFromGz(), so start from zero pages at the same addresses
+  int prot = PROT_READ | PROT_WRITE, flags = MAP_ANON | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED;
+  if (mmap(pmem, pmem_size, prot, flags, -1, 0) == MAP_FAILED ||
+      mmap(pmem_flag, pmem_flag_size(), prot, flags, -1, 0) == MAP_FAILED ||
+      mmap(pmem_flag_page, pmem_flag_page_size(), prot, flags, -1, 0) == MAP_FAILED) {
+    return false;
+  }
+  huge_advise(pmem, pmem_size);
+  huge_advise(pmem_flag, pmem_flag_size());
+  huge_advise(pmem_flag_page, pmem_flag_page_size());
+  goldenmem_flush_pt();
+  return readFromGz(pmem, filename, pmem_size, LOAD_SNAPSHOT) >= 0;
+}
+
+#ifdef CONFIG_DIFFTEST_PARALLEL
+// The words overwritten by the stores of this cycle, in core order. Entries are appended by the serial update
+// phase only. The checkers change their data under the write guard of the word, and read them consistently.
+struct GoldenmemUndo {
+  uint64_t addr; // 8-byte aligned
+  int core;
+  uint8_t mask;  // bytes stored by core
+  word_t data;   // the word before the stores of core
+  word_t flag;   // its flags, as returned by pmem_flag_read()
+};
+static inline word_t pmem_read(uint64_t addr, int len);
+static inline word_t pmem_flag_read(uint64_t addr, int len);
+static std::vector<GoldenmemUndo> goldenmem_undo;
+static FlatAddrSet goldenmem_undo_words;
+static int goldenmem_writer = -1;
+static thread_local int goldenmem_view = -1;
+
+void goldenmem_cycle_begin() {
+  goldenmem_undo.clear();
+  goldenmem_undo_words.clear();
+}
+
+void goldenmem_set_writer(int core) {
+  goldenmem_writer = core;
+}
+
+void goldenmem_set_view(int core) {
+  goldenmem_view = core;
+}
+
+static inline bool goldenmem_undo_hit(uint64_t word) {
+  return goldenmem_view >= 0 && goldenmem_undo_words.size() && goldenmem_undo_words.contains(word);
+}
+
+// the word before the stores of the cores after the viewing core, or nullptr if they have not stored to it
+static inline GoldenmemUndo *goldenmem_undo_after(uint64_t word) {
+  for (auto &u: goldenmem_undo) {
+    if (u.addr == word && u.core > goldenmem_view) {
+      return &u;
     }
   }
+  return nullptr;
 }
 
-void read_goldenmem(uint64_t addr, void *data, uint64_t len, void *flag) {
-  *(uint64_t *)data = paddr_read(addr, len);
-  if (flag != NULL) {
-    *(uint64_t *)flag = paddr_flag_read(addr, len);
+// bit j is set if byte j of the word at addr + offset is in the byte mask of [addr, addr + len)
+static inline uint8_t goldenmem_word_mask(uint64_t mask, int offset, int len) {
+  uint8_t m = 0;
+  for (int j = 0; j < 8; j++) {
+    if (offset + j >= 0 && offset + j < len && ((mask >> (offset + j)) & 1)) {
+      m |= 1 << j;
+    }
+  }
+  return m;
+}
+
+// Called before the bytes in mask of [addr, addr + len) are written, and returns the bytes to write to pmem.
+// The update phase records the overwritten words. A checker writes its bytes into the words before the stores
+// of later cores, and only the bytes that no later core stores are written to pmem.
+static uint64_t goldenmem_undo_write(uint64_t addr, const uint8_t *data, uint64_t mask, int len, uint8_t flag) {
+  if (goldenmem_view < 0 && goldenmem_writer < 0) {
+    return mask;
+  }
+  for (uint64_t word = addr & ~7UL; word < addr + len; word += 8) {
+    int offset = word - addr;
+    uint8_t bytes = goldenmem_word_mask(mask, offset, len);
+    if (!bytes || !in_pmem(word)) {
+      continue;
+    }
+    if (goldenmem_view < 0) {
+      bool found = false;
+      for (auto &u: goldenmem_undo) {
+        if (u.addr == word && u.core == goldenmem_writer) {
+          u.mask |= bytes;
+          found = true;
+        }
+      }
+      if (!found) {
+        goldenmem_undo.push_back({word, goldenmem_writer, bytes, pmem_read(word, 8), pmem_flag_read(word, 8)});
+        goldenmem_undo_words.insert(word);
+      }
+      continue;
+    }
+    if (!goldenmem_undo_hit(word)) {
+      continue;
+    }
+    uint8_t remain = bytes;
+    for (auto &u: goldenmem_undo) {
+      if (u.addr != word || u.core <= goldenmem_view) {
+        continue;
+      }
+      for (int j = 0; j < 8; j++) {
+        if ((remain >> j) & 1) {
+          ((uint8_t *)&u.data)[j] = data[offset + j];
+          ((uint8_t *)&u.flag)[j] = flag ? 1 : 0;
+        }
+      }
+      remain &= ~u.mask;
+    }
+    for (int j = 0; j < 8; j++) {
+      if (((bytes & ~remain) >> j) & 1) {
+        mask &= ~(1UL << (offset + j));
+      }
+    }
   }
+  return mask;
+}
+#endif // CONFIG_DIFFTEST_PARALLEL
+
+void read_goldenmem(uint64_t addr, void *data, uint64_t len, void *flag) {
+  auto read = [&]() {
+    *(uint64_t *)data = paddr_read(addr, len);
+    if (flag != NULL) {
+      *(uint64_t *)flag = paddr_flag_read(addr, len);
+    }
+#ifdef CONFIG_DIFFTEST_PARALLEL
+    GoldenmemUndo *u = goldenmem_undo_hit(addr & ~7UL) ? goldenmem_undo_after(addr & ~7UL) : nullptr;
+    if (u) {
+      uint64_t shift = (addr & 7) * 8, keep = len < 8 ? (1UL << (len * 8)) - 1 : ~0UL;
+      *(uint64_t *)data = (u->data >> shift) & keep;
+      if (flag != NULL) {
+        *(uint64_t *)flag = (u->flag >> shift) & keep;
+      }
+    }
+#endif // CONFIG_DIFFTEST_PARALLEL
+  };
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  goldenmem_read_consistent(addr, len, read);
+#else
+  read();
+#endif // CONFIG_DIFFTEST_PARALLEL
+}
+
+void read_goldenmem_line(uint64_t addr, uint64_t *line) {
+  auto read = [&]() {
+    memcpy(line, pmem + (addr - PMEM_BASE), 64);
+#ifdef CONFIG_DIFFTEST_PARALLEL
+    for (int i = 0; i < 8; i++) {
+      GoldenmemUndo *u = goldenmem_undo_hit(addr + i * 8) ? goldenmem_undo_after(addr + i * 8) : nullptr;
+      if (u) {
+        line[i] = u->data;
+      }
+    }
+#endif // CONFIG_DIFFTEST_PARALLEL
+  };
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  goldenmem_read_consistent(addr, 64, read);
+#else
+  read();
+#endif // CONFIG_DIFFTEST_PARALLEL
 }
 
 bool in_pmem(uint64_t addr) {
@@ -79,61 +426,55 @@ static inline word_t pmem_read(uint64_t addr, int len) {
   }
 }
 
+// flags are returned as one 0/1 byte per byte of memory
 static inline word_t pmem_flag_read(uint64_t addr, int len) {
-  void *p = &pmem_flag[addr - PMEM_BASE];
-  uint8_t *tmpArray = (uint8_t *)p;
-  for (int i = 0; i < len; i++) {
-    if (*(uint8_t *)(tmpArray + i) != 0 && *(uint8_t *)(tmpArray + i) != 1)
-      assert(0);
-  }
   switch (len) {
-    case 1: return *(uint8_t *)p;
-    case 2: return *(uint16_t *)p;
-    case 4: return *(uint32_t *)p;
-    case 8: return *(uint64_t *)p;
+    case 1:
+    case 2:
+    case 4:
+    case 8: return spread_bits(pmem_flag_get(addr - PMEM_BASE, len));
     default: assert(0);
   }
 }
 
 static inline void pmem_write(uint64_t addr, word_t data, word_t flag, int len) {
+  pt_write_check(addr, len);
 #ifdef DIFFTEST_STORE_COMMIT
   store_commit_queue_push(addr, data, len);
 #endif
 
+  // flag has one 0/1 byte per byte of data
+  uint64_t mask = (len < 8) ? (1UL << len) - 1 : 0xff;
+  uint8_t flag_bits = gather_bits(flag);
+  pmem_flag_set(addr - PMEM_BASE, flag_bits & mask, true);
+  pmem_flag_set(addr - PMEM_BASE, ~flag_bits & mask, false);
+
   void *p = &pmem[addr - PMEM_BASE];
-  void *pf = &pmem_flag[addr - PMEM_BASE];
   switch (len) {
-    case 1:
-      *(uint8_t *)p = data;
-      *(uint8_t *)pf = flag;
-      return;
-    case 2:
-      *(uint16_t *)p = data;
-      *(uint16_t *)pf = flag;
-      return;
-    case 4:
-      *(uint32_t *)p = data;
-      *(uint32_t *)pf = flag;
-      return;
-    case 8:
-      *(uint64_t *)p = data;
-      *(uint64_t *)pf = flag;
-      return;
+    case 1: *(uint8_t *)p = data; return;
+    case 2: *(uint16_t *)p = data; return;
+    case 4: *(uint32_t *)p = data; return;
+    case 8: *(uint64_t *)p = data; return;
     default: assert(0);
   }
 }
 
 // Golden Memory Store Log
 #ifdef ENABLE_STORE_LOG
-#define GOLDENMEM_STORE_LOG_SIZE 1024
+// The first store to each 8-byte word since the last reset records the original word.
+// Entries are kept in chunks, which are reused after resets.
+#define STORE_LOG_CHUNK 4096
 struct store_log {
   uint64_t addr;
   word_t org_data;
   word_t org_flag;
-} goldenmem_store_log_buf[GOLDENMEM_STORE_LOG_SIZE];
+};
+static std::vector<store_log *> goldenmem_store_log_chunks;
+static FlatAddrSet goldenmem_store_log_words;
 
 bool goldenmem_store_log_enable = false;
-int goldenmem_store_log_ptr = 0;
+static size_t goldenmem_store_log_ptr = 0;
+static bool goldenmem_store_log_full = false;
 
 void goldenmem_set_store_log(bool enable) {
   goldenmem_store_log_enable = enable;
@@ -141,27 +482,43 @@ void goldenmem_set_store_log(bool enable) {
 
 void goldenmem_store_log_reset() {
   goldenmem_store_log_ptr = 0;
+  goldenmem_store_log_full = false;
+  goldenmem_store_log_words.clear();
+}
+
+bool goldenmem_store_log_overflow() {
+  return goldenmem_store_log_full;
 }
 
 void pmem_record_store(uint64_t addr) {
-  if (goldenmem_store_log_enable) {
+  if (goldenmem_store_log_enable && !goldenmem_store_log_full) {
     // align to 8 byte
     addr = (addr >> 3) << 3;
-    word_t rdata = pmem_read(addr, 8);
-    word_t rflag = pmem_flag_read(addr, 8);
-    goldenmem_store_log_buf[goldenmem_store_log_ptr].addr = addr;
-    goldenmem_store_log_buf[goldenmem_store_log_ptr].org_data = rdata;
-    goldenmem_store_log_buf[goldenmem_store_log_ptr].org_flag = rflag;
+    if (goldenmem_store_log_words.contains(addr)) {
+      return;
+    }
+    if (goldenmem_store_log_ptr >= GOLDENMEM_STORE_LOG_SIZE) {
+      Info("Warning: golden memory store log is full, replay is disabled until the next snapshot\n");
+      goldenmem_store_log_full = true;
+      return;
+    }
+    size_t chunk = goldenmem_store_log_ptr / STORE_LOG_CHUNK;
+    if (chunk == goldenmem_store_log_chunks.size()) {
+      goldenmem_store_log_chunks.push_back(new store_log[STORE_LOG_CHUNK]);
+    }
+    store_log &log = goldenmem_store_log_chunks[chunk][goldenmem_store_log_ptr % STORE_LOG_CHUNK];
+    log.addr = addr;
+    log.org_data = pmem_read(addr, 8);
+    log.org_flag = pmem_flag_read(addr, 8);
+    goldenmem_store_log_words.insert(addr);
     ++goldenmem_store_log_ptr;
-    if (goldenmem_store_log_ptr >= GOLDENMEM_STORE_LOG_SIZE)
-      assert(0);
   }
 }
 
 void goldenmem_store_log_restore() {
-  for (int i = goldenmem_store_log_ptr - 1; i >= 0; i--) {
-    pmem_write(goldenmem_store_log_buf[i].addr, goldenmem_store_log_buf[i].org_data,
-               goldenmem_store_log_buf[i].org_flag, 8);
+  for (size_t i = goldenmem_store_log_ptr; i-- > 0;) {
+    store_log &log = goldenmem_store_log_chunks[i / STORE_LOG_CHUNK][i % STORE_LOG_CHUNK];
+    pmem_write(log.addr, log.org_data, log.org_flag, 8);
   }
 }
 #endif // ENABLE_STORE_LOG
@@ -172,7 +529,7 @@ inline word_t paddr_read(uint64_t addr, int len) {
   if (in_pmem(addr))
     return pmem_read(addr, len);
   else {
-    Info("[Hint] read not in pmem, maybe in speculative state! addr: %lx\n", addr);
+    Info_limited("[Hint] read not in pmem, maybe in speculative state! addr: %lx\n", addr);
     return 0;
   }
   return 0;
@@ -182,7 +539,7 @@ inline word_t paddr_flag_read(uint64_t addr, int len) {
   if (in_pmem(addr))
     return pmem_flag_read(addr, len);
   else {
-    Info("[Hint] read not in pmem, maybe in speculative state! addr: %lx\n", addr);
+    Info_limited("[Hint] read not in pmem, maybe in speculative state! addr: %lx\n", addr);
     return 0;
   }
   return 0;
@@ -198,3 +555,76 @@ inline void paddr_write(uint64_t addr, word_t data, word_t flag, int len) {
   } else
     panic("write not in pmem!");
 }
+
+static inline void pmem_blend(uint8_t *p, const uint8_t *data, uint64_t mask, int len) {
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint8_t m = mask >> i;
+    if (m == 0xff) {
+      memcpy(p + i, data + i, 8);
+    } else if (m) {
+      uint64_t bits = spread_bits(m) * 0xff, old, val;
+      memcpy(&old, p + i, 8);
+      memcpy(&val, data + i, 8);
+      old = (old & ~bits) | (val & bits);
+      memcpy(p + i, &old, 8);
+    }
+  }
+  for (; i < len; i++) {
+    if ((mask >> i) & 1) {
+      p[i] = data[i];
+    }
+  }
+}
+
+void update_goldenmem(uint64_t addr, void *data, uint64_t mask, int len, uint8_t flag) {
+  assert(len <= 64);
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  GoldenmemWriteGuard guard(addr, len);
+#endif // CONFIG_DIFFTEST_PARALLEL
+  if (len < 64) {
+    mask &= (1UL << len) - 1;
+  }
+  uint8_t *dataArray = (uint8_t *)data;
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  mask = goldenmem_undo_write(addr, dataArray, mask, len, flag);
+#endif // CONFIG_DIFFTEST_PARALLEL
+  if (mask == 0) {
+    return;
+  }
+#ifdef DIFFTEST_STORE_COMMIT
+  // the store commit queue records byte writes
+  for (int i = 0; i < len; i++) {
+    if (((mask >> i) & 1) != 0) {
+      paddr_write(addr + i, dataArray[i], flag, 1);
+    }
+  }
+#else
+  if (!in_pmem(addr + __builtin_ctzl(mask)) || !in_pmem(addr + 63 - __builtin_clzl(mask))) {
+    panic("write not in pmem!");
+  }
+#ifdef ENABLE_STORE_LOG
+  if (goldenmem_store_log_enable) {
+    // record each 8-byte word once
+    for (uint64_t word = addr & ~7UL; word < addr + len; word += 8) {
+      int offset = word - addr;
+      uint64_t word_mask = offset < 0 ? (mask << -offset) : (mask >> offset);
+      if (word_mask & 0xff) {
+        pmem_record_store(word);
+      }
+    }
+  }
+#endif // ENABLE_STORE_LOG
+  pt_write_check(addr, len);
+  // the flag bitmap is updated with the byte mask directly
+  pmem_flag_set(addr - PMEM_BASE, mask, flag);
+  uint8_t *p = &pmem[addr - PMEM_BASE];
+#ifdef __AVX512BW__
+  if (len == 64) {
+    _mm512_mask_storeu_epi8(p, mask, _mm512_loadu_si512(dataArray));
+    return;
+  }
+#endif // __AVX512BW__
+  pmem_blend(p, dataArray, mask, len);
+#endif // DIFFTEST_STORE_COMMIT
+}
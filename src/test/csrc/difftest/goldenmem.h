@@ -20,6 +20,7 @@
 #include "common.h"
 #include "ram.h"
 #include <assert.h>
+#include <atomic>
 #include <cstdint>
 #include <stdint.h>
 #include <stdio.h>
@@ -29,19 +30,49 @@ typedef uint64_t uint64_t;
 typedef uint64_t word_t;
 
 extern uint8_t *pmem;
-extern uint8_t *pmem_flag;
+extern uint64_t *pmem_flag;
 
 void init_goldenmem();
 void goldenmem_finish();
+// Save or load the golden memory as a gz file. Memory flags are not saved and cleared by loading.
+bool goldenmem_save(const char *filename);
+bool goldenmem_load(const char *filename);
 
 extern "C" void update_goldenmem(uint64_t addr, void *data, uint64_t mask, int len, uint8_t flag = 0);
 extern "C" void read_goldenmem(uint64_t addr, void *data, uint64_t len, void *flag = NULL);
 
+// Page-table walks of the TLB checkers are cached until a write hits a page they have read.
+// The walker watches a page before reading it and tags its results with the generation.
+extern std::atomic<uint64_t> goldenmem_pt_generation;
+void goldenmem_watch_pt(uint64_t addr);
+// drop all cached walks, called when the golden memory is changed in bulk
+void goldenmem_flush_pt();
+// The generation for a walk. With NUM_CORES > 1, REF writes the golden memory directly through the address from
+// ref_put_gmaddr, which no write check sees, so every walk starts a new generation and nothing is reused.
+static inline uint64_t goldenmem_pt_walk_generation() {
+#if NUM_CORES > 1
+  return goldenmem_pt_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+#else
+  return goldenmem_pt_generation.load(std::memory_order_acquire);
+#endif // NUM_CORES
+}
+
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
 void *guest_to_host(uint64_t addr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 uint64_t host_to_guest(void *addr);
 
+// copy the 64-byte line at addr, which must be in pmem
+void read_goldenmem_line(uint64_t addr, uint64_t *line);
+
+#ifdef CONFIG_DIFFTEST_PARALLEL
+// Start the stores of a cycle, which are applied by goldenmem_set_writer(core) in the order of cores.
+// A checker thread with goldenmem_set_view(core) reads the golden memory without the stores of later cores.
+void goldenmem_cycle_begin();
+void goldenmem_set_writer(int core);
+void goldenmem_set_view(int core);
+#endif // CONFIG_DIFFTEST_PARALLEL
+
 word_t paddr_read(uint64_t addr, int len);
 word_t paddr_flag_read(uint64_t addr, int len);
 void paddr_write(uint64_t addr, word_t data, word_t flag, int len);
@@ -52,5 +83,7 @@ bool in_pmem(uint64_t addr);
 void goldenmem_set_store_log(bool enable);
 void goldenmem_store_log_reset();
 void goldenmem_store_log_restore();
+// whether stores were dropped since the last reset, which makes the log unable to restore
+bool goldenmem_store_log_overflow();
 #endif
 #endif
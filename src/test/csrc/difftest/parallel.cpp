@@ -0,0 +1,88 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifdef CONFIG_DIFFTEST_PARALLEL
+#include "parallel.h"
+#include "affinity.h"
+
+ParallelChecker::ParallelChecker(int num_tasks, std::function<int(int)> task)
+    : num_tasks(num_tasks), task(task), owner_pid(getpid()) {
+  slots = new WorkerSlot[num_tasks];
+  for (int i = 1; i < num_tasks; i++) {
+    workers.emplace_back(&ParallelChecker::worker_loop, this, i);
+    affinity_place_thread(workers.back().native_handle(), "difftest checker");
+  }
+}
+
+ParallelChecker::~ParallelChecker() {
+  if (getpid() != owner_pid) {
+    // the workers exist only in the parent, so their handles are leaked instead of joined
+    new std::vector<std::thread>(std::move(workers));
+  } else {
+    exit.store(true, std::memory_order_release);
+    for (auto &t: workers) {
+      t.join();
+    }
+  }
+  delete[] slots;
+}
+
+void ParallelChecker::worker_loop(int idx) {
+  WorkerSlot *slot = &slots[idx];
+  uint64_t seen = 0;
+  while (true) {
+    int spin = 0;
+    while (slot->epoch.load(std::memory_order_acquire) == seen) {
+      if (exit.load(std::memory_order_acquire)) {
+        return;
+      }
+      difftest_spin_wait(spin);
+    }
+    seen++;
+    slot->result = task(idx);
+    slot->done.store(true, std::memory_order_release);
+  }
+}
+
+int ParallelChecker::run() {
+  if (getpid() != owner_pid) {
+    for (int i = 0; i < num_tasks; i++) {
+      int ret = task(i);
+      if (ret) {
+        return ret;
+      }
+    }
+    return 0;
+  }
+  epoch++;
+  for (int i = 1; i < num_tasks; i++) {
+    slots[i].done.store(false, std::memory_order_relaxed);
+    slots[i].epoch.store(epoch, std::memory_order_release);
+  }
+  slots[0].result = task(0);
+  int ret = 0;
+  for (int i = 0; i < num_tasks; i++) {
+    int spin = 0;
+    while (!slots[i].done.load(std::memory_order_acquire)) {
+      difftest_spin_wait(spin);
+    }
+    if (!ret) {
+      ret = slots[i].result;
+    }
+  }
+  return ret;
+}
+#endif // CONFIG_DIFFTEST_PARALLEL
@@ -0,0 +1,59 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DIFFTEST_PARALLEL_H__
+#define __DIFFTEST_PARALLEL_H__
+
+#include "common.h"
+#include "spinwait.h"
+#include <atomic>
+#include <thread>
+
+#ifdef CONFIG_DIFFTEST_PARALLEL
+#include <functional>
+#include <vector>
+
+// Run the same task for every core on persistent worker threads.
+// Task 0 runs on the calling (simulation) thread, task i (i > 0) runs on worker i.
+// run() returns after all tasks of this round finish, which acts as a barrier.
+// A forked child (e.g. a LightSSS checkpoint) has no workers, and runs the tasks in order itself.
+class ParallelChecker {
+public:
+  ParallelChecker(int num_tasks, std::function<int(int)> task);
+  ~ParallelChecker();
+  // returns the non-zero result of the task with the lowest index, or 0
+  int run();
+
+private:
+  struct alignas(64) WorkerSlot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> done{true};
+    int result = 0;
+  };
+
+  int num_tasks;
+  std::function<int(int)> task;
+  std::vector<std::thread> workers;
+  WorkerSlot *slots;
+  std::atomic<bool> exit{false};
+  uint64_t epoch = 0;
+  pid_t owner_pid;
+
+  void worker_loop(int idx);
+};
+#endif // CONFIG_DIFFTEST_PARALLEL
+
+#endif // __DIFFTEST_PARALLEL_H__
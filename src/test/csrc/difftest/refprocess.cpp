@@ -0,0 +1,565 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "refprocess.h"
+
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+#include "dut.h"
+#include "parallel.h"
+#include <algorithm>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef ENABLE_RUNHEAD
+#error "REF_PROCESS does not support runahead"
+#endif // ENABLE_RUNHEAD
+
+int ref_process_cpu = -1;
+static RefProcess *ref_process = NULL;
+// returned to the stubs after REF has crashed, so that they need no checks
+static RefCall crashed_call;
+
+RefProcess::RefProcess(AbstractRefProxy *proxy, const char *env, const char *file_path) {
+  channel = (RefChannel *)mmap(NULL, sizeof(RefChannel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (channel == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  new (channel) RefChannel();
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  } else if (pid == 0) {
+    serve(proxy, env, file_path);
+  }
+
+  Info("REF runs in process %d\n", pid);
+  int spin = 0;
+  while (!channel->ready.load(std::memory_order_acquire)) {
+    if (waitpid(pid, NULL, WNOHANG) == pid) {
+      printf("REF process failed to start\n");
+      exit(1);
+    }
+    difftest_spin_wait(spin);
+  }
+}
+
+RefProcess::~RefProcess() {
+  if (!crashed) {
+    begin(REF_FUNC_QUIT);
+    post();
+    waitpid(pid, NULL, 0);
+  }
+  munmap(channel, sizeof(RefChannel));
+}
+
+bool RefProcess::wait_calls(uint64_t n) {
+  int spin = 0;
+  uint64_t rounds = 0;
+  while (head - channel->tail.load(std::memory_order_acquire) >= n) {
+    difftest_spin_wait(spin);
+    if (crashed) {
+      return false;
+    }
+    // check whether REF is still alive once in a while
+    if (spin == DIFFTEST_SPIN_LIMIT && ++rounds % DIFFTEST_SPIN_LIMIT == 0) {
+      int status;
+      if (waitpid(pid, &status, WNOHANG) == pid) {
+        if (WIFSIGNALED(status)) {
+          printf("REF process %d is killed by signal %d\n", pid, WTERMSIG(status));
+        } else {
+          printf("REF process %d exits with code %d\n", pid, WEXITSTATUS(status));
+        }
+        fflush(stdout);
+        crashed = true;
+      }
+    }
+  }
+  return true;
+}
+
+RefCall *RefProcess::begin(int func) {
+  if (crashed || !wait_calls(REF_PROCESS_SLOTS)) {
+    crashed_call.size = 0;
+    crashed_call.ret = 0;
+    return &crashed_call;
+  }
+  RefCall *c = &channel->calls[head % REF_PROCESS_SLOTS];
+  c->func = func;
+  c->size = 0;
+  return c;
+}
+
+void RefProcess::post() {
+  if (crashed) {
+    return;
+  }
+  head++;
+  channel->head.store(head, std::memory_order_release);
+}
+
+RefCall *RefProcess::call() {
+  post();
+  if (crashed || !wait_calls(1)) {
+    crashed_call.size = 0;
+    crashed_call.ret = 0;
+    return &crashed_call;
+  }
+  return &channel->calls[(head - 1) % REF_PROCESS_SLOTS];
+}
+
+void RefProcess::serve(AbstractRefProxy *proxy, const char *env, const char *file_path) {
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (ref_process_cpu >= 0) {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(ref_process_cpu, &mask);
+    if (sched_setaffinity(0, sizeof(mask), &mask)) {
+      perror("sched_setaffinity");
+    }
+  }
+
+  proxy->load_functions(env, file_path);
+#define MarkRefFunc(this_func, ...) channel->available[REF_FUNC_##this_func] = proxy->this_func != nullptr;
+  REF_ALL(MarkRefFunc)
+  REF_OPTIONAL(MarkRefFunc)
+  // these functions share pointers between the two sides
+  channel->available[REF_FUNC_ref_put_gmaddr] = false;
+  channel->available[REF_FUNC_ref_get_vec_load_dual_goldenmem_reg] = false;
+  channel->available[REF_FUNC_ref_update_vec_load_goldenmen] = false;
+  channel->ready.store(true, std::memory_order_release);
+
+  uint64_t tail = 0;
+  int spin = 0;
+  while (true) {
+    if (channel->head.load(std::memory_order_acquire) == tail) {
+      difftest_spin_wait(spin);
+      continue;
+    }
+    spin = 0;
+    RefCall *c = &channel->calls[tail % REF_PROCESS_SLOTS];
+    if (c->func == REF_FUNC_QUIT) {
+      channel->tail.store(tail + 1, std::memory_order_release);
+      fflush(stdout);
+      _exit(0);
+    }
+    dispatch(proxy, c);
+    fflush(stdout);
+    channel->tail.store(++tail, std::memory_order_release);
+  }
+}
+
+// clang-format off
+void RefProcess::dispatch(AbstractRefProxy *p, RefCall *c) {
+  uint64_t *a = c->args;
+  switch (c->func) {
+    case REF_FUNC_ref_init: p->ref_init(); break;
+    case REF_FUNC_ref_regcpy:
+      p->ref_regcpy(c->data, a[0], a[1]);
+      c->size = (a[0] == REF_TO_DUT) ? REF_STATE_SIZE : 0;
+      break;
+    case REF_FUNC_ref_csrcpy:
+      p->ref_csrcpy(c->data, a[0]);
+      c->size = (a[0] == REF_TO_DUT) ? 4096 * sizeof(uint64_t) : 0;
+      break;
+    case REF_FUNC_ref_memcpy:
+    case REF_FUNC_ref_memcpy_init:
+      (c->func == REF_FUNC_ref_memcpy ? p->ref_memcpy : p->ref_memcpy_init)(a[0], c->data, a[1], a[2]);
+      c->size = (a[2] == REF_TO_DUT) ? a[1] : 0;
+      break;
+    case REF_FUNC_ref_exec: p->ref_exec(a[0]); break;
+    case REF_FUNC_ref_reg_display: p->ref_reg_display(); break;
+    case REF_FUNC_update_config: p->update_config(c->data); break;
+    case REF_FUNC_uarchstatus_sync: p->uarchstatus_sync(c->data); break;
+    case REF_FUNC_store_commit: {
+      uint64_t *addr = (uint64_t *)c->data, *data = addr + 1;
+      c->ret = p->store_commit(addr, data, (uint8_t *)(data + 1));
+      c->size = 2 * sizeof(uint64_t) + sizeof(uint8_t);
+      break;
+    }
+    case REF_FUNC_raise_intr: p->raise_intr(a[0]); break;
+#ifdef ENABLE_STORE_LOG
+    case REF_FUNC_ref_store_log_reset: p->ref_store_log_reset(); break;
+    case REF_FUNC_ref_store_log_restore: p->ref_store_log_restore(); break;
+#endif // ENABLE_STORE_LOG
+#ifdef DEBUG_MODE_DIFF
+    case REF_FUNC_debug_mem_sync: p->debug_mem_sync(a[0], c->data, a[1]); break;
+#endif // DEBUG_MODE_DIFF
+    case REF_FUNC_load_flash_bin: p->load_flash_bin((const char *)c->data, a[0]); break;
+    case REF_FUNC_load_flash_bin_v2: p->load_flash_bin_v2(c->data, a[0]); break;
+    case REF_FUNC_ref_status: c->ret = p->ref_status(); break;
+    case REF_FUNC_ref_close: p->ref_close(); break;
+    case REF_FUNC_ref_set_ramsize: p->ref_set_ramsize(a[0]); break;
+    case REF_FUNC_ref_set_mhartid: p->ref_set_mhartid(a[0]); break;
+    case REF_FUNC_ref_skip_one: p->ref_skip_one(a[0], a[1], a[2], a[3]); break;
+    case REF_FUNC_ref_guided_exec: p->ref_guided_exec(c->data); break;
+    case REF_FUNC_raise_nmi_intr: p->raise_nmi_intr(a[0]); break;
+    case REF_FUNC_ref_virtual_interrupt_is_hvictl_inject: p->ref_virtual_interrupt_is_hvictl_inject(a[0]); break;
+    case REF_FUNC_ref_interrupt_delegate: p->ref_interrupt_delegate(c->data); break;
+    case REF_FUNC_disambiguation_state: c->ret = p->disambiguation_state(); break;
+    case REF_FUNC_ref_non_reg_interrupt_pending: p->ref_non_reg_interrupt_pending(c->data); break;
+    case REF_FUNC_raise_mhpmevent_overflow: p->raise_mhpmevent_overflow(a[0]); break;
+    case REF_FUNC_ref_raise_critical_error: c->ret = p->ref_raise_critical_error(); break;
+    case REF_FUNC_ref_get_store_event_other_info:
+      p->ref_get_store_event_other_info(c->data);
+      c->size = sizeof(uint64_t);
+      break;
+    case REF_FUNC_ref_sync_aia: p->ref_sync_aia(c->data); break;
+    case REF_FUNC_ref_sync_custom_mflushpwr: p->ref_sync_custom_mflushpwr(a[0]); break;
+    case REF_FUNC_ref_get_vec_load_vdNum: c->ret = p->ref_get_vec_load_vdNum(); break;
+    case REF_FUNC_ref_regcpy_delta: {
+      const size_t mask_size = REF_COMPARE_MASK_SIZE * sizeof(uint64_t);
+      p->ref_regcpy_delta(c->data + mask_size, (const uint64_t *)c->data, a[0]);
+      c->size = (a[0] == REF_TO_DUT) ? mask_size + REF_STATE_SIZE : 0;
+      break;
+    }
+    case REF_FUNC_ref_exec_batch: c->ret = p->ref_exec_batch(c->data, a[0]); break;
+    case REF_FUNC_ref_store_commit_batch:
+      c->ret = p->ref_store_commit_batch(c->data, a[0]);
+      c->size = ((uint64_t)c->ret < a[0]) ? a[0] * sizeof(StoreCommit) : 0;
+      break;
+    case REF_FUNC_ref_memfd_init: c->ret = p->ref_memfd_init(a[0], a[1], a[2]); break;
+    case REF_FUNC_ref_reset: p->ref_reset(); break;
+    case REF_FUNC_ref_exec_until_pc: c->ret = p->ref_exec_until_pc(a[0], a[1]); break;
+    default:
+      printf("REF process: unsupported call %d\n", c->func);
+      fflush(stdout);
+      _exit(1);
+  }
+}
+// clang-format on
+
+// Stubs of the REF functions in the simulator process
+
+static inline RefCall *ref_call_in(int func, const void *data, size_t size) {
+  assert(size <= REF_PROCESS_PAYLOAD);
+  RefCall *c = ref_process->begin(func);
+  memcpy(c->data, data, size);
+  c->size = size;
+  return c;
+}
+
+static inline void ref_post_in(int func, const void *data, size_t size) {
+  ref_call_in(func, data, size);
+  ref_process->post();
+}
+
+static inline void ref_post_args(int func, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0, uint64_t a3 = 0) {
+  RefCall *c = ref_process->begin(func);
+  c->args[0] = a0;
+  c->args[1] = a1;
+  c->args[2] = a2;
+  c->args[3] = a3;
+  ref_process->post();
+}
+
+static inline int64_t ref_call_ret(int func) {
+  ref_process->begin(func);
+  return ref_process->call()->ret;
+}
+
+// copy the result back if REF has returned it
+static inline void ref_copy_out(RefCall *c, void *dest, size_t size) {
+  if (c->size) {
+    memcpy(dest, c->data, size);
+  }
+}
+
+static void ref_init_stub() {
+  ref_post_args(REF_FUNC_ref_init);
+}
+
+static void ref_regcpy_stub(void *dut, bool direction, bool on_demand) {
+  RefCall *c = ref_call_in(REF_FUNC_ref_regcpy, dut, direction == DUT_TO_REF ? REF_STATE_SIZE : 0);
+  c->args[0] = direction;
+  c->args[1] = on_demand;
+  if (direction == DUT_TO_REF) {
+    ref_process->post();
+  } else {
+    ref_copy_out(ref_process->call(), dut, REF_STATE_SIZE);
+  }
+}
+
+static void ref_csrcpy_stub(void *dut, bool direction) {
+  const size_t size = 4096 * sizeof(uint64_t);
+  RefCall *c = ref_call_in(REF_FUNC_ref_csrcpy, dut, direction == DUT_TO_REF ? size : 0);
+  c->args[0] = direction;
+  if (direction == DUT_TO_REF) {
+    ref_process->post();
+  } else {
+    ref_copy_out(ref_process->call(), dut, size);
+  }
+}
+
+static void ref_memcpy_chunks(int func, uint64_t addr, void *buf, size_t n, bool direction) {
+  for (size_t offset = 0; offset < n; offset += REF_PROCESS_PAYLOAD) {
+    size_t size = std::min(n - offset, (size_t)REF_PROCESS_PAYLOAD);
+    uint8_t *ptr = (uint8_t *)buf + offset;
+    RefCall *c = ref_call_in(func, ptr, direction == DUT_TO_REF ? size : 0);
+    c->args[0] = addr + offset;
+    c->args[1] = size;
+    c->args[2] = direction;
+    if (direction == DUT_TO_REF) {
+      ref_process->post();
+    } else {
+      ref_copy_out(ref_process->call(), ptr, size);
+    }
+  }
+}
+
+static void ref_memcpy_stub(uint64_t addr, void *buf, size_t n, bool direction) {
+  ref_memcpy_chunks(REF_FUNC_ref_memcpy, addr, buf, n, direction);
+}
+
+static void ref_memcpy_init_stub(uint64_t addr, void *buf, size_t n, bool direction) {
+  ref_memcpy_chunks(REF_FUNC_ref_memcpy_init, addr, buf, n, direction);
+}
+
+static void ref_exec_stub(uint64_t n) {
+  ref_post_args(REF_FUNC_ref_exec, n);
+}
+
+static void ref_reg_display_stub() {
+  ref_call_ret(REF_FUNC_ref_reg_display);
+}
+
+static void update_config_stub(void *config) {
+  ref_post_in(REF_FUNC_update_config, config, sizeof(RefProxyConfig));
+}
+
+static void uarchstatus_sync_stub(void *status) {
+  ref_post_in(REF_FUNC_uarchstatus_sync, status, sizeof(SyncState));
+}
+
+static int store_commit_stub(uint64_t *addr, uint64_t *data, uint8_t *mask) {
+  RefCall *c = ref_process->begin(REF_FUNC_store_commit);
+  uint64_t *words = (uint64_t *)c->data;
+  words[0] = *addr;
+  words[1] = *data;
+  *(uint8_t *)(words + 2) = *mask;
+  c = ref_process->call();
+  if (c->size) {
+    words = (uint64_t *)c->data;
+    *addr = words[0];
+    *data = words[1];
+    *mask = *(uint8_t *)(words + 2);
+  }
+  return c->ret;
+}
+
+static void raise_intr_stub(uint64_t no) {
+  ref_post_args(REF_FUNC_raise_intr, no);
+}
+
+#ifdef ENABLE_STORE_LOG
+static void ref_store_log_reset_stub() {
+  ref_post_args(REF_FUNC_ref_store_log_reset);
+}
+
+static void ref_store_log_restore_stub() {
+  ref_post_args(REF_FUNC_ref_store_log_restore);
+}
+#endif // ENABLE_STORE_LOG
+
+#ifdef DEBUG_MODE_DIFF
+static void debug_mem_sync_stub(uint64_t addr, void *buf, size_t n) {
+  RefCall *c = ref_call_in(REF_FUNC_debug_mem_sync, buf, n);
+  c->args[0] = addr;
+  c->args[1] = n;
+  ref_process->post();
+}
+#endif // DEBUG_MODE_DIFF
+
+static void load_flash_bin_stub(const char *flash_bin, size_t size) {
+  RefCall *c = ref_call_in(REF_FUNC_load_flash_bin, flash_bin, strlen(flash_bin) + 1);
+  c->args[0] = size;
+  ref_process->post();
+}
+
+static void load_flash_bin_v2_stub(const uint8_t *flash_bin, size_t size) {
+  RefCall *c = ref_call_in(REF_FUNC_load_flash_bin_v2, flash_bin, size);
+  c->args[0] = size;
+  ref_process->post();
+}
+
+// A crashed REF is reported as an aborted REF
+static int ref_status_stub() {
+  if (ref_process->is_crashed()) {
+    return STATE_ABORT;
+  }
+  if (!ref_process->is_available(REF_FUNC_ref_status)) {
+    return 0;
+  }
+  int status = ref_call_ret(REF_FUNC_ref_status);
+  return ref_process->is_crashed() ? STATE_ABORT : status;
+}
+
+static void ref_close_stub() {
+  ref_call_ret(REF_FUNC_ref_close);
+}
+
+static void ref_set_ramsize_stub(size_t size) {
+  ref_post_args(REF_FUNC_ref_set_ramsize, size);
+}
+
+static void ref_set_mhartid_stub(int hartid) {
+  ref_post_args(REF_FUNC_ref_set_mhartid, hartid);
+}
+
+static void ref_put_gmaddr_stub(void *addr) {
+  printf("REF_PROCESS does not support the shared golden memory\n");
+  assert(0);
+}
+
+static void ref_skip_one_stub(bool isRVC, bool wen, uint32_t wdest, uint64_t wdata) {
+  ref_post_args(REF_FUNC_ref_skip_one, isRVC, wen, wdest, wdata);
+}
+
+static void ref_guided_exec_stub(void *guide) {
+  ref_post_in(REF_FUNC_ref_guided_exec, guide, sizeof(ExecutionGuide));
+}
+
+static void raise_nmi_intr_stub(bool hasNMI) {
+  ref_post_args(REF_FUNC_raise_nmi_intr, hasNMI);
+}
+
+static void ref_virtual_interrupt_is_hvictl_inject_stub(bool inject) {
+  ref_post_args(REF_FUNC_ref_virtual_interrupt_is_hvictl_inject, inject);
+}
+
+static void ref_interrupt_delegate_stub(void *deleg) {
+  ref_post_in(REF_FUNC_ref_interrupt_delegate, deleg, sizeof(InterruptDelegate));
+}
+
+static int disambiguation_state_stub() {
+  return ref_call_ret(REF_FUNC_disambiguation_state);
+}
+
+static void ref_non_reg_interrupt_pending_stub(void *ip) {
+  ref_post_in(REF_FUNC_ref_non_reg_interrupt_pending, ip, sizeof(NonRegInterruptPending));
+}
+
+static void raise_mhpmevent_overflow_stub(uint64_t overflow) {
+  ref_post_args(REF_FUNC_raise_mhpmevent_overflow, overflow);
+}
+
+static bool ref_raise_critical_error_stub() {
+  return ref_call_ret(REF_FUNC_ref_raise_critical_error);
+}
+
+static void ref_get_store_event_other_info_stub(void *info) {
+  ref_process->begin(REF_FUNC_ref_get_store_event_other_info);
+  ref_copy_out(ref_process->call(), info, sizeof(uint64_t));
+}
+
+static void ref_sync_aia_stub(void *aia) {
+  ref_post_in(REF_FUNC_ref_sync_aia, aia, sizeof(FromAIA));
+}
+
+static void ref_sync_custom_mflushpwr_stub(bool l2FlushDone) {
+  ref_post_args(REF_FUNC_ref_sync_custom_mflushpwr, l2FlushDone);
+}
+
+static int ref_get_vec_load_vdNum_stub() {
+  return ref_call_ret(REF_FUNC_ref_get_vec_load_vdNum);
+}
+
+static void *ref_get_vec_load_dual_goldenmem_reg_stub() {
+  return nullptr;
+}
+
+static void ref_update_vec_load_goldenmen_stub() {}
+
+static void ref_regcpy_delta_stub(void *state, const uint64_t *mask, bool direction) {
+  const size_t mask_size = REF_COMPARE_MASK_SIZE * sizeof(uint64_t);
+  RefCall *c = ref_call_in(REF_FUNC_ref_regcpy_delta, mask, mask_size);
+  memcpy(c->data + mask_size, state, REF_STATE_SIZE);
+  c->size += REF_STATE_SIZE;
+  c->args[0] = direction;
+  if (direction == DUT_TO_REF) {
+    ref_process->post();
+  } else {
+    c = ref_process->call();
+    if (c->size) {
+      memcpy(state, c->data + mask_size, REF_STATE_SIZE);
+    }
+  }
+}
+
+static int ref_exec_batch_stub(void *commits, int n) {
+  RefCall *c = ref_call_in(REF_FUNC_ref_exec_batch, commits, n * sizeof(ExecBatchCommit));
+  c->args[0] = n;
+  return ref_process->call()->ret;
+}
+
+static int ref_store_commit_batch_stub(void *stores, int n) {
+  RefCall *c = ref_call_in(REF_FUNC_ref_store_commit_batch, stores, n * sizeof(StoreCommit));
+  c->args[0] = n;
+  c = ref_process->call();
+  if (c->size) {
+    memcpy(stores, c->data, c->size);
+  }
+  return c->ret;
+}
+
+// the memfd is inherited by the REF process
+static bool ref_memfd_init_stub(int fd, uint64_t dest, size_t n) {
+  RefCall *c = ref_process->begin(REF_FUNC_ref_memfd_init);
+  c->args[0] = fd;
+  c->args[1] = dest;
+  c->args[2] = n;
+  return ref_process->call()->ret;
+}
+
+static void ref_reset_stub() {
+  ref_call_ret(REF_FUNC_ref_reset);
+}
+
+static uint64_t ref_exec_until_pc_stub(uint64_t target_pc, uint64_t n) {
+  RefCall *c = ref_process->begin(REF_FUNC_ref_exec_until_pc);
+  c->args[0] = target_pc;
+  c->args[1] = n;
+  return ref_process->call()->ret;
+}
+
+void RefProcess::install_stubs(AbstractRefProxy *proxy) {
+#define SetRefStub(this_func, ...) proxy->this_func = is_available(REF_FUNC_##this_func) ? this_func##_stub : nullptr;
+  REF_ALL(SetRefStub)
+  REF_OPTIONAL(SetRefStub)
+  proxy->ref_status = ref_status_stub;
+}
+
+void ref_process_start(AbstractRefProxy *proxy, const char *env, const char *file_path) {
+  if (NUM_CORES > 1) {
+    printf("REF_PROCESS does not support NUM_CORES(%d) > 1\n", NUM_CORES);
+    exit(1);
+  }
+  assert(!ref_process);
+  ref_process = new RefProcess(proxy, env, file_path);
+  ref_process->install_stubs(proxy);
+}
+
+void ref_process_stop() {
+  delete ref_process;
+  ref_process = NULL;
+}
+#endif // CONFIG_DIFFTEST_REF_PROCESS
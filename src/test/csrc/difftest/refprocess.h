@@ -0,0 +1,94 @@
+/***************************************************************************************
+* Copyright (c) 2020-2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DIFFTEST_REFPROCESS_H__
+#define __DIFFTEST_REFPROCESS_H__
+
+#include "refproxy.h"
+#include <atomic>
+#include <sys/types.h>
+
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+// REF runs in a forked process. The REF functions of the proxy are replaced by stubs,
+// which pass the calls through a shared-memory ring. Calls without results are posted
+// without waiting, so that REF overlaps with the simulation until the next result is needed.
+
+// bytes of data passed with a call. Larger memory copies are split.
+#define REF_PROCESS_PAYLOAD (1024 * 1024)
+// max number of calls in flight
+#define REF_PROCESS_SLOTS 16
+
+#define RefFuncId(this_func, ...) REF_FUNC_##this_func,
+enum {
+  REF_ALL(RefFuncId) REF_OPTIONAL(RefFuncId) REF_FUNC_QUIT,
+  REF_FUNC_NUM
+};
+
+struct RefCall {
+  uint32_t func;
+  uint32_t size; // bytes of data, set by the caller for inputs and by REF for outputs
+  int64_t ret;
+  uint64_t args[4];
+  uint8_t data[REF_PROCESS_PAYLOAD];
+};
+
+struct RefChannel {
+  alignas(64) std::atomic<uint64_t> head; // # of posted calls
+  alignas(64) std::atomic<uint64_t> tail; // # of finished calls
+  alignas(64) std::atomic<bool> ready;
+  bool available[REF_FUNC_NUM];
+  RefCall calls[REF_PROCESS_SLOTS];
+};
+
+class RefProcess {
+public:
+  RefProcess(AbstractRefProxy *proxy, const char *env, const char *file_path);
+  ~RefProcess();
+
+  // Replace the REF functions of the proxy with the stubs
+  void install_stubs(AbstractRefProxy *proxy);
+  // Wait for a free slot and start a call
+  RefCall *begin(int func);
+  // Post the started call without waiting for it
+  void post();
+  // Post the started call and wait for its result
+  RefCall *call();
+  inline bool is_available(int func) {
+    return channel->available[func];
+  }
+  inline bool is_crashed() {
+    return crashed;
+  }
+
+private:
+  RefChannel *channel;
+  pid_t pid;
+  bool crashed = false;
+  uint64_t head = 0;
+
+  // wait until fewer than n calls are in flight. Return false if REF has crashed.
+  bool wait_calls(uint64_t n);
+  void serve(AbstractRefProxy *proxy, const char *env, const char *file_path);
+  void dispatch(AbstractRefProxy *proxy, RefCall *c);
+};
+
+// pin the REF process to this cpu if non-negative
+extern int ref_process_cpu;
+
+void ref_process_start(AbstractRefProxy *proxy, const char *env, const char *file_path);
+void ref_process_stop();
+#endif // CONFIG_DIFFTEST_REF_PROCESS
+
+#endif // __DIFFTEST_REFPROCESS_H__
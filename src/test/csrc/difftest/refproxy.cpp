@@ -15,11 +15,15 @@
 ***************************************************************************************/
 
 #include "refproxy.h"
+#include "refprocess.h"
 #include <dlfcn.h>
 #include <fstream>
 #include <iostream>
 #include <unistd.h>
 #include <vector>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 uint8_t *ref_golden_mem = NULL;
 const char *difftest_ref_so = NULL;
@@ -52,18 +56,12 @@ REF_OPTIONAL(DeclWeakExtRefFunc)
 #endif
 
 AbstractRefProxy::AbstractRefProxy(int coreid, size_t ram_size, const char *env, const char *file_path)
-    : handler(load_handler(env, file_path)) {
-#ifdef LINKED_REFPROXY_LIB
-#define GetRefFunc(dummy, ref_func, ret, ...) ref_func
+    : handler(nullptr) {
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+  ref_process_start(this, env, file_path);
 #else
-#define GetRefFunc(dummy, ref_func, ret, ...) load_function<RefFunc((*), ret, __VA_ARGS__)>(#ref_func)
-#endif
-#define LoadRefFunc(this_func, ref_func, ret, ...)  this_func = GetRefFunc(, ref_func, ret, __VA_ARGS__);
-#define CheckRefFunc(this_func, ref_func, ret, ...) check_and_assert(this_func);
-
-  REF_ALL(LoadRefFunc)
-  REF_ALL(CheckRefFunc)
-  REF_OPTIONAL(LoadRefFunc)
+  load_functions(env, file_path);
+#endif // CONFIG_DIFFTEST_REF_PROCESS
 
   if (NUM_CORES > 1) {
     check_and_assert(ref_set_mhartid);
@@ -88,7 +86,25 @@ AbstractRefProxy::AbstractRefProxy(int coreid, size_t ram_size, const char *env,
   ref_init();
 }
 
+void AbstractRefProxy::load_functions(const char *env, const char *file_path) {
+  handler = load_handler(env, file_path);
+#ifdef LINKED_REFPROXY_LIB
+#define GetRefFunc(dummy, ref_func, ret, ...) ref_func
+#else
+#define GetRefFunc(dummy, ref_func, ret, ...) load_function<RefFunc((*), ret, __VA_ARGS__)>(#ref_func)
+#endif
+#define LoadRefFunc(this_func, ref_func, ret, ...)  this_func = GetRefFunc(, ref_func, ret, __VA_ARGS__);
+#define CheckRefFunc(this_func, ref_func, ret, ...) check_and_assert(this_func);
+
+  REF_ALL(LoadRefFunc)
+  REF_ALL(CheckRefFunc)
+  REF_OPTIONAL(LoadRefFunc)
+}
+
 AbstractRefProxy::~AbstractRefProxy() {
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+  ref_process_stop();
+#endif // CONFIG_DIFFTEST_REF_PROCESS
   if (handler) {
     dlclose(handler);
   }
@@ -168,55 +184,141 @@ void RefProxy::regcpy(DiffTestState *dut) {
   ref_regcpy(&regs_int, DUT_TO_REF, false);
 };
 
+static inline void mask_set(uint64_t *mask, size_t pos) {
+  mask[pos / 64] |= 1UL << (pos % 64);
+}
+
+static inline bool mask_test(const uint64_t *mask, size_t pos) {
+  return (mask[pos / 64] >> (pos % 64)) & 1;
+}
+
+// Set bit (offset + i) of mask for every mismatched word a[i] != b[i]. Return true if any mismatches.
+static inline bool compare_words_kernel(const uint64_t *a, const uint64_t *b, size_t n, uint64_t *mask, size_t offset) {
+  uint64_t any = 0;
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) {
+    uint64_t m = _mm512_cmpneq_epu64_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    for (any |= m; m; m &= m - 1) {
+      mask_set(mask, offset + i + __builtin_ctzll(m));
+    }
+  }
+#elif defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                    _mm256_loadu_si256((const __m256i *)(b + i)));
+    uint64_t m = ~_mm256_movemask_pd(_mm256_castsi256_pd(eq)) & 0xfUL;
+    for (any |= m; m; m &= m - 1) {
+      mask_set(mask, offset + i + __builtin_ctzll(m));
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (a[i] != b[i]) {
+      mask_set(mask, offset + i);
+      any = 1;
+    }
+  }
+  return any != 0;
+}
+
+int RefProxy::compare_words(const void *dut, const void *ref, size_t size) {
+  size_t offset = (const uint64_t *)ref - (const uint64_t *)&regs_int;
+  size_t n = size / sizeof(uint64_t);
+  bool mismatch = compare_words_kernel((const uint64_t *)dut, (const uint64_t *)ref, n, compare_mask, offset);
+  // the trailing bytes of a state not aligned to 64 bits
+  size_t tail = size % sizeof(uint64_t);
+  if (tail && memcmp((const uint64_t *)dut + n, (const uint64_t *)ref + n, tail)) {
+    mask_set(compare_mask, offset + n);
+    mismatch = true;
+  }
+  return mismatch;
+}
+
 int RefProxy::compare(DiffTestState *dut) {
-#define PROXY_COMPARE(field) memcmp(&(dut->field), &(field), sizeof(field))
+#define PROXY_COMPARE(field) compare_words(&(dut->field), &(field), sizeof(field))
+  memset(compare_mask, 0, sizeof(compare_mask));
+
+  // The states almost always match. Check them with memcmp first, the hot register blocks leading,
+  // and build the mismatch bitmap only when some state differs.
+#define PROXY_EQUAL(field) (memcmp(&(dut->field), &(field), sizeof(field)) == 0)
+  bool equal = PROXY_EQUAL(regs_int) && PROXY_EQUAL(csr);
+#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
+  equal = equal && PROXY_EQUAL(regs_fp);
+#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
+#ifdef CONFIG_DIFFTEST_FPCSRSTATE
+  equal = equal && PROXY_EQUAL(fcsr);
+#endif // CONFIG_DIFFTEST_FPCSRSTATE
+#ifdef CONFIG_DIFFTEST_HCSRSTATE
+  equal = equal && PROXY_EQUAL(hcsr);
+#endif // CONFIG_DIFFTEST_HCSRSTATE
+#ifdef CONFIG_DIFFTEST_VECCSRSTATE
+  equal = equal && PROXY_EQUAL(vcsr);
+#endif // CONFIG_DIFFTEST_VECCSRSTATE
+#ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
+  equal = equal && PROXY_EQUAL(triggercsr);
+#endif // CONFIG_DIFFTEST_TRIGGERCSRSTATE
+#ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
+  equal = equal && PROXY_EQUAL(regs_vec);
+#endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
+#undef PROXY_EQUAL
+  if (equal) {
+    return 0;
+  }
 
-  const int results[] = {PROXY_COMPARE(regs_int),
+  // All states are compared in one pass to fill the mismatch bitmap for display().
+  int mismatch = PROXY_COMPARE(regs_int);
 #ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
-                         PROXY_COMPARE(regs_fp),
+  mismatch |= PROXY_COMPARE(regs_fp);
 #endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
 #ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
-                         PROXY_COMPARE(regs_vec),
+  mismatch |= PROXY_COMPARE(regs_vec);
 #endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
 #ifdef CONFIG_DIFFTEST_VECCSRSTATE
-                         PROXY_COMPARE(vcsr),
+  mismatch |= PROXY_COMPARE(vcsr);
 #endif // CONFIG_DIFFTEST_VECCSRSTATE
 #ifdef CONFIG_DIFFTEST_FPCSRSTATE
-                         PROXY_COMPARE(fcsr),
+  mismatch |= PROXY_COMPARE(fcsr);
 #endif // CONFIG_DIFFTEST_FPCSRSTATE
 #ifdef CONFIG_DIFFTEST_HCSRSTATE
-                         PROXY_COMPARE(hcsr),
+  mismatch |= PROXY_COMPARE(hcsr);
 #endif // CONFIG_DIFFTEST_HCSRSTATE
 #ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
-                         PROXY_COMPARE(triggercsr),
+  mismatch |= PROXY_COMPARE(triggercsr);
 #endif // CONFIG_DIFFTEST_TRIGGERCSRSTATE
-                         PROXY_COMPARE(csr)
-
-  };
-  for (int i = 0; i < sizeof(results) / sizeof(int); i++) {
-    if (results[i]) {
-      // There may be some waive rules for CSRs
-      if (i == sizeof(results) / sizeof(int) - 1) {
-        // If mismatches are cleared, we sync the states back to REF.
-        if (do_csr_waive(dut) && !PROXY_COMPARE(csr)) {
-          sync(true);
-          return 0;
-        }
+  int csr_mismatch = PROXY_COMPARE(csr);
+
+  if (mismatch) {
+    return 1;
+  }
+  // There may be some waive rules for CSRs
+  if (csr_mismatch) {
+    if (do_csr_waive(dut)) {
+      size_t offset = (uint64_t *)&csr - (uint64_t *)&regs_int;
+      for (size_t i = 0; i < (sizeof(csr) + sizeof(uint64_t) - 1) / sizeof(uint64_t); i++) {
+        compare_mask[(offset + i) / 64] &= ~(1UL << ((offset + i) % 64));
+      }
+      // If mismatches are cleared, we sync the states back to REF.
+      if (!PROXY_COMPARE(csr)) {
+        sync(true);
+        return 0;
       }
-      return 1;
     }
+    return 1;
   }
   return 0;
 };
 
 void RefProxy::display(DiffTestState *dut) {
   if (dut) {
+    // mismatches are recorded by the last compare()
 #define PROXY_COMPARE_AND_DISPLAY(field, field_names)                     \
   do {                                                                    \
     uint64_t *_ptr_dut = (uint64_t *)(&((dut)->field));                   \
     uint64_t *_ptr_ref = (uint64_t *)(&(field));                          \
+    size_t _offset = _ptr_ref - (uint64_t *)&regs_int;                    \
     for (int i = 0; i < sizeof(field) / sizeof(uint64_t); i++) {          \
-      if (_ptr_dut[i] != _ptr_ref[i]) {                                   \
+      if (mask_test(compare_mask, _offset + i)) {                         \
         Info(                                                             \
             "%7s different at pc = 0x%010lx, right= 0x%016lx, "           \
             "wrong = 0x%016lx\n",                                         \
@@ -250,6 +352,144 @@ void RefProxy::display(DiffTestState *dut) {
   }
 };
 
+// Without difftest_exec_until_pc, REF is stepped by one instruction, and only pc is copied after each step
+// if REF provides difftest_regcpy_delta
+uint64_t RefProxy::exec_until_pc(uint64_t target_pc, uint64_t n) {
+  uint64_t pc_mask[REF_COMPARE_MASK_SIZE] = {0};
+  mark_words(pc_mask, &pc, sizeof(pc));
+  auto sync_pc = [this, &pc_mask]() { ref_regcpy_delta ? ref_regcpy_delta(&regs_int, pc_mask, REF_TO_DUT) : sync(); };
+  if (ref_exec_until_pc) {
+    uint64_t executed = ref_exec_until_pc(target_pc, n);
+    sync_pc();
+    return executed;
+  }
+  sync_pc();
+  uint64_t executed = 0;
+  while (executed < n && pc != target_pc && !get_status()) {
+    ref_exec(1);
+    executed++;
+    sync_pc();
+  }
+  return executed;
+}
+
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+void RefProxy::sync_dirty(bool full) {
+  if (full || !ref_regcpy_delta) {
+    sync();
+    return;
+  }
+  // CSRs are always synced since most instructions and all exceptions change some of them
+  uint64_t mask[REF_COMPARE_MASK_SIZE];
+  memcpy(mask, dirty_mask, sizeof(mask));
+  mark_words(mask, &csr, sizeof(csr));
+  mark_words(mask, &pc, sizeof(pc));
+#ifdef CONFIG_DIFFTEST_HCSRSTATE
+  mark_words(mask, &hcsr, sizeof(hcsr));
+#endif // CONFIG_DIFFTEST_HCSRSTATE
+#ifdef CONFIG_DIFFTEST_VECCSRSTATE
+  mark_words(mask, &vcsr, sizeof(vcsr));
+#endif // CONFIG_DIFFTEST_VECCSRSTATE
+#ifdef CONFIG_DIFFTEST_FPCSRSTATE
+  mark_words(mask, &fcsr, sizeof(fcsr));
+#endif // CONFIG_DIFFTEST_FPCSRSTATE
+#ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
+  mark_words(mask, &triggercsr, sizeof(triggercsr));
+#endif // CONFIG_DIFFTEST_TRIGGERCSRSTATE
+  ref_regcpy_delta(&regs_int, mask, REF_TO_DUT);
+}
+
+int RefProxy::compare_dirty_words(const void *dut, const void *ref, size_t size) {
+  const uint64_t *dut_words = (const uint64_t *)dut;
+  const uint64_t *ref_words = (const uint64_t *)ref;
+  size_t begin = ref_words - (const uint64_t *)&regs_int;
+  size_t end = begin + size / sizeof(uint64_t);
+  for (size_t w = begin / 64; w * 64 < end; w++) {
+    for (uint64_t m = dirty_mask[w]; m; m &= m - 1) {
+      size_t pos = w * 64 + __builtin_ctzll(m);
+      if (pos >= begin && pos < end && dut_words[pos - begin] != ref_words[pos - begin]) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int RefProxy::compare_dirty(DiffTestState *dut, bool full) {
+  int mismatch = 0;
+  if (!full) {
+#define PROXY_COMPARE_DIRTY(field) compare_dirty_words(&(dut->field), &(field), sizeof(field))
+#define PROXY_COMPARE_CSR(field)   memcmp(&(dut->field), &(field), sizeof(field))
+    mismatch = PROXY_COMPARE_DIRTY(regs_int) || PROXY_COMPARE_CSR(csr)
+#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
+               || PROXY_COMPARE_DIRTY(regs_fp)
+#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
+#ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
+               || PROXY_COMPARE_DIRTY(regs_vec)
+#endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
+#ifdef CONFIG_DIFFTEST_HCSRSTATE
+               || PROXY_COMPARE_CSR(hcsr)
+#endif // CONFIG_DIFFTEST_HCSRSTATE
+#ifdef CONFIG_DIFFTEST_VECCSRSTATE
+               || PROXY_COMPARE_CSR(vcsr)
+#endif // CONFIG_DIFFTEST_VECCSRSTATE
+#ifdef CONFIG_DIFFTEST_FPCSRSTATE
+               || PROXY_COMPARE_CSR(fcsr)
+#endif // CONFIG_DIFFTEST_FPCSRSTATE
+#ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
+               || PROXY_COMPARE_CSR(triggercsr)
+#endif // CONFIG_DIFFTEST_TRIGGERCSRSTATE
+        ;
+    // Mismatches (including waived CSRs) are checked again with all states.
+    if (mismatch) {
+      sync();
+    }
+  }
+  memset(dirty_mask, 0, sizeof(dirty_mask));
+  return (full || mismatch) ? compare(dut) : 0;
+}
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+// Each word of a state is rotated left by its index in the state. Must match StateHash.hashWords().
+void RefProxy::hash_words(const void *ref, size_t size) {
+  const uint64_t *words = (const uint64_t *)ref;
+  uint64_t *shadow = hash_shadow + (words - (const uint64_t *)&regs_int);
+  for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+    if (words[i] != shadow[i]) {
+      int r = i % 64;
+      uint64_t diff = words[i] ^ shadow[i];
+      state_hash ^= r ? (diff << r) | (diff >> (64 - r)) : diff;
+      shadow[i] = words[i];
+    }
+  }
+}
+
+uint64_t RefProxy::update_hash() {
+  hash_words(&regs_int, sizeof(regs_int));
+#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
+  hash_words(&regs_fp, sizeof(regs_fp));
+#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
+#ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
+  hash_words(&regs_vec, sizeof(regs_vec));
+#endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
+#ifdef CONFIG_DIFFTEST_VECCSRSTATE
+  hash_words(&vcsr, sizeof(vcsr));
+#endif // CONFIG_DIFFTEST_VECCSRSTATE
+#ifdef CONFIG_DIFFTEST_FPCSRSTATE
+  hash_words(&fcsr, sizeof(fcsr));
+#endif // CONFIG_DIFFTEST_FPCSRSTATE
+#ifdef CONFIG_DIFFTEST_HCSRSTATE
+  hash_words(&hcsr, sizeof(hcsr));
+#endif // CONFIG_DIFFTEST_HCSRSTATE
+#ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
+  hash_words(&triggercsr, sizeof(triggercsr));
+#endif // CONFIG_DIFFTEST_TRIGGERCSRSTATE
+  hash_words(&csr, sizeof(csr));
+  return state_hash;
+}
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
+
 void RefProxy::flash_init(const uint8_t *flash_base, size_t size, const char *flash_bin) {
   if (load_flash_bin_v2) {
     load_flash_bin_v2(flash_base, size);
@@ -93,6 +93,13 @@ public:
   bool enable_store_log = false;
 };
 
+// A store checked by difftest_store_commit_batch
+struct StoreCommit {
+  uint64_t addr;
+  uint64_t data;
+  uint8_t mask;
+};
+
 /* clang-format off */
 #define REF_BASE(f)                                                           \
   f(ref_init, difftest_init, void, )                                          \
@@ -157,7 +164,13 @@ public:
   f(ref_sync_custom_mflushpwr, difftest_sync_custom_mflushpwr, void, bool)                                  \
   f(ref_get_vec_load_vdNum, difftest_get_vec_load_vdNum, int, )                                                 \
   f(ref_get_vec_load_dual_goldenmem_reg, difftest_get_vec_load_dual_goldenmem_reg, void*, )                                                       \
-  f(ref_update_vec_load_goldenmen, difftest_update_vec_load_pmem, void, )
+  f(ref_update_vec_load_goldenmen, difftest_update_vec_load_pmem, void, )                                   \
+  f(ref_regcpy_delta, difftest_regcpy_delta, void, void*, const uint64_t*, bool)                             \
+  f(ref_exec_batch, difftest_exec_batch, int, void*, int)                                                  \
+  f(ref_store_commit_batch, difftest_store_commit_batch, int, void*, int)                                  \
+  f(ref_memfd_init, difftest_memfd_init, bool, int, uint64_t, size_t)                                     \
+  f(ref_reset, difftest_reset, void, )                                                                     \
+  f(ref_exec_until_pc, difftest_exec_until_pc, uint64_t, uint64_t, uint64_t)
 #define RefFunc(func, ret, ...) ret func(__VA_ARGS__)
 #define DeclRefFunc(this_func, dummy, ret, ...) RefFunc((*this_func), ret, __VA_ARGS__);
 /* clang-format on */
@@ -174,11 +187,39 @@ protected:
   REF_OPTIONAL(DeclRefFunc)
 
 private:
-  void *const handler;
+  void *handler;
   void *load_handler(const char *env, const char *file_path);
+  void load_functions(const char *env, const char *file_path);
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+  friend class RefProcess;
+#endif // CONFIG_DIFFTEST_REF_PROCESS
   template <typename T> T load_function(const char *func_name);
 };
 
+// size of the architectural states starting from RefProxy::regs_int
+static const int REF_STATE_SIZE = sizeof(DifftestArchIntRegState) + sizeof(DifftestCSRState) + sizeof(uint64_t)
+#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
+                                  + sizeof(DifftestArchFpRegState)
+#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
+#ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
+                                  + sizeof(DifftestArchVecRegState)
+#endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
+#ifdef CONFIG_DIFFTEST_VECCSRSTATE
+                                  + sizeof(DifftestVecCSRState)
+#endif // CONFIG_DIFFTEST_VECCSRSTATE
+#ifdef CONFIG_DIFFTEST_FPCSRSTATE
+                                  + sizeof(DifftestFpCSRState)
+#endif // CONFIG_DIFFTEST_FPCSRSTATE
+#ifdef CONFIG_DIFFTEST_HCSRSTATE
+                                  + sizeof(DifftestHCSRState)
+#endif // CONFIG_DIFFTEST_HCSRSTATE
+#ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
+                                  + sizeof(DifftestTriggerCSRState)
+#endif //CONFIG_DIFFTEST_TRIGGERCSRSTATE
+    ;
+// # of 64-bit words in the mismatch bitmap of RefProxy::compare()
+static const int REF_COMPARE_MASK_SIZE = ((REF_STATE_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t) + 63) / 64;
+
 class RefProxy : public AbstractRefProxy {
 public:
   RefProxy(int coreid, size_t ram_size) : AbstractRefProxy(coreid, ram_size, nullptr, nullptr) {}
@@ -226,9 +267,40 @@ public:
   }
 
   void regcpy(DiffTestState *dut);
+  // Compare all states with DUT, and record mismatched 64-bit words in compare_mask for display()
   int compare(DiffTestState *dut);
   void display(DiffTestState *dut = nullptr);
 
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+  // Record the register written by a commit. Vector registers are always marked as a whole.
+  inline void mark_dirty(bool rfwen, bool fpwen, bool vecwen, uint32_t wdest) {
+    if (rfwen && wdest != 0) {
+      mark_words(dirty_mask, &regs_int.value[wdest], sizeof(uint64_t));
+    }
+#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
+    if (fpwen) {
+      mark_words(dirty_mask, &regs_fp.value[wdest], sizeof(uint64_t));
+    }
+#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
+#ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
+    if (vecwen) {
+      mark_words(dirty_mask, &regs_vec, sizeof(regs_vec));
+    }
+#endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
+  }
+  // Copy the dirty registers and all CSRs from REF, or all states if full is set
+  void sync_dirty(bool full);
+  // Compare the dirty registers and all CSRs with DUT, or all states if full is set.
+  // Dirty registers are cleared afterwards. Mismatches are confirmed by a full sync and compare.
+  int compare_dirty(DiffTestState *dut, bool full);
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+  // Return the hash of the compared states, computed as the DUT does in StateHash.scala.
+  // The hash is updated incrementally by the words changed since the last call.
+  uint64_t update_hash();
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
+
   inline void skip_one(bool isRVC, bool rfwen, bool fpwen, bool vecwen, uint32_t wdest, uint64_t wdata) {
     bool wen = rfwen | fpwen;
     if (ref_skip_one) {
@@ -341,6 +413,29 @@ public:
     return ref_guided_exec ? ref_guided_exec(&guide) : ref_exec(1);
   }
 
+  inline bool has_exec_batch() {
+    return ref_exec_batch != nullptr;
+  }
+
+  // Execute (or skip) the commits in order. Return the index of the first commit whose pc mismatches REF, or n.
+  inline int exec_batch(struct ExecBatchCommit *commits, int n) {
+    return ref_exec_batch(commits, n);
+  }
+
+  // Check the committed stores in order, with one call of difftest_store_commit_batch if REF provides it.
+  // Return the index of the first mismatched store, which is overwritten by the store of REF, or n.
+  inline int store_commit_batch(struct StoreCommit *stores, int n) {
+    if (ref_store_commit_batch) {
+      return ref_store_commit_batch(stores, n);
+    }
+    for (int i = 0; i < n; i++) {
+      if (store_commit(&stores[i].addr, &stores[i].data, &stores[i].mask)) {
+        return i;
+      }
+    }
+    return n;
+  }
+
   virtual inline bool in_disambiguation_state() {
     return disambiguation_state ? disambiguation_state() : false;
   }
@@ -355,6 +450,24 @@ public:
     sync_config();
   }
 
+  // Let REF map n bytes of the memfd at dest privately. Return false if not supported.
+  inline bool mem_map_fd(int fd, uint64_t dest, size_t n) {
+    return ref_memfd_init ? ref_memfd_init(fd, dest, n) : false;
+  }
+
+  // Reset REF to the states right after ref_init(), including zeroed memory. Return false if not supported.
+  inline bool reset() {
+    if (!ref_reset) {
+      return false;
+    }
+    ref_reset();
+    return true;
+  }
+
+  // Execute at most n instructions, and stop before the one at target_pc. Return the number of executed
+  // instructions. Only pc is synced afterwards, and other states need a sync().
+  uint64_t exec_until_pc(uint64_t target_pc, uint64_t n);
+
   inline void mem_init(uint64_t dest, void *src, size_t n, bool direction) {
     if (ref_memcpy_init) {
       ref_memcpy_init(dest, src, n, direction);
@@ -383,26 +496,7 @@ public:
 #endif // ENABLE_STORE_LOG
 
   inline int get_reg_size() {
-    return sizeof(DifftestArchIntRegState) + sizeof(DifftestCSRState) + sizeof(uint64_t)
-#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
-           + sizeof(DifftestArchFpRegState)
-#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
-#ifdef CONFIG_DIFFTEST_ARCHVECREGSTATE
-           + sizeof(DifftestArchVecRegState)
-#endif // CONFIG_DIFFTEST_ARCHVECREGSTATE
-#ifdef CONFIG_DIFFTEST_VECCSRSTATE
-           + sizeof(DifftestVecCSRState)
-#endif // CONFIG_DIFFTEST_VECCSRSTATE
-#ifdef CONFIG_DIFFTEST_FPCSRSTATE
-           + sizeof(DifftestFpCSRState)
-#endif // CONFIG_DIFFTEST_FPCSRSTATE
-#ifdef CONFIG_DIFFTEST_HCSRSTATE
-           + sizeof(DifftestHCSRState)
-#endif // CONFIG_DIFFTEST_HCSRSTATE
-#ifdef CONFIG_DIFFTEST_TRIGGERCSRSTATE
-           + sizeof(DifftestTriggerCSRState)
-#endif //CONFIG_DIFFTEST_TRIGGERCSRSTATE
-        ;
+    return REF_STATE_SIZE;
   }
 
   inline int get_status() {
@@ -411,6 +505,27 @@ public:
 
 private:
   RefProxyConfig config;
+  // bit i is set if the i-th 64-bit word from regs_int mismatches in the last compare()
+  uint64_t compare_mask[REF_COMPARE_MASK_SIZE] = {0};
+  int compare_words(const void *dut, const void *ref, size_t size);
+  // set the bits in mask for the 64-bit words of a state
+  inline void mark_words(uint64_t *mask, const void *ref, size_t size) {
+    size_t offset = (const uint64_t *)ref - (const uint64_t *)&regs_int;
+    for (size_t i = 0; i < (size + sizeof(uint64_t) - 1) / sizeof(uint64_t); i++) {
+      mask[(offset + i) / 64] |= 1UL << ((offset + i) % 64);
+    }
+  }
+#ifdef CONFIG_DIFFTEST_DELTA_SYNC
+  // bit i is set if the i-th 64-bit word from regs_int is written since the last compare_dirty()
+  uint64_t dirty_mask[REF_COMPARE_MASK_SIZE] = {0};
+  int compare_dirty_words(const void *dut, const void *ref, size_t size);
+#endif // CONFIG_DIFFTEST_DELTA_SYNC
+#ifdef CONFIG_DIFFTEST_ARCHSTATEHASH
+  // the states from regs_int hashed by the last update_hash(), and their hash
+  uint64_t hash_shadow[(REF_STATE_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)] = {0};
+  uint64_t state_hash = 0;
+  void hash_words(const void *ref, size_t size);
+#endif // CONFIG_DIFFTEST_ARCHSTATEHASH
 
   inline void sync_config() {
     update_config(&config);
@@ -481,6 +596,21 @@ struct InterruptDelegate {
   bool irToVS;
 };
 
+struct ExecBatchCommit {
+  uint64_t pc;
+  // written data of a skipped instruction
+  uint64_t wdata;
+  uint32_t wdest;
+  uint8_t nFused;
+  // skip the instruction (like ref_skip_one) instead of executing nFused + 1 instructions
+  bool skip;
+  bool isRVC;
+  // destination register file written by a skipped instruction, rfwen being cleared for x0
+  bool rfwen;
+  bool fpwen;
+  bool vecwen;
+};
+
 extern const char *difftest_ref_so;
 extern uint8_t *ref_golden_mem;
 
@@ -14,6 +14,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include "affinity.h"
 #include "device.h"
 #include "diffstate.h"
 #include "difftest.h"
@@ -22,10 +23,15 @@
 #include "mpool.h"
 #include "ram.h"
 #include "refproxy.h"
+#include "telemetry.h"
 #include "xdma.h"
 #include <condition_variable>
+#include <fcntl.h>
 #include <getopt.h>
 #include <mutex>
+#include <string>
+#include <sys/wait.h>
+#include <vector>
 #ifdef FPGA_SIM
 #include "xdma_sim.h"
 #endif // FPGA_SIM
@@ -45,18 +51,35 @@ static uint8_t fpga_result = FPGA_RUN;
 static bool enable_difftest = true;
 static uint64_t max_instrs = 0;
 static uint64_t warmup_instr = 0;
+static const char *telemetry_path = NULL;
+static uint64_t telemetry_interval = 1000;
+static int numa_node = -1;
+// XDMA cards checked by this process, each by a forked process of its own
+static std::vector<int> fpga_cards = {0};
 
-void fpga_init();
+void fpga_init(int card);
 void fpga_step();
 void set_diff_ref_so(char *s);
 void args_parsing(int argc, char *argv[]);
+static void fpga_place_numa(int card);
+static int fpga_run_cards();
 
 FpgaXdma *xdma_device = NULL;
 
 int main(int argc, char *argv[]) {
   args_parsing(argc, argv);
 
-  fpga_init();
+  if (fpga_cards.size() > 1) {
+    // The workload is loaded once before forking, and its pages are shared by the cards until written
+    init_ram(work_load, DEFAULT_EMU_RAM_SIZE);
+    init_flash(flash_bin_file);
+    return fpga_run_cards();
+  }
+
+  fpga_place_numa(fpga_cards[0]);
+  init_ram(work_load, DEFAULT_EMU_RAM_SIZE);
+  init_flash(flash_bin_file);
+  fpga_init(fpga_cards[0]);
 
   printf("fpga init\n");
   xdma_device->start(); // Trigger stop by fpga_nstep
@@ -65,6 +88,54 @@ int main(int argc, char *argv[]) {
   return 0;
 }
 
+// Each card runs in its own process, so the DMA channels, mempool, checker threads, golden memory
+// and REF singletons are private to it. Its output goes to fpga-card<N>.log.
+static int fpga_run_cards() {
+  std::vector<pid_t> pids;
+  for (int card: fpga_cards) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fpga card fork");
+      break;
+    }
+    if (pid == 0) {
+      std::string log = "fpga-card" + std::to_string(card) + ".log";
+      int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+      }
+      fpga_place_numa(card);
+      fpga_init(card);
+      printf("fpga init\n");
+      xdma_device->start();
+      fpga_finish();
+      printf("difftest releases the fpga device and exits\n");
+      fflush(stdout);
+      fflush(stderr);
+      _exit(fpga_result == FPGA_GOODTRAP || fpga_result == FPGA_EXCEED ? 0 : 1);
+    }
+    printf("card %d is checked by process %d\n", card, pid);
+    pids.push_back(pid);
+  }
+
+  int failed = fpga_cards.size() - pids.size();
+  for (size_t i = 0; i < pids.size(); i++) {
+    int status;
+    if (waitpid(pids[i], &status, 0) < 0) {
+      perror("fpga card wait");
+      status = -1;
+    }
+    bool good = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    failed += !good;
+    printf("card %d: %s, see fpga-card%d.log\n", fpga_cards[i], good ? "PASS" : "FAIL", fpga_cards[i]);
+  }
+  return failed != 0;
+}
+
 void set_diff_ref_so(char *s) {
   extern const char *difftest_ref_so;
   char *buf = (char *)malloc(256);
@@ -72,10 +143,8 @@ void set_diff_ref_so(char *s) {
   difftest_ref_so = buf;
 }
 
-void fpga_init() {
-  xdma_device = new FpgaXdma();
-  init_ram(work_load, DEFAULT_EMU_RAM_SIZE);
-  init_flash(flash_bin_file);
+void fpga_init(int card) {
+  xdma_device = new FpgaXdma(card);
 
   difftest_init();
 
@@ -85,9 +154,17 @@ void fpga_init() {
 #ifdef USE_XDMA_DDR_LOAD
   xdma_device->ddr_load_workload(work_load);
 #endif // USE_XDMA_DDR_LOAD
+  if (telemetry_path) {
+    std::string path = telemetry_path;
+    if (fpga_cards.size() > 1 && path.compare(0, 5, "unix:")) {
+      path += ".card" + std::to_string(card);
+    }
+    telemetry_start(path.c_str(), telemetry_interval);
+  }
 }
 
 void fpga_finish() {
+  telemetry_stop();
   delete xdma_device;
   common_finish();
 
@@ -120,7 +197,20 @@ void fpga_display_result(int ret) {
 
 int fpga_get_result(uint8_t step) {
   // Compare DUT and REF
-  int trapCode = difftest_nstep(step, enable_difftest);
+  int trapCode;
+  if (telemetry_path) {
+    uint64_t check_start = telemetry_ns();
+    trapCode = difftest_nstep(step, enable_difftest);
+    telemetry.check_ns.fetch_add(telemetry_ns() - check_start, std::memory_order_relaxed);
+    uint64_t instrs = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+      instrs += difftest[i]->get_trap_event()->instrCnt;
+    }
+    telemetry.cycles.store(difftest[0]->get_trap_event()->cycleCnt, std::memory_order_relaxed);
+    telemetry.instrs.store(instrs, std::memory_order_relaxed);
+  } else {
+    trapCode = difftest_nstep(step, enable_difftest);
+  }
   if (trapCode != STATE_RUNNING) {
     if (trapCode == STATE_GOODTRAP)
       return FPGA_GOODTRAP;
@@ -175,6 +265,11 @@ void args_parsing(int argc, char *argv[]) {
                                          {"max-instrs", required_argument, 0, 0},
                                          {"warmup-instr", required_argument, 0, 0},
                                          {"flash", required_argument, 0, 0},
+                                         {"telemetry", required_argument, 0, 0},
+                                         {"telemetry-interval", required_argument, 0, 0},
+                                         {"cpus", required_argument, 0, 0},
+                                         {"numa-node", required_argument, 0, 0},
+                                         {"cards", required_argument, 0, 0},
                                          {0, 0, 0, 0}};
 
   while ((opt = getopt_long(argc, argv, "i:", long_options, &option_index)) != -1) {
@@ -189,6 +284,32 @@ void args_parsing(int argc, char *argv[]) {
         } else if (strcmp(long_options[option_index].name, "flash") == 0) {
           flash_bin_file = (char *)malloc(256);
           strcpy(flash_bin_file, optarg);
+        } else if (strcmp(long_options[option_index].name, "telemetry") == 0) {
+          telemetry_path = optarg;
+        } else if (strcmp(long_options[option_index].name, "telemetry-interval") == 0) {
+          telemetry_interval = std::stoul(optarg, nullptr, 10);
+        } else if (strcmp(long_options[option_index].name, "cpus") == 0) {
+          if (affinity_set_cpus(optarg) < 0) {
+            std::cerr << "Invalid cpu list " << optarg << std::endl;
+            exit(EXIT_FAILURE);
+          }
+        } else if (strcmp(long_options[option_index].name, "numa-node") == 0) {
+          numa_node = std::stoi(optarg, nullptr, 10);
+        } else if (strcmp(long_options[option_index].name, "cards") == 0) {
+          fpga_cards.clear();
+          for (char *s = strtok(optarg, ","); s; s = strtok(NULL, ",")) {
+            fpga_cards.push_back(std::stoi(s, nullptr, 10));
+          }
+          if (fpga_cards.empty()) {
+            std::cerr << "Invalid card list" << std::endl;
+            exit(EXIT_FAILURE);
+          }
+#ifdef FPGA_SIM
+          if (fpga_cards.size() > 1) {
+            std::cerr << "FPGA_SIM has only one card" << std::endl;
+            exit(EXIT_FAILURE);
+          }
+#endif // FPGA_SIM
         }
         break;
       case 'i': strncpy(work_load, optarg, sizeof(work_load) - 1); break;
@@ -196,8 +317,29 @@ void args_parsing(int argc, char *argv[]) {
         std::cerr
             << "Usage: " << argv[0]
             << " [--diff <path>] [-i <workload>] [--max-instrs <num>] [--warmup-instr <num>] [--flash <flash_img>]"
+            << " [--telemetry <path>] [--telemetry-interval <ms>] [--cpus <list>] [--numa-node <node>]"
+            << " [--cards <list>]"
             << std::endl;
         exit(EXIT_FAILURE);
     }
   }
 }
+
+static void fpga_place_numa(int card) {
+  int node = numa_node;
+#ifndef FPGA_SIM
+  // keep the buffers and threads close to the card by default
+  if (node < 0) {
+    char sysfs[64];
+    snprintf(sysfs, sizeof(sysfs), XDMA_SYSFS_DEVICE, card);
+    node = affinity_device_node(sysfs);
+  }
+#endif // FPGA_SIM
+  if (node >= 0) {
+    if (affinity_set_node(node)) {
+      printf("host pipeline on NUMA node %d\n", node);
+    } else {
+      printf("NUMA node %d has no cpus, ignored\n", node);
+    }
+  }
+}
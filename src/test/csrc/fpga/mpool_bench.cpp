@@ -0,0 +1,115 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Throughput of the memory pools between the receive threads and one process thread.
+// Built by `make fpga-mpool-bench`, which is not part of fpga-host. See bench.h for the options.
+#ifdef MPOOL_BENCH
+#include "bench.h"
+#include "mpool.h"
+#include <thread>
+
+// bytes touched in each chunk, similar to the packet header
+#define BENCH_TOUCH_BYTES 64
+
+static uint64_t bench_checksum = 0;
+
+static inline void bench_produce(char *mem, uint64_t i) {
+  memset(mem, (uint8_t)i, BENCH_TOUCH_BYTES);
+}
+
+static inline void bench_consume(const char *mem) {
+  bench_checksum += *(const uint64_t *)mem;
+}
+
+static void bench_memory_pool(uint64_t n) {
+  MemoryPool pool;
+  std::thread producer([&]() {
+    for (uint64_t i = 0; i < n; i++) {
+      bench_produce(pool.get_free_chunk(), i);
+      pool.set_busy_chunk();
+    }
+  });
+  for (uint64_t i = 0; i < n; i++) {
+    bench_consume(pool.get_busy_chunk());
+    pool.set_free_chunk();
+  }
+  producer.join();
+}
+
+static void bench_memory_idx_pool(uint64_t n) {
+  const uint64_t group = 256;
+  MemoryIdxPool pool(MEMBLOCK_SIZE);
+  // one more group lets the consumer step over its last group
+  std::thread producer([&]() {
+    size_t mem_idx = 0;
+    for (uint64_t i = 0; i < n + group; i++) {
+      char *mem = nullptr;
+      while ((mem = pool.get_free_chunk(&mem_idx)) == nullptr) {}
+      bench_produce(mem, i);
+      pool.write_free_chunk((uint8_t)i, mem_idx);
+    }
+  });
+  pool.wait_mempool_start();
+  for (uint64_t i = 0; i < n; i++) {
+    bench_consume(pool.read_busy_chunk());
+    pool.set_free_chunk();
+  }
+  producer.join();
+}
+
+// n is a multiple of producers * batch
+static void bench_memory_ring(uint64_t n, size_t batch, int producers) {
+  MemoryRing ring(MEMBLOCK_SIZE);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&]() {
+      for (uint64_t i = 0; i < n / producers; i += batch) {
+        uint64_t ticket = ring.acquire_free(batch);
+        for (size_t j = 0; j < batch; j++) {
+          bench_produce(ring.get_chunk(ticket + j), ticket + j);
+          ring.set_busy(ticket + j);
+        }
+      }
+    });
+  }
+  for (uint64_t i = 0; i < n; i += batch) {
+    uint64_t ticket = ring.acquire_busy(batch);
+    for (size_t j = 0; j < batch; j++) {
+      bench_consume(ring.get_chunk(ticket + j));
+    }
+    ring.release(batch);
+  }
+  for (auto &t: threads) {
+    t.join();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  BenchSuite suite(argc, argv);
+  // each iteration passes one chunk, and iterations are in whole MemoryIdxPool groups
+  suite.run("mpool/MemoryPool", 0, bench_memory_pool, 256);
+  suite.run("mpool/MemoryIdxPool", 0, bench_memory_idx_pool, 256);
+  for (int producers: {1, 2, 4}) {
+    for (size_t batch: {1, 8}) {
+      std::string name = "mpool/MemoryRing/producers:" + std::to_string(producers) + "/batch:" + std::to_string(batch);
+      suite.run(
+          name, 0, [=](uint64_t n) { bench_memory_ring(n, batch, producers); }, 256);
+    }
+  }
+  printf("checksum %lx\n", bench_checksum);
+  return 0;
+}
+#endif // MPOOL_BENCH
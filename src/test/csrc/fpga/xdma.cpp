@@ -14,9 +14,11 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 #include "xdma.h"
+#include "affinity.h"
 #include "difftest-dpic.h"
 #include "mpool.h"
 #include "ram.h"
+#include "telemetry.h"
 #include <execinfo.h>
 #include <fcntl.h>
 #include <fstream>
@@ -28,10 +30,11 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
-#define XDMA_USER       "/dev/xdma0_user"
-#define XDMA_BYPASS     "/dev/xdma0_bypass"
-#define XDMA_C2H_DEVICE "/dev/xdma0_c2h_"
-#define XDMA_H2C_DEVICE "/dev/xdma0_h2c_0"
+// Device paths of card N
+#define XDMA_USER       "/dev/xdma%d_user"
+#define XDMA_BYPASS     "/dev/xdma%d_bypass"
+#define XDMA_C2H_DEVICE "/dev/xdma%d_c2h_%d"
+#define XDMA_H2C_DEVICE "/dev/xdma%d_h2c_0"
 
 void signal_handler(int sig) {
   void *array[20];
@@ -53,15 +56,16 @@ void handle_sigint(int sig) {
   exit(1);
 }
 
-FpgaXdma::FpgaXdma()
+FpgaXdma::FpgaXdma(int card)
+    : card(card)
 #ifdef USE_THREAD_MEMPOOL
-    : xdma_mempool(sizeof(FpgaPackgeHead))
+    , xdma_mempool(sizeof(FpgaPackgeHead))
 #endif // USE_THREAD_MEMPOOL
 {
   signal(SIGINT, handle_sigint);
   for (int i = 0; i < CONFIG_DMA_CHANNELS; i++) {
     char c2h_device[64];
-    sprintf(c2h_device, "%s%d", XDMA_C2H_DEVICE, i);
+    snprintf(c2h_device, sizeof(c2h_device), XDMA_C2H_DEVICE, card, i);
 #ifdef FPGA_SIM
     xdma_sim_open(i, true);
 #else
@@ -75,13 +79,15 @@ FpgaXdma::FpgaXdma()
 #endif // FPGA_SIM
   }
 #ifdef CONFIG_USE_XDMA_H2C
-  xdma_h2c_fd = open(XDMA_H2C_DEVICE, O_WRONLY);
+  char h2c_device[64];
+  snprintf(h2c_device, sizeof(h2c_device), XDMA_H2C_DEVICE, card);
+  xdma_h2c_fd = open(h2c_device, O_WRONLY);
   if (xdma_h2c_fd == -1) {
-    std::cout << XDMA_H2C_DEVICE << std::endl;
+    std::cout << h2c_device << std::endl;
     perror("Failed to open XDMA device");
     exit(-1);
   }
-  std::cout << "XDMA link " << XDMA_H2C_DEVICE << std::endl;
+  std::cout << "XDMA link " << h2c_device << std::endl;
 #endif
 }
 
@@ -99,12 +105,11 @@ void FpgaXdma::device_write(bool is_bypass, const char *workload, uint64_t addr,
     exit(-1);
   }
 
-  if (is_bypass)
-    fd = open(XDMA_BYPASS, O_RDWR | O_SYNC);
-  else
-    fd = open(XDMA_USER, O_RDWR | O_SYNC);
+  char device[64];
+  snprintf(device, sizeof(device), is_bypass ? XDMA_BYPASS : XDMA_USER, card);
+  fd = open(device, O_RDWR | O_SYNC);
   if (fd < 0) {
-    printf("Failed to open %s\n", is_bypass ? XDMA_BYPASS : XDMA_USER);
+    printf("Failed to open %s\n", device);
     exit(-1);
   }
 
@@ -132,13 +137,16 @@ void FpgaXdma::device_write(bool is_bypass, const char *workload, uint64_t addr,
 
 #ifdef USE_THREAD_MEMPOOL
 void FpgaXdma::start_transmit_thread() {
+  telemetry_add_gauge("mempool_busy", [this] { return (uint64_t)xdma_mempool.busy_count(); });
   for (int i = 0; i < CONFIG_DMA_CHANNELS; i++) {
     printf("start channel %d \n", i);
     receive_thread[i] = std::thread(thread_wrapper<decltype(&FpgaXdma::read_xdma_thread), FpgaXdma *, int>,
                                     &FpgaXdma::read_xdma_thread, this, i);
+    affinity_place_thread(receive_thread[i].native_handle(), "xdma receive");
   }
   process_thread = std::thread(thread_wrapper<decltype(&FpgaXdma::write_difftest_thread), FpgaXdma *>,
                                &FpgaXdma::write_difftest_thread, this);
+  affinity_place_thread(process_thread.native_handle(), "difftest process");
 }
 
 void FpgaXdma::stop_thansmit_thread() {
@@ -159,6 +167,65 @@ void FpgaXdma::stop_thansmit_thread() {
 #endif
 }
 
+#ifdef USE_MEMPOOL_RING
+void FpgaXdma::read_xdma_thread(int channel) {
+  while (running) {
+    uint64_t ticket = xdma_mempool.acquire_free(MEMPOOL_RING_BATCH);
+    if (ticket == MemoryRing::RING_STOPPED) {
+      break;
+    }
+#ifdef FPGA_SIM
+    // take all the packets already in the shared ring at once
+    char *mems[MEMPOOL_RING_BATCH];
+    for (int i = 0; i < MEMPOOL_RING_BATCH; i++) {
+      mems[i] = xdma_mempool.get_chunk(ticket + i);
+    }
+    for (int i = 0; i < MEMPOOL_RING_BATCH;) {
+      int n = xdma_sim_read_packets(channel, mems + i, MEMPOOL_RING_BATCH - i, sizeof(FpgaPackgeHead));
+      for (int k = 0; k < n; k++) {
+        xdma_mempool.set_busy(ticket + i + k);
+      }
+      i += n;
+    }
+#else
+    for (int i = 0; i < MEMPOOL_RING_BATCH; i++) {
+      char *mem = xdma_mempool.get_chunk(ticket + i);
+      size_t size = read(xdma_c2h_fd[channel], mem, sizeof(FpgaPackgeHead));
+      xdma_mempool.set_busy(ticket + i);
+    }
+#endif // FPGA_SIM
+  }
+}
+
+void FpgaXdma::write_difftest_thread() {
+  FpgaPackgeHead *packge;
+  uint8_t recv_count = 0;
+  int pending_free = 0;
+  while (running) {
+    uint64_t ticket = xdma_mempool.acquire_busy();
+    if (ticket == MemoryRing::RING_STOPPED) {
+      break;
+    }
+    packge = reinterpret_cast<FpgaPackgeHead *>(xdma_mempool.get_chunk(ticket));
+    if (packge->diff_packge[0].packge_idx != recv_count) {
+      printf("read mempool idx failed, packge_idx %d need_idx %d\n", packge->diff_packge[0].packge_idx, recv_count);
+      assert(0);
+    }
+    recv_count++;
+    // packge unpack
+    for (size_t i = 0; i < DMA_PACKGE_NUM; i++) {
+      v_difftest_Batch(packge->diff_packge[i].diff_packge);
+    }
+    // free chunks in batches to reduce cache line transfers
+    if (++pending_free == MEMPOOL_RING_BATCH) {
+      xdma_mempool.release(pending_free);
+      pending_free = 0;
+    }
+  }
+  // the receive thread may be waiting for free chunks
+  xdma_mempool.stop();
+}
+#else
 void FpgaXdma::read_xdma_thread(int channel) {
   size_t mem_get_idx = 0;
   while (running) {
@@ -197,6 +264,7 @@ void FpgaXdma::write_difftest_thread() {
     xdma_mempool.set_free_chunk();
   }
 }
+#endif // USE_MEMPOOL_RING
 
 #else
 void *posix_memalignd_malloc(size_t size) {
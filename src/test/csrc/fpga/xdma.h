@@ -33,6 +33,17 @@
 
 #define DMA_PACKGE_NUM 8
 
+// sysfs entry of card N, used to find its NUMA node
+#define XDMA_SYSFS_DEVICE "/sys/class/xdma/xdma%d_user/device"
+
+// Packets from a single channel arrive in order, so the lock-free ring is used.
+// Multiple channels require reordering by packge_idx with MemoryIdxPool.
+#if defined(USE_THREAD_MEMPOOL) && (CONFIG_DMA_CHANNELS == 1)
+#define USE_MEMPOOL_RING
+// # of chunks claimed by the receive thread at a time
+#define MEMPOOL_RING_BATCH 8
+#endif
+
 // DMA_PADDING (packge_idx(1) + difftest_data) send width to be calculated by mod up
 #define DMA_PACKGE_LEN     (CONFIG_DIFFTEST_BATCH_BYTELEN + 1)
 #define DMA_PACKGE_ALIGNED ((DMA_PACKGE_LEN + 63) / 64 * 64)
@@ -52,7 +63,7 @@ typedef struct __attribute__((packed)) {
 
 class FpgaXdma {
 public:
-  FpgaXdma();
+  FpgaXdma(int card = 0);
 
   void start() {
     running = true;
@@ -81,6 +92,7 @@ public:
 
 private:
   bool running = false;
+  int card; // N of the /dev/xdmaN_* devices
   int xdma_c2h_fd[CONFIG_DMA_CHANNELS];
 #ifdef CONFIG_USE_XDMA_H2C
   int xdma_h2c_fd;
@@ -101,7 +113,11 @@ private:
 #ifdef USE_THREAD_MEMPOOL
   std::mutex thread_mtx;
   std::condition_variable thread_cv;
+#ifdef USE_MEMPOOL_RING
+  MemoryRing xdma_mempool;
+#else
   MemoryIdxPool xdma_mempool;
+#endif // USE_MEMPOOL_RING
   std::thread receive_thread[CONFIG_DMA_CHANNELS];
   std::thread process_thread;
   // thread api
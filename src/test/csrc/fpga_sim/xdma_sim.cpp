@@ -15,34 +15,76 @@
  ***************************************************************************************/
 #include "xdma_sim.h"
 #include <assert.h>
+#include <atomic>
 #include <fcntl.h>
-#include <pthread.h>
+#include <linux/futex.h>
+#include <sched.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define BUFFER_SIZE 65536
+// Single-producer single-consumer byte ring in the shared segment. The device (simv) appends
+// the AXI beats and the host reads whole packets. The reader sleeps on a futex only when the
+// ring holds less than it needs, and the writer makes the syscall only to wake a sleeping reader.
+// The ring size is a power of 2 set by the host with XDMA_SIM_RING_SIZE, default 4 MB.
+#define XDMA_SIM_RING_SIZE (4UL << 20)
 
 typedef struct {
-  pthread_mutex_t lock;
-  pthread_cond_t read_cond;
-  bool read_waiting;
-  int read_size;
-  int write_size;
-  char buffer[BUFFER_SIZE];
+  uint64_t size;
+  alignas(64) std::atomic<uint64_t> head; // bytes written
+  alignas(64) std::atomic<uint64_t> tail; // bytes read
+  alignas(64) std::atomic<uint64_t> wait_for; // the reader sleeps until head reaches this
+  std::atomic<uint32_t> reader_waiting;
+  std::atomic<uint32_t> wake_seq;
+  alignas(64) char buffer[];
 } xdma_shm;
 
+static inline void futex_wait(std::atomic<uint32_t> *addr, uint32_t val) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static inline void futex_wake(std::atomic<uint32_t> *addr) {
+  syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
 class xdma_sim {
 private:
   int shm_fd = -1;
   xdma_shm *shm_ptr = nullptr;
+  size_t shm_size;
+  uint64_t mask;
   char path[128];
   bool is_host;
 
+  // wait until at least n bytes are readable, returns the readable bytes
+  uint64_t wait_readable(uint64_t tail, uint64_t n) {
+    uint64_t avail;
+    while ((avail = shm_ptr->head.load(std::memory_order_acquire) - tail) < n) {
+      uint32_t seq = shm_ptr->wake_seq.load();
+      shm_ptr->wait_for.store(tail + n);
+      shm_ptr->reader_waiting.store(1); // seq_cst: ordered before the following load of head
+      if (shm_ptr->head.load() - tail >= n) {
+        shm_ptr->reader_waiting.store(0);
+        continue;
+      }
+      futex_wait(&shm_ptr->wake_seq, seq);
+    }
+    return avail;
+  }
+
+  void copy_out(char *buf, uint64_t from, size_t n) {
+    uint64_t start = from & mask;
+    size_t first = n < shm_ptr->size - start ? n : shm_ptr->size - start;
+    memcpy(buf, shm_ptr->buffer + start, first);
+    memcpy(buf + first, shm_ptr->buffer, n - first);
+  }
+
 public:
   xdma_sim(int channel, bool _is_host) {
     is_host = _is_host;
@@ -52,67 +94,75 @@ public:
       perror("XDMA_SIM: Failed to open shared memory device\n");
       exit(-1);
     }
+    uint64_t ring_size = XDMA_SIM_RING_SIZE;
     if (is_host) {
-      ftruncate(shm_fd, sizeof(xdma_shm));
+      const char *env = getenv("XDMA_SIM_RING_SIZE");
+      if (env) {
+        ring_size = strtoull(env, NULL, 0);
+      }
+      assert(ring_size >= 4096 && (ring_size & (ring_size - 1)) == 0);
+      shm_size = sizeof(xdma_shm) + ring_size;
+      ftruncate(shm_fd, shm_size);
+    } else {
+      // the host has set up the segment, whose size gives the ring size
+      struct stat st;
+      fstat(shm_fd, &st);
+      shm_size = st.st_size;
+      assert(shm_size > sizeof(xdma_shm));
     }
-    shm_ptr = (xdma_shm *)mmap(NULL, sizeof(xdma_shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    shm_ptr = (xdma_shm *)mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    assert(shm_ptr != MAP_FAILED);
     if (is_host) {
-      memset(shm_ptr, 0, sizeof(xdma_shm));
-      pthread_mutexattr_t attr;
-      pthread_mutexattr_init(&attr);
-      pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-      pthread_mutex_init(&shm_ptr->lock, &attr);
-      pthread_condattr_t cattr;
-      pthread_condattr_init(&cattr);
-      pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
-      pthread_cond_init(&shm_ptr->read_cond, &cattr);
+      memset((void *)shm_ptr, 0, sizeof(xdma_shm));
+      shm_ptr->size = ring_size;
     }
+    mask = shm_ptr->size - 1;
   }
   ~xdma_sim() {
     if (is_host) {
       shm_unlink(path);
     }
-    munmap(shm_ptr, sizeof(xdma_shm));
+    munmap(shm_ptr, shm_size);
     close(shm_fd);
   }
   int read(char *buf, size_t size) {
-    assert(size <= BUFFER_SIZE);
-    pthread_mutex_lock(&shm_ptr->lock);
-
-    shm_ptr->read_waiting = true;
-    shm_ptr->write_size = 0;
-    shm_ptr->read_size = size;
-    while (shm_ptr->write_size < size) {
-      pthread_cond_wait(&shm_ptr->read_cond, &shm_ptr->lock);
+    assert(size <= shm_ptr->size);
+    uint64_t tail = shm_ptr->tail.load(std::memory_order_relaxed);
+    wait_readable(tail, size);
+    copy_out(buf, tail, size);
+    shm_ptr->tail.store(tail + size, std::memory_order_release);
+    return size;
+  }
+  // read at least one and at most n packets of size bytes, returns the number of packets
+  int read_packets(char *const *bufs, int n, size_t size) {
+    assert(size <= shm_ptr->size);
+    uint64_t tail = shm_ptr->tail.load(std::memory_order_relaxed);
+    uint64_t avail = wait_readable(tail, size);
+    int count = avail / size < (uint64_t)n ? avail / size : n;
+    for (int i = 0; i < count; i++) {
+      copy_out(bufs[i], tail + i * size, size);
     }
-    size_t to_copy = size < shm_ptr->write_size ? size : shm_ptr->write_size;
-    memcpy(buf, shm_ptr->buffer, to_copy);
-
-    pthread_mutex_unlock(&shm_ptr->lock);
-
-    return to_copy;
+    shm_ptr->tail.store(tail + count * size, std::memory_order_release);
+    return count;
   }
   int write(const char *buf, unsigned char tlast, size_t size) {
-    pthread_mutex_lock(&shm_ptr->lock);
-    while (!shm_ptr->read_waiting) {
-      pthread_mutex_unlock(&shm_ptr->lock);
-      pthread_mutex_lock(&shm_ptr->lock);
+    uint64_t head = shm_ptr->head.load(std::memory_order_relaxed);
+    // the reader drains the ring quickly, so a full ring is only polled
+    while (head + size - shm_ptr->tail.load(std::memory_order_acquire) > shm_ptr->size) {
+      sched_yield();
     }
-    size_t space = shm_ptr->read_size - shm_ptr->write_size;
-    size_t to_write = size < space ? size : space;
-
-    memcpy(shm_ptr->buffer + shm_ptr->write_size, buf, to_write);
-    shm_ptr->write_size += to_write;
-    if (shm_ptr->write_size >= shm_ptr->read_size) {
-      assert(tlast == 1); // Check if tlast set properly
-      shm_ptr->read_waiting = false;
-      pthread_cond_signal(&shm_ptr->read_cond);
-    } else {
-      assert(tlast == 0);
+    uint64_t start = head & mask;
+    size_t first = size < shm_ptr->size - start ? size : shm_ptr->size - start;
+    memcpy(shm_ptr->buffer + start, buf, first);
+    memcpy(shm_ptr->buffer, buf + first, size - first);
+    head += size;
+    shm_ptr->head.store(head); // seq_cst: ordered before the following load of reader_waiting
+    if (shm_ptr->reader_waiting.load() && head >= shm_ptr->wait_for.load()) {
+      shm_ptr->reader_waiting.store(0);
+      shm_ptr->wake_seq.fetch_add(1);
+      futex_wake(&shm_ptr->wake_seq);
     }
-    pthread_mutex_unlock(&shm_ptr->lock);
-
-    return to_write;
+    return size;
   }
 };
 
@@ -132,6 +182,10 @@ int xdma_sim_read(int channel, char *buf, size_t size) {
   return xsim[channel]->read(buf, size);
 }
 
+int xdma_sim_read_packets(int channel, char *const *bufs, int n, size_t size) {
+  return xsim[channel]->read_packets(bufs, n, size);
+}
+
 int xdma_sim_write(int channel, const char *buf, uint8_t tlast, size_t size) {
   return xsim[channel]->write(buf, tlast, size);
 }
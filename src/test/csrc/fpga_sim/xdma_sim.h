@@ -21,6 +21,8 @@
 void xdma_sim_open(int channel, bool is_host);
 void xdma_sim_close(int channel);
 int xdma_sim_read(int channel, char *buf, size_t size);
+// read at least one and at most n packets of size bytes into bufs, returns the number of packets
+int xdma_sim_read_packets(int channel, char *const *bufs, int n, size_t size);
 int xdma_sim_write(int channel, const char *buf, uint8_t tlast, size_t size);
 
 #endif // __XDMA_SIM_H__
@@ -16,14 +16,71 @@
 
 #include "runahead.h"
 #include "memdep.h"
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// ---------------------------------------------------
+// Run ahead channel
+// ---------------------------------------------------
+
+static RunaheadChannel *runahead_channel = NULL;
+
+// spin before sleeping, since the other side usually answers within microseconds
+#define RUNAHEAD_SPIN_LIMIT 4096
+
+// wait until *addr != val
+static void runahead_wait(std::atomic<uint32_t> *addr, uint32_t val, std::atomic<uint32_t> *sleeping) {
+  for (int spin = 0; addr->load(std::memory_order_acquire) == val; spin++) {
+    if (spin < RUNAHEAD_SPIN_LIMIT) {
+      sched_yield();
+      continue;
+    }
+    sleeping->store(1);
+    if (addr->load() == val) {
+      syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, NULL, NULL, 0);
+    }
+    sleeping->store(0);
+  }
+}
+
+static void runahead_wake(std::atomic<uint32_t> *addr, std::atomic<uint32_t> *sleeping) {
+  if (sleeping->load()) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+  }
+}
+
+template <typename T> static void runahead_send(RunaheadRing<T> *ring, const T &msg) {
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  while (head - ring->tail.load(std::memory_order_acquire) >= RUNAHEAD_RING_SIZE) {
+    sched_yield();
+  }
+  ring->slots[head % RUNAHEAD_RING_SIZE] = msg;
+  ring->head.store(head + 1);
+  runahead_wake(&ring->head, &ring->sleeping);
+}
+
+template <typename T> static T runahead_recv(RunaheadRing<T> *ring) {
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  runahead_wait(&ring->head, tail, &ring->sleeping);
+  T msg = ring->slots[tail % RUNAHEAD_RING_SIZE];
+  ring->tail.store(tail + 1, std::memory_order_release);
+  return msg;
+}
+
+static RunaheadResponse runahead_recv_resp(uint32_t type) {
+  RunaheadResponse resp = runahead_recv(&runahead_channel->resp);
+  assert(resp.message_type == type);
+  return resp;
+}
 
 // ---------------------------------------------------
 // Run ahead master process
 // ---------------------------------------------------
 
 Runahead **runahead = NULL;
-int runahead_req_msgq_id = 0;
-int runahead_resp_msgq_id = 0;
 bool runahead_is_slave = false;
 
 Runahead::Runahead(int coreid) : Difftest(coreid) {}
@@ -37,14 +94,11 @@ void Runahead::remove_all_checkpoints() {
   }
 }
 
-void Runahead::remove_msg_queues() {
-  if (runahead_req_msgq_id) {
-    runahead_debug("Try to remove runahead_req_msgq %d\n", runahead_req_msgq_id);
-    msgctl(runahead_req_msgq_id, IPC_RMID, NULL);
-  }
-  if (runahead_resp_msgq_id) {
-    runahead_debug("Try to remove runahead_resp_msgq %d\n", runahead_resp_msgq_id);
-    msgctl(runahead_resp_msgq_id, IPC_RMID, NULL);
+void Runahead::remove_channel() {
+  if (runahead_channel && !runahead_is_slave) {
+    runahead_debug("Try to remove runahead channel\n");
+    munmap(runahead_channel, sizeof(RunaheadChannel));
+    runahead_channel = NULL;
   }
 }
 
@@ -59,16 +113,14 @@ int runahead_init() {
     runahead[i]->ref_ptr = runahead[i]->get_ref();
     runahead[i]->update_nemuproxy(i, 0);
   }
-  runahead_debug("Allocate msgq for %s\n", emu_path);
-  key_t req_msgq_key = ftok(emu_path, 'a');
-  runahead_req_msgq_id = msgget(req_msgq_key, IPC_CREAT | 0600);
-  key_t resp_msgq_key = ftok(emu_path, 'b');
-  runahead_resp_msgq_id = msgget(resp_msgq_key, IPC_CREAT | 0600);
-  if ((runahead_req_msgq_id <= 0) || (runahead_resp_msgq_id <= 0)) {
+  // shared with all the slaves forked later
+  void *channel = mmap(NULL, sizeof(RunaheadChannel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (channel == MAP_FAILED) {
     runahead_debug("%s\n", std::strerror(errno));
-    runahead_debug("Failed to create run ahead message queue.\n");
+    runahead_debug("Failed to create run ahead channel.\n");
     assert(0);
   }
+  runahead_channel = new (channel) RunaheadChannel();
   runahead_debug("Simulator run ahead of commit enabled.\n");
   return 0;
 }
@@ -76,14 +128,14 @@ int runahead_init() {
 int runahead_cleanup() {
   for (int i = 0; i < NUM_CORES; i++) {
     runahead[i]->remove_all_checkpoints();
-    runahead[i]->remove_msg_queues();
+    runahead[i]->remove_channel();
   }
   return 0;
 }
 
 Runahead::~Runahead() {
   remove_all_checkpoints();
-  remove_msg_queues();
+  remove_channel();
 }
 
 // Runahead exec a step
@@ -356,12 +408,18 @@ int Runahead::step() { // override step() method
 // Request slave to run a single inst
 pid_t Runahead::request_slave_runahead() {
   RunaheadRequest request;
-  RunaheadResponsePid resp;
   request.message_type = RUNAHEAD_MSG_REQ_EXEC;
-  assert_no_error(msgsnd(runahead_req_msgq_id, &request, sizeof(RunaheadRequest) - sizeof(long int), 0));
-  assert_no_error(
-      msgrcv(runahead_resp_msgq_id, &resp, sizeof(RunaheadResponsePid) - sizeof(long int), RUNAHEAD_MSG_RESP_EXEC, 0));
-  assert(resp.pid == 0);
+#ifdef QUERY_MEM_ACCESS
+  request.query = true;
+#else
+  request.query = false;
+#endif // QUERY_MEM_ACCESS
+  runahead_send(&runahead_channel->req, request);
+#ifdef QUERY_MEM_ACCESS
+  last_resp = runahead_recv_resp(RUNAHEAD_MSG_RESP_EXEC);
+#else
+  runahead_recv_resp(RUNAHEAD_MSG_RESP_EXEC);
+#endif // QUERY_MEM_ACCESS
   return 0;
 }
 
@@ -369,28 +427,36 @@ pid_t Runahead::request_slave_runahead() {
 //
 // Return checkpoint pid. Checkpoint is generated before inst exec.
 pid_t Runahead::request_slave_runahead_pc_guided(uint64_t target_pc) {
+  uint32_t fork_seq = runahead_channel->fork_seq.load(std::memory_order_acquire);
   RunaheadRequest request;
   request.message_type = RUNAHEAD_MSG_REQ_GUIDED_EXEC;
+#ifdef QUERY_MEM_ACCESS
+  request.query = true;
+#else
+  request.query = false;
+#endif // QUERY_MEM_ACCESS
   request.target_pc = target_pc;
-  assert_no_error(msgsnd(runahead_req_msgq_id, &request, sizeof(RunaheadRequest) - sizeof(long int), 0));
-  RunaheadResponsePid resp_exec;
-  RunaheadResponsePid resp_fork;
-  assert_no_error(msgrcv(runahead_resp_msgq_id, &resp_exec, sizeof(RunaheadResponsePid) - sizeof(long int),
-                         RUNAHEAD_MSG_RESP_EXEC, 0));
-  assert_no_error(msgrcv(runahead_resp_msgq_id, &resp_fork, sizeof(RunaheadResponsePid) - sizeof(long int),
-                         RUNAHEAD_MSG_RESP_FORK, 0));
-  assert(resp_fork.pid > 0); // fork succeed
-  return resp_fork.pid;
+  runahead_send(&runahead_channel->req, request);
+#ifdef QUERY_MEM_ACCESS
+  last_resp = runahead_recv_resp(RUNAHEAD_MSG_RESP_EXEC);
+#else
+  runahead_recv_resp(RUNAHEAD_MSG_RESP_EXEC);
+#endif // QUERY_MEM_ACCESS
+  runahead_wait(&runahead_channel->fork_seq, fork_seq, &runahead_channel->fork_sleeping);
+  pid_t pid = runahead_channel->fork_pid;
+  assert(pid > 0); // fork succeed
+  return pid;
 }
 
 // Request slave to run a single inst
 void Runahead::request_slave_refquery(void *resp_target, int type) {
   RunaheadRequest request;
   request.message_type = RUNAHEAD_MSG_REQ_QUERY;
+  request.query = true;
   request.query_type = type;
-  assert_no_error(msgsnd(runahead_req_msgq_id, &request, sizeof(RunaheadRequest) - sizeof(long int), 0));
-  assert_no_error(msgrcv(runahead_resp_msgq_id, resp_target, sizeof(RunaheadResponseQuery) - sizeof(long int),
-                         RUNAHEAD_MSG_RESP_QUERY, 0));
+  runahead_send(&runahead_channel->req, request);
+  RunaheadResponse resp = runahead_recv_resp(RUNAHEAD_MSG_RESP_QUERY);
+  memcpy(resp_target, &resp.query, sizeof(RunaheadResponseQuery));
   return;
 }
 
@@ -405,7 +471,13 @@ void Runahead::debug_print_checkpoint_list() {
 #ifdef QUERY_MEM_ACCESS
 void Runahead::do_query_mem_access(RunaheadResponseQuery *result_buffer) {
   auto mem_access_info = &result_buffer->result.mem_access_info;
-  request_slave_refquery(result_buffer, REF_QUERY_MEM_EVENT);
+  if (last_resp.has_query) {
+    // returned together with the exec request
+    *result_buffer = last_resp.query;
+    last_resp.has_query = false;
+  } else {
+    request_slave_refquery(result_buffer, REF_QUERY_MEM_EVENT);
+  }
   runahead_debug("Query result: pc %lx mem access %x isload %x vaddr %lx ref_need_wait %x\n", mem_access_info->pc,
                  mem_access_info->mem_access, mem_access_info->mem_access_is_load, mem_access_info->mem_access_vaddr,
                  mem_access_info->ref_need_wait);
@@ -417,24 +489,45 @@ void Runahead::do_query_mem_access(RunaheadResponseQuery *result_buffer) {
 // Run ahead slave process
 // ---------------------------------------------------
 
-// Slave process listens to msg queue, exec simulator according to instructions in msgq
+#ifdef QUERY_MEM_ACCESS
+// Query the memory access of the last executed inst and track its dependency
+static void runahead_slave_query(Runahead *r, RunaheadResponseQuery *result, uint64_t query_type) {
+  auto mem_access_info = &result->result.mem_access_info;
+  r->proxy->query(&result->result, query_type);
+  mem_access_info->ref_need_wait = false;
+  if (mem_access_info->mem_access) {
+    if (mem_access_info->mem_access_is_load) {
+      r->memdep_watcher->watch_load(mem_access_info->pc, mem_access_info->mem_access_vaddr);
+      mem_access_info->ref_need_wait =
+          r->memdep_watcher->query_load_store_dep(mem_access_info->pc, mem_access_info->mem_access_vaddr);
+    } else {
+      r->memdep_watcher->watch_store(mem_access_info->pc, mem_access_info->mem_access_vaddr);
+    }
+  }
+}
+#endif
+
+// Slave process listens to the request ring, exec simulator according to the requests
 void Runahead::runahead_slave() {
   runahead_debug("runahead_slave inited\n");
-  RunaheadRequest request;
-  RunaheadResponsePid resp;
-  RunaheadResponseQuery resp_query;
-  resp.message_type = RUNAHEAD_MSG_RESP_EXEC;
-  resp.pid = 0;
-  resp_query.message_type = RUNAHEAD_MSG_RESP_QUERY;
-  auto mem_access_info = &resp_query.result.mem_access_info;
+  runahead_is_slave = true;
+  RunaheadResponse resp;
+  resp.has_query = false;
   while (1) {
-    assert_no_error(msgrcv(runahead_req_msgq_id, &request, sizeof(request) - sizeof(long int), 0, 0));
-    runahead_debug("Received msg type: %ld\n", request.message_type);
+    RunaheadRequest request = runahead_recv(&runahead_channel->req);
+    runahead_debug("Received msg type: %d\n", request.message_type);
     switch (request.message_type) {
       case RUNAHEAD_MSG_REQ_EXEC:
         proxy->exec(1);
         runahead_debug("Run ahead: proxy->exec(1)\n");
-        assert_no_error(msgsnd(runahead_resp_msgq_id, &resp, sizeof(RunaheadResponsePid) - sizeof(long int), 0));
+        resp.message_type = RUNAHEAD_MSG_RESP_EXEC;
+#ifdef QUERY_MEM_ACCESS
+        resp.has_query = request.query;
+        if (request.query) {
+          runahead_slave_query(this, &resp.query, REF_QUERY_MEM_EVENT);
+        }
+#endif
+        runahead_send(&runahead_channel->resp, resp);
         break;
       case RUNAHEAD_MSG_REQ_GUIDED_EXEC:
         if (fork_runahead_slave() == 0) { // father process wait here
@@ -446,25 +539,23 @@ void Runahead::runahead_slave() {
           runahead_debug("force jump to %lx\n", request.target_pc);
           proxy->guided_exec(&guide);
           runahead_debug("Run ahead: proxy->guided_exec(&guide)\n");
-          assert_no_error(msgsnd(runahead_resp_msgq_id, &resp, sizeof(RunaheadResponsePid) - sizeof(long int), 0));
+          resp.message_type = RUNAHEAD_MSG_RESP_EXEC;
+#ifdef QUERY_MEM_ACCESS
+          resp.has_query = request.query;
+          if (request.query) {
+            runahead_slave_query(this, &resp.query, REF_QUERY_MEM_EVENT);
+          }
+#endif
+          runahead_send(&runahead_channel->resp, resp);
         }
         break;
 #ifdef QUERY_MEM_ACCESS
       case RUNAHEAD_MSG_REQ_QUERY:
         runahead_debug("Query runahead result, type %lx\n", request.query_type);
-        proxy->query(&resp_query.result, request.query_type);
-        mem_access_info->ref_need_wait = false;
-        if (mem_access_info->mem_access) {
-          if (mem_access_info->mem_access_is_load) {
-            memdep_watcher->watch_load(mem_access_info->pc, mem_access_info->mem_access_vaddr);
-            mem_access_info->ref_need_wait =
-                memdep_watcher->query_load_store_dep(mem_access_info->pc, mem_access_info->mem_access_vaddr);
-          } else {
-            memdep_watcher->watch_store(mem_access_info->pc, mem_access_info->mem_access_vaddr);
-          }
-        }
-        assert_no_error(
-            msgsnd(runahead_resp_msgq_id, &resp_query, sizeof(RunaheadResponseQuery) - sizeof(long int), 0));
+        resp.message_type = RUNAHEAD_MSG_RESP_QUERY;
+        resp.has_query = true;
+        runahead_slave_query(this, &resp.query, request.query_type);
+        runahead_send(&runahead_channel->resp, resp);
         break;
 #endif
       default: runahead_debug("Runahead slave received invalid runahead req\n"); assert(0);
@@ -510,10 +601,9 @@ pid_t Runahead::fork_runahead_slave() {
     // Wait until checkpoint is recovered or checkpoint is freed
     int status = -1;
     // Send new pid to master
-    RunaheadResponsePid resp;
-    resp.message_type = RUNAHEAD_MSG_RESP_FORK;
-    resp.pid = pid;
-    assert_no_error(msgsnd(runahead_resp_msgq_id, &resp, sizeof(RunaheadResponsePid) - sizeof(long int), 0));
+    runahead_channel->fork_pid = pid;
+    runahead_channel->fork_seq.fetch_add(1);
+    runahead_wake(&runahead_channel->fork_seq, &runahead_channel->fork_sleeping);
     runahead_debug("%d wait for %d\n", getpid(), pid);
     waitpid(pid, &status, 0);
     runahead_debug("pid %d wakeup\n", getpid());
@@ -21,10 +21,9 @@
 #include "difftest.h"
 #include "memdep.h"
 #include "ram.h"
+#include <atomic>
 #include <queue>
 #include <signal.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -39,18 +38,14 @@ typedef struct RunaheadCheckpoint {
 } RunaheadCheckpoint;
 
 typedef struct RunaheadRequest {
-  long int message_type;
+  uint32_t message_type;
+  bool query; // also return the memory access of the executed inst
   union {
     uint64_t target_pc;
     uint64_t query_type;
   };
 } RunaheadRequest;
 
-typedef struct RunaheadResponsePid {
-  long int message_type;
-  pid_t pid;
-} RunaheadResponsePid;
-
 typedef struct MemdepQueryResponse {
   uint64_t pc;
   bool mem_access;
@@ -62,12 +57,38 @@ typedef struct MemdepQueryResponse {
 } MemdepQueryResponse;
 
 typedef struct RunaheadResponseQuery {
-  long int message_type;
   union {
     MemdepQueryResponse mem_access_info;
   } result;
 } RunaheadResponseQuery;
 
+typedef struct RunaheadResponse {
+  uint32_t message_type;
+  bool has_query;
+  RunaheadResponseQuery query;
+} RunaheadResponse;
+
+// The master and the active slave talk through rings in shared memory mapped before the
+// first fork. Only the newest slave reads requests, the others wait for it in waitpid(),
+// so each ring has a single producer and a single consumer at a time. Waiters spin for a
+// while before sleeping on a futex, and producers wake them only if they sleep.
+#define RUNAHEAD_RING_SIZE 16
+template <typename T> struct RunaheadRing {
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> sleeping;
+  T slots[RUNAHEAD_RING_SIZE];
+};
+
+typedef struct RunaheadChannel {
+  RunaheadRing<RunaheadRequest> req;
+  RunaheadRing<RunaheadResponse> resp;
+  // pid of the new checkpoint, sent by the slave which forked it
+  alignas(64) std::atomic<uint32_t> fork_seq;
+  std::atomic<uint32_t> fork_sleeping;
+  pid_t fork_pid;
+} RunaheadChannel;
+
 class Runahead : public Difftest {
 public:
   // Runahead framework
@@ -89,7 +110,7 @@ public:
   pid_t request_slave_runahead_pc_guided(uint64_t target_pc);
   void debug_print_checkpoint_list();
   void remove_all_checkpoints();
-  void remove_msg_queues();
+  void remove_channel();
   void do_first_instr_runahead();
   void request_slave_refquery(void *target, int type);
 
@@ -110,6 +131,10 @@ public:
 
 private:
   std::deque<RunaheadCheckpoint> checkpoints;
+#ifdef QUERY_MEM_ACCESS
+  // query result returned with the last exec request
+  RunaheadResponse last_resp = {};
+#endif
   bool branch_reported;
   bool may_replay;
   uint64_t branch_checkpoint_id;
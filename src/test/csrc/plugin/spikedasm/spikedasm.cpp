@@ -15,9 +15,17 @@
 ***************************************************************************************/
 
 #include "spikedasm.h"
+#include <list>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
 
 // We cache the spike-dasm state here. If it is changed during running, the behavior is undefined.
 static bool is_tested = false, is_valid = true;
@@ -49,14 +57,118 @@ static void execute_dasm_cmd() {
   }
 }
 
+// A spike-dasm process kept running for all instructions. It talks through a socket, so that
+// a dead coprocess does not raise SIGPIPE. Its output is line-buffered by stdbuf.
+// If it cannot be started or stops answering, every instruction falls back to execute_dasm_cmd().
+#define DASM_TIMEOUT_MS 1000
+static int dasm_fd = -1;
+static pid_t dasm_pid = -1;
+static pid_t dasm_owner = -1; // LightSSS children start their own coprocess
+static bool dasm_failed = false;
+
+static void dasm_coprocess_stop() {
+  if (dasm_fd >= 0) {
+    close(dasm_fd);
+    dasm_fd = -1;
+  }
+  if (dasm_pid > 0 && dasm_owner == getpid()) {
+    kill(dasm_pid, SIGKILL);
+    waitpid(dasm_pid, NULL, 0);
+  }
+  dasm_pid = -1;
+}
+
+static bool dasm_coprocess_start() {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDIN_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    execlp("stdbuf", "stdbuf", "-oL", "spike-dasm", (char *)NULL);
+    execlp("spike-dasm", "spike-dasm", (char *)NULL);
+    _exit(127);
+  }
+  close(fds[1]);
+  dasm_fd = fds[0];
+  dasm_pid = pid;
+  dasm_owner = getpid();
+  return true;
+}
+
+static bool dasm_coprocess_query(const char *line, char *result, size_t size) {
+  if (dasm_owner != getpid()) {
+    dasm_coprocess_stop();
+  }
+  if (dasm_fd < 0 && !dasm_coprocess_start()) {
+    return false;
+  }
+  size_t len = strlen(line);
+  if (send(dasm_fd, line, len, MSG_NOSIGNAL) != (ssize_t)len) {
+    return false;
+  }
+  std::string out;
+  while (out.empty() || out.back() != '\n') {
+    struct pollfd pfd = {dasm_fd, POLLIN, 0};
+    char buf[256];
+    if (poll(&pfd, 1, DASM_TIMEOUT_MS) <= 0) {
+      return false;
+    }
+    ssize_t n = read(dasm_fd, buf, sizeof(buf));
+    if (n <= 0) {
+      return false;
+    }
+    out.append(buf, n);
+  }
+  snprintf(result, size, "%s", out.c_str());
+  return true;
+}
+
+// encodings of the most recently disassembled instructions
+#define DASM_CACHE_SIZE 4096
+typedef std::list<std::pair<uint64_t, std::string>> DasmList;
+static DasmList dasm_lru;
+static std::unordered_map<uint64_t, DasmList::iterator> dasm_cache;
+
 const char *spike_dasm(uint64_t inst) {
+  auto it = dasm_cache.find(inst);
+  if (it != dasm_cache.end()) {
+    dasm_lru.splice(dasm_lru.begin(), dasm_lru, it->second);
+    snprintf(dasm_result, sizeof(dasm_result), "%s", it->second->second.c_str());
+    return dasm_result;
+  }
+
   char inst_hex_string[17];
   sprintf(inst_hex_string, "%016lx", inst);
   memcpy(dasm_cmd + dasm_offset, inst_hex_string, 16);
-  execute_dasm_cmd();
+  char line[32];
+  snprintf(line, sizeof(line), "DASM(%s)\n", inst_hex_string);
+  if (dasm_failed || !dasm_coprocess_query(line, dasm_result, sizeof(dasm_result))) {
+    if (!dasm_failed) {
+      dasm_failed = true;
+      dasm_coprocess_stop();
+    }
+    execute_dasm_cmd();
+  }
   char *first_n_occ = strpbrk(dasm_result, "\n");
   if (first_n_occ)
     *first_n_occ = '\0';
+
+  dasm_lru.emplace_front(inst, dasm_result);
+  dasm_cache[inst] = dasm_lru.begin();
+  if (dasm_lru.size() > DASM_CACHE_SIZE) {
+    dasm_cache.erase(dasm_lru.back().first);
+    dasm_lru.pop_back();
+  }
   return dasm_result;
 }
 
@@ -44,10 +44,69 @@ flash_device_t *GetFlash() {
   return &flash_dev;
 }
 
+static FlatAddrSet breakpoints;
+static bool break_hit = false;
+static int break_core = -1;
+static uint64_t break_pc = 0;
+
+// Check the commits of the step difftest is about to check, before it consumes them
+static void check_breakpoints() {
+  if (breakpoints.size() == 0) {
+    return;
+  }
+  for (int i = 0; i < NUM_CORES; i++) {
+    DiffTestState *dut = difftest[i]->get_dut();
+    for (int j = 0; j < CONFIG_DIFF_COMMIT_WIDTH; j++) {
+      if (dut->commit[j].valid && breakpoints.contains(dut->commit[j].pc)) {
+        break_core = i;
+        break_pc = dut->commit[j].pc;
+        break_hit = true;
+        return;
+      }
+    }
+  }
+}
+
 int _diff_stat = -1;
 bool DifftestStepAndCheck(uint64_t pin, uint64_t val, uint64_t arg) {
+  break_hit = false;
+  difftest_set_step_hook(check_breakpoints);
   _diff_stat = difftest_nstep(1, true);
-  return _diff_stat != STATE_RUNNING;
+  return break_hit || _diff_stat != STATE_RUNNING;
+}
+
+uint64_t DifftestStepN(uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    if (DifftestStepAndCheck(0, 0, 0)) {
+      return i + 1;
+    }
+  }
+  return n;
+}
+
+void AddBreakpoint(uint64_t pc) {
+  breakpoints.insert(pc);
+}
+
+bool RemoveBreakpoint(uint64_t pc) {
+  return breakpoints.erase(pc);
+}
+
+void ClearBreakpoints() {
+  breakpoints.clear();
+  break_hit = false;
+}
+
+bool GetBreakpointHit() {
+  return break_hit;
+}
+
+int GetBreakpointHitCore() {
+  return break_core;
+}
+
+uint64_t GetBreakpointHitPC() {
+  return break_pc;
 }
 
 uint64_t GetFuncAddressOfDifftestStepAndCheck() {
@@ -58,6 +117,28 @@ int GetDifftestStat() {
   return _diff_stat;
 }
 
+uint64_t GetRamAddress() {
+  return simMemory ? (uint64_t)simMemory->as_ptr() : 0;
+}
+
+uint64_t GetRamSize() {
+  return simMemory ? simMemory->get_size() : 0;
+}
+
+// The golden memory has the same size as the RAM
+uint64_t GetGoldenMemAddress() {
+  return (uint64_t)pmem;
+}
+
+uint64_t GetDiffTestStateAddress(int index) {
+  Difftest *d = GetDifftest(index);
+  return d ? (uint64_t)d->get_dut() : 0;
+}
+
+uint64_t GetDiffTestStateSize() {
+  return sizeof(DiffTestState);
+}
+
 void GoldenMemInit() {
   init_goldenmem();
 }
@@ -3,6 +3,7 @@
 
 #include "difftest.h"
 #include "flash.h"
+#include "flatset.h"
 #include "goldenmem.h"
 #include "ram.h"
 #include <string>
@@ -21,6 +22,25 @@ int FlashWrite(uint32_t addr, uint64_t data);
 bool DifftestStepAndCheck(uint64_t pin, uint64_t val, uint64_t arg);
 uint64_t GetFuncAddressOfDifftestStepAndCheck();
 int GetDifftestStat();
+// Run up to n difftest steps. Stop early when difftest stops running or a commit hits a breakpoint.
+// Returns the number of steps taken.
+uint64_t DifftestStepN(uint64_t n);
+
+// Breakpoints on the pc of committed instructions, checked in C by DifftestStepAndCheck and DifftestStepN
+void AddBreakpoint(uint64_t pc);
+bool RemoveBreakpoint(uint64_t pc);
+void ClearBreakpoints();
+// whether the last step stopped on a breakpoint, and where
+bool GetBreakpointHit();
+int GetBreakpointHitCore();
+uint64_t GetBreakpointHitPC();
+
+// Raw address and size of the buffers wrapped as memoryview in swig.i
+uint64_t GetRamAddress();
+uint64_t GetRamSize();
+uint64_t GetGoldenMemAddress();
+uint64_t GetDiffTestStateAddress(int index);
+uint64_t GetDiffTestStateSize();
 
 void GoldenMemInit();
 void GoldenMemFinish();
@@ -77,3 +77,26 @@ GAL_METHODS(DifftestTrapEvent, pc)
 GAL_METHODS(DifftestTrapEvent, code)
 GAL_METHODS(DifftestTrapEvent, hasTrap)
 
+%{
+static PyObject *memory_view(uint64_t addr, uint64_t size) {
+  if (addr == 0) {
+    Py_RETURN_NONE;
+  }
+  return PyMemoryView_FromMemory((char *)addr, size, PyBUF_WRITE);
+}
+%}
+
+// Zero-copy views of the RAM, the golden memory and the per-core DiffTestState. None if not available.
+%inline %{
+PyObject *RamView() {
+  return memory_view(GetRamAddress(), GetRamSize());
+}
+
+PyObject *GoldenMemView() {
+  return memory_view(GetGoldenMemAddress(), GetRamSize());
+}
+
+PyObject *DiffTestStateView(int index) {
+  return memory_view(GetDiffTestStateAddress(index), GetDiffTestStateSize());
+}
+%}
@@ -0,0 +1,207 @@
+/***************************************************************************************
+* Copyright (c) 2025 Beijing Institute of Open Source Chip (BOSC)
+* Copyright (c) 2025 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* DiffTest is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Merge the coverage bitmaps dumped by emu --dump-cover-bitmap. Built by `make cover-merge`.
+//   cover-merge [-j THREADS] [-o MERGED] [--rank] FILE... (or @LIST for the files listed in LIST)
+// With --rank, the points newly covered by each file are printed in the given order, for ranking the tests.
+#include "coverfile.h"
+#include <algorithm>
+#include <atomic>
+#include <emmintrin.h>
+#include <fstream>
+#include <immintrin.h>
+#include <stdlib.h>
+#include <thread>
+
+// files loaded at a time with --rank, for each thread
+#define RANK_WINDOW 64
+
+static std::vector<CoverSection> layout;
+static size_t layout_words = 0;
+
+static void or_words(uint64_t *dst, const uint64_t *src, size_t n) {
+  size_t i = 0;
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(a, b));
+  }
+#endif // __AVX2__
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(a, b));
+  }
+  for (; i < n; i++) {
+    dst[i] |= src[i];
+  }
+}
+
+// Merge src into dst, and return the number of points not in dst before
+static uint64_t merge_new(uint64_t *dst, const uint64_t *src, size_t n) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    count += __builtin_popcountll(src[i] & ~dst[i]);
+    dst[i] |= src[i];
+  }
+  return count;
+}
+
+// Read the sections of path into one array of words. They must be those of the first file.
+static bool load(const std::string &path, std::vector<uint64_t> &words) {
+  std::vector<CoverSection> sections;
+  if (!cover_file_read(path.c_str(), sections)) {
+    printf("Failed to read %s\n", path.c_str());
+    return false;
+  }
+  if (sections.size() != layout.size()) {
+    printf("%s has %lu coverage sections, but %lu are expected\n", path.c_str(), sections.size(), layout.size());
+    return false;
+  }
+  words.resize(layout_words);
+  size_t offset = 0;
+  for (size_t i = 0; i < sections.size(); i++) {
+    if (sections[i].name != layout[i].name || sections[i].total != layout[i].total) {
+      printf("%s has coverage %s of %u points, but %s of %u points is expected\n", path.c_str(),
+             sections[i].name.c_str(), sections[i].total, layout[i].name.c_str(), layout[i].total);
+      return false;
+    }
+    memcpy(words.data() + offset, sections[i].words.data(), sections[i].words.size() * sizeof(uint64_t));
+    offset += sections[i].words.size();
+  }
+  return true;
+}
+
+// Run task(i) for i in [begin, end) on the threads
+template <typename F> static void parallel_for(size_t begin, size_t end, int n_threads, F task) {
+  std::atomic<size_t> next(begin);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < n_threads; t++) {
+    threads.emplace_back([&, t] {
+      for (size_t i; (i = next.fetch_add(1)) < end;) {
+        task(t, i);
+      }
+    });
+  }
+  for (auto &th: threads) {
+    th.join();
+  }
+}
+
+static void usage(const char *prog) {
+  printf("Usage: %s [-j THREADS] [-o MERGED] [--rank] FILE... (or @LIST)\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int n_threads = std::thread::hardware_concurrency();
+  const char *output = NULL;
+  bool rank = false;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      n_threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      output = argv[++i];
+    } else if (!strcmp(argv[i], "--rank")) {
+      rank = true;
+    } else if (argv[i][0] == '@') {
+      std::ifstream list(argv[i] + 1);
+      if (!list) {
+        printf("Failed to read the list %s\n", argv[i] + 1);
+        return EXIT_FAILURE;
+      }
+      for (std::string line; std::getline(list, line);) {
+        if (!line.empty()) {
+          files.push_back(line);
+        }
+      }
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty()) {
+    usage(argv[0]);
+  }
+  n_threads = std::max(1, n_threads);
+
+  if (!cover_file_read(files[0].c_str(), layout)) {
+    printf("Failed to read %s\n", files[0].c_str());
+    return EXIT_FAILURE;
+  }
+  for (auto &s: layout) {
+    layout_words += s.words.size();
+  }
+
+  std::vector<uint64_t> merged(layout_words, 0);
+  std::atomic<size_t> failed(0);
+  if (rank) {
+    // load a window of files in parallel, and count their new points in order
+    size_t window = RANK_WINDOW * n_threads;
+    std::vector<std::vector<uint64_t>> loaded(window);
+    std::vector<char> ok(window);
+    uint64_t covered = 0;
+    printf("%10s %10s  file\n", "new", "covered");
+    for (size_t begin = 0; begin < files.size(); begin += window) {
+      size_t end = std::min(files.size(), begin + window);
+      parallel_for(begin, end, n_threads, [&](int t, size_t i) { ok[i - begin] = load(files[i], loaded[i - begin]); });
+      for (size_t i = begin; i < end; i++) {
+        if (!ok[i - begin]) {
+          failed++;
+          continue;
+        }
+        uint64_t n = merge_new(merged.data(), loaded[i - begin].data(), layout_words);
+        covered += n;
+        printf("%10lu %10lu  %s\n", n, covered, files[i].c_str());
+      }
+    }
+  } else {
+    // each thread merges into its own bitmap
+    std::vector<std::vector<uint64_t>> partial(n_threads, std::vector<uint64_t>(layout_words, 0));
+    parallel_for(0, files.size(), n_threads, [&](int t, size_t i) {
+      std::vector<uint64_t> words;
+      if (load(files[i], words)) {
+        or_words(partial[t].data(), words.data(), layout_words);
+      } else {
+        failed++;
+      }
+    });
+    for (auto &p: partial) {
+      or_words(merged.data(), p.data(), layout_words);
+    }
+  }
+
+  size_t offset = 0;
+  for (auto &s: layout) {
+    memcpy(s.words.data(), merged.data() + offset, s.words.size() * sizeof(uint64_t));
+    offset += s.words.size();
+    uint64_t covered = 0;
+    for (auto w: s.words) {
+      covered += __builtin_popcountll(w);
+    }
+    double value = s.total ? 100.0 * covered / s.total : 0;
+    printf("COVERAGE: %s, %u, %lu, %.2f%%\n", s.name.c_str(), s.total, covered, value);
+  }
+  printf("Merged %lu files, %lu failed\n", files.size() - failed, failed.load());
+  if (output && !cover_file_write(output, layout)) {
+    printf("Failed to write %s\n", output);
+    return EXIT_FAILURE;
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
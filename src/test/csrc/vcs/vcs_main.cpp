@@ -144,6 +144,9 @@ int switch_workload() {
     } else if (feof(fp)) {
       printf("Workload list is completed\n");
       switch_workload_completed = true;
+#ifndef CONFIG_NO_DIFFTEST
+      difftest_ref_pool_free();
+#endif // CONFIG_NO_DIFFTEST
       fclose(fp);
       return 1;
     } else {
@@ -189,6 +192,10 @@ extern "C" uint8_t simv_init() {
   init_flash(flash_bin_file);
 
 #ifndef CONFIG_NO_DIFFTEST
+  // REF instances are reused across the workloads in the list
+  if (workload_list != NULL) {
+    difftest_ref_pool_enable();
+  }
   difftest_init();
 #endif // CONFIG_NO_DIFFTEST
 
@@ -198,6 +205,10 @@ extern "C" uint8_t simv_init() {
   if (enable_difftest) {
     init_goldenmem();
     init_nemuproxy(ram_size);
+#ifdef CONFIG_DIFFTEST_ASYNC
+    // simv_nstep() then only enqueues the states, and a failure is reported by a later call
+    difftest_async_start();
+#endif // CONFIG_DIFFTEST_ASYNC
   }
 #endif // CONFIG_NO_DIFFTEST
 
@@ -249,7 +260,9 @@ extern "C" void simv_tick() {
 }
 #endif
 
-void simv_finish() {
+// Return STATE_RUNNING, or the state of the async checker if it has failed
+int simv_finish() {
+  int status = STATE_RUNNING;
 #ifdef OUTPUT_CPI_TO_FILE
   output_cpi_to_file();
 #endif
@@ -257,7 +270,7 @@ void simv_finish() {
   flash_finish();
 
 #ifndef CONFIG_NO_DIFFTEST
-  difftest_finish();
+  status = difftest_finish();
   if (enable_difftest) {
     goldenmem_finish();
   }
@@ -270,8 +283,23 @@ void simv_finish() {
 #ifdef FPGA_SIM
   xdma_sim_close(0);
 #endif //FPGA_SIM
+  return status;
 }
 
+#ifndef CONFIG_NO_DIFFTEST
+// The async checker runs behind the simulation. Stop it after all pushed states are checked, and its failure
+// takes precedence over ret.
+static int simv_async_result(int ret) {
+#ifdef CONFIG_DIFFTEST_ASYNC
+  int status = difftest_async_stop();
+  if (status != STATE_RUNNING && status != STATE_GOODTRAP) {
+    return SIMV_FAIL;
+  }
+#endif // CONFIG_DIFFTEST_ASYNC
+  return ret;
+}
+#endif // CONFIG_NO_DIFFTEST
+
 int simv_get_result(uint8_t step) {
   // Assert Check
   if (assert_count > 0) {
@@ -289,9 +317,9 @@ int simv_get_result(uint8_t step) {
   // Max Instr Limit Check
   if (max_instrs != 0) {
     for (int i = 0; i < NUM_CORES; i++) {
-      auto trap = difftest[i]->get_trap_event();
+      auto trap = difftest_trap_event(i);
       if (trap->instrCnt >= max_instrs) {
-        return SIMV_EXCEED;
+        return simv_async_result(SIMV_EXCEED);
       }
     }
   }
@@ -299,7 +327,7 @@ int simv_get_result(uint8_t step) {
   if (warmup_instr != 0) {
     bool finish = false;
     for (int i = 0; i < NUM_CORES; i++) {
-      auto trap = difftest[i]->get_trap_event();
+      auto trap = difftest_trap_event(i);
       if (trap->instrCnt >= warmup_instr) {
         warmup_instr = -1; // maxium of uint64_t
         finish = true;
@@ -308,10 +336,19 @@ int simv_get_result(uint8_t step) {
     }
     if (finish) {
       Info("Warmup finished. The performance counters will be dumped and then reset.\n");
+      // the states of the checker are recorded after it has checked all pushed states
+      if (simv_async_result(SIMV_WARMUP) == SIMV_FAIL) {
+        return SIMV_FAIL;
+      }
       // Record Instr/Cycle for soft warmup
       for (int i = 0; i < NUM_CORES; i++) {
         difftest[i]->warmup_record();
       }
+#ifdef CONFIG_DIFFTEST_ASYNC
+      if (enable_difftest) {
+        difftest_async_start();
+      }
+#endif // CONFIG_DIFFTEST_ASYNC
       // perfCtrl_clean/dump will set according to SIMV_WARMUP
       return SIMV_WARMUP;
     }
@@ -324,7 +361,7 @@ void simv_display_result(int ret) {
 #ifndef CONFIG_NO_DIFFTEST
   for (int i = 0; i < NUM_CORES; i++) {
     printf("Core %d: ", i);
-    uint64_t pc = difftest[i]->get_trap_event()->pc;
+    uint64_t pc = difftest_trap_event(i)->pc;
     switch (ret) {
       case SIMV_GOODTRAP: eprintf(ANSI_COLOR_GREEN "HIT GOOD TRAP at pc = 0x%" PRIx64 "\n" ANSI_COLOR_RESET, pc); break;
       case SIMV_EXCEED:
@@ -361,7 +398,10 @@ extern "C" uint8_t simv_nstep(uint8_t step) {
     simv_display_result(ret);
     if (ret == SIMV_GOODTRAP || ret == SIMV_EXCEED || ret == SIMV_FAIL) {
       simv_result = ret;
-      simv_finish();
+      int status = simv_finish();
+      if (status != STATE_RUNNING && status != STATE_GOODTRAP) {
+        simv_result = ret = SIMV_FAIL;
+      }
     }
 #ifdef CONFIG_DIFFTEST_DEFERRED_RESULT
     difftest_deferred_result(ret);
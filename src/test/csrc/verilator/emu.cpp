@@ -15,19 +15,29 @@
 ***************************************************************************************/
 
 #include "emu.h"
+#include "affinity.h"
 #include "compress.h"
+#include "console.h"
 #include "device.h"
 #include "flash.h"
+#include "hugepage.h"
 #include "lightsss.h"
+#include "perfdump.h"
+#include "profile.h"
 #include "ram.h"
 #include "remote_bitbang.h"
 #include "sdcard.h"
+#include "telemetry.h"
+#include <algorithm>
 #include <getopt.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <thread>
 #ifndef CONFIG_NO_DIFFTEST
 #include "difftest.h"
 #include "goldenmem.h"
+#include "refprocess.h"
 #include "refproxy.h"
 #endif // CONFIG_NO_DIFFTEST
 #ifdef ENABLE_RUNHEAD
@@ -39,9 +49,115 @@
 #ifdef ENABLE_IPC
 #include <sys/stat.h>
 #endif
+#ifdef VM_SAVABLE
+#include "snapshot.h"
+#endif // VM_SAVABLE
 
 extern remote_bitbang_t *jtag;
 
+#ifdef VM_SAVABLE
+// Memory bases of the incremental snapshots, and the base used by each snapshot slot
+static SnapshotBase snapshot_base[2];
+static int snapshot_slot_base[2] = {-1, -1};
+
+static void snapshot_slot_save(VerilatedSaveMem *slots, int slot) {
+  if (snapshot_slot_base[slot] >= 0) {
+    snapshot_base[snapshot_slot_base[slot]].save();
+  }
+  slots[slot].save();
+}
+
+// Snapshots are compressed and written to files on this thread while the simulation goes on.
+// The slots and bases are not changed until it finishes, so no extra memory is used.
+static std::thread snapshot_saver;
+static pid_t snapshot_saver_pid = 0;
+static std::atomic<bool> snapshot_saving(false);
+
+static void snapshot_saver_wait() {
+  if (!snapshot_saver.joinable()) {
+    return;
+  }
+  if (snapshot_saver_pid != getpid()) {
+    // a LightSSS child does not inherit the thread, and its snapshot is left to the parent
+    new std::thread(std::move(snapshot_saver));
+    snapshot_saving = false;
+    return;
+  }
+  snapshot_saver.join();
+}
+
+static void snapshot_slot_save_async(VerilatedSaveMem *slots, int slot) {
+  snapshot_saver_wait();
+  snapshot_saving = true;
+  snapshot_saver_pid = getpid();
+  snapshot_saver = std::thread([slots, slot] {
+    snapshot_slot_save(slots, slot);
+    snapshot_saving = false;
+  });
+  affinity_place_thread(snapshot_saver.native_handle(), "snapshot saver", AFFINITY_HELPER);
+}
+#endif // VM_SAVABLE
+
+#ifdef FUZZER_LIB
+// Each fuzzing input runs with a new Emulator. The model is kept for the next input, together
+// with its state after reset if VM_SAVABLE, so that it is built and reset only once.
+static SIMULATOR *fuzz_model = nullptr;
+#ifdef VM_SAVABLE
+static std::vector<uint8_t> fuzz_reset_state;
+#endif // VM_SAVABLE
+#endif // FUZZER_LIB
+
+#ifndef CONFIG_NO_DIFFTEST
+static bool gcpt_export_has_restorer(REF_PROXY *proxy, const char *gcpt_restore, uint64_t overwrite_nbytes);
+#endif // CONFIG_NO_DIFFTEST
+
+static SIMULATOR *model_create() {
+#ifdef FUZZER_LIB
+  if (!fuzz_model) {
+    fuzz_model = new SIMULATOR;
+  }
+  return fuzz_model;
+#else
+  return new SIMULATOR;
+#endif // FUZZER_LIB
+}
+
+// Split the cpus before the checker and helper threads are spawned. The model threads already exist.
+static void thread_budget_init(const char *cpus) {
+  if (strcmp(cpus, "auto") && affinity_set_cpus(cpus) <= 0) {
+    printf("Invalid cpu list %s\n", cpus);
+    exit(1);
+  }
+#ifdef EMU_THREAD
+  int model_threads = EMU_THREAD;
+#else
+  int model_threads = 1;
+#endif // EMU_THREAD
+  int checker_threads = 0;
+#ifdef CONFIG_DIFFTEST_PARALLEL
+  checker_threads += NUM_CORES - 1;
+#endif // CONFIG_DIFFTEST_PARALLEL
+#ifdef CONFIG_DIFFTEST_ASYNC
+  checker_threads += 1;
+#endif // CONFIG_DIFFTEST_ASYNC
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+  checker_threads += ref_process_cpu < 0;
+#endif // CONFIG_DIFFTEST_REF_PROCESS
+#if defined(WITH_DRAMSIM3) && defined(DRAMSIM3_THREAD)
+  // DRAMSim3 is ticked every cycle by its worker
+  checker_threads += 1;
+#endif // WITH_DRAMSIM3 && DRAMSIM3_THREAD
+  if (!affinity_plan(model_threads, checker_threads)) {
+    return;
+  }
+  affinity_place_model();
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+  if (ref_process_cpu < 0) {
+    ref_process_cpu = affinity_take_cpu();
+  }
+#endif // CONFIG_DIFFTEST_REF_PROCESS
+}
+
 static uint64_t parse_and_update_ramsize(const char *arg_ramsize_str) {
   unsigned long ram_size_value = 0;
   char ram_size_unit[64];
@@ -76,6 +192,10 @@ static inline void print_help(const char *file) {
   printf("  -D, --stat-cycles=NUM      the interval cycles of dumping statistics\n");
   printf("  -i, --image=FILE           run with this image file\n");
   printf("  -r, --gcpt-restore=FILE    overwrite gcptrestore img with this image file\n");
+  printf("      --fast-forward=NUM     run NUM instructions on REF only, then start from its state\n");
+  printf("                             with gcpt-restore\n");
+  printf("      --fast-forward-pc=ADDR run REF only until it reaches ADDR, then start from its state\n");
+  printf("                             with gcpt-restore\n");
   printf("  -b, --log-begin=NUM        display log from NUM th cycle\n");
   printf("  -e, --log-end=NUM          stop display log at NUM th cycle\n");
 #ifdef DEBUG_REFILL
@@ -85,9 +205,15 @@ static inline void print_help(const char *file) {
   printf("  -R, --ipc-interval=NUM     the interval insts of drawing IPC curve\n");
 #endif
   printf("  -X, --fork-interval=NUM    LightSSS snapshot interval (in seconds), default: 10\n");
+  printf("      --fork-slots=NUM       max number of LightSSS checkpoint processes, default: %d\n", SLOT_SIZE);
+  printf("      --fork-cycles=NUM      fork every NUM cycles instead, unless the fork cost exceeds %d%% of the time\n",
+         LIGHTSSS_MAX_OVERHEAD);
+  printf("      --fork-geometric       keep LightSSS checkpoints geometrically spaced in time\n");
+  printf("      --fork-mem-budget=MB   kill old LightSSS checkpoints beyond MB of private memory\n");
   printf("      --overwrite-nbytes=N   set valid bytes, but less than 0xf00, default: 0xe00\n");
   printf("      --overwrite-auto       overwrite size is automatically set of the new gcpt\n");
   printf("      --force-dump-result    force dump performance counter result in the end\n");
+  printf("      --perf-dump=FILE       dump the performance counters and IPC samples to the binary FILE\n");
   printf("      --load-snapshot=PATH   load snapshot from PATH\n");
   printf("      --no-snapshot          disable saving snapshots\n");
   printf("      --dump-wave            dump waveform when log is enabled\n");
@@ -101,10 +227,20 @@ static inline void print_help(const char *file) {
   printf("  -F, --flash                the flash bin file for simulation\n");
   printf("      --sim-run-ahead        let a fork of simulator run ahead of commit for perf analysis\n");
   printf("      --wave-path=FILE       dump waveform to a specified PATH\n");
+  printf("      --uart-capture=FILE    also write the UART output to FILE\n");
+  printf("      --uart-stdin           feed stdin to the UART input\n");
+  printf("      --wave-window=N        record the waveform of the last N cycles and dump it on errors only\n");
   printf("      --ram-size=SIZE        simulation memory size, for example 8GB / 128MB\n");
+  printf("      --sparse-ram           allocate simulation memory in pages on demand\n");
+  printf("      --share-image          share the image pages between RAM, golden memory and REF\n");
   printf("      --enable-fork          enable folking child processes to debug\n");
   printf("      --no-diff              disable differential testing\n");
   printf("      --diff=PATH            set the path of REF for differential testing\n");
+  printf("      --second-ref=PATH      re-check the window before an error with REF PATH (with --enable-fork)\n");
+  printf("      --sample-difftest=WINDOW,INTERVAL\n");
+  printf("                             check only WINDOW of every INTERVAL instructions, and all of them\n");
+  printf("                             in the checkpoint woken up by an error (with --enable-fork)\n");
+  printf("      --async-log            write the log from a background thread\n");
   printf("      --enable-jtag          enable remote bitbang server\n");
   printf("      --remote-jtag-port     specify remote bitbang port\n");
 #ifdef WITH_DRAMSIM3
@@ -114,12 +250,27 @@ static inline void print_help(const char *file) {
 #if VM_COVERAGE == 1
   printf("      --dump-coverage        enable coverage dump\n");
 #endif // VM_COVERAGE
+  printf("      --dump-cover-bitmap=FILE\n");
+  printf("                             dump the covered points of this run to FILE for cover-merge\n");
+  printf("      --export-gcpt=PREFIX   export the REF states as gcpt checkpoint PREFIX_<instrs>.zstd (when the run\n");
+  printf("                             reaches --max-instr or --max-cycles, or at each --export-gcpt-interval)\n");
+  printf("      --export-gcpt-interval=NUM\n");
+  printf("                             export a gcpt checkpoint every NUM instructions\n");
   printf("      --load-difftrace=NAME  load from trace NAME\n");
   printf("      --dump-difftrace=NAME  dump to trace NAME\n");
+  printf("      --trace-start=CYCLE    load the trace from the last checkpoint before CYCLE\n");
   printf("      --iotrace-name=NAME    load from/dump to iotrace NAME\n");
+  printf("      --ref-cpu=NUM          pin the REF process to cpu NUM\n");
+  printf("      --cpus=LIST|auto       split the cpus in LIST (or of the process) between the model and checkers\n");
+  printf("      --telemetry=PATH       write telemetry JSON lines to PATH, or to the UNIX socket if PATH is\n");
+  printf("                             unix:SOCKET\n");
+  printf("      --telemetry-interval=MS\n");
+  printf("                             write telemetry every MS milliseconds (default: 1000)\n");
   printf("      --dump-footprints=NAME dump memory access footprints to NAME\n");
   printf("      --as-footprints        load the image as memory access footprints\n");
   printf("      --dump-linearized=NAME dump the linearized footprints to NAME\n");
+  printf("      --workload-list=FILE   run each \"IMAGE MAX_INSTR\" line of FILE in its own process\n");
+  printf("      --workload-jobs=N      run at most N workloads of the list at the same time\n");
   printf("  -h, --help                 print program help info\n");
   printf("\n");
 }
@@ -161,6 +312,29 @@ inline EmuArgs parse_args(int argc, const char *argv[]) {
     { "dramsim3-ini",      1, NULL,  0  },
     { "dramsim3-outdir",   1, NULL,  0  },
     { "overwrite-auto",    1, NULL,  0  },
+    { "sparse-ram",        0, NULL,  0  },
+    { "share-image",       0, NULL,  0  },
+    { "trace-start",       1, NULL,  0  },
+    { "fork-slots",        1, NULL,  0  },
+    { "fork-geometric",    0, NULL,  0  },
+    { "fork-mem-budget",   1, NULL,  0  },
+    { "fast-forward",      1, NULL,  0  },
+    { "fast-forward-pc",   1, NULL,  0  },
+    { "ref-cpu",           1, NULL,  0  },
+    { "telemetry",         1, NULL,  0  },
+    { "telemetry-interval", 1, NULL, 0  },
+    { "wave-window",       1, NULL,  0  },
+    { "uart-capture",      1, NULL,  0  },
+    { "uart-stdin",        0, NULL,  0  },
+    { "cpus",              1, NULL,  0  },
+    { "fork-cycles",       1, NULL,  0  },
+    { "dump-cover-bitmap", 1, NULL,  0  },
+    { "export-gcpt",       1, NULL,  0  },
+    { "export-gcpt-interval", 1, NULL, 0 },
+    { "second-ref",        1, NULL,  0  },
+    { "sample-difftest",   1, NULL,  0  },
+    { "async-log",         0, NULL,  0  },
+    { "perf-dump",         1, NULL,  0  },
     { "seed",              1, NULL, 's' },
     { "max-cycles",        1, NULL, 'C' },
     { "fork-interval",     1, NULL, 'X' },
@@ -268,6 +442,49 @@ inline EmuArgs parse_args(int argc, const char *argv[]) {
             break;
 #endif
           case 27: args.overwrite_nbytes_autoset = true; continue;
+          case 28: args.sparse_ram = true; continue;
+          case 29: args.share_image = true; continue;
+          case 30: args.trace_start_cycle = atoll_strict(optarg, "trace-start"); continue;
+          case 31: args.fork_slots = atoll_strict(optarg, "fork-slots"); continue;
+          case 32: args.fork_geometric = true; continue;
+          case 33: args.fork_mem_budget = atoll_strict(optarg, "fork-mem-budget") << 20; continue;
+          case 34: args.fast_forward_instr = atoll_strict(optarg, "fast-forward"); continue;
+          case 35: args.fast_forward_pc = std::strtoull(optarg, NULL, 0); continue;
+          case 36:
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+            ref_process_cpu = atoll_strict(optarg, "ref-cpu");
+#else
+            printf("[WARN] REF process is not enabled at compile time, ignore --ref-cpu\n");
+#endif // CONFIG_DIFFTEST_REF_PROCESS
+            continue;
+          case 37: args.telemetry_path = optarg; continue;
+          case 38: args.telemetry_interval = atoll_strict(optarg, "telemetry-interval"); continue;
+          case 39:
+            args.wave_window = atoll_strict(optarg, "wave-window");
+            args.enable_waveform = true;
+            continue;
+          case 40: console_capture_path = optarg; continue;
+          case 41: args.uart_stdin = true; continue;
+          case 42: args.cpus = optarg; continue;
+          case 43: args.fork_cycles = atoll_strict(optarg, "fork-cycles"); continue;
+          case 44: args.cover_bitmap = optarg; continue;
+          case 45: args.gcpt_export = optarg; continue;
+          case 46: args.gcpt_export_interval = atoll_strict(optarg, "export-gcpt-interval"); continue;
+          case 47: args.second_ref = optarg; continue;
+          case 48:
+            if (sscanf(optarg, "%lu,%lu", &args.sample_window, &args.sample_interval) != 2 ||
+                args.sample_window == 0 || args.sample_window >= args.sample_interval) {
+              printf("Invalid --sample-difftest=%s. Expect WINDOW,INTERVAL with 0 < WINDOW < INTERVAL\n", optarg);
+              exit(1);
+            }
+            // the golden memory and the load checks of other cores need every instruction of REF
+            if (NUM_CORES > 1) {
+              printf("--sample-difftest is not supported with %d cores\n", NUM_CORES);
+              exit(1);
+            }
+            continue;
+          case 49: args.async_log = true; continue;
+          case 50: args.perf_dump = optarg; continue;
         }
         // fall through
       default: print_help(argv[0]); exit(0);
@@ -326,6 +543,11 @@ inline EmuArgs parse_args(int argc, const char *argv[]) {
 
   args.enable_waveform = args.enable_waveform && !args.enable_fork;
 
+  if (args.second_ref && !args.enable_fork) {
+    printf("[WARN] --second-ref needs --enable-fork to re-check from the checkpoints, ignore it\n");
+    args.second_ref = nullptr;
+  }
+
 #ifdef ENABLE_IPC
   char *ipc_image = (char *)malloc(255);
   char *ipc_file = (char *)malloc(255);
@@ -350,7 +572,7 @@ inline EmuArgs parse_args(int argc, const char *argv[]) {
 }
 
 Emulator::Emulator(int argc, const char *argv[])
-    : dut_ptr(new DUT_TOP), cycles(0), trapCode(STATE_RUNNING), elapsed_time(uptime()) {
+    : dut_ptr(model_create()), cycles(0), trapCode(STATE_RUNNING), elapsed_time(uptime()) {
 
 #ifdef VERILATOR
 #if !defined(VERILATOR_VERSION_INTEGER) || VERILATOR_VERSION_INTEGER < 5026000
@@ -368,6 +590,21 @@ Emulator::Emulator(int argc, const char *argv[])
 #endif // VERILATOR
 
   args = parse_args(argc, argv);
+  if (args.cpus) {
+    thread_budget_init(args.cpus);
+  }
+  if (args.async_log) {
+    asynclog_start();
+  }
+  if (args.perf_dump) {
+    perfdump_start(args.perf_dump);
+  }
+#ifdef CONFIG_DIFFTEST_PERFDUMP
+  // The DifftestPerf counters have no text output in the binary channel
+  else {
+    perfdump_start(create_noop_filename(".perfdump"));
+  }
+#endif // CONFIG_DIFFTEST_PERFDUMP
 #ifdef ENABLE_CONSTANTIN
   void constantinLoad();
   constantinLoad();
@@ -388,7 +625,12 @@ Emulator::Emulator(int argc, const char *argv[])
   init_flash(args.flash_bin);
 
 #if VM_TRACE == 1
-  if (args.enable_waveform) {
+  if (args.enable_waveform && args.wave_window) {
+    // dump every cycle, but keep only the last window of them
+    uint64_t window = args.enable_waveform_full ? 2 * args.wave_window : args.wave_window;
+    waveform = new EmuWaveform(trace_bind, 0, args.wave_path, window);
+    force_dump_wave = true;
+  } else if (args.enable_waveform) {
     uint64_t waveform_clock = args.enable_waveform_full ? 2 * args.log_begin : args.log_begin;
     if (args.wave_path != NULL) {
       waveform = new EmuWaveform(trace_bind, waveform_clock, args.wave_path);
@@ -399,7 +641,18 @@ Emulator::Emulator(int argc, const char *argv[])
 #endif
 
   // init core
+#if defined(FUZZER_LIB) && defined(VM_SAVABLE)
+  if (fuzz_reset_state.empty()) {
+    reset_ncycles(args.reset_cycles);
+    VerilatedSaveVec stream(fuzz_reset_state);
+    stream << *dut_ptr;
+  } else {
+    VerilatedRestoreVec stream(fuzz_reset_state);
+    stream >> *dut_ptr;
+  }
+#else
   reset_ncycles(args.reset_cycles);
+#endif // FUZZER_LIB && VM_SAVABLE
 
   // init ram
   uint64_t ram_size = DEFAULT_EMU_RAM_SIZE;
@@ -418,8 +671,10 @@ Emulator::Emulator(int argc, const char *argv[])
   else {
     if (args.footprints_name) {
       simMemory = new MmapMemoryWithFootprints(args.image, ram_size, args.footprints_name);
+    } else if (args.sparse_ram) {
+      simMemory = new SparseMemory(args.image, ram_size);
     } else {
-      init_ram(args.image, ram_size);
+      init_ram(args.image, ram_size, args.share_image);
 #ifdef WITH_DRAMSIM3
       dramsim3_init(args.dramsim3_ini, args.dramsim3_outdir);
 #endif
@@ -451,14 +706,8 @@ Emulator::Emulator(int argc, const char *argv[])
 #endif
 
   // set log time range and log level
-#ifdef VERILATOR
-  dut_ptr->difftest_logCtrl_begin = args.log_begin;
-  dut_ptr->difftest_logCtrl_end = args.log_end;
-#endif // VERILATOR
-#ifdef GSIM
-  dut_ptr->set_difftest__DOT__logCtrl__DOT__begin(args.log_begin);
-  dut_ptr->set_difftest__DOT__logCtrl__DOT__end(args.log_end);
-#endif // GSIM
+  dut_ptr->set_log_begin(args.log_begin);
+  dut_ptr->set_log_end(args.log_end);
 
 #ifndef CONFIG_NO_DIFFTEST
   // init difftest
@@ -467,18 +716,47 @@ Emulator::Emulator(int argc, const char *argv[])
   // init difftest traces
   if (args.trace_name) {
     for (int i = 0; i < NUM_CORES; i++) {
-      difftest[i]->set_trace(args.trace_name, args.trace_is_read);
+      difftest[i]->set_trace(args.trace_name, args.trace_is_read, args.trace_start_cycle);
     }
   }
 #endif // CONFIG_NO_DIFFTEST
 
   init_device();
+  if (args.uart_stdin) {
+    console_enable_input();
+  }
 
 #ifndef CONFIG_NO_DIFFTEST
   if (args.enable_diff) {
     init_goldenmem();
+#ifdef FUZZER_LIB
+    // REF instances are reset and reused by the next input
+    difftest_ref_pool_enable();
+#endif // FUZZER_LIB
     size_t ref_ramsize = args.ram_size ? simMemory->get_size() : 0;
     init_nemuproxy(ref_ramsize);
+    if (args.sample_interval) {
+      difftest_sample_enable(args.sample_window, args.sample_interval);
+    }
+    if (args.fast_forward_instr || args.fast_forward_pc) {
+      fast_forward();
+    }
+  }
+  if (args.gcpt_export) {
+    bool async = false;
+#ifdef CONFIG_DIFFTEST_ASYNC
+    // REF runs behind the simulation on the checker thread
+    async = true;
+#endif // CONFIG_DIFFTEST_ASYNC
+    if (NUM_CORES > 1 || !args.enable_diff || async) {
+      printf("--export-gcpt needs a single core with difftest and without CONFIG_DIFFTEST_ASYNC\n");
+      exit(1);
+    }
+    if (!gcpt_export_has_restorer(difftest[0]->proxy, args.gcpt_restore, args.overwrite_nbytes)) {
+      printf("--export-gcpt needs a gcpt restorer as --gcpt-restore, or an image restored from a gcpt checkpoint\n");
+      exit(1);
+    }
+    gcpt_export_next = args.gcpt_export_interval;
   }
 #endif // CONFIG_NO_DIFFTEST
 #ifdef ENABLE_RUNAHEAD
@@ -503,19 +781,273 @@ Emulator::Emulator(int argc, const char *argv[])
     // Currently, runahead does not work well with fork based snapshot
     assert(!args.enable_runahead);
 #endif // ENABLE_RUNAHEAD
-    lightsss = new LightSSS;
+#ifdef CONFIG_DIFFTEST_REF_PROCESS
+    // checkpoint processes would share the REF process
+    printf("LightSSS does not work with REF_PROCESS\n");
+    exit(1);
+#endif // CONFIG_DIFFTEST_REF_PROCESS
+    if (args.fork_slots < 1) {
+      printf("--fork-slots should be at least 1\n");
+      exit(1);
+    }
+    lightsss = new LightSSS(args.fork_slots, args.fork_geometric ? FORK_POLICY_GEOMETRIC : FORK_POLICY_OLDEST,
+                            args.fork_mem_budget);
+    lightsss->set_target_cycles(args.fork_cycles);
     FORK_PRINTF("enable fork debugging...\n")
   }
 
+#if !defined(CONFIG_NO_DIFFTEST) && defined(CONFIG_DIFFTEST_ASYNC)
+  // LightSSS forks only the simulation thread, and trace reading writes to the checked states
+  if (args.enable_fork || (args.trace_name && args.trace_is_read)) {
+    Info("The async checker is disabled because of fork debugging or trace reading.\n");
+  } else if (args.enable_diff) {
+    difftest_async_start();
+  }
+#endif // !CONFIG_NO_DIFFTEST && CONFIG_DIFFTEST_ASYNC
+
 #if VM_COVERAGE == 1
   if (args.dump_coverage) {
     coverage = Verilated::threadContextp()->coveragep();
   }
 #endif
+
+  if (args.telemetry_path) {
+#ifdef VM_SAVABLE
+    if (args.enable_snapshot) {
+      telemetry_add_gauge("snapshot_saving", [] { return (uint64_t)snapshot_saving.load(); });
+    }
+#endif // VM_SAVABLE
+    if (lightsss) {
+      LightSSS *l = lightsss;
+      telemetry_add_gauge("fork_ns", [l] { return l->forkNs.load(std::memory_order_relaxed); });
+      telemetry_add_gauge("fork_faults", [l] { return l->forkFaults.load(std::memory_order_relaxed); });
+      telemetry_add_gauge("fork_interval_ms", [l] { return l->forkIntervalMs.load(std::memory_order_relaxed); });
+    }
+    telemetry_start(args.telemetry_path, args.telemetry_interval);
+  }
 }
 
+#ifndef CONFIG_NO_DIFFTEST
+// Memory layout of the gcpt restorer, relative to PMEM_BASE
+#define GCPT_MAGIC_NUMBER   0xbeef
+#define GCPT_BOOT_FLAG_ADDR 0xECDB0
+#define GCPT_PC_ADDR        0xECDB8
+#define GCPT_MODE_ADDR      0xECDC0
+#define GCPT_MISC_DONE_ADDR 0xECDD8
+#define GCPT_INT_REG_ADDR   0xEDDE0
+#define GCPT_INT_REG_DONE   0xEDEE0
+#define GCPT_FP_REG_ADDR    0xEDEE8
+#define GCPT_FP_REG_DONE    0xEDFE8
+#define GCPT_CSR_REG_ADDR   0xEDFF0
+#define GCPT_CSR_REG_DONE   0xF5FF0
+
+// The states are written above the restorer, which has its size at offset 4 as --overwrite-auto expects
+static bool gcpt_is_restorer(const char *path, uint64_t overwrite_nbytes) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  uint32_t size = 0;
+  bool ok = fseek(fp, 4, SEEK_SET) == 0 && fread(&size, sizeof(size), 1, fp) == 1;
+  fclose(fp);
+  return ok && size > 0 && size <= GCPT_BOOT_FLAG_ADDR && overwrite_nbytes <= GCPT_BOOT_FLAG_ADDR;
+}
+
+// An exported checkpoint starts with the restorer of --gcpt-restore, or with the memory of a run that was
+// started from a gcpt checkpoint, which has the boot flag of the restorer
+static bool gcpt_export_has_restorer(REF_PROXY *proxy, const char *gcpt_restore, uint64_t overwrite_nbytes) {
+  if (gcpt_restore) {
+    return gcpt_is_restorer(gcpt_restore, overwrite_nbytes);
+  }
+  uint64_t flag = 0;
+  proxy->mem_init(PMEM_BASE + GCPT_BOOT_FLAG_ADDR, &flag, sizeof(flag), REF_TO_DUT);
+  return flag == GCPT_MAGIC_NUMBER;
+}
+
+// Write the synced architectural states of REF to the layout of the gcpt restorer by write(offset, src, n)
+template <typename F> static void gcpt_write_states(REF_PROXY *proxy, F write) {
+  uint64_t magic = GCPT_MAGIC_NUMBER;
+  uint64_t mode = proxy->csr.privilegeMode;
+  uint64_t ref_csr[4096];
+  proxy->ref_csrcpy(ref_csr, REF_TO_DUT);
+  write(GCPT_BOOT_FLAG_ADDR, &magic, sizeof(magic));
+  write(GCPT_PC_ADDR, &proxy->pc, sizeof(proxy->pc));
+  write(GCPT_MODE_ADDR, &mode, sizeof(mode));
+  write(GCPT_MISC_DONE_ADDR, &magic, sizeof(magic));
+  write(GCPT_INT_REG_ADDR, &proxy->regs_int, sizeof(proxy->regs_int));
+  write(GCPT_INT_REG_DONE, &magic, sizeof(magic));
+#ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
+  write(GCPT_FP_REG_ADDR, &proxy->regs_fp, sizeof(proxy->regs_fp));
+  write(GCPT_FP_REG_DONE, &magic, sizeof(magic));
+#endif // CONFIG_DIFFTEST_ARCHFPREGSTATE
+  write(GCPT_CSR_REG_ADDR, ref_csr, sizeof(ref_csr));
+  write(GCPT_CSR_REG_DONE, &magic, sizeof(magic));
+}
+
+// Exported checkpoints are compressed and written to files on this thread while the simulation goes on
+static std::thread gcpt_exporter;
+static pid_t gcpt_exporter_pid = 0;
+
+static void gcpt_exporter_wait() {
+  if (!gcpt_exporter.joinable()) {
+    return;
+  }
+  if (gcpt_exporter_pid != getpid()) {
+    // a LightSSS child does not inherit the thread, and its export is left to the parent
+    new std::thread(std::move(gcpt_exporter));
+    return;
+  }
+  gcpt_exporter.join();
+}
+
+// Run the REF alone to the fast-forward point and turn its states into a gcpt checkpoint in the DUT memory.
+// The REF is then reset, so that it runs the gcpt restorer together with the DUT as usual.
+void Emulator::fast_forward() {
+  if (NUM_CORES > 1 || !args.gcpt_restore || !simMemory->as_ptr() || simMemory->get_image_fd() >= 0) {
+    printf("Fast-forward needs a single core, --gcpt-restore and a linear RAM without --share-image\n");
+    exit(1);
+  }
+  // the restorer and the states overwrite the start of the memory
+  if (!gcpt_is_restorer(args.gcpt_restore, args.overwrite_nbytes)) {
+    printf("Fast-forward needs a gcpt restorer below 0x%x as --gcpt-restore, but got %s of 0x%lx bytes\n",
+           GCPT_BOOT_FLAG_ADDR, args.gcpt_restore, args.overwrite_nbytes);
+    exit(1);
+  }
+  auto proxy = difftest[0]->proxy;
+  uint8_t *dut_mem = (uint8_t *)simMemory->as_ptr();
+  uint64_t mem_size = simMemory->get_size();
+
+  // the reset states, restored after fast-forward
+  proxy->sync();
+  uint8_t *reset_regs = new uint8_t[REF_STATE_SIZE];
+  memcpy(reset_regs, &proxy->regs_int, REF_STATE_SIZE);
+  uint64_t *csr_buf = new uint64_t[4096];
+  proxy->ref_csrcpy(csr_buf, REF_TO_DUT);
+
+  proxy->flash_init((const uint8_t *)flash_dev.base, flash_dev.img_size, flash_dev.img_path);
+  simMemory->clone([proxy](void *src, size_t n) { proxy->mem_init(PMEM_BASE, src, n, DUT_TO_REF); }, true);
+  proxy->pc = FIRST_INST_ADDRESS;
+  proxy->ref_regcpy(&proxy->regs_int, DUT_TO_REF, false);
+
+  if (args.fast_forward_pc) {
+    Info("Fast-forwarding REF to pc 0x%lx ...\n", args.fast_forward_pc);
+  } else {
+    Info("Fast-forwarding REF by %lu instructions ...\n", args.fast_forward_instr);
+  }
+  const uint64_t chunk = 1000000;
+  uint32_t start = uptime();
+  uint64_t instr = 0;
+  while (!proxy->get_status()) {
+    if (args.fast_forward_pc) {
+      instr += proxy->exec_until_pc(args.fast_forward_pc, chunk);
+      if (proxy->pc == args.fast_forward_pc) {
+        break;
+      }
+    } else if (instr < args.fast_forward_instr) {
+      uint64_t n = std::min(chunk, args.fast_forward_instr - instr);
+      proxy->ref_exec(n);
+      instr += n;
+    } else {
+      break;
+    }
+  }
+  if (proxy->get_status()) {
+    printf("REF stopped with status %d during fast-forward\n", proxy->get_status());
+    exit(1);
+  }
+  proxy->sync();
+  Info("Fast-forward done at pc 0x%lx after %lu instructions in %u ms\n", proxy->pc, instr, uptime() - start);
+
+  // the gcpt restorer and the architectural states are written to the REF memory first
+  FileReader reader(args.gcpt_restore);
+  std::vector<uint8_t> restorer(args.overwrite_nbytes);
+  uint64_t restorer_size = reader.read_all(restorer.data(), args.overwrite_nbytes);
+  proxy->mem_init(PMEM_BASE, restorer.data(), restorer_size, DUT_TO_REF);
+  auto ref_write = [proxy](uint64_t offset, const void *src, size_t n) {
+    proxy->mem_init(PMEM_BASE + offset, (void *)src, n, DUT_TO_REF);
+  };
+  gcpt_write_states(proxy, ref_write);
+
+  // copy the changed parts of the REF memory to the DUT memory and the golden memory
+  const size_t buf_size = 2 * 1024 * 1024;
+  uint8_t *buf = new uint8_t[buf_size];
+  for (uint64_t offset = 0; offset < mem_size; offset += buf_size) {
+    size_t n = std::min((uint64_t)buf_size, mem_size - offset);
+    proxy->mem_init(PMEM_BASE + offset, buf, n, REF_TO_DUT);
+    if (memcmp(dut_mem + offset, buf, n)) {
+      memcpy(dut_mem + offset, buf, n);
+      if (pmem) {
+        memcpy(pmem + offset, buf, n);
+      }
+    }
+  }
+  delete[] buf;
+  if (pmem) {
+    goldenmem_flush_pt();
+  }
+
+  memcpy(&proxy->regs_int, reset_regs, REF_STATE_SIZE);
+  proxy->ref_regcpy(&proxy->regs_int, DUT_TO_REF, false);
+  proxy->ref_csrcpy(csr_buf, DUT_TO_REF);
+  delete[] reset_regs;
+  delete[] csr_buf;
+}
+
+// Export the REF memory and states as a gcpt checkpoint, which restarts the run on any simulator (or FPGA)
+// with the gcpt restorer. The memory is copied here, and the copy is compressed on a helper thread.
+void Emulator::gcpt_export(uint64_t instr) {
+  // at most one image is kept in memory
+  gcpt_exporter_wait();
+  auto proxy = difftest[0]->proxy;
+  proxy->sync();
+
+  // pages are only allocated for the non-zero chunks, and the trailing zeros are not written
+  uint64_t mem_size = simMemory->get_size();
+  int flags = MAP_ANON | MAP_PRIVATE | MAP_NORESERVE;
+  uint8_t *image = (uint8_t *)mmap(NULL, mem_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  assert(image != MAP_FAILED);
+  const size_t buf_size = 2 * 1024 * 1024;
+  std::vector<uint64_t> buf(buf_size / sizeof(uint64_t));
+  uint64_t image_size = GCPT_CSR_REG_DONE + sizeof(uint64_t);
+  for (uint64_t offset = 0; offset < mem_size; offset += buf_size) {
+    size_t n = std::min((uint64_t)buf_size, mem_size - offset);
+    proxy->mem_init(PMEM_BASE + offset, buf.data(), n, REF_TO_DUT);
+    if (std::any_of(buf.begin(), buf.begin() + n / sizeof(uint64_t), [](uint64_t w) { return w != 0; })) {
+      memcpy(image + offset, buf.data(), n);
+      image_size = std::max(image_size, offset + n);
+    }
+  }
+  // the restorer is already in memory if the run was started from a gcpt checkpoint
+  if (args.gcpt_restore) {
+    FileReader reader(args.gcpt_restore);
+    reader.read_all(image, args.overwrite_nbytes);
+  }
+  gcpt_write_states(proxy, [image](uint64_t offset, const void *src, size_t n) { memcpy(image + offset, src, n); });
+
+  std::string filename = std::string(args.gcpt_export) + "_" + std::to_string(instr) + ".zstd";
+  Info("Exporting gcpt checkpoint at pc 0x%lx after %lu instructions to %s\n", proxy->pc, instr, filename.c_str());
+  gcpt_exporter_pid = getpid();
+  gcpt_exporter = std::thread([image, mem_size, image_size, filename] {
+    if (zstd_compressToFile(image, filename.c_str(), image_size) < 0) {
+      printf("Failed to export gcpt checkpoint %s\n", filename.c_str());
+    }
+    munmap(image, mem_size);
+  });
+  affinity_place_thread(gcpt_exporter.native_handle(), "gcpt exporter", AFFINITY_HELPER);
+}
+#endif // CONFIG_NO_DIFFTEST
+
 Emulator::~Emulator() {
   // Simulation ends here, do clean up & display jobs
+  console_finish();
+
+#if !defined(CONFIG_NO_DIFFTEST) && defined(CONFIG_DIFFTEST_ASYNC)
+  // the checker runs behind the simulation, and its failure takes precedence
+  int async_state = difftest_async_stop();
+  if (async_state != STATE_RUNNING && trapCode != STATE_ABORT && trapCode != STATE_SIG) {
+    trapCode = async_state;
+  }
+#endif // !CONFIG_NO_DIFFTEST && CONFIG_DIFFTEST_ASYNC
 
 #if VM_COVERAGE == 1
   // we dump coverage into files at the end
@@ -532,6 +1064,10 @@ Emulator::~Emulator() {
   }
 #endif // ENABLE_RUNAHEAD
 
+  // the gauges read lightsss
+  telemetry_stop();
+  perfdump_stop();
+
   if (args.enable_fork && !is_fork_child()) {
     bool need_wakeup = trapCode != STATE_GOODTRAP && trapCode != STATE_LIMIT_EXCEEDED && trapCode != STATE_SIG;
     if (need_wakeup) {
@@ -548,10 +1084,22 @@ Emulator::~Emulator() {
 
 #ifndef CONFIG_NO_DIFFTEST
   stats.update(difftest[0]->dut);
+  if (args.cover_bitmap) {
+    stats.dump_cover_file(args.cover_bitmap);
+  }
+  if (args.gcpt_export && !args.gcpt_export_interval && trapCode == STATE_LIMIT_EXCEEDED) {
+    gcpt_export(difftest[0]->get_trap_event()->instrCnt);
+  }
+  gcpt_exporter_wait();
 #endif // CONFIG_NO_DIFFTEST
 
   simMemory->display_stats();
+  hugepage_display_stats();
+#ifdef FUZZER_LIB
+  ram_recycle(simMemory);
+#else
   delete simMemory;
+#endif // FUZZER_LIB
   simMemory = nullptr;
 
 #ifndef CONFIG_NO_DIFFTEST
@@ -565,10 +1113,11 @@ Emulator::~Emulator() {
 #endif // CONFIG_NO_DIFFTEST
 
 #ifdef VM_SAVABLE
+  snapshot_saver_wait();
   if (args.enable_snapshot && trapCode != STATE_GOODTRAP && trapCode != STATE_LIMIT_EXCEEDED) {
     Info("Saving snapshots to file system. Please wait.\n");
-    snapshot_slot[0].save();
-    snapshot_slot[1].save();
+    snapshot_slot_save(snapshot_slot, 0);
+    snapshot_slot_save(snapshot_slot, 1);
     Info("Please remove unused snapshots manually\n");
   }
   delete[] snapshot_slot;
@@ -592,11 +1141,17 @@ Emulator::~Emulator() {
   }
 
 #if VM_TRACE == 1
-  if (args.enable_waveform)
+  if (args.enable_waveform) {
+    if (!is_good_trap()) {
+      waveform->save_tail();
+    }
     delete waveform;
+  }
 #endif
 
+#ifndef FUZZER_LIB
   delete dut_ptr;
+#endif // FUZZER_LIB
 }
 
 inline void Emulator::reset_ncycles(size_t cycles) {
@@ -604,16 +1159,8 @@ inline void Emulator::reset_ncycles(size_t cycles) {
     return;
   }
   for (int i = 0; i < cycles; i++) {
-#ifdef VERILATOR
-    dut_ptr->reset = 1;
-#ifdef COVERAGE_PORT_RESET
-    dut_ptr->coverage_reset = dut_ptr->reset;
-#endif // COVERAGE_PORT_RESET
-    dut_ptr->clock = 1;
-#ifdef COVERAGE_PORT_CLOCK
-    dut_ptr->coverage_clock = dut_ptr->clock;
-#endif // COVERAGE_PORT_CLOCK
-    dut_ptr->eval();
+    dut_ptr->set_reset(1);
+    dut_ptr->posedge();
 
 #if VM_TRACE == 1
     if (args.enable_waveform && args.enable_waveform_full && args.log_begin == 0) {
@@ -621,31 +1168,15 @@ inline void Emulator::reset_ncycles(size_t cycles) {
     }
 #endif
 
-    dut_ptr->clock = 0;
-#ifdef COVERAGE_PORT_CLOCK
-    dut_ptr->coverage_clock = dut_ptr->clock;
-#endif // COVERAGE_PORT_CLOCK
-    dut_ptr->eval();
+    dut_ptr->negedge();
 
 #if VM_TRACE == 1
     if (args.enable_waveform && args.enable_waveform_full && args.log_begin == 0) {
       waveform->tick();
     }
 #endif
-
-    dut_ptr->reset = 0;
-#ifdef COVERAGE_PORT_RESET
-    dut_ptr->coverage_reset = dut_ptr->reset;
-#endif // COVERAGE_PORT_RESET
-#endif // VERILATOR
-
-#ifdef GSIM
-    dut_ptr->set_reset(1);
-    dut_ptr->step();
-    dut_ptr->set_reset(0);
-    dut_ptr->step();
-#endif // GSIM
   }
+  dut_ptr->set_reset(0);
 }
 
 inline void Emulator::single_cycle() {
@@ -653,18 +1184,15 @@ inline void Emulator::single_cycle() {
     goto end_single_cycle;
   }
 
-#ifdef VERILATOR
-  dut_ptr->clock = 1;
-#ifdef COVERAGE_PORT_CLOCK
-  dut_ptr->coverage_clock = dut_ptr->clock;
-#endif // COVERAGE_PORT_CLOCK
-  dut_ptr->eval();
-#endif // VERILATOR
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_rtl_eval);
+    dut_ptr->posedge();
+  }
 
 #if VM_TRACE == 1
   if (args.enable_waveform) {
 #if !defined(CONFIG_NO_DIFFTEST) && !defined(CONFIG_DIFFTEST_SQUASH)
-    uint64_t cycle = difftest[0]->get_trap_event()->cycleCnt;
+    uint64_t cycle = difftest_trap_event(0)->cycleCnt;
 #else
     static uint64_t cycle = -1UL;
     cycle++;
@@ -680,44 +1208,17 @@ inline void Emulator::single_cycle() {
   dramsim3_step();
 #endif
 
-#ifdef VERILATOR
-  if (dut_ptr->difftest_uart_out_valid) {
-    // printf("%c", dut_ptr->difftest_uart_out_ch);
-    // fflush(stdout);
-    uart16550_putc(dut_ptr->difftest_uart_out_ch);
-  }
-  if (dut_ptr->difftest_uart_in_valid) {
-    // extern uint8_t uart_getc();
-    // dut_ptr->difftest_uart_in_ch = uart_getc();
-    uint8_t ch;
-    uart16550_getc_legacy(&ch);
-    dut_ptr->difftest_uart_in_ch = ch;
-  }
-
-  dut_ptr->clock = 0;
-#ifdef COVERAGE_PORT_CLOCK
-  dut_ptr->coverage_clock = dut_ptr->clock;
-#endif // COVERAGE_PORT_CLOCK
-  dut_ptr->eval();
-#endif // VERILATOR
+  dut_ptr->step_uart();
 
-#ifdef GSIM
-  dut_ptr->step();
-  if (dut_ptr->get_difftest__DOT__uart__DOT__out__DOT__valid()) {
-    printf("%c", dut_ptr->get_difftest__DOT__uart__DOT__out__DOT__ch());
-    fflush(stdout);
+  {
+    DIFFTEST_PROFILE_SCOPE(prof_rtl_eval);
+    dut_ptr->negedge();
   }
-  if (dut_ptr->get_difftest__DOT__uart__DOT__in__DOT__valid()) {
-    extern uint8_t uart_getc();
-    uint8_t ch = uart_getc();
-    dut_ptr->set_difftest__DOT__uart__DOT__in__DOT__ch(ch);
-  }
-#endif // GSIM
 
 #if VM_TRACE == 1
   if (args.enable_waveform && args.enable_waveform_full) {
 #if !defined(CONFIG_NO_DIFFTEST) && !defined(CONFIG_DIFFTEST_MERGE)
-    uint64_t cycle = difftest[0]->get_trap_event()->cycleCnt;
+    uint64_t cycle = difftest_trap_event(0)->cycleCnt;
 #else
     static uint64_t cycle = -1UL;
     cycle++;
@@ -733,19 +1234,85 @@ end_single_cycle:
   cycles++;
 }
 
-int Emulator::tick() {
+#ifndef CONFIG_NO_DIFFTEST
+// Handle the periodic events of core i at this cycle, and set its thresholds to the nearest events after it
+void Emulator::schedule_core_events(int i) {
+  auto trap = difftest_trap_event(i);
+  if (trap->instrCnt >= args.warmup_instr) {
+    Info("Warmup finished. The performance counters will be dumped and then reset.\n");
+    dut_ptr->set_perf_clean(1);
+    dut_ptr->set_perf_dump(1);
+    args.warmup_instr = -1;
+  }
+  if (trap->cycleCnt % args.stat_cycles == args.stat_cycles - 1) {
+#ifdef CONFIG_DIFFTEST_PROFILE
+    difftest_profile_dump();
+#endif // CONFIG_DIFFTEST_PROFILE
+    dut_ptr->set_perf_clean(1);
+    dut_ptr->set_perf_dump(1);
+  }
+#ifdef ENABLE_IPC
+  if (trap->instrCnt >= args.ipc_times * args.ipc_interval &&
+      args.ipc_last_instr < args.ipc_times * args.ipc_interval) {
+    if (perfdump_active()) {
+      perfdump_ipc(args.ipc_times * args.ipc_interval, cycles);
+    } else {
+      fprintf(args.ipc_file, "%d %f\n", args.ipc_times * args.ipc_interval,
+              (float)args.ipc_interval / (cycles - args.ipc_last_cycle));
+    }
+    args.ipc_times++;
+    args.ipc_last_instr = trap->instrCnt;
+    args.ipc_last_cycle = cycles;
+  }
+#endif
+  if (args.enable_ref_trace) {
+    if (trap->cycleCnt == args.log_begin) {
+      difftest_set_ref_debug(i, true);
+    }
+    if (trap->cycleCnt == args.log_end) {
+      difftest_set_ref_debug(i, false);
+    }
+  }
+  if (args.enable_commit_trace) {
+    if (trap->cycleCnt == args.log_begin) {
+      difftest_set_commit_trace(i, true);
+    }
+    if (trap->cycleCnt == args.log_end) {
+      difftest_set_commit_trace(i, false);
+    }
+  }
 
-#ifdef SHOW_SCREEN
-  uint32_t t = uptime();
-  if (t - lasttime_poll > 100) {
-    poll_event();
-    lasttime_poll = t;
+  uint64_t cycle = trap->cycleCnt;
+  uint64_t next_cycle = args.max_cycles;
+  uint64_t next_stat = cycle - cycle % args.stat_cycles + args.stat_cycles - 1;
+  next_cycle = std::min(next_cycle, next_stat > cycle ? next_stat : next_stat + args.stat_cycles);
+  if (args.enable_ref_trace || args.enable_commit_trace) {
+    for (uint64_t log_cycle: {args.log_begin, args.log_end}) {
+      if (log_cycle > cycle) {
+        next_cycle = std::min(next_cycle, log_cycle);
+      }
+    }
   }
+  next_cycle_event[i] = next_cycle;
+
+  uint64_t next_instr = std::min(core_max_instr[i], args.warmup_instr);
+#ifdef ENABLE_IPC
+  next_instr = std::min(next_instr, args.ipc_times * args.ipc_interval);
 #endif
+  next_instr_event[i] = next_instr;
+}
+#endif // CONFIG_NO_DIFFTEST
+
+int Emulator::tick() {
+
+  device_poll(cycles);
 
   if (args.enable_fork && is_fork_child() && cycles != 0) {
     if (cycles == lightsss->get_end_cycles()) {
       FORK_PRINTF("checkpoint has reached the main process abort point: %lu\n", cycles)
+      if (args.second_ref) {
+        FORK_PRINTF("the second REF has not reproduced the error, which may be a modeling gap of the first REF\n")
+      }
     }
     if (cycles == lightsss->get_end_cycles() + STEP_FORWARD_CYCLES) {
       trapCode = STATE_ABORT;
@@ -753,20 +1320,24 @@ int Emulator::tick() {
     }
   }
 
-  // cycle limitation
-  bool exceed_cycle_limit = false;
+  // cycle and instruction limitation
+  bool exceed_limit = false;
 #ifdef CONFIG_NO_DIFFTEST
-  exceed_cycle_limit = !args.max_cycles;
+  exceed_limit = !args.max_cycles;
 #else
+  uint64_t events_due = 0; // bit i is set if core i has reached an event threshold
   for (int i = 0; i < NUM_CORES; i++) {
-    auto trap = difftest[i]->get_trap_event();
-    if (trap->cycleCnt >= args.max_cycles) {
-      exceed_cycle_limit = true;
+    auto trap = difftest_trap_event(i);
+    if (trap->cycleCnt >= next_cycle_event[i] || trap->instrCnt >= next_instr_event[i]) {
+      events_due |= 1UL << i;
+      if (trap->cycleCnt >= args.max_cycles || trap->instrCnt >= core_max_instr[i]) {
+        exceed_limit = true;
+      }
     }
   }
 #endif // CONFIG_NO_DIFFTEST
 
-  if (exceed_cycle_limit) {
+  if (exceed_limit) {
     trapCode = STATE_LIMIT_EXCEEDED;
 #ifdef FUZZER_LIB
     stats.exit_code = SimExitCode::exceed_limit;
@@ -774,19 +1345,6 @@ int Emulator::tick() {
     return trapCode;
   }
 
-  // instruction limitation
-#ifndef CONFIG_NO_DIFFTEST
-  for (int i = 0; i < NUM_CORES; i++) {
-    auto trap = difftest[i]->get_trap_event();
-    if (trap->instrCnt >= core_max_instr[i]) {
-      trapCode = STATE_LIMIT_EXCEEDED;
-#ifdef FUZZER_LIB
-      stats.exit_code = SimExitCode::exceed_limit;
-#endif // FUZZER_LIB
-      return trapCode;
-    }
-  }
-#endif // CONFIG_NO_DIFFTEST
   // assertions
   if (assert_count > 0) {
     Info("The simulation stopped. There might be some assertion failed.\n");
@@ -799,12 +1357,7 @@ int Emulator::tick() {
   }
 
   // exit signal: non-zero exit exits the simulation. exit all 1's indicates good.
-#ifdef VERILATOR
-  uint64_t difftest_exit = dut_ptr->difftest_exit;
-#endif
-#ifdef GSIM
-  uint64_t difftest_exit = 0; // TODO: gsim API
-#endif
+  uint64_t difftest_exit = dut_ptr->get_difftest_exit();
   if (difftest_exit) {
     if (difftest_exit == -1UL) {
       trapCode = STATE_SIM_EXIT;
@@ -818,56 +1371,8 @@ int Emulator::tick() {
     return trapCode;
   }
 #ifndef CONFIG_NO_DIFFTEST
-  for (int i = 0; i < NUM_CORES; i++) {
-    auto trap = difftest[i]->get_trap_event();
-    if (trap->instrCnt >= args.warmup_instr) {
-      Info("Warmup finished. The performance counters will be dumped and then reset.\n");
-#ifdef VERILATOR
-      dut_ptr->difftest_perfCtrl_clean = 1;
-      dut_ptr->difftest_perfCtrl_dump = 1;
-#endif // VERILATOR
-#ifdef GSIM
-      dut_ptr->set_difftest__DOT__perfCtrl__DOT__clean(1);
-      dut_ptr->set_difftest__DOT__perfCtrl__DOT__dump(1);
-#endif // GSIM
-      args.warmup_instr = -1;
-    }
-    if (trap->cycleCnt % args.stat_cycles == args.stat_cycles - 1) {
-#ifdef VERILATOR
-      dut_ptr->difftest_perfCtrl_clean = 1;
-      dut_ptr->difftest_perfCtrl_dump = 1;
-#endif // VERILATOR
-#ifdef GSIM
-      dut_ptr->set_difftest__DOT__perfCtrl__DOT__clean(1);
-      dut_ptr->set_difftest__DOT__perfCtrl__DOT__dump(1);
-#endif // GSIM
-    }
-#ifdef ENABLE_IPC
-    if (trap->instrCnt >= args.ipc_times * args.ipc_interval &&
-        args.ipc_last_instr < args.ipc_times * args.ipc_interval) {
-      fprintf(args.ipc_file, "%d %f\n", args.ipc_times * args.ipc_interval,
-              (float)args.ipc_interval / (cycles - args.ipc_last_cycle));
-      args.ipc_times++;
-      args.ipc_last_instr = trap->instrCnt;
-      args.ipc_last_cycle = cycles;
-    }
-#endif
-    if (args.enable_ref_trace) {
-      if (trap->cycleCnt == args.log_begin) {
-        difftest[i]->proxy->set_debug(true);
-      }
-      if (trap->cycleCnt == args.log_end) {
-        difftest[i]->proxy->set_debug(false);
-      }
-    }
-    if (args.enable_commit_trace) {
-      if (trap->cycleCnt == args.log_begin) {
-        difftest[i]->set_commit_trace(true);
-      }
-      if (trap->cycleCnt == args.log_end) {
-        difftest[i]->set_commit_trace(false);
-      }
-    }
+  for (; events_due; events_due &= events_due - 1) {
+    schedule_core_events(__builtin_ctzll(events_due));
   }
 #endif // CONFIG_NO_DIFFTEST
 
@@ -875,26 +1380,15 @@ int Emulator::tick() {
 #ifdef CONFIG_NO_DIFFTEST
   args.max_cycles--;
 #endif // CONFIG_NO_DIFFTEST
-#ifdef VERILATOR
-  dut_ptr->difftest_perfCtrl_clean = 0;
-  dut_ptr->difftest_perfCtrl_dump = 0;
-#endif // VERILATOR
-#ifdef GSIM
-  dut_ptr->set_difftest__DOT__perfCtrl__DOT__clean(0);
-  dut_ptr->set_difftest__DOT__perfCtrl__DOT__dump(0);
-#endif // GSIM
+  dut_ptr->set_perf_clean(0);
+  dut_ptr->set_perf_dump(0);
 #ifndef CONFIG_NO_DIFFTEST
   int step = 0;
   if (args.trace_name && args.trace_is_read) {
     step = 1;
     difftest_trace_read();
   } else {
-#ifdef VERILATOR
-    step = dut_ptr->difftest_step;
-#endif // VERILATOR
-#ifdef GSIM
-    step = 1; // TODO: gsim API
-#endif        // GSIM
+    step = dut_ptr->get_difftest_step();
   }
 
   static uint64_t stuck_timer = 0;
@@ -912,7 +1406,31 @@ int Emulator::tick() {
     difftest_trace_write(step);
   }
 
-  trapCode = difftest_nstep(step, args.enable_diff);
+  if (args.telemetry_path) {
+    uint64_t check_start = telemetry_ns();
+    trapCode = difftest_nstep(step, args.enable_diff);
+    telemetry.check_ns.fetch_add(telemetry_ns() - check_start, std::memory_order_relaxed);
+    uint64_t instrs = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+      instrs += difftest_trap_event(i)->instrCnt;
+    }
+    telemetry.cycles.store(cycles, std::memory_order_relaxed);
+    telemetry.instrs.store(instrs, std::memory_order_relaxed);
+  } else {
+    trapCode = difftest_nstep(step, args.enable_diff);
+  }
+
+  // The same error is reported at the abort point of the main process, or a few cycles off with the async
+  // checker. An error far before it is a different one, which the first REF has not found.
+  if (trapCode == STATE_ABORT && args.second_ref && args.enable_fork && is_fork_child()) {
+    uint64_t end_cycles = lightsss->get_end_cycles();
+    if (cycles + STEP_FORWARD_CYCLES >= end_cycles) {
+      FORK_PRINTF("the second REF has confirmed the error at cycle %lu\n", cycles)
+    } else {
+      FORK_PRINTF("the second REF has found a different error at cycle %lu, before the abort point %lu\n", cycles,
+                  end_cycles)
+    }
+  }
 
   if (trapCode != STATE_RUNNING) {
 #ifdef FUZZER_LIB
@@ -934,8 +1452,26 @@ int Emulator::tick() {
   }
 #endif // ENABLE_RUNAHEAD
 
+#ifndef CONFIG_NO_DIFFTEST
+  if (args.gcpt_export && args.gcpt_export_interval) {
+    uint64_t instr = difftest_trap_event(0)->instrCnt;
+    if (instr >= gcpt_export_next) {
+      gcpt_export(instr);
+      while (gcpt_export_next <= instr) {
+        gcpt_export_next += args.gcpt_export_interval;
+      }
+    }
+  }
+#endif // CONFIG_NO_DIFFTEST
+
+  // the timers are read at the first cycle and then every TIMER_POLL_CYCLES cycles
+  bool poll_timer = cycles >= next_timer_poll;
+  if (poll_timer) {
+    next_timer_poll = cycles + TIMER_POLL_CYCLES;
+  }
+
 #ifdef VM_SAVABLE
-  if (args.enable_snapshot) {
+  if (args.enable_snapshot && poll_timer) {
     static int snapshot_count = 0;
     uint32_t t = uptime();
     if (trapCode != STATE_GOODTRAP && t - lasttime_snapshot > 1000 * SNAPSHOT_INTERVAL) {
@@ -945,7 +1481,7 @@ int Emulator::tick() {
       // dump one snapshot to file every 60 snapshots
       snapshot_count++;
       if (snapshot_count == 60) {
-        snapshot_slot[0].save();
+        snapshot_slot_save_async(snapshot_slot, 0);
         snapshot_count = 0;
       }
     }
@@ -964,11 +1500,12 @@ int Emulator::tick() {
   fclose(args.ipc_file);
 #endif
 
-  if (args.enable_fork) {
+  if (args.enable_fork && (poll_timer || args.fork_cycles)) {
     static bool have_initial_fork = false;
     uint32_t timer = uptime();
     // check if it's time to fork a checkpoint process
-    if (((timer - lasttime_snapshot > args.fork_interval) || !have_initial_fork) && !is_fork_child()) {
+    bool due = args.fork_cycles ? lightsss->fork_due(cycles) : timer - lasttime_snapshot > args.fork_interval;
+    if ((due || !have_initial_fork) && !is_fork_child()) {
       have_initial_fork = true;
       lasttime_snapshot = timer;
       switch (lightsss->do_fork()) {
@@ -1002,18 +1539,10 @@ void Emulator::save_coverage() {
 #endif
 
 void Emulator::trigger_stat_dump() {
-#ifdef VERILATOR
-  dut_ptr->difftest_perfCtrl_dump = 1;
-  if (get_args().force_dump_result) {
-    dut_ptr->difftest_logCtrl_end = -1;
-  }
-#endif // VERILATOR
-#ifdef GSIM
-  dut_ptr->set_difftest__DOT__perfCtrl__DOT__dump(1);
+  dut_ptr->set_perf_dump(1);
   if (get_args().force_dump_result) {
-    dut_ptr->set_difftest__DOT__logCtrl__DOT__end(-1);
+    dut_ptr->set_log_end(-1);
   }
-#endif // GSIM
   single_cycle();
 }
 
@@ -1054,12 +1583,18 @@ void Emulator::display_trapinfo() {
 #ifdef VM_SAVABLE
 void Emulator::snapshot_save() {
   static int last_slot = 0;
-  VerilatedSaveMem &stream = snapshot_slot[last_slot];
+  static int current_base = -1, since_base = 0;
+  int slot = last_slot;
+  VerilatedSaveMem &stream = snapshot_slot[slot];
   last_slot = !last_slot;
+  // the slot or the base may still be written to a file
+  snapshot_saver_wait();
 
-  stream.init(snapshot_filename());
+  const char *filename = snapshot_filename();
+  stream.init(filename);
   stream << *dut_ptr;
   stream.flush();
+  auto write = [&stream](const void *datap, size_t size) { stream.unbuf_write(datap, size); };
 
   long size = simMemory->get_size();
   stream.unbuf_write(&size, sizeof(size));
@@ -1067,13 +1602,30 @@ void Emulator::snapshot_save() {
     printf("simMemory does not support as_ptr\n");
     assert(0);
   }
-  stream.unbuf_write(simMemory->as_ptr(), size);
+  const uint8_t *dut_mem = (const uint8_t *)simMemory->as_ptr();
 
   auto diff = difftest[0];
+  auto proxy = diff->proxy;
+  auto ref_copy = [proxy](uint64_t offset, void *buf, size_t n) {
+    proxy->mem_init(PMEM_BASE + offset, buf, n, REF_TO_DUT);
+  };
+
+  // Take a new base periodically. It must not be the base of the snapshot in the other slot.
+  if (current_base < 0 || ++since_base == SNAPSHOT_BASE_INTERVAL) {
+    current_base = (snapshot_slot_base[!slot] == 0) ? 1 : 0;
+    snapshot_base[current_base].take(filename, dut_mem, size, ref_copy);
+    since_base = 0;
+  }
+  snapshot_slot_base[slot] = current_base;
+  SnapshotBase &base = snapshot_base[current_base];
+  char base_name[256] = {};
+  strncpy(base_name, base.get_filename(), sizeof(base_name) - 1);
+  stream.unbuf_write(base_name, sizeof(base_name));
+  base.write_dut_pages(dut_mem, write);
+
   uint64_t cycleCnt = diff->get_trap_event()->cycleCnt;
   stream.unbuf_write(&cycleCnt, sizeof(cycleCnt));
 
-  auto proxy = diff->proxy;
   stream.unbuf_write(&proxy->regs_int, sizeof(proxy->regs_int));
 #ifdef CONFIG_DIFFTEST_ARCHFPREGSTATE
   stream.unbuf_write(&proxy->regs_fp, sizeof(proxy->regs_fp));
@@ -1081,20 +1633,13 @@ void Emulator::snapshot_save() {
   stream.unbuf_write(&proxy->csr, sizeof(proxy->csr));
   stream.unbuf_write(&proxy->pc, sizeof(proxy->pc));
 
-  char *buf = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-  proxy->mem_init(PMEM_BASE, buf, size, REF_TO_DUT);
-  stream.unbuf_write(buf, size);
-  munmap(buf, size);
+  base.write_ref_pages(ref_copy, write);
 
   uint64_t csr_buf[4096];
   proxy->ref_csrcpy(csr_buf, REF_TO_DUT);
   stream.unbuf_write(&csr_buf, sizeof(csr_buf));
 
-  long sdcard_offset;
-  if (fp)
-    sdcard_offset = ftell(fp);
-  else
-    sdcard_offset = 0;
+  long sdcard_offset = sd_get_offset();
   stream.unbuf_write(&sdcard_offset, sizeof(sdcard_offset));
 
   // actually write to file in snapshot_finalize()
@@ -1104,6 +1649,7 @@ void Emulator::snapshot_load(const char *filename) {
   VerilatedRestoreMem stream;
   stream.open(filename);
   stream >> *dut_ptr;
+  auto read = [&stream](void *datap, size_t size) { stream.read((uint8_t *)datap, size); };
 
   long size;
   stream.read(&size, sizeof(size));
@@ -1112,7 +1658,17 @@ void Emulator::snapshot_load(const char *filename) {
     printf("simMemory does not support as_ptr\n");
     assert(0);
   }
-  stream.read(simMemory->as_ptr(), size);
+  uint8_t *dut_mem = (uint8_t *)simMemory->as_ptr();
+
+  // the REF memory is the base with changed pages, the same as the DUT memory
+  char *buf = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  char base_name[256];
+  stream.read(base_name, sizeof(base_name));
+  if (!snapshot_base_load(base_name, dut_mem, (uint8_t *)buf, size)) {
+    printf("Could not load snapshot base %s\n", base_name);
+    assert(0);
+  }
+  snapshot_read_pages(dut_mem, read);
 
   auto diff = difftest[0];
   uint64_t *cycleCnt = &(diff->get_trap_event()->cycleCnt);
@@ -1127,8 +1683,7 @@ void Emulator::snapshot_load(const char *filename) {
   stream.read(&proxy->pc, sizeof(proxy->pc));
   proxy->ref_regcpy(&proxy->regs_int, DUT_TO_REF, false);
 
-  char *buf = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-  stream.read(buf, size);
+  snapshot_read_pages((uint8_t *)buf, read);
   proxy->mem_init(PMEM_BASE, buf, size, DUT_TO_REF);
   munmap(buf, size);
 
@@ -1138,9 +1693,7 @@ void Emulator::snapshot_load(const char *filename) {
 
   long sdcard_offset = 0;
   stream.read(&sdcard_offset, sizeof(sdcard_offset));
-
-  if (fp)
-    fseek(fp, sdcard_offset, SEEK_SET);
+  sd_set_offset(sdcard_offset);
 
   // No one uses snapshot when !has_commit, isn't it?
   diff->has_commit = 1;
@@ -1148,22 +1701,8 @@ void Emulator::snapshot_load(const char *filename) {
 #endif
 
 void Emulator::fork_child_init() {
-#ifdef VERILATOR_VERSION_INTEGER // >= v4.220
-#if VERILATOR_VERSION_INTEGER >= 5016000
-  // This will cause 288 bytes leaked for each one fork call.
-  // However, one million snapshots cause only 288MB leaks, which is still acceptable.
-  // See verilator/test_regress/t/t_wrapper_clone.cpp:48 to avoid leaks.
   dut_ptr->atClone();
-#else
-#error Please use Verilator v5.016 or newer versions.
-#endif                 // check VERILATOR_VERSION_INTEGER values
-#elif EMU_THREAD > 1   // VERILATOR_VERSION_INTEGER not defined
-#ifdef VERILATOR_4_210 // v4.210 <= version < 4.220
-  dut_ptr->vlSymsp->__Vm_threadPoolp = new VlThreadPool(dut_ptr->contextp(), EMU_THREAD - 1, 0);
-#else                  // older than v4.210
-  dut_ptr->__Vm_threadPoolp = new VlThreadPool(dut_ptr->contextp(), EMU_THREAD - 1, 0);
-#endif
-#endif
+  console_fork_wake();
 
   FORK_PRINTF("the oldest checkpoint start to dump wave and dump nemu log...\n")
 #if VM_TRACE == 1
@@ -1173,6 +1712,17 @@ void Emulator::fork_child_init() {
   args.enable_waveform = true;
 #endif
 #ifndef CONFIG_NO_DIFFTEST
+  // the checkpoint re-executes the interval before the error with full checks
+  if (args.sample_interval && args.enable_diff && difftest_sample_disable()) {
+    FORK_PRINTF("the stores skipped before the checkpoint mismatch\n")
+  }
+  // the checkpoint re-executes the window before the error with the second REF
+  if (args.second_ref && args.enable_diff) {
+    size_t ref_ramsize = args.ram_size ? simMemory->get_size() : 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+      difftest[i]->switch_ref(args.second_ref, ref_ramsize);
+    }
+  }
 #ifdef ENABLE_SIMULATOR_DEBUG_INFO
   // let simulator print debug info
   for (int i = 0; i < NUM_CORES; i++) {
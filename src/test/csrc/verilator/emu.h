@@ -33,6 +33,17 @@ struct EmuArgs {
   uint64_t stat_cycles = -1;
   uint64_t log_begin = 0, log_end = -1;
   uint64_t overwrite_nbytes = 0xe00;
+  uint64_t trace_start_cycle = 0;
+  uint64_t sample_window = 0;
+  uint64_t sample_interval = 0;
+  uint64_t fork_mem_budget = 0;
+  uint64_t fork_cycles = 0;
+  uint64_t fast_forward_instr = 0;
+  uint64_t fast_forward_pc = 0;
+  uint64_t telemetry_interval = 1000;
+  uint64_t wave_window = 0;
+  uint64_t gcpt_export_interval = 0;
+  uint32_t fork_slots = SLOT_SIZE;
   const char *dramsim3_ini = nullptr;
   const char *dramsim3_outdir = nullptr;
 #ifdef DEBUG_REFILL
@@ -55,10 +66,17 @@ struct EmuArgs {
   const char *trace_name = nullptr;
   const char *footprints_name = nullptr;
   const char *linearized_name = nullptr;
+  const char *telemetry_path = nullptr;
+  const char *cpus = nullptr;
+  const char *cover_bitmap = nullptr;
+  const char *gcpt_export = nullptr;
+  const char *second_ref = nullptr;
+  const char *perf_dump = nullptr;
   bool enable_waveform = false;
   bool enable_waveform_full = false;
   bool enable_ref_trace = false;
   bool enable_commit_trace = false;
+  bool async_log = false;
   bool enable_snapshot = false;
   bool force_dump_result = false;
   bool enable_diff = true;
@@ -68,12 +86,16 @@ struct EmuArgs {
   bool trace_is_read = true;
   bool dump_coverage = false;
   bool image_as_footprints = false;
+  bool sparse_ram = false;
+  bool share_image = false;
   bool overwrite_nbytes_autoset = false;
+  bool fork_geometric = false;
+  bool uart_stdin = false;
 };
 
 class Emulator final : public DUT {
 private:
-  Simulator *dut_ptr;
+  SIMULATOR *dut_ptr;
 
   bool force_dump_wave = false;
   EmuArgs args;
@@ -87,11 +109,18 @@ private:
   int trapCode;
   uint32_t lasttime_snapshot = 0;
   uint64_t core_max_instr[NUM_CORES];
-  uint32_t lasttime_poll = 0;
   uint32_t elapsed_time;
 
   inline void reset_ncycles(size_t cycles);
   inline void single_cycle();
+  // The limits and periodic events of core i are handled only when its cycleCnt or instrCnt reaches
+  // these thresholds, which are set to the nearest event by schedule_core_events(i).
+  uint64_t next_cycle_event[NUM_CORES] = {};
+  uint64_t next_instr_event[NUM_CORES] = {};
+  void schedule_core_events(int i);
+  // the timers of snapshots and forks are read every TIMER_POLL_CYCLES cycles
+  static const uint64_t TIMER_POLL_CYCLES = 64;
+  uint64_t next_timer_poll = 0;
   void trigger_stat_dump();
   void display_trapinfo();
 
@@ -118,6 +147,11 @@ private:
   void save_coverage();
 #endif
 
+  void fast_forward();
+  // instruction count of core 0 for the next gcpt checkpoint at --export-gcpt-interval
+  uint64_t gcpt_export_next = 0;
+  void gcpt_export(uint64_t instr);
+
   void fork_child_init();
   inline bool is_fork_child() {
     return lightsss->is_child();
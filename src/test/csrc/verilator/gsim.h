@@ -18,21 +18,23 @@
 
 #include "SimTop.h"
 
-class GsimSim final : public Simulator {
+class GsimSim final : public Simulator<GsimSim> {
+  friend class Simulator<GsimSim>;
+
 private:
   SSimTop *dut;
 
 protected:
-  inline unsigned get_uart_out_valid() override {
+  inline unsigned get_uart_out_valid() {
     return dut->get_difftest__DOT__uart__DOT__out__DOT__valid();
   }
-  inline uint8_t get_uart_out_ch() override {
+  inline uint8_t get_uart_out_ch() {
     return dut->get_difftest__DOT__uart__DOT__out__DOT__ch();
   }
-  inline unsigned get_uart_in_valid() override {
+  inline unsigned get_uart_in_valid() {
     return dut->get_difftest__DOT__uart__DOT__in__DOT__valid();
   }
-  inline void set_uart_in_ch(uint8_t ch) override {
+  inline void set_uart_in_ch(uint8_t ch) {
     dut->set_difftest__DOT__uart__DOT__in__DOT__ch(ch);
   }
 
@@ -40,34 +42,40 @@ public:
   GsimSim();
   ~GsimSim();
 
-  inline void set_clock(unsigned clock) override {
+  inline void set_clock(unsigned clock) {
     // Gsim does not use explicit clock. Simply call step() instead.
   }
-  inline void set_reset(unsigned reset) override {
+  inline void set_reset(unsigned reset) {
     dut->set_reset(reset);
   }
-  inline void step() override {
+  inline void step() {
+    dut->step();
+  }
+
+  // GSIM evaluates a whole cycle in one step
+  inline void posedge() {
     dut->step();
   }
+  inline void negedge() {}
 
-  inline uint64_t get_difftest_exit() final {
+  inline uint64_t get_difftest_exit() {
     return dut->get_difftest__DOT__exit();
   }
-  inline uint64_t get_difftest_step() final {
+  inline uint64_t get_difftest_step() {
     return dut->get_difftest__DOT__step();
   }
 
-  inline void set_perf_clean(unsigned clean) override {
+  inline void set_perf_clean(unsigned clean) {
     dut->set_difftest__DOT__perfCtrl__DOT__clean(clean);
   }
-  inline void set_perf_dump(unsigned dump) override {
+  inline void set_perf_dump(unsigned dump) {
     dut->set_difftest__DOT__perfCtrl__DOT__dump(dump);
   }
 
-  inline void set_log_begin(uint64_t begin) override {
+  inline void set_log_begin(uint64_t begin) {
     dut->set_difftest__DOT__logCtrl__DOT__begin(begin);
   }
-  inline void set_log_end(uint64_t end) override {
+  inline void set_log_end(uint64_t end) {
     dut->set_difftest__DOT__logCtrl__DOT__end(end);
   }
 };
@@ -17,8 +17,12 @@
 #define __SIMULATOR_H
 
 #include "common.h"
+#include "console.h"
 
-class Simulator {
+// The simulator backends derive from Simulator<Backend>, and Emulator holds the backend type SIMULATOR.
+// There are no virtual calls: the base calls the backend methods statically, and the backend hides
+// the optional methods of the base, so the per-cycle methods are inlined into Emulator.
+template <typename Backend> class Simulator {
 private:
   static void report_waveform_error() {
     printf("Waveform is unsupported in this simulator or disabled.\n");
@@ -32,85 +36,81 @@ private:
     throw std::runtime_error("Snapshot not supported.");
   }
 
+  inline Backend *backend() {
+    return static_cast<Backend *>(this);
+  }
+
 protected:
-  virtual unsigned get_uart_out_valid() = 0;
-  virtual uint8_t get_uart_out_ch() = 0;
-  virtual unsigned get_uart_in_valid() = 0;
-  virtual void set_uart_in_ch(uint8_t ch) = 0;
+  Simulator() = default;
+  ~Simulator() = default;
 
 public:
-  Simulator() = default;
-  virtual ~Simulator() {};
-
-  /******* mandatory methods for child classes *******/
-  // Set the clock signal, 0 or 1.
-  virtual void set_clock(unsigned clock) = 0;
-  // Set the reset signal, 0 or 1.
-  virtual void set_reset(unsigned reset) = 0;
-  // Tick one step. Note this method may have various implementations.
-  virtual void step() = 0;
-
-  // Get the exit signal from DiffTest.
-  virtual uint64_t get_difftest_exit() = 0;
-  // Get the step signal from DiffTest.
-  virtual uint64_t get_difftest_step() = 0;
-
-  // Set the clean signal for performance counters.
-  virtual void set_perf_clean(unsigned clean) = 0;
-  // Set the dump signal for performance counters.
-  virtual void set_perf_dump(unsigned dump) = 0;
-
-  // Set the log begin signal.
-  virtual void set_log_begin(uint64_t begin) = 0;
-  // Set the log end signal.
-  virtual void set_log_end(uint64_t end) = 0;
-
-  /******* optional methods for child classes *******/
+  /******* mandatory methods for backends *******/
+  // void set_clock(unsigned clock);    Set the clock signal, 0 or 1.
+  // void set_reset(unsigned reset);    Set the reset signal, 0 or 1.
+  // void step();                       Tick one step. Note this method may have various implementations.
+  // uint64_t get_difftest_exit();      Get the exit signal from DiffTest.
+  // uint64_t get_difftest_step();      Get the step signal from DiffTest.
+  // void set_perf_clean(unsigned);     Set the clean signal for performance counters.
+  // void set_perf_dump(unsigned);      Set the dump signal for performance counters.
+  // void set_log_begin(uint64_t);      Set the log begin signal.
+  // void set_log_end(uint64_t);        Set the log end signal.
+  // unsigned get_uart_out_valid();     uint8_t get_uart_out_ch();
+  // unsigned get_uart_in_valid();      void set_uart_in_ch(uint8_t ch);
+
+  /******* optional methods for backends *******/
+  // Evaluate the rising and the falling edge of the clock. A cycle-based backend evaluates the whole
+  // cycle at the rising edge.
+  inline void posedge() {
+    backend()->set_clock(1);
+    backend()->step();
+  }
+  inline void negedge() {
+    backend()->set_clock(0);
+    backend()->step();
+  }
+
   // To re-initialize the simulator upon a `fork()` call.
-  virtual void atClone() {};
+  void atClone() {}
 
   // To initialize the waveform.
-  virtual void waveform_init(uint64_t cycles) {
+  void waveform_init(uint64_t cycles) {
     report_waveform_error();
   }
   // To tick the waveform.
-  virtual void waveform_init(uint64_t cycles, const char *filename) {
+  void waveform_init(uint64_t cycles, const char *filename) {
     report_waveform_error();
   }
   // To tick the waveform for one timestamp.
-  virtual void waveform_tick() {
+  void waveform_tick() {
     report_waveform_error();
   };
 
   // To initialize the simulation snapshot.
-  virtual void snapshot_init() {
+  void snapshot_init() {
     report_snapshot_error(nullptr, 0);
   }
   // To clean the simulation snapshot.
-  virtual void snapshot_save(int index) {
+  void snapshot_save(int index) {
     report_snapshot_error(nullptr, 0);
   }
   // To save the simulation snapshot.
-  virtual std::function<void(void *, size_t)> snapshot_take() {
+  std::function<void(void *, size_t)> snapshot_take() {
     return report_snapshot_error;
   }
   // To load the simulation snapshot from a file.
-  virtual std::function<void(void *, size_t)> snapshot_load(const char *filename) {
+  std::function<void(void *, size_t)> snapshot_load(const char *filename) {
     return report_snapshot_error;
   }
 
-  /******* final methods *******/
-
   // Step the UART, this is used to read/write UART data.
-  // This method cannot be overridden.
   inline void step_uart() {
-    if (get_uart_out_valid()) {
-      printf("%c", get_uart_out_ch());
-      fflush(stdout);
+    if (backend()->get_uart_out_valid()) {
+      console_putc(backend()->get_uart_out_ch());
     }
-    if (get_uart_in_valid()) {
+    if (backend()->get_uart_in_valid()) {
       extern uint8_t uart_getc();
-      set_uart_in_ch(uart_getc());
+      backend()->set_uart_in_ch(uart_getc());
     }
   }
 };
@@ -19,8 +19,12 @@
 
 #include "VSimTop.h"
 #include "compress.h"
+#include "hugepage.h"
 #include "ram.h"
+#include <functional>
+#include <string>
 #include <sys/mman.h>
+#include <vector>
 #include <verilated_save.h>
 
 #define SNAPSHOT_SIZE (3UL * simMemory->get_size())
@@ -40,10 +44,10 @@ public:
 
   void init(const char *filename) {
     if (buf != NULL) {
-      munmap(buf, SNAPSHOT_SIZE);
+      huge_munmap(buf, SNAPSHOT_SIZE);
       buf = NULL;
     }
-    buf = (uint8_t *)mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    buf = (uint8_t *)huge_mmap(buf_size);
     if (buf == (uint8_t *)MAP_FAILED) {
       printf("Cound not mmap 0x%lx bytes\n", SNAPSHOT_SIZE);
       assert(0);
@@ -54,7 +58,7 @@ public:
   }
 
   void unbuf_write(const void *__restrict datap, size_t size) VL_MT_UNSAFE_ONE {
-    nonzero_large_memcpy(buf + this->size, datap, size);
+    nonzero_large_memcpy(buf + this->size, datap, size, true);
     this->size += size;
   }
 
@@ -72,7 +76,7 @@ class VerilatedRestoreMem : public VerilatedDeserialize {
 public:
   VerilatedRestoreMem() {
     buf_size = SNAPSHOT_SIZE;
-    buf = (uint8_t *)mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    buf = (uint8_t *)huge_mmap(buf_size);
     if (buf == (uint8_t *)MAP_FAILED) {
       printf("Cound not mmap 0x%lx bytes\n", SNAPSHOT_SIZE);
       assert(0);
@@ -96,4 +100,78 @@ public:
   void fill() override VL_MT_UNSAFE_ONE;
 };
 
+// Model state kept in memory without a file, e.g. the state after reset that is restored for
+// each fuzzing input.
+class VerilatedSaveVec : public VerilatedSerialize {
+  std::vector<uint8_t> &data;
+
+public:
+  VerilatedSaveVec(std::vector<uint8_t> &data) : data(data) {
+    data.clear();
+    m_isOpen = true;
+    header();
+  }
+  ~VerilatedSaveVec() {
+    close();
+  }
+
+  void close() override VL_MT_UNSAFE_ONE;
+  void flush() override VL_MT_UNSAFE_ONE;
+};
+
+class VerilatedRestoreVec : public VerilatedDeserialize {
+  const std::vector<uint8_t> &data;
+  size_t pos = 0;
+
+public:
+  VerilatedRestoreVec(const std::vector<uint8_t> &data) : data(data) {
+    m_isOpen = true;
+    m_cp = m_bufp;
+    m_endp = m_bufp;
+    header();
+  }
+  ~VerilatedRestoreVec() {
+    close();
+  }
+
+  void close() override VL_MT_UNSAFE_ONE;
+  void flush() override VL_MT_UNSAFE_ONE {}
+  void fill() override VL_MT_UNSAFE_ONE;
+};
+
+// Incremental snapshots store the memory pages that differ from a full base image.
+#define SNAPSHOT_PAGE_SIZE 4096UL
+
+typedef std::function<void(const void *, size_t)> SnapshotWriter;
+typedef std::function<void(void *, size_t)> SnapshotReader;
+// copy n bytes at offset of the REF memory to buf
+typedef std::function<void(uint64_t, void *, size_t)> SnapshotRefCopy;
+
+class SnapshotBase {
+public:
+  ~SnapshotBase();
+  // Take a copy of the DUT and REF memory as the new base, saved as filename later
+  void take(const char *filename, const uint8_t *dut, size_t size, SnapshotRefCopy ref_copy);
+  // Write the pages that differ from the base
+  void write_dut_pages(const uint8_t *dut, SnapshotWriter write);
+  void write_ref_pages(SnapshotRefCopy ref_copy, SnapshotWriter write);
+  // Write the base to its file if it has not been saved
+  void save();
+  const char *get_filename() {
+    return filename.c_str();
+  }
+
+private:
+  size_t size = 0;
+  uint8_t *mem = nullptr; // DUT memory followed by REF memory
+  std::string filename;
+  bool saved = false;
+  // whether DUT pages written since the base are tracked by soft-dirty bits
+  bool soft_dirty = false;
+};
+
+// Load a base into the DUT and REF memory, and apply the pages written by SnapshotBase
+bool snapshot_base_load(const char *filename, uint8_t *dut, uint8_t *ref, size_t size);
+void snapshot_read_pages(uint8_t *mem, SnapshotReader read);
+
 #endif // SNAPSHOT_H
@@ -18,12 +18,15 @@
 
 #include "VSimTop.h"
 #include "VSimTop__Syms.h"
+#include "uart16550.h"
 #include "waveform.h"
 #ifdef VM_SAVABLE
 #include "snapshot.h"
 #endif // VM_SAVABLE
 
-class VerilatorSim final : public Simulator {
+class VerilatorSim final : public Simulator<VerilatorSim> {
+  friend class Simulator<VerilatorSim>;
+
 private:
   VSimTop *dut;
 
@@ -37,16 +40,16 @@ private:
 #endif // VM_SAVABLE
 
 protected:
-  inline unsigned get_uart_out_valid() override {
+  inline unsigned get_uart_out_valid() {
     return dut->difftest_uart_out_valid;
   }
-  inline uint8_t get_uart_out_ch() override {
+  inline uint8_t get_uart_out_ch() {
     return dut->difftest_uart_out_ch;
   }
-  inline unsigned get_uart_in_valid() override {
+  inline unsigned get_uart_in_valid() {
     return dut->difftest_uart_in_valid;
   }
-  inline void set_uart_in_ch(uint8_t ch) override {
+  inline void set_uart_in_ch(uint8_t ch) {
     dut->difftest_uart_in_ch = ch;
   }
 
@@ -54,50 +57,68 @@ public:
   VerilatorSim();
   ~VerilatorSim();
 
-  inline void set_clock(unsigned clock) override {
+  inline void set_clock(unsigned clock) {
     dut->clock = clock;
+#ifdef COVERAGE_PORT_CLOCK
+    dut->coverage_clock = clock;
+#endif // COVERAGE_PORT_CLOCK
   }
-  inline void set_reset(unsigned reset) override {
+  inline void set_reset(unsigned reset) {
     dut->reset = reset;
+#ifdef COVERAGE_PORT_RESET
+    dut->coverage_reset = reset;
+#endif // COVERAGE_PORT_RESET
   }
-  inline void step() override {
+  inline void step() {
     dut->eval();
   }
 
-  inline uint64_t get_difftest_exit() override {
+  inline uint64_t get_difftest_exit() {
     return dut->difftest_exit;
   }
-  inline uint64_t get_difftest_step() override {
+  inline uint64_t get_difftest_step() {
     return dut->difftest_step;
   }
 
-  inline void set_perf_clean(unsigned clean) override {
+  inline void set_perf_clean(unsigned clean) {
     dut->difftest_perfCtrl_clean = clean;
   }
-  inline void set_perf_dump(unsigned dump) override {
+  inline void set_perf_dump(unsigned dump) {
     dut->difftest_perfCtrl_dump = dump;
   }
 
-  inline void set_log_begin(uint64_t begin) override {
+  inline void set_log_begin(uint64_t begin) {
     dut->difftest_logCtrl_begin = begin;
   }
-  inline void set_log_end(uint64_t end) override {
+  inline void set_log_end(uint64_t end) {
     dut->difftest_logCtrl_end = end;
   }
 
-  void atClone() override;
+  // The UART of Verilator models is the 16550 one
+  inline void step_uart() {
+    if (dut->difftest_uart_out_valid) {
+      uart16550_putc(dut->difftest_uart_out_ch);
+    }
+    if (dut->difftest_uart_in_valid) {
+      uint8_t ch;
+      uart16550_getc_legacy(&ch);
+      dut->difftest_uart_in_ch = ch;
+    }
+  }
+
+  void atClone();
 
 #if VM_TRACE == 1
-  void waveform_init(uint64_t cycles) override;
-  void waveform_init(uint64_t cycles, const char *filename) override;
-  void waveform_tick() override;
+  void waveform_init(uint64_t cycles);
+  void waveform_init(uint64_t cycles, const char *filename);
+  void waveform_tick();
 #endif // VM_TRACE == 1
 
 #ifdef VM_SAVABLE
-  void snapshot_init() override;
-  void snapshot_save(int index) override;
-  std::function<void(void *, size_t)> snapshot_take() override;
-  std::function<void(void *, size_t)> snapshot_load(const char *filename) override;
+  void snapshot_init();
+  void snapshot_save(int index);
+  std::function<void(void *, size_t)> snapshot_take();
+  std::function<void(void *, size_t)> snapshot_load(const char *filename);
 #endif // VM_SAVABLE
 };
 
@@ -17,6 +17,7 @@
 #define __WAVEFORM_H
 
 #include "verilated.h"
+#include <string>
 #ifdef ENABLE_FST
 #include <verilated_fst_c.h>
 #else
@@ -28,28 +29,40 @@ using TraceBindFunc = std::function<void(VerilatedTraceBaseC *, int)>;
 class EmuWaveform {
 private:
 #ifdef ENABLE_FST
-  VerilatedFstC *tfp;
+  VerilatedFstC *tfp = nullptr;
 #else
-  VerilatedVcdC *tfp;
+  VerilatedVcdC *tfp = nullptr;
 #endif
 
   // waveform clock: this may differ from the CPU clock
   uint64_t waveform_clock;
 
+  // Flight recorder: the waveform is written to two segment files of window clocks each
+  // in an in-memory directory, and the older one is reused when the newer one is full.
+  // Only save_tail() copies them to the output path.
+  TraceBindFunc trace;
+  uint64_t window = 0;
+  uint64_t segment_begin[2];
+  int segment = 0;
+  bool segment_used[2] = {false, false};
+  std::string filename;
+
   const char *default_filename(uint64_t cycles);
+  void open(const char *path);
+  void close();
+  std::string segment_path(int index);
+  void next_segment();
 
 public:
   EmuWaveform(TraceBindFunc trace, uint64_t cycles);
   EmuWaveform(TraceBindFunc trace, uint64_t cycles, const char *filename);
+  EmuWaveform(TraceBindFunc trace, uint64_t cycles, const char *filename, uint64_t window);
 
-  ~EmuWaveform() {
-    if (tfp) {
-      tfp->close();
-      delete tfp;
-    }
-  }
+  ~EmuWaveform();
 
   void tick();
+  // save the last one or two segments, i.e. at least the last window clocks
+  void save_tail();
 };
 
 #endif
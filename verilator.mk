@@ -23,7 +23,7 @@ EMU_CONFIG_DIR = $(abspath ./config)
 EMU_CXXFILES  = $(SIM_CXXFILES) $(shell find $(EMU_CSRC_DIR) -name "*.cpp")
 EMU_CXXFLAGS  = $(SIM_CXXFLAGS) -I$(EMU_CSRC_DIR)
 EMU_CXXFLAGS += -DVERILATOR -DNUM_CORES=$(NUM_CORES) --std=c++17
-EMU_LDFLAGS   = $(SIM_LDFLAGS) -ldl
+EMU_LDFLAGS   = $(SIM_LDFLAGS) -lpthread -ldl
 
 VEXTRA_FLAGS  = $(SIM_VFLAGS)
 
@@ -62,6 +62,10 @@ endif
 ifneq (,$(filter $(EMU_TRACE),fst FST))
 VEXTRA_FLAGS += --trace-fst
 EMU_CXXFLAGS += -DENABLE_FST
+# compress and write FST on separate threads
+ifneq ($(EMU_TRACE_THREADS),)
+VEXTRA_FLAGS += --trace-threads $(EMU_TRACE_THREADS)
+endif
 endif
 
 # Verilator trace underscore support
@@ -71,6 +75,11 @@ endif
 
 # Verilator multi-thread support
 EMU_THREADS  ?= 0
+# auto: leave a cpu for each checker and one for the helpers, and stop at 16 where the models hardly scale.
+# Run emu with --cpus=auto to pin the threads to this split.
+ifeq ($(EMU_THREADS),auto)
+override EMU_THREADS := $(shell n=$$(nproc); t=$$((n - $(NUM_CORES) - 1)); echo $$((t < 1 ? 1 : (t > 16 ? 16 : t))))
+endif
 ifneq ($(EMU_THREADS),0)
 VEXTRA_FLAGS += --threads $(EMU_THREADS) --threads-dpi all
 EMU_CXXFLAGS += -DEMU_THREAD=$(EMU_THREADS)